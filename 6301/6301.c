@@ -55,6 +55,11 @@ SSE.
 ---------------------------------------------------------------------------*/
 
 #include "6301.h"
+#include "callstac.h" // HD6301_DEBUG
+#include "symtab.h"   // HD6301_SYMBOLS
+#include "profile.h"  // HD6301_PROFILE
+#include "itrace.h"   // HD6301_ITRACE
+#include "session.h"  // HD6301_SESSION
 
 #pragma GCC diagnostic ignored "-Wimplicit-function-declaration"
 
@@ -62,12 +67,16 @@ SSE.
 extern double cpu_cycles_multiplier;
 
 // our variables that Steem must see
-COUNTER_VAR cycles_run=0; 
+HD6301_STATE COUNTER_VAR cycles_run=0;
 
 // additional variables for our module
-unsigned int mouse_x_counter;
-unsigned int mouse_y_counter;
-int crashed = 0;
+HD6301_STATE unsigned int mouse_x_counter;
+HD6301_STATE unsigned int mouse_y_counter;
+HD6301_STATE int crashed = 0;
+
+#if defined(HD6301_OPCODE_STATS)
+HD6301_STATE unsigned long hd6301_opcode_stats[256];
+#endif
 
 // Debug facilities
 #if defined(TRACE_6301)
@@ -86,7 +95,9 @@ int crashed = 0;
 #include "cpu.c"
 #include "fprinthe.c"
 #include "memsetl.c"
-#include "symtab.c"  
+#if HD6301_DEBUG || HD6301_SYMBOLS
+#include "symtab.c"
+#endif
 //#include "tty.c"
 // arch
 // m68xx
@@ -99,7 +110,21 @@ int crashed = 0;
 #include "optab.c"
 #include "sci.c"
 #include "timer.c"
+#if HD6301_DEBUG
 #include "callstac.c"
+#endif
+#include "idle.c"
+#include "decode.c"
+#include "snapshot.c"
+#if HD6301_PROFILE
+#include "profile.c"
+#endif
+#if HD6301_ITRACE
+#include "itrace.c"
+#endif
+#if HD6301_SESSION
+#include "session.c"
+#endif
 
 // Interface with Steem
 
@@ -110,15 +135,20 @@ BYTE* hd6301_init() {
 
 hd6301_destroy() {
   TRACE("6301: destroy object\n");
-  if(ram) 
-    free(ram);
-  ram=NULL;
+  ram=NULL; // static, mem_init() sets it up again
 }
 
 
 hd6301_reset(int Cold) {
+  // FRC is kept over a warm reset although the cycle count restarts
+  WORD frc=Cold ? 0 : timer_getfrc();
   TRACE("6301 emu cpu reset (cold %d)\n",Cold);
   crashed = 0;
+  idle_sleeping = 0;
+#if HD6301_SESSION
+  if (session_on)
+    session_restart();
+#endif
   cpu_reset();
   if(Cold)
   {
@@ -131,9 +161,14 @@ hd6301_reset(int Cold) {
     mouse_x_counter=_rotl(mouse_x_counter,rnd);
     mouse_y_counter=_rotl(mouse_y_counter,rnd);
     //TRACE("Mouse mask %X\n",mouse_x_counter); // 333... 666 999 CCC
+    decode_init();
+    kbd_init();
   }
   iram[TRCSR]=0x20;
+  sci_reset();
+  timer_setfrc(frc);
   mem_putw (OCR, 0xFFFF);
+  int_update();
 }
 
  
@@ -148,17 +183,20 @@ void hd6301_run_clocks(COUNTER_VAR clocks) {
     TRACE("6301 starting cpu\n");
     cpu_start();
   }
+#if HD6301_SESSION
+  if (session_on)
+    session_slice();
+#endif
   if(iram[TRCSR]&1)
   {
     TRACE("6301 waking up (PC %X cycles %lu)\n",reg_getpc(),cpu.ncycles);
+    SESSION_EVENT(SESSION_WAKE, 0);
     iram[TRCSR]&=~1;
   }
   pc=reg_getpc();
+  idle_deadline=starting_cycles+clocks;
 
-  while(!crashed && ((cpu.ncycles-starting_cycles) < clocks))
-  {
-    instr_exec (); // execute one instruction
-  }
+  instr_run(starting_cycles+clocks); // execute instructions for the slice
 }
 
 hd6301_receive_byte(u_char byte_in) {
@@ -166,13 +204,163 @@ hd6301_receive_byte(u_char byte_in) {
 }
 
 void hd6301_tx_empty(int empty) {
-  // Once our serial port TX buffer has space then set the register
-  // to show the CPU another byte can be sent
-  if (empty) {
-    iram[TRCSR] |= TDRE;
-  }
+  // TDRE follows the modelled byte timing (sci.c) while our serial port
+  // TX buffer has space, and is held off while it is full
+  sci_tx_ready(SESSION_CHANGE(SESSION_TX_READY, empty));
 }
 
 int hd6301_sci_busy() {
   return (iram[TRCSR] & RDRF) ? 1 : 0;
 }
+
+int hd6301_tx_busy() {
+  // A byte waiting in TDR or still being shifted out
+  return (sci_tdre_at != SCI_NEVER || cpu.ncycles < sci_shift_end) ? 1 : 0;
+}
+
+void hd6301_set_idle_skip(int enable) {
+  idle_enabled = enable;
+}
+
+COUNTER_VAR hd6301_idle_cycles() {
+  return idle_skipped;
+}
+
+unsigned long hd6301_sci_count(int tx) {
+  return tx ? sci_tx_count : sci_rx_count;
+}
+
+unsigned long hd6301_sci_overruns() {
+  return sci_overrun_count;
+}
+
+unsigned long hd6301_instr_count() {
+  return instr_count;
+}
+
+unsigned long hd6301_debug_ram() {
+  unsigned long bytes = 0;
+#if HD6301_DEBUG
+  bytes += sizeof(callstack);
+#endif
+#if HD6301_DEBUG || HD6301_SYMBOLS
+  bytes += sizeof(symtab);
+#endif
+  return bytes;
+}
+
+void hd6301_trace_freeze() {
+#if HD6301_ITRACE
+  itrace_freeze();
+#endif
+}
+
+void hd6301_trace_dump() {
+#if HD6301_ITRACE
+  itrace_dump();
+#endif
+}
+
+#if HD6301_PROFILE
+void hd6301_profile_clear() {
+  profile_clear();
+}
+
+void hd6301_profile_dump(int top) {
+  profile_dump(top);
+}
+#endif
+
+#if HD6301_SYMBOLS
+int hd6301_load_symbols(const char* path) {
+  return sym_readfile(NULL, (char*)path);
+}
+#endif
+
+int hd6301_snapshot_size() {
+  return sizeof(struct snapshot);
+}
+
+int hd6301_save(void* buf, int size) {
+  if(size < (int)sizeof(struct snapshot))
+    return 0;
+  snapshot_save((struct snapshot*)buf);
+  return sizeof(struct snapshot);
+}
+
+int hd6301_restore(const void* buf, int size) {
+  if(size < (int)sizeof(struct snapshot))
+    return 0;
+  TRACE("6301 restore snapshot\n");
+#if HD6301_SESSION
+  if (session_on)
+    session_restart();
+#endif
+  return snapshot_restore((const struct snapshot*)buf);
+}
+
+void hd6301_set_key(int code, int down) {
+  if (code > 0 && code < 128)
+  {
+    SESSION_EVENT(SESSION_KEY, code | (down ? 0x80 : 0));
+    kbd_setkey(code, down);
+  }
+}
+
+#if HD6301_SESSION
+void hd6301_session_start() {
+  session_start();
+}
+
+void hd6301_session_stop() {
+  session_stop();
+}
+
+void hd6301_session_dump(FILE* f) {
+  session_dump(f);
+}
+#endif
+
+unsigned long hd6301_int_count(int source) {
+  return int_count[source & 1];
+}
+
+#if defined(HD6301_IREG_STATS)
+#if NIREGS != HD6301_NIREGS
+#error HD6301_NIREGS must match NIREGS in chip.h
+#endif
+unsigned long hd6301_ireg_count(int write, int reg) {
+  return (reg >= 0 && reg < NIREGS) ? hd6301_ireg_stats[write ? 1 : 0][reg] : 0;
+}
+
+const char* hd6301_ireg_name(int reg) {
+  return (reg >= 0 && reg < NIREGS) ? ireg_names[reg] : "?";
+}
+
+void hd6301_ireg_clear() {
+  memset (hd6301_ireg_stats, 0, sizeof (hd6301_ireg_stats));
+}
+#endif
+
+#if defined(HD6301_OPCODE_STATS)
+#if !HD6301_OPINFO
+#error HD6301_OPCODE_STATS needs the opcode names, HD6301_OPINFO=1
+#endif
+const char* hd6301_opcode_name(int opcode) {
+  /*
+   * The table holds disassembler formats, keep the mnemonic before the
+   * first space or operand
+   */
+  static char names[256][8];
+  char *name = names[opcode & 0xFF];
+  if (!name[0]) {
+    const char *format = opcodetab[opcode & 0xFF].op_mnemonic;
+    size_t n = strcspn (format, " %");
+    if (n >= sizeof (names[0]))
+      n = sizeof (names[0]) - 1;
+    memcpy (name, format, n);
+    name[n] = 0;
+  }
+  return name;
+}
+#endif
@@ -69,11 +69,42 @@ unsigned int _rotr(unsigned int Data, unsigned int Bits);
 unsigned int _rotl(unsigned int Data, unsigned int Bits);
 
 typedef int64_t COUNTER_VAR;
+
+/*
+ * Storage class of every variable that holds emulator state. Empty for the
+ * Pico, where there is one 6301. The host build defines it as __thread so
+ * each thread runs a 6301 of its own, hd6301_init() has to be called on
+ * each thread that uses the core.
+ */
+#ifndef HD6301_STATE
+#define HD6301_STATE
+#endif
+
+/*
+ * Placement of what core1 touches on every instruction. On the Pico the
+ * registers, the internal registers and the opcode fetch page table go in
+ * the SCRATCH_X bank, which only core1 uses (its 2KB stack is at the top),
+ * so fetching and executing an instruction never waits for core0 using the
+ * striped SRAM. About 1.1KB is used, keep it under the 2KB left beside the
+ * stack. The interpreter loop is put with the time critical code, which is
+ * in RAM even if the binary is not built copy_to_ram. Both are empty on the
+ * host.
+ */
+#if defined(PICO) && !defined(HD6301_FAST_DATA)
+#define HD6301_FAST_DATA __attribute__((section(".scratch_x.hd6301")))
+#define HD6301_FAST_CODE __attribute__((section(".time_critical.hd6301")))
+#endif
+#ifndef HD6301_FAST_DATA
+#define HD6301_FAST_DATA
+#endif
+#ifndef HD6301_FAST_CODE
+#define HD6301_FAST_CODE
+#endif
 typedef unsigned char BYTE;
 typedef unsigned short WORD;
 
 // variables that Steem must see
-extern COUNTER_VAR cycles_run; 
+extern HD6301_STATE COUNTER_VAR cycles_run;
 
 // functions used by Steem
 BYTE* hd6301_init();
@@ -81,15 +112,58 @@ int hd6301_destroy(); // like a C++ destructor
 int hd6301_reset(int Cold); 
 void hd6301_run_clocks(COUNTER_VAR clocks);
 int hd6301_receive_byte(u_char byte_in); // just passing through
-void hd6301_tx_empty(int empty);
+void hd6301_tx_empty(int empty); // 0 holds TDRE off while the host TX buffer is full
 int hd6301_sci_busy();
+int hd6301_tx_busy(); // a byte is still on its way to the ST
+void hd6301_set_idle_skip(int enable); // fast-forward wait loops and SLP
+COUNTER_VAR hd6301_idle_cycles(); // total cycles fast-forwarded
+#define HD6301_INT_OCF 0
+#define HD6301_INT_SCI 1
+unsigned long hd6301_int_count(int source); // interrupts taken since boot
+void hd6301_set_key(int code, int down); // ST scancode pressed or released
+unsigned long hd6301_sci_count(int tx); // bytes received (0) or sent (1) since boot
+unsigned long hd6301_sci_overruns(); // bytes received while RDRF was still set
+unsigned long hd6301_instr_count(); // instructions interpreted since boot
+unsigned long hd6301_debug_ram(); // bytes used by the HD6301_DEBUG call stack and symbol table
+#if defined(HD6301_PROFILE) && HD6301_PROFILE
+void hd6301_profile_clear();
+void hd6301_profile_dump(int top); // print the hottest ROM ranges to stdio
+#endif
+#if defined(HD6301_SYMBOLS) && HD6301_SYMBOLS
+int hd6301_load_symbols(const char* path); // returns 0 if loaded
+#endif
+void hd6301_trace_freeze(); // keep the last instructions run, call when a crash is seen
+void hd6301_trace_dump(); // print them to stdio
+#if defined(HD6301_SESSION) && HD6301_SESSION
+void hd6301_session_start(); // record everything going in and out from the next slice
+void hd6301_session_stop();
+void hd6301_session_dump(FILE* f); // write the recording as text, see session.h
+#endif
+int hd6301_snapshot_size(); // bytes needed by hd6301_save()
+int hd6301_save(void* buf, int size); // returns the bytes used, 0 if buf is too small
+int hd6301_restore(const void* buf, int size); // returns 0 if buf isn't a snapshot for this ROM
 
 #define MOUSE_MASK 0x33333333 // 20bit on real HW?
 
-extern unsigned int mouse_x_counter;
-extern unsigned int mouse_y_counter;
+extern HD6301_STATE unsigned int mouse_x_counter;
+extern HD6301_STATE unsigned int mouse_y_counter;
+
+extern HD6301_STATE int crashed;
 
-extern int crashed;
+#if defined(HD6301_OPCODE_STATS)
+// Number of times each opcode has been executed (host benchmark builds)
+extern HD6301_STATE unsigned long hd6301_opcode_stats[256];
+const char* hd6301_opcode_name(int opcode);
+#endif
+
+#if defined(HD6301_IREG_STATS)
+// Reads and writes of each internal register by the ROM (host benchmark
+// builds), reg is the offset from 0 to HD6301_NIREGS - 1
+#define HD6301_NIREGS 0x15
+unsigned long hd6301_ireg_count(int write, int reg);
+const char* hd6301_ireg_name(int reg);
+void hd6301_ireg_clear();
+#endif
 
 #define USE_PROTOTYPES 
 
@@ -20,6 +20,14 @@
 #include "alu.h"
 #include "reg.h"
 #endif
+
+#if HD6301_LAZY_FLAGS
+/*
+ * Store the values reg_get[nz]flag() read the N and Z flags from
+ */
+#define alu_nz8(r)  {lazy_flags.n = (r); lazy_flags.z = (r) & 0xFF;}
+#define alu_nz16(r) {lazy_flags.n = (r) >> 8; lazy_flags.z = (r) & 0xFFFF;}
+#endif
 /*
  *  addbyte - Return val1 + val2 + carry, set CCR flags
  *
@@ -31,6 +39,12 @@ alu_addbyte (val1, val2, carry)
   u_char carry;   /* 0 or 1 */
 {
   u_int  result = val1 + val2 + carry;
+#if HD6301_LAZY_FLAGS
+  lazy_flags.c = result >> 8;
+  alu_nz8 (result);
+  lazy_flags.v = val1 ^ val2 ^ result ^ (result >> 1);
+  lazy_flags.h = val1 ^ val2 ^ result; /* addbyte only */
+#else
   u_char cflag  = (result >> 1) & 0x80;
 
   reg_setcflag (cflag);
@@ -38,6 +52,7 @@ alu_addbyte (val1, val2, carry)
   reg_setvflag (((val1 ^ val2 ^ result) ^ cflag) & 0x80);
   reg_setzflag ((result & 0xFF) == 0);
   reg_sethflag ((val1 ^ val2 ^ result) & 0x10); /* addbyte only */
+#endif
   return result;
 }
 
@@ -51,12 +66,18 @@ alu_addword (val1, val2, carry)
   u_char  carry;
 {
   u_long result = (long) val1 + val2 + carry;
+#if HD6301_LAZY_FLAGS
+  lazy_flags.c = (result >> 16) != 0;
+  alu_nz16 (result);
+  lazy_flags.v = (val1 ^ val2 ^ result ^ (result >> 1)) >> 8;
+#else
   u_int  cflag  = (result >> 1) & 0x8000;
 
   reg_setcflag (cflag);
   reg_setnflag (result & 0x8000);
   reg_setvflag (((val1 ^ val2 ^ result) ^ cflag) & 0x8000);
   reg_setzflag ((result & 0xFFFF) == 0);
+#endif
   return result;
 }
 
@@ -81,18 +102,28 @@ alu_andbyte (val1, val2)
 alu_bittestbyte (value)
   u_char value;
 {
+#if HD6301_LAZY_FLAGS
+  alu_nz8 (value);
+  lazy_flags.v = 0;
+#else
   reg_setnflag (value & 0x80);
   reg_setzflag (value == 0);
   reg_setvflag (0);
+#endif
   return value;
 }
 
 alu_bittestword (value)
   u_int value;
 {
+#if HD6301_LAZY_FLAGS
+  alu_nz16 (value);
+  lazy_flags.v = 0;
+#else
   reg_setnflag (value & 0x8000);
   reg_setzflag (value == 0);
   reg_setvflag (0);
+#endif
   return value;
 }
 
@@ -117,9 +148,14 @@ alu_combyte (value)
   u_char value;
 {
   u_char result = ~value;
+#if HD6301_LAZY_FLAGS
+  alu_nz8 (result);
+  lazy_flags.v = 0;
+#else
   reg_setnflag (result & 0x80);
   reg_setzflag (result == 0);
   reg_setvflag (0);
+#endif
   reg_setcflag (1);
   return result;
 }
@@ -132,8 +168,12 @@ alu_decbyte (value)
 {
   reg_setvflag (value == 0x80);
   value = (--value & 0xFF);
+#if HD6301_LAZY_FLAGS
+  alu_nz8 (value);
+#else
   reg_setnflag (value & 0x80);
   reg_setzflag (value == 0);
+#endif
   return value;
 }
 
@@ -157,8 +197,12 @@ alu_incbyte (value)
 {
   reg_setvflag (value == 0x7F);
   value = ++value & 0xFF;
+#if HD6301_LAZY_FLAGS
+  alu_nz8 (value);
+#else
   reg_setnflag (value & 0x80);
   reg_setzflag (value == 0);
+#endif
   return value;
 }
 
@@ -216,10 +260,16 @@ alu_shlbyte (operand, lsbit)
   u_int  result = ((operand << 1) & 0xFF) | (lsbit != 0);
   u_char cflag  = operand & 0x80;
 
+#if HD6301_LAZY_FLAGS
+  alu_nz8 (result);
+  lazy_flags.v = result ^ cflag;
+  lazy_flags.c = cflag != 0;
+#else
   reg_setnflag (result & 0x80);
   reg_setzflag (result == 0);
   reg_setvflag ((result ^ cflag) & 0x80);
   reg_setcflag (cflag);
+#endif
   return result;
 }
 
@@ -234,10 +284,16 @@ alu_shrbyte (operand, msbit)
   u_int result = ((operand >> 1) & 0xFF) | (msbit ? 0x80 : 0);
   u_char cflag = operand & 0x01 ? 0x80 : 0;
 
+#if HD6301_LAZY_FLAGS
+  alu_nz8 (result);
+  lazy_flags.v = result ^ cflag;
+  lazy_flags.c = cflag != 0;
+#else
   reg_setnflag (result & 0x80);
   reg_setzflag (result == 0);
   reg_setvflag ((result ^ cflag) & 0x80);
   reg_setcflag (cflag);
+#endif
   return result;
 }
 
@@ -252,10 +308,16 @@ alu_shlword (operand, lsbit)
   u_int result = ((operand << 1) & 0xFFFF) | (lsbit != 0);
   u_int cflag  = operand & 0x8000;
 
+#if HD6301_LAZY_FLAGS
+  alu_nz16 (result);
+  lazy_flags.v = (result ^ cflag) >> 8;
+  lazy_flags.c = cflag != 0;
+#else
   reg_setnflag (result & 0x8000);
   reg_setzflag (result == 0);
   reg_setvflag ((result ^ cflag) & 0x8000);
   reg_setcflag (cflag);
+#endif
   return result;
 }
 
@@ -270,10 +332,16 @@ alu_shrword (operand, msbit)
   u_int result = ((operand >> 1) & 0xFFFF) | (msbit ? 0x8000 : 0);
   u_int cflag  = operand & 0x0001 ? 0x8000 : 0;
 
+#if HD6301_LAZY_FLAGS
+  alu_nz16 (result);
+  lazy_flags.v = (result ^ cflag) >> 8;
+  lazy_flags.c = cflag != 0;
+#else
   reg_setnflag (result & 0x8000);
   reg_setzflag (result == 0);
   reg_setvflag ((result ^ cflag) & 0x8000);
   reg_setcflag (cflag);
+#endif
   return result;
 }
 
@@ -287,12 +355,18 @@ alu_subbyte (val1, val2, carry)
   u_char  carry;    /* 0 or 1 */
 {
   u_int  result = val1 - val2 - carry;
+#if HD6301_LAZY_FLAGS
+  lazy_flags.c = (result >> 8) != 0;
+  alu_nz8 (result);
+  lazy_flags.v = val1 ^ val2 ^ result ^ (result >> 1);
+#else
   u_char cflag  = (result >> 1) & 0x80;
 
   reg_setcflag (cflag);
   reg_setnflag (result & 0x80);
   reg_setvflag (((val1 ^ val2 ^ result) ^ cflag) & 0x80);
   reg_setzflag ((result & 0xFF) == 0);
+#endif
   return result;
 
 }
@@ -307,12 +381,18 @@ alu_subword (val1, val2, carry)
   u_char carry;   /* 0 or 1 */
 {
   u_long result = (long) val1 - val2 - carry;
+#if HD6301_LAZY_FLAGS
+  lazy_flags.c = (result >> 16) != 0;
+  alu_nz16 (result);
+  lazy_flags.v = (val1 ^ val2 ^ result ^ (result >> 1)) >> 8;
+#else
   u_int  cflag  = (result >> 1) & 0x8000;
 
   reg_setcflag (cflag);
   reg_setnflag (result & 0x8000);
   reg_setvflag (((val1 ^ val2 ^ result) ^ cflag) & 0x8000);
   reg_setzflag ((result & 0xFFFF) == 0);
+#endif
   return result;
 }
 
@@ -323,7 +403,12 @@ alu_subword (val1, val2, carry)
 alu_testbyte (operand)
   u_char operand;
 {
+#if HD6301_LAZY_FLAGS
+  int result = operand;
+  alu_nz8 (result);
+#else
   int result = alu_subbyte (operand, 0, 0);
+#endif
   reg_setvflag (0);
   reg_setcflag (0);
   return result;
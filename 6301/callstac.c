@@ -30,7 +30,7 @@
  */
 #define MAXCALLSTACK 256
 
-static struct {
+static HD6301_STATE struct {
   u_int sp;     /* Points to first free element */
   u_int trace;
   struct {
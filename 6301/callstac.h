@@ -8,6 +8,16 @@
 # define P_(s) ()
 #endif
 
+/*
+ * The subroutine call stack, the stack limit warnings and the symbol table
+ * are debugger features. They are only built with -DHD6301_DEBUG=1,
+ * otherwise the calls compile to nothing.
+ */
+#ifndef HD6301_DEBUG
+# define HD6301_DEBUG 0
+#endif
+
+#if HD6301_DEBUG
 extern int callstack_push P_((unsigned int addr));
 extern int callstack_pop P_((void));
 extern int callstack_peek_addr P_((void));
@@ -15,6 +25,15 @@ extern int callstack_peek_stack P_((void));
 extern int callstack_nelem P_((void));
 extern int callstack_print P_((void));
 extern int callstack_trace P_((int on));
+#else
+# define callstack_push(addr)
+# define callstack_pop()
+# define callstack_peek_addr()    0
+# define callstack_peek_stack()   0
+# define callstack_nelem()        0
+# define callstack_print()
+# define callstack_trace(on)      0
+#endif
 
 #undef P_
 #endif /* CALLSTAC_H */
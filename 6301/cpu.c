@@ -9,7 +9,7 @@
 #include "cpu.h"
 #include "reg.h"
 
-struct cpu cpu;
+HD6301_STATE HD6301_FAST_DATA struct cpu cpu;
 
 cpu_reset ()
 {
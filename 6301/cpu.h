@@ -34,7 +34,7 @@ struct cpu {
 
 };
 
-extern struct cpu cpu;
+extern HD6301_STATE struct cpu cpu;
 
 /*
  * Function prototypes (and macros)
@@ -0,0 +1,51 @@
+/*
+ * Atari ST RP2040 IKBD Emulator
+ * Copyright (C) 2021 Roy Hopkins
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#include "defs.h"
+#include "memory.h"
+#include "decode.h"
+
+/*
+ROM predecode.
+
+The mask ROM can't be written (memory.c maps its pages to discard writes),
+so the opcode and operand bytes at every ROM address are read once at a cold
+reset and the interpreter fetches an instruction with a single load instead
+of three page table lookups. Code running from RAM is fetched as before.
+
+Decoding stops at the instruction level: interrupts and the timer are
+checked between every instruction so a whole basic block can't be run
+without changing when they are taken.
+*/
+
+HD6301_STATE u_int decode_rom[DECODE_SIZE];
+HD6301_STATE u_short instr_operand;
+
+/*
+ * decode_init - decode the ROM, called after the image has been loaded
+ */
+void decode_init ()
+{
+  u_int i, pc;
+
+  for (i = 0; i < DECODE_SIZE; i++)
+  {
+    pc = DECODE_START + i;
+    decode_rom[i] = mem_fetchb (pc) | (mem_fetchw (pc + 1) << 8);
+  }
+}
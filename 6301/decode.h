@@ -0,0 +1,69 @@
+/*
+ * Atari ST RP2040 IKBD Emulator
+ * Copyright (C) 2021 Roy Hopkins
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#ifndef H6301_DECODE_H
+#define H6301_DECODE_H
+
+#if defined(__STDC__) || defined(__cplusplus)
+# define P_(s) s
+#else
+# define P_(s) ()
+#endif
+
+/*
+ * Instructions in the mask ROM are decoded once. The last ROM byte is left
+ * out, its operands would be past the end of memory.
+ */
+#define DECODE_START  0xF000
+#define DECODE_SIZE   0x0FFF
+
+/*
+ * Each entry holds the opcode in bits 7-0 and the two bytes after it in
+ * bits 23-8, first operand byte highest
+ */
+extern HD6301_STATE u_int decode_rom[DECODE_SIZE];
+
+/*
+ * Operand bytes of the instruction being executed that haven't been
+ * used yet, the next one in bits 15-8 (see getbyte_imm() in opfunc.c)
+ */
+extern HD6301_STATE u_short instr_operand;
+
+/*
+ * decode_fetch - opcode at pc, loads instr_operand with its operands
+ */
+static u_char
+decode_fetch (pc)
+  u_int pc;
+{
+  u_int entry;
+
+  if (pc - DECODE_START < DECODE_SIZE)
+  {
+    entry = decode_rom[pc - DECODE_START];
+    instr_operand = entry >> 8;
+    return entry & 0xFF;
+  }
+  instr_operand = mem_fetchw (pc + 1);
+  return mem_fetchb (pc);
+}
+
+extern void decode_init P_((void));
+
+#undef P_
+#endif /* H6301_DECODE_H */
@@ -0,0 +1,195 @@
+/*
+ * Atari ST RP2040 IKBD Emulator
+ * Copyright (C) 2021 Roy Hopkins
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#include "defs.h"
+#include "chip.h"
+#include "cpu.h"
+#include "instr.h"
+#include "ireg.h"
+#include "memory.h"
+#include "optab.h"
+#include "reg.h"
+#include "sci.h"
+#include "timer.h"
+#include "idle.h"
+
+/*
+Idle fast-forward.
+
+Some loops in the ROM can only be left because of something that happens
+outside the instruction stream. Rather than interpreting every iteration,
+the time they would have taken is added to the cycle counter in one go,
+the free running counter follows it (timer.c). The loops recognised are:
+
+  bra *                       Branch to itself, waits for an interrupt
+  tim #m,TRCSR; beq/bne       Waits for a TRCSR bit
+  ldaa TRCSR; bita #m; beq/bne
+  ldab TRCSR; bitb #m; beq/bne
+  deca/decb; [nop...]; bne    Software delay, the count is known up front
+  slp                         Sleeps until an interrupt
+
+The TRCSR status bits only change between slices (hd6301_tx_empty(), a
+received byte and the wake-up bit in hd6301_run_clocks()) or when TDRE is
+due (timer_next), so a wait loop can't finish before the end of the current
+slice or the next timer event. The bits are checked again when the loop is
+entered because the test may have been made before the slice started.
+Whole iterations are skipped and the skip always stops before the end of
+the slice, before the free running counter reaches OCR or overflows and
+before TDRE is set. Whatever is left is interpreted normally so the machine
+state is the same as if every iteration had been run.
+*/
+
+HD6301_STATE int idle_enabled = 1;      /* Fast-forward recognised loops */
+HD6301_STATE int idle_sleeping = 0;     /* SLP executed, waiting for an interrupt */
+HD6301_STATE COUNTER_VAR idle_deadline = 0; /* End of the current slice */
+HD6301_STATE COUNTER_VAR idle_skipped = 0;  /* Total cycles fast-forwarded */
+
+/*
+ * idle_window - number of cycles that can be skipped after the current
+ * instruction (which takes 'pending' cycles) finishes
+ */
+static u_int idle_window (u_int pending)
+{
+  COUNTER_VAR left = idle_deadline - (cpu_getncycles () + pending);
+  COUNTER_VAR window = timer_next - (cpu_getncycles () + pending);
+
+  // Stop one cycle short of a timer event so it is raised by an
+  // interpreted instruction
+  if (left <= 0 || window <= 0)
+    return 0;
+  window -= 1;
+  return (u_int) ((left < window) ? left : window);
+}
+
+static void idle_skip (u_int ncycles)
+{
+  cpu_setncycles (cpu_getncycles () + ncycles);
+  idle_skipped += ncycles;
+}
+
+/*
+ * idle_polls - the ROM tested TRCSR with 'mask' and is branching back with
+ * 'branch' (beq or bne). The test may have been made in the previous slice
+ * and the wake-up bit cleared since, so only keep going round if the bits
+ * as they are now would take the branch again.
+ */
+static int idle_polls (u_char mask, u_char branch)
+{
+  int set = (iram[TRCSR] & mask) != 0;
+
+  return (branch == 0x26) ? set : !set;
+}
+
+/*
+ * idle_loop - called by a taken backward branch with the pc at the loop head
+ */
+void idle_loop (int offs)
+{
+  u_int head = reg_getpc ();
+  u_int body = -offs - 2;
+  u_char lp[IDLE_MAX_BODY + 1];
+  u_int pending, cycles, n, i;
+
+  if (!idle_enabled || head < 0x80 || body > IDLE_MAX_BODY)
+    return;
+  for (i = 0; i <= body; i++)
+    lp[i] = mem_getb (head + i);
+  pending = opcyctab[lp[body]];
+
+  if (body == 0)
+  {
+    // Branching to itself, only an interrupt gets out of here
+    cycles = pending;
+  }
+  else if (body == 3 && lp[0] == 0x7b && lp[2] == TRCSR)
+  {
+    if (!idle_polls (lp[1], lp[body]))
+      return;
+    cycles = opcyctab[0x7b] + pending;
+  }
+  else if (body == 4 && lp[1] == TRCSR &&
+           ((lp[0] == 0x96 && lp[2] == 0x85) || (lp[0] == 0xd6 && lp[2] == 0xc5)))
+  {
+    if (!idle_polls (lp[3], lp[body]))
+      return;
+    cycles = opcyctab[lp[0]] + opcyctab[lp[2]] + pending;
+  }
+  else if ((lp[0] == 0x4a || lp[0] == 0x5a) && lp[body] == 0x26)
+  {
+    u_int count = (lp[0] == 0x4a) ? reg_getacca () : reg_getaccb ();
+    u_int left = (count ? count : 256) - 1; /* the last pass is interpreted */
+
+    cycles = opcyctab[lp[0]] + pending;
+    for (i = 1; i < body; i++)
+    {
+      if (lp[i] != 0x01)
+        return;
+      cycles += opcyctab[0x01];
+    }
+    n = idle_window (pending) / cycles;
+    if (n > left)
+      n = left;
+    if (n)
+    {
+      count = (count - n) & 0xFF;
+      if (lp[0] == 0x4a)
+      {
+        reg_setacca (count);
+      }
+      else
+      {
+        reg_setaccb (count);
+      }
+      // Flags as left by the last skipped decrement
+      reg_setnflag (count & 0x80);
+      reg_setzflag (0);
+      reg_setvflag (count == 0x7f);
+      idle_skip (n * cycles);
+    }
+    return;
+  }
+  else
+    return;
+
+  n = idle_window (pending) / cycles;
+  if (n)
+    idle_skip (n * cycles);
+}
+
+/*
+ * idle_sleep - SLP instruction
+ *
+ * The pc is held on the SLP so it is executed again until an interrupt
+ * is requested. int_addr() stacks the address after it.
+ */
+void idle_sleep ()
+{
+  u_int cycles = opcyctab[0x1a];
+  u_int n;
+
+  if (int_pending)
+  {
+    // Interrupt requested while masked, carry on after the SLP
+    idle_sleeping = 0;
+    return;
+  }
+  idle_sleeping = 1;
+  reg_incpc (-1);
+  if (idle_enabled && (n = idle_window (cycles) / cycles))
+    idle_skip (n * cycles);
+}
@@ -0,0 +1,43 @@
+/*
+ * Atari ST RP2040 IKBD Emulator
+ * Copyright (C) 2021 Roy Hopkins
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#ifndef H6301_IDLE_H
+#define H6301_IDLE_H
+
+#if defined(__STDC__) || defined(__cplusplus)
+# define P_(s) s
+#else
+# define P_(s) ()
+#endif
+
+/*
+ * Longest loop body (in bytes, excluding the branch) that is checked for
+ * an idle pattern. Taken branches further back than this are ignored.
+ */
+#define IDLE_MAX_BODY 6
+
+extern HD6301_STATE int idle_enabled;
+extern HD6301_STATE int idle_sleeping;
+extern HD6301_STATE COUNTER_VAR idle_deadline;
+extern HD6301_STATE COUNTER_VAR idle_skipped;
+
+extern void idle_loop P_((int offs));
+extern void idle_sleep P_((void));
+
+#undef P_
+#endif /* H6301_IDLE_H */
@@ -13,13 +13,24 @@
 #include "optab.h"
 #include "reg.h"
 #include "sci.h"
+#include "profile.h"
+#include "itrace.h"
 #include "timer.h"
+#include "decode.h"
 
 #ifdef USE_PROTOTYPES
 #include "instr.h"
 #endif
 
 
+/*
+ * Interrupt requests, kept up to date by int_update() so instr_exec() only
+ * has to look at the registers when one of them is active
+ */
+HD6301_STATE int int_pending = 0;
+HD6301_STATE unsigned long int_count[2];  /* Interrupts taken, [0] OCF [1] SCI */
+HD6301_STATE unsigned long instr_count;   /* Instructions executed, not counting skipped idle loops */
+
 /*
  *  reset - jump to the reset vector
  */
@@ -30,6 +41,34 @@ reset ()
 }
 
 
+/*
+ * int_update - called whenever TCSR or TRCSR change a bit that can
+ * request an interrupt
+ */
+int_update ()
+{
+  int_pending = (((ireg_getb (TCSR) & OCF) && (ireg_getb (TCSR) & EOCI)) ? INT_OCF : 0)
+    | (serial_int () ? INT_SCI : 0);
+}
+
+/*
+ * instr_interrupt - take the highest priority interrupt requested
+ */
+static void instr_interrupt ()
+{
+  /*
+   * Check for interrupts in priority order
+   */
+  if (int_pending & INT_OCF) {
+    int_addr (OCFVECTOR);
+    ++int_count[0];
+  } 
+  else {
+    int_addr (SCIVECTOR);
+    ++int_count[1];
+  }
+}
+
 /*
  * instr_exec - execute an instruction
  */
@@ -41,24 +80,15 @@ instr_exec ()
    * inc program counter to point to first operand,
    * Decode and execute the opcode.
    */
-  struct opcode *opptr;
+  u_char op;
   int interrupted = 0;    /* 1 = HW interrupt occured */
 
 #ifndef M6800
 
-  if (!reg_getiflag ()) 
+  if (int_pending && !reg_getiflag ()) 
   {
-    /*
-     * Check for interrupts in priority order
-     */
-    if ((ireg_getb (TCSR) & OCF) && (ireg_getb (TCSR) & EOCI)) {
-      int_addr (OCFVECTOR);
-      interrupted = 1;
-    } 
-    else if (serial_int ()) {
-      int_addr (SCIVECTOR);
-      interrupted = 1;
-    }
+    instr_interrupt ();
+    interrupted = 1;
   }
 #if 0
   /*
@@ -75,10 +105,11 @@ instr_exec ()
 
   if (interrupted) /* Prepare cycle count for register stacking */
   {
-    opptr = &opcodetab[0x3f]; /* SWI */
+    op = 0x3f; /* SWI */
   }
   else
   {
+#if HD6301_PC_CHECK
     int pc=reg_getpc (); 
     if(!(pc>=0x80&&pc<0xFFFF)) // eg bad snapshot
     {
@@ -86,15 +117,107 @@ instr_exec ()
       crashed = 1;
       return -1;
     }
+#endif
 
-    opptr = &opcodetab [mem_getb (reg_getpc ())];
+    op = decode_fetch (reg_getpc ());
+    ITRACE_RECORD (op);
+#if defined(HD6301_OPCODE_STATS)
+    hd6301_opcode_stats[op]++;
+#endif
+    ++instr_count;
     reg_incpc (1);
-    (*opptr->op_func) ();
+    (*opfunctab[op]) ();
 //    ASSERT(iram[7]!=0xf0);
   }
   
-  cpu_setncycles (cpu_getncycles () + opptr->op_n_cycles);
-  timer_inc (opptr->op_n_cycles);
+  cpu_setncycles (cpu_getncycles () + opcyctab[op]);
+  timer_update ();
+  return 0;
+}
+
+/*
+ * instr_run - execute instructions until the cycle count reaches 'end'
+ *
+ * With the switch and computed goto engines every handler is called
+ * directly from here, so the compiler can inline it and the cycle count
+ * is a constant. The behaviour is the same as calling instr_exec().
+ */
+instr_run (end)
+  COUNTER_VAR end;
+{
+#if HD6301_DISPATCH == HD6301_DISPATCH_TABLE
+  while (!crashed && cpu_getncycles () < end)
+  {
+    PROFILE_SAMPLE ();
+    instr_exec ();
+  }
+#else
+  u_int pc;
+  u_char op;
+  unsigned long executed = 0; /* added to instr_count on the way out */
+#if HD6301_DISPATCH == HD6301_DISPATCH_GOTO
+  static void *const op_label[256] = {
+#define OPCODE(value, operands, func, cycles, mnemonic) &&op_##value,
+#include "oplist.h"
+#undef OPCODE
+  };
+#endif
+
+  // Only set in this loop, which stops straight away
+  if (crashed)
+    return 0;
+  while (cpu_getncycles () < end)
+  {
+    if (int_pending && !reg_getiflag ())
+    {
+      instr_interrupt ();
+      cpu_setncycles (cpu_getncycles () + opcyctab[0x3f]);
+      timer_update ();
+      continue;
+    }
+    PROFILE_SAMPLE ();
+    pc = reg_getpc ();
+#if HD6301_PC_CHECK
+    if (!(pc >= 0x80 && pc < 0xFFFF)) // eg bad snapshot
+    {
+      TRACE("pc=%x, 6301 emu is hopelessly crashed!\n",pc);
+      crashed = 1;
+      break;
+    }
+#endif
+    op = decode_fetch (pc);
+    ITRACE_RECORD (op);
+#if defined(HD6301_OPCODE_STATS)
+    hd6301_opcode_stats[op]++;
+#endif
+    ++executed;
+    reg_setpc (pc + 1);
+#if HD6301_DISPATCH == HD6301_DISPATCH_GOTO
+    goto *op_label[op];
+#define OPCODE(value, operands, func, cycles, mnemonic) \
+  op_##value: \
+    func (); \
+    cpu_setncycles (cpu_getncycles () + cycles); \
+    timer_update (); \
+    continue;
+#include "oplist.h"
+#undef OPCODE
+#else
+    switch (op)
+    {
+#define OPCODE(value, operands, func, cycles, mnemonic) \
+    case value: \
+      func (); \
+      cpu_setncycles (cpu_getncycles () + cycles); \
+      break;
+#include "oplist.h"
+#undef OPCODE
+    }
+    timer_update ();
+#endif
+  }
+  instr_count += executed;
+#endif
   return 0;
 }
 
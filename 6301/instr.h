@@ -8,8 +8,45 @@
 #endif
 
 
+/*
+ * int_pending bits, set while the source is requesting an interrupt
+ * (whether or not the I flag masks it)
+ */
+#define INT_OCF 0x01  /* Output compare, OCF and EOCI */
+#define INT_SCI 0x02  /* Serial, RDRF and RIE or TDRE and TIE */
+
+extern HD6301_STATE int int_pending;
+extern HD6301_STATE unsigned long int_count[2];
+extern HD6301_STATE unsigned long instr_count;
+
+/*
+ * Dispatch engine used by instr_run(), select with -DHD6301_DISPATCH=n
+ */
+#define HD6301_DISPATCH_TABLE   0  /* Indirect call through opcodetab[] */
+#define HD6301_DISPATCH_SWITCH  1  /* One switch, handlers inlined */
+#define HD6301_DISPATCH_GOTO    2  /* GCC computed goto, handlers inlined */
+
+#ifndef HD6301_DISPATCH
+# if defined(__GNUC__)
+#  define HD6301_DISPATCH HD6301_DISPATCH_GOTO
+# else
+#  define HD6301_DISPATCH HD6301_DISPATCH_SWITCH
+# endif
+#endif
+
+/*
+ * Stop with 'crashed' set when the pc leaves the ROM and internal RAM, eg
+ * after a bad snapshot. Costs a compare per instruction, build with
+ * -DHD6301_PC_CHECK=0 to leave it out. The crash recovery depends on it.
+ */
+#ifndef HD6301_PC_CHECK
+# define HD6301_PC_CHECK 1
+#endif
+
 extern int reset P_((void));
+extern int int_update P_((void));
 extern int instr_exec P_((void));
+extern HD6301_FAST_CODE int instr_run P_((COUNTER_VAR end));
 extern int instr_print P_((u_short addr));
 
 #undef P_
@@ -3,6 +3,7 @@
 /* All rights reserved.                 */
 /* >>>                                  */
 #include <stdio.h>
+#include <string.h>
 
 #include "defs.h"
 #include "chip.h"
@@ -10,14 +11,25 @@
 #include "sci.h"
 #include "timer.h"
 #include "ireg.h"
+#include "session.h"
 #include "AtariSTMouse.h"
 #include "HidInput.h"
 
 /*
  * Start/end of internal register block
  */
-u_int ireg_start = 0;
-u_char  iram[NIREGS];
+HD6301_STATE u_int ireg_start = 0;
+HD6301_STATE HD6301_FAST_DATA u_char  iram[NIREGS];
+
+#if defined(HD6301_IREG_STATS)
+HD6301_STATE unsigned long hd6301_ireg_stats[2][NIREGS];
+
+static const char *const ireg_names[NIREGS] = {
+  "DDR1", "DDR2", "P1",  "P2",  "DDR3", "DDR4", "P3",  "P4",
+  "TCSR", "FRCH", "FRCL", "OCRH", "OCRL", "ICRH", "ICRL", "P3CSR",
+  "RMCR", "TRCSR", "RDR", "TDR", "RAMCR"
+};
+#endif
 
 #if defined(__STDC__) || defined(__cplusplus)
 # define P_(s) s
@@ -34,8 +46,14 @@ u_char  iram[NIREGS];
 */
 
 static u_char dr1_getb P_((u_int offs));
-static u_char dr2_getb P_((u_int offs));
-static u_char dr4_getb P_((u_int offs));
+
+/* Input latency tracing (LatencyTrace.cpp) notes each port read */
+#ifdef LATENCY_TRACE
+extern void latency_read P_((int port));
+# define LATENCY_READ(port) latency_read (port)
+#else
+# define LATENCY_READ(port)
+#endif
 
 /*  DR1
     This is the funniest part.
@@ -49,9 +67,11 @@ static u_char dr4_getb P_((u_int offs));
     To do that we use a look-up table based on doc. 
     Note that the first row had to be shifted to the right compared with the 
     existing doc.
-    We also use a table with key states (already used in Steem), and a function 
-    that builds DR1 bit by bit. 
-    It's slow but performance isn't needed for the keyboard.
+    The scancode at each row and column is read from the ROM table once (see
+    kbd_init()), along with where each scancode is, and the keys that are
+    down are kept as a bitmap of columns for each DR1 bit, updated by
+    hd6301_set_key() when a key changes. Reading DR1
+    then only has to test the selected columns against each row.
 */
 
 /*  go fetch the value in 6301 rom instead of in a fat table!
@@ -118,60 +138,76 @@ SCAN CODES
 1A  [       34  .             4E  KEYPAD +      72  KEYPAD ENTER
 */
 
+static HD6301_STATE u_char kbd_code[8][15];  /* Scancode at each DR1 bit and column */
+static HD6301_STATE u_char kbd_pos[128];     /* DR1 bit << 4 | column of each scancode, KBD_NO_POS if none */
+static HD6301_STATE u_short kbd_matrix[8];   /* Columns with a key down for each DR1 bit */
+
+#define KBD_NO_POS 0xFF
+
+/*
+ * kbd_setkey - update the matrix for an ST scancode going up or down
+ */
+static void kbd_setkey (code, down)
+  u_char code;
+  int down;
+{
+  u_char pos;
+
+  // Each scancode is at one place in the ROM table
+  if (!code || code >= 128 || (pos = kbd_pos[code]) == KBD_NO_POS)
+    return;
+  if (down)
+    kbd_matrix[pos >> 4] |= 1 << (pos & 15);
+  else
+    kbd_matrix[pos >> 4] &= ~(1 << (pos & 15));
+}
+
+/*
+ * kbd_init - read the scancode table from the ROM and rebuild the matrix,
+ * called after the ROM has been loaded
+ */
+static void kbd_init ()
+{
+  int dr1bit, column;
+  u_char code;
+
+  memset (kbd_pos, KBD_NO_POS, sizeof (kbd_pos));
+  for (dr1bit = 0; dr1bit < 8; dr1bit++)
+  {
+    kbd_matrix[dr1bit] = 0;
+    for (column = 0; column < 15; column++)
+    {
+      code = kbd_code[dr1bit][column] = get_scancode (dr1bit, column);
+      if (code && code < 128 && kbd_pos[code] == KBD_NO_POS)
+        kbd_pos[code] = (dr1bit << 4) | column;
+    }
+  }
+  for (column = 1; column < 128; column++)
+    kbd_setkey (column, st_keydown (column));
+}
+
 static u_char dr1_getb (offs)
 u_int offs;
 {
   u_char value=0xFF;
-  u_char  ddr1=iram[DDR1];
-  u_char  ddr3=iram[DDR3];
-  u_char  ddr4=iram[DDR4];
-  u_char  dr2=iram[P2];
-  u_char  dr3=iram[P3];
-  u_char  dr4=iram[P4];
+  u_short columns;
   int dr1bit;
-  int mask,scancode=-1;
 //  ASSERT(offs==P1);
 //  ASSERT(!ddr1); // strong
 //  ASSERT(!(dr2&1)); // strong, asserts at reset?
-   // We make DR1 bit by bit
-  for(dr1bit=0;dr1bit<8;dr1bit++)
+  if (iram[P2] & 1)
+    return value;
+  LATENCY_READ (1);
+  // Columns 0-6 are DR3 bits 1-7, columns 7-14 are DR4 bits 0-7. The diode
+  // is on when the bit is set in both the data and the direction register.
+  columns = ((iram[P3] & iram[DDR3]) >> 1) | ((iram[P4] & iram[DDR4]) << 7);
+  for (dr1bit = 0; dr1bit < 8; dr1bit++)
   {
-    mask=1<<dr1bit; 
-    // we only consider bits with a corresponding 0 in DDR1
-    if(!(mask&ddr1) && !(dr2&1))
-    {
-      int column,mask2,found=0; // 'found' avoids being too slow
-      // test DR3
-      for(column=0;column<7&&!found;column++)
-      {
-        mask2=1<<(column+1);
-        scancode=get_scancode(dr1bit,column);
-        if(st_keydown(scancode)
-          &&  (dr3&mask2) // must be set (diode on)
-          &&  (ddr3&mask2)
-          )
-          found++;
-      }
-      // test DR4
-      for(column=7;column<15&&!found;column++)
-      {
-        mask2=1<<(column-7);
-        scancode=get_scancode(dr1bit,column);
-        if(st_keydown(scancode)
-          &&  (dr4&mask2) // must be set (diode on)
-          &&  (ddr4&mask2)
-          )
-          found++;
-      }
-      if(found)
-      {
-        value&=~mask; // clear bit
-        //TRACE("Read DR1 %X scancode %x\n",value,scancode);
-      }
-    }
+    if (kbd_matrix[dr1bit] & columns)
+      value &= ~(1 << dr1bit); // clear bit
   }
-//  ASSERT(value);
-  return value;
+  // we only consider bits with a corresponding 0 in DDR1
+  return value | iram[DDR1];
 }
  
 /*  DR2 ($03 DDR2: $01)
@@ -189,19 +225,22 @@ u_int offs;
     mousek 3 ->   value 0
 */
 
-static u_char dr2_getb (offs)
+u_char dr2_getb (offs)
   u_int offs;
 {
   u_char value;
-#if !defined(NDEBUG)
+  int buttons;
+#if HD6301_DEBUG
 //  u_char ddr2=iram[DDR2];
   //ASSERT(ddr2==1); // strong
 #endif
   //ASSERT(offs==P2);
+  LATENCY_READ (2);
   value=0xFF; // note bits 5-7=111 in monochip mode, bits 3-4=serial lines
-  if(st_mouse_buttons()) // clear the correct bit (see above)
+  buttons=SESSION_CHANGE(SESSION_BUTTONS, st_mouse_buttons());
+  if(buttons) // clear the correct bit (see above)
   {
-    value=(st_mouse_buttons()*2)%6;
+    value=(buttons*2)%6;
 //    TRACE("HD6301 handling mousek %x -> %x\n",mousek,value);
   }
   return value;
@@ -232,7 +271,7 @@ static u_char dr2_getb (offs)
     Y# vertical movement
 */
 
-static u_char dr4_getb (offs)
+u_char dr4_getb (offs)
   u_int offs;
 {
   u_char value;
@@ -251,20 +290,22 @@ static u_char dr4_getb (offs)
     registry when read. To emulate this, we rotate a $3 (0011) sequence and
     send the last bits to registry bits 0-1 for horizontal movement, 2-3
     for vertical movement. */
+  LATENCY_READ (4);
   mouse_tick(cpu.ncycles, &mouse_x_counter, &mouse_y_counter);
+  (void) SESSION_CHANGE(SESSION_MOUSE, (mouse_x_counter & 0xf) | ((mouse_y_counter & 0xf) << 4));
 
 /*  Joystick movements
     Movement is signalled by cleared bits.
 */
   if(!ddr4 && (ddr2&1) && (dr2&1))
   {
-    if (st_mouse_enabled()) {
+    if (SESSION_CHANGE(SESSION_MOUSE_EN, st_mouse_enabled())) {
       value = (value & (~0xF)) | (mouse_x_counter&3)|((mouse_y_counter&3)<<2);
       // Add joystick 1
-      value = (value & ~0xf0) | (~st_joystick() & 0xf0);
+      value = (value & ~0xf0) | (~SESSION_CHANGE(SESSION_JOYSTICK, st_joystick()) & 0xf0);
     }
     else {
-      value = ~st_joystick();
+      value = ~SESSION_CHANGE(SESSION_JOYSTICK, st_joystick());
     }
     return value;
   }
@@ -291,7 +332,7 @@ u_char (*ireg_getb_func[NIREGS]) P_((u_int offs)) = {
 /* 0x00 */
   0,          0,  dr1_getb ,  dr2_getb ,
   0,          0,          0,  dr4_getb ,
-  tcsr_getb,  0,          0,          0,
+  tcsr_getb,  frc_getb,   frc_getb,   0,
   0,          0,          0,          0,
 /* 0x10 */
   0,          trcsr_getb, rdr_getb,   0,
@@ -306,7 +347,7 @@ int (*ireg_putb_func[NIREGS]) P_((u_int offs, u_char val)) = {
 /* 0x00 */
   0,          0,          port_putb,   port_putb,
   0,          0,          port_putb,   port_putb,
-  tcsr_putb,  0,          0,           ocr_putb,
+  tcsr_putb,  frc_putb,   frc_putb,    ocr_putb,
   ocr_putb,   0,          0,           0,
 /* 0x10 */
   0,          trcsr_putb, 0,           tdr_putb,
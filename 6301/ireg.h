@@ -10,8 +10,8 @@
 /*
  * Start/end of internal register block
  */
-extern u_int  ireg_start;
-extern u_char iram[];
+extern HD6301_STATE u_int  ireg_start;
+extern HD6301_STATE u_char iram[];
 
 
 #if defined(__STDC__) || defined(__cplusplus)
@@ -77,5 +77,22 @@ ireg_install (offs, getb, putb)
 extern u_char (*ireg_getb_func[]) P_((u_int offs));
 extern int (*ireg_putb_func[]) P_((u_int offs, u_char val));
 
+/*
+ * DR2 and DR4 reads, called directly by mem_getb_slow()
+ */
+extern u_char dr2_getb P_((u_int offs));
+extern u_char dr4_getb P_((u_int offs));
+
+/*
+ * Reads (0) and writes (1) of each internal register by the program, built
+ * with -DHD6301_IREG_STATS (host benchmark builds)
+ */
+#if defined(HD6301_IREG_STATS)
+extern HD6301_STATE unsigned long hd6301_ireg_stats[2][NIREGS];
+# define IREG_COUNT(write, offs) (hd6301_ireg_stats[write][offs]++)
+#else
+# define IREG_COUNT(write, offs)
+#endif
+
 #undef P_
 #endif /* IREG_H */
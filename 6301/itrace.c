@@ -0,0 +1,108 @@
+/*
+ * Atari ST RP2040 IKBD Emulator
+ * Copyright (C) 2021 Roy Hopkins
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#include <stdio.h>
+#include <string.h>
+#include "defs.h"
+#include "cpu.h"
+#include "reg.h"
+#include "optab.h"
+#include "decode.h"
+#include "itrace.h"
+
+/*
+Crash trace.
+
+Every instruction is written to a small ring before it runs, which is a
+few stores and no branches. When the emulation crashes itrace_freeze()
+copies the ring, oldest first, along with the registers at the point the
+crash was seen, so the 6301 can be reset or restored straight away and the
+copy printed later by another core with itrace_dump().
+*/
+
+HD6301_STATE struct itrace_entry itrace_ring[ITRACE_SIZE];
+HD6301_STATE u_int itrace_pos = 0;
+
+static HD6301_STATE struct {
+  u_int count;                          /* Entries in trace[] */
+  u_int crashes;                        /* itrace_freeze() calls */
+  struct regs regs;                     /* When the crash was seen */
+  u_int cycles;
+  struct itrace_entry trace[ITRACE_SIZE];
+} itrace_crash;
+
+/*
+ * itrace_freeze - keep a copy of the ring, called when a crash is detected
+ */
+void itrace_freeze ()
+{
+  u_int n = (itrace_pos < ITRACE_SIZE) ? itrace_pos : ITRACE_SIZE;
+  u_int i;
+
+  for (i = 0; i < n; i++)
+    itrace_crash.trace[i] = itrace_ring[(itrace_pos - n + i) & (ITRACE_SIZE - 1)];
+  itrace_crash.count = n;
+  itrace_crash.regs = regs;
+  itrace_crash.regs.ccr = reg_ccr ();
+  itrace_crash.cycles = (u_int) cpu_getncycles ();
+  ++itrace_crash.crashes;
+}
+
+static void itrace_print_regs (r, ccr)
+  const struct regs *r;
+  u_int ccr;
+{
+  printf ("a=%02x b=%02x x=%04x sp=%04x ccr=%02x",
+    r->accd.a, r->accd.b, r->ix, r->sp, ccr);
+}
+
+/*
+ * itrace_dump - print the copy taken by the last itrace_freeze()
+ */
+void itrace_dump ()
+{
+  u_int i;
+
+  if (!itrace_crash.crashes)
+    return;
+  printf ("6301 crash %u: %u instructions before pc=%04x at cycle %u\n",
+    itrace_crash.crashes, itrace_crash.count, itrace_crash.regs.pc, itrace_crash.cycles);
+  for (i = 0; i < itrace_crash.count; i++)
+  {
+    const struct itrace_entry *e = &itrace_crash.trace[i];
+    char text[24];
+#if HD6301_OPINFO
+    const struct opcode *op = &opcodetab[e->op];
+
+    snprintf (text, sizeof (text), op->op_mnemonic,
+      (op->op_n_operands == 1) ? (e->operand >> 8) : e->operand);
+#else
+    snprintf (text, sizeof (text), "%04x", e->operand);
+#endif
+    printf ("  %10u %04x %02x %-16s ", e->cycles, e->regs.pc, e->op, text);
+#if HD6301_LAZY_FLAGS
+    itrace_print_regs (&e->regs, reg_ccrof (e->regs.ccr, &e->flags));
+#else
+    itrace_print_regs (&e->regs, e->regs.ccr);
+#endif
+    printf ("\n");
+  }
+  printf ("  %10u %04x    %-16s ", itrace_crash.cycles, itrace_crash.regs.pc, "(crash)");
+  itrace_print_regs (&itrace_crash.regs, itrace_crash.regs.ccr);
+  printf ("\n");
+}
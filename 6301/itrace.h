@@ -0,0 +1,78 @@
+/*
+ * Atari ST RP2040 IKBD Emulator
+ * Copyright (C) 2021 Roy Hopkins
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#ifndef H6301_ITRACE_H
+#define H6301_ITRACE_H
+
+#include "reg.h"
+
+#if defined(__STDC__) || defined(__cplusplus)
+# define P_(s) s
+#else
+# define P_(s) ()
+#endif
+
+/*
+ * Ring of the last instructions executed, kept so there is something to
+ * look at after a crash. On by default, build with -DHD6301_ITRACE=0 to
+ * leave it out.
+ */
+#ifndef HD6301_ITRACE
+# define HD6301_ITRACE 1
+#endif
+
+#define ITRACE_SIZE 64  /* Entries, a power of two */
+
+struct itrace_entry {
+  struct regs regs;     /* Before the instruction, pc is its address */
+  u_int cycles;         /* Low 32 bits of the cycle count */
+#if HD6301_LAZY_FLAGS
+  struct lazy_flags flags; /* The rest of the CCR */
+#endif
+  u_short operand;      /* Bytes after the opcode */
+  u_char op;
+};
+
+#if HD6301_LAZY_FLAGS
+# define ITRACE_FLAGS(e) ((e)->flags = lazy_flags)
+#else
+# define ITRACE_FLAGS(e)
+#endif
+
+#if HD6301_ITRACE
+extern HD6301_STATE struct itrace_entry itrace_ring[ITRACE_SIZE];
+extern HD6301_STATE u_int itrace_pos;
+
+extern void itrace_freeze P_((void));
+extern void itrace_dump P_((void));
+
+# define ITRACE_RECORD(opcode) \
+  do { \
+    struct itrace_entry *e_ = &itrace_ring[itrace_pos++ & (ITRACE_SIZE - 1)]; \
+    e_->regs = regs; \
+    e_->cycles = (u_int) cpu_getncycles (); \
+    e_->operand = instr_operand; \
+    e_->op = (opcode); \
+    ITRACE_FLAGS (e_); \
+  } while (0)
+#else
+# define ITRACE_RECORD(opcode)
+#endif
+
+#undef P_
+#endif /* H6301_ITRACE_H */
@@ -17,6 +17,7 @@
 #include <ctype.h>
 #include <errno.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "defs.h"   /* general definitions */
 #include "chip.h"   /* chip specific: NIREGS */
@@ -30,26 +31,67 @@
  * Addresses used by mem_getb/putb should be set with command line options.
  * Disabling internal regs can be done by declaring intreg_start > intreg_end
  */
-u_int ram_start;    /* 0x0000; */
-u_int ram_end;    /* 0xFFFF; */
-u_char  *ram=0;     /* was [65536]; modified for MSDOS compilers */
+HD6301_STATE u_int ram_start;    /* 0x0000; */
+HD6301_STATE u_int ram_end;    /* 0xFFFF; */
+HD6301_STATE u_char  *ram=0;     /* was [65536]; modified for MSDOS compilers */
+
+HD6301_STATE u_char  *mem_rpage[MEM_NPAGES];
+HD6301_STATE u_char  *mem_wpage[MEM_NPAGES];
+HD6301_STATE HD6301_FAST_DATA u_char  *mem_cpage[MEM_NPAGES];
+/*
+ * Direct page followed by the 4KB ROM. Too big for a scratch bank beside a
+ * stack, so it stays in the striped SRAM, but it is static so there is no
+ * heap allocation at boot.
+ */
+static HD6301_STATE u_char mem_store[256 + 4096] __attribute__((aligned(4)));
+static HD6301_STATE u_char mem_open_bus[256];  /* Unmapped reads return 0xFF */
+static HD6301_STATE u_char mem_discard[256];   /* Unmapped writes are lost */
+
+/*
+ * mem_map - build the page tables
+ *
+ * 0x0000-0x00FF  internal registers and RAM (slow path)
+ * 0x0100-0xEFFF  unmapped
+ * 0xF000-0xFFFF  ROM, held in ram+256, writes are ignored
+ */
+static void
+mem_map ()
+{
+  u_int page;
+
+  memset (mem_open_bus, 0xFF, sizeof (mem_open_bus));
+  for (page = 0; page < MEM_NPAGES; page++)
+  {
+    if (page >= 0xF0 && page <= 0xFF)
+    {
+      mem_rpage[page] = mem_cpage[page] = ram + 256 + ((page - 0xF0) << 8);
+      mem_wpage[page] = mem_discard;
+    }
+    else if (page == 0 || page == MEM_NPAGES - 1)
+    {
+      mem_rpage[page] = mem_wpage[page] = NULL;
+      mem_cpage[page] = (page == 0) ? ram : mem_open_bus;
+    }
+    else
+    {
+      mem_rpage[page] = mem_cpage[page] = mem_open_bus;
+      mem_wpage[page] = mem_discard;
+    }
+  }
+}
 /*
  * mem_init - initialize memory area
  */
 u_char *
 mem_init ()
 {
-  u_int size = (256+4096);
   if (ram == NULL) {
-    if ((ram = malloc (size)) == NULL) {
-      perror ("Couldn't allocate ram");
-      return NULL;
-    }
-    //printf("6301: ram %d allocated OK\n",size); //SS
-    TRACE("6301: ram %d allocated OK\n",size); //SS
+    ram = mem_store;
+    TRACE("6301: ram %d set up OK\n",(int)sizeof (mem_store)); //SS
     ram_start = 0;
     ram_end   = MEMSIZE - 1;
     memset (ram, 0, 256);
+    mem_map ();
   } else {
     printf ("ram already allocated\n");
   }
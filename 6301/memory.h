@@ -17,6 +17,7 @@
 #include "defs.h"   /* general definitions */
 #include "chip.h"   /* chip specific: NIREGS */
 #include "ireg.h"   /* chip specific: ireg_getb/putb_func[], ireg_start/end */
+#include "callstac.h" /* callstack_peek_addr() */
 
 #define MEMSIZE 65536   /* Size of ram and breakpoint arrays */
 /*
@@ -25,24 +26,70 @@
  * Addresses used by mem_getb/putb should be set with command line options.
  * Disabling internal regs can be done by declaring ireg_start > ireg_end
  */
-extern u_int  ram_start;  /* First valid RAM address */
-extern u_int  ram_end;  /* Last valid RAM address */
-extern u_char  *ram;    /* Physical storage for simulated RAM */
+extern HD6301_STATE u_int  ram_start;  /* First valid RAM address */
+extern HD6301_STATE u_int  ram_end;  /* Last valid RAM address */
+extern HD6301_STATE u_char  *ram;    /* Physical storage for simulated RAM */
 
 /*
- *  mem_getb - called to get a byte from an address
+ * Page tables, one pointer per 256 bytes of address space.
+ *
+ * ROM and unmapped pages point straight at their storage. A NULL entry
+ * (page 0 with the internal registers and RAM, and the extra page that
+ * catches an address computed past 0xFFFF) goes through the slow path.
+ * Code is never run from the internal registers so mem_cpage[0] maps RAM.
+ */
+#define MEM_NPAGES 257
+
+extern HD6301_STATE u_char  *mem_rpage[MEM_NPAGES];  /* Reads */
+extern HD6301_STATE u_char  *mem_wpage[MEM_NPAGES];  /* Writes */
+extern HD6301_STATE u_char  *mem_cpage[MEM_NPAGES];  /* Opcode and operand fetch */
+
+/*
+ *  mem_fetchb, mem_fetchw - opcode or operand at the pc
  */
 static u_char
-mem_getb (addr)
+mem_fetchb (addr)
+  u_int addr;
+{
+  return mem_cpage[addr >> 8][addr & 0xFF];
+}
+
+static u_short
+mem_fetchw (addr)
+  u_int addr;
+{
+  u_char hi = mem_fetchb (addr);
+  u_char lo = mem_fetchb (addr + 1);
+  return (hi << 8) | lo;
+}
+
+/*
+ *  mem_getb_slow - read from page 0 or past the end of memory
+ */
+static u_char
+mem_getb_slow (addr)
   u_int addr;
 {
   int offs = addr - ireg_start;
   //ASSERT(!ireg_start);
   if (offs >= 0 && offs < NIREGS) {
+    IREG_COUNT (0, offs);
+    // The registers the ROM reads most (see ikbd_bench) don't go through
+    // the function table. DR2 and DR4 are read on every mouse and joystick
+    // poll, TRCSR in the serial loops and trcsr_getb() only returns it.
+    switch (offs)
+    {
+    case P4:
+      return dr4_getb (offs);
+    case P2:
+      return dr2_getb (offs);
+    case TRCSR:
+      return iram[TRCSR];
+    }
     if(offs==DDR1||offs==DDR2||offs==DDR3||offs==DDR4
       ||offs==TDR) 
     {
-#if !defined(NDEBUG)
+#if HD6301_DEBUG
     if(reg_getpc()!=0xB5)
       TRACE("NOTE PC %X reading WO register %X\n",reg_getpc(),addr);
 #endif
@@ -67,30 +114,44 @@ mem_getb (addr)
   }
 }
 
+/*
+ *  mem_getb - called to get a byte from an address
+ */
+static u_char
+mem_getb (addr)
+  u_int addr;
+{
+  u_char *page = mem_rpage[addr >> 8];
+  if (page)
+    return page[addr & 0xFF];
+  return mem_getb_slow (addr);
+}
+
 static u_short
 mem_getw (addr)
   u_int addr;
 {
   /* Make sure hi byte is accessed first */
   u_char hi = mem_getb (addr);
-  u_char lo = mem_getb (addr + 1);
+  u_char lo = mem_getb ((addr + 1) & 0xFFFF); /* ffff wraps to 0000 */
   return (hi << 8) | lo;
 }
 
 /*
- * mem_putb - called to write a byte to an address
+ * mem_putb_slow - write to page 0 or past the end of memory
  */ 
 static void
-mem_putb (addr, value)
+mem_putb_slow (addr, value)
   u_int   addr;
   u_char  value;
 {
   int offs = addr - ireg_start; /* Address of on-chip memory */
   //ASSERT(addr != 0x83);
   if (offs >= 0 && offs < NIREGS) {
+    IREG_COUNT (1, offs);
     if(offs==RDR||offs==FRC||offs==ICR)
     {
-#if !defined(NDEBUG)
+#if HD6301_DEBUG
       TRACE("NOTE PX %X writing %X on RO register %X\n",reg_getpc(),addr, value);
 #endif
       return;
@@ -112,13 +173,28 @@ mem_putb (addr, value)
   }
 }
 
+/*
+ * mem_putb - called to write a byte to an address
+ */ 
+static void
+mem_putb (addr, value)
+  u_int   addr;
+  u_char  value;
+{
+  u_char *page = mem_wpage[addr >> 8];
+  if (page)
+    page[addr & 0xFF] = value;
+  else
+    mem_putb_slow (addr, value);
+}
+
 static void
 mem_putw (addr, value)
   u_int addr;
   u_int value;
 {
   mem_putb (addr, value >> 8);    /* hi byte */
-  mem_putb (addr + 1, value & 0xFF);  /* lo byte */
+  mem_putb ((addr + 1) & 0xFFFF, value & 0xFF);  /* lo byte, ffff wraps to 0000 */
 }
 
 #if defined(__STDC__) || defined(__cplusplus)
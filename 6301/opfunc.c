@@ -14,8 +14,11 @@
 #include "reg.h"
 #include "opfunc.h"
 #endif
+#include "idle.h"
+#include "decode.h"
 
 #include "memory.h"
+#include "callstac.h"
 #include "reg.h"
 #include "alu.c"  /* To get inline functions */
 
@@ -39,29 +42,41 @@
 
 
 /*
- * Functions returning a memory address
+ * Operand bytes, taken from instr_operand which decode_fetch() loaded
+ * with the two bytes after the opcode
  */
-#if defined(NDEBUG)
-getaddr_dir ()  {return mem_getb (reg_postincpc (1));}
-#else
-getaddr_dir ()  {
-  int operand_addr=reg_postincpc(1);
-  int addr=mem_getb (operand_addr);
-  return addr;
+static u_char
+operand_byte ()
+{
+  u_char value = instr_operand >> 8;
+  instr_operand <<= 8;
+  reg_incpc (1);
+  return value;
+}
+
+static u_short
+operand_word ()
+{
+  reg_incpc (2);
+  return instr_operand;
 }
-#endif
-getaddr_ext ()  {return mem_getw (reg_postincpc (2));}
-getaddr_ix  ()  {return (mem_getb (reg_postincpc (1)) + reg_getix()) & 0xffff;}
+
+/*
+ * Functions returning a memory address
+ */
+getaddr_dir ()  {return operand_byte ();}
+getaddr_ext ()  {return operand_word ();}
+getaddr_ix  ()  {return (operand_byte () + reg_getix()) & 0xffff;}
 
 /*
  * Functions returning the value of a memory address
  */
-u_char getbyte_imm () {return mem_getb (reg_postincpc (1));}
+u_char getbyte_imm () {return operand_byte ();}
 u_char getbyte_dir () {return mem_getb (getaddr_dir ());}
 u_char getbyte_ext () {return mem_getb (getaddr_ext ());}
 u_char getbyte_ix  () {return mem_getb (getaddr_ix  ());}
-u_short getword_imm () {return mem_getw (reg_postincpc (2));}
-#if defined(NDEBUG)
+u_short getword_imm () {return operand_word ();}
+#if !HD6301_DEBUG
 u_short getword_dir () {return mem_getw (getaddr_dir ());}
 #else
 u_short getword_dir () {
@@ -82,6 +97,9 @@ branch_expr (expr)
 {
   s_char offs = getbyte_imm ();
   reg_incpc (expr ? offs : 0);
+  /* Short loop back, check if it is waiting for something (idle.c) */
+  if (expr && offs < 0 && offs >= -(IDLE_MAX_BODY + 2))
+    idle_loop (offs);
 }
 
 /*
@@ -135,6 +153,12 @@ tst_addr (addr)   {alu_testbyte (mem_getb (addr));}
 int_addr (addr)
   u_int addr;
 {
+  if (idle_sleeping)
+  {
+    /* Woken from SLP, return to the next instruction */
+    idle_sleeping = 0;
+    reg_incpc (1);
+  }
   pushword (reg_getpc ());
   pushword (reg_getix());
   pushbyte (reg_getacca ());
@@ -416,10 +440,12 @@ tpa_inh ()  {reg_setacca (reg_getccr ());}
  */
 trap ()
 {
+#if HD6301_DEBUG
   u_int  routine = callstack_peek_addr ();
   char  *p       = (char *) sym_find_name (routine);
   warning ("trap: pc:%04x\nSubroutine: %04x %s\n",
      reg_getpc (), routine, p ? p : "");
+#endif
   int_addr (0xffee); /* Trap vector 6301 */
 }
 tst_ext ()  {alu_testbyte (getbyte_ext ());}
@@ -506,21 +532,19 @@ subd_ind_x () {reg_setaccd (alu_subword (reg_getaccd (), getword_ix  (), 0));}
  */
 aim_dir ()
 {
-  u_int immed = mem_getb (reg_getpc());
-  u_int addr  = mem_getb (reg_getpc() + 1);
+  u_int immed = getbyte_imm ();
+  u_int addr  = getaddr_dir ();
 
   mem_putb (addr, alu_andbyte (immed, mem_getb (addr)));
-  reg_incpc (2);
 }
 
 aim_ind_x ()
 {
-  u_int immed = mem_getb (reg_getpc());
-  u_int offs  = mem_getb (reg_getpc() + 1);
+  u_int immed = getbyte_imm ();
+  u_int offs  = getbyte_imm ();
   u_int addr  = reg_getix() + offs;
 
   mem_putb (addr, alu_andbyte (immed, mem_getb (addr)));
-  reg_incpc (2);
 }
 
 
@@ -529,21 +553,19 @@ aim_ind_x ()
  */
 eim_dir ()
 {
-  u_int immed = mem_getb (reg_getpc());
-  u_int addr  = mem_getb (reg_getpc() + 1);
+  u_int immed = getbyte_imm ();
+  u_int addr  = getaddr_dir ();
 
   mem_putb (addr, alu_xorbyte (immed, mem_getb (addr)));
-  reg_incpc (2);
 }
 
 eim_ind_x ()
 {
-  u_int immed = mem_getb (reg_getpc());
-  u_int offs  = mem_getb (reg_getpc() + 1);
+  u_int immed = getbyte_imm ();
+  u_int offs  = getbyte_imm ();
   u_int addr  = reg_getix() + offs;
 
   mem_putb (addr, alu_xorbyte (immed, mem_getb (addr)));
-  reg_incpc (2);
 }
 
 
@@ -552,20 +574,18 @@ eim_ind_x ()
  */
 oim_dir () // 72
 {
-  u_int immed = mem_getb (reg_getpc());
-  u_int addr  = mem_getb (reg_getpc() + 1);
+  u_int immed = getbyte_imm ();
+  u_int addr  = getaddr_dir ();
   mem_putb (addr, alu_orbyte (immed, mem_getb (addr)));
-  reg_incpc (2);
 }
 
 oim_ind_x () 
 {
-  u_int immed = mem_getb (reg_getpc());
-  u_int offs  = mem_getb (reg_getpc() + 1);
+  u_int immed = getbyte_imm ();
+  u_int offs  = getbyte_imm ();
   u_int addr  = reg_getix() + offs;
 
   mem_putb (addr, alu_orbyte (immed, mem_getb (addr)));
-  reg_incpc (2);
 }
 
 
@@ -574,21 +594,19 @@ oim_ind_x ()
  */
 tim_dir () //7B
 {
-  u_int immed = mem_getb (reg_getpc());
-  u_int addr  = mem_getb (reg_getpc() + 1);
+  u_int immed = getbyte_imm ();
+  u_int addr  = getaddr_dir ();
 
   alu_andbyte (immed, mem_getb (addr));
-  reg_incpc (2);
 }
 
 tim_ind_x () //6B
 {
-  u_int immed = mem_getb (reg_getpc());
-  u_int offs  = mem_getb (reg_getpc() + 1);
+  u_int immed = getbyte_imm ();
+  u_int offs  = getbyte_imm ();
   u_int addr  = reg_getix() + offs;
 
   alu_andbyte (immed, mem_getb (addr));
-  reg_incpc (2);
 }
 
 
@@ -601,8 +619,7 @@ xgdx_inh ()
 
 slp_inh ()
 {
-  printf("slp_inh\n");
-  /* cpu.state = sleep; */
+  idle_sleep ();
 }
 
 
@@ -658,6 +675,12 @@ bclr_addr (addr)
 int_6811 (addr)
   u_int addr;
 {
+  if (idle_sleeping)
+  {
+    /* Woken from SLP, return to the next instruction */
+    idle_sleeping = 0;
+    reg_incpc (1);
+  }
   pushword (reg_getpc ());
   pushword (reg_getiy ());
   pushword (reg_getix ());
@@ -862,11 +885,13 @@ swi_6811 () {int_6811 (0xfff6);}
 test_inh () {reg_setpc (reg_getpc () -1);} /* Infinite loop */
 trap_6811 ()
 {
+#if HD6301_DEBUG
   u_int  routine = callstack_peek_addr ();
   char  *p       = (char *) sym_find_name (routine);
 
   warning ("trap: pc:%04x\nSubroutine: %04x %s\n",
      reg_getpc (), routine, p ? p : "");
+#endif
   int_6811 (0xfff8);
 }
 tst_ind_y ()  {alu_testbyte (getbyte_iy ());}
@@ -1161,6 +1186,12 @@ stx_ext_6805 () {mem_putb (getaddr_ext (), alu_bittestbyte (reg_getix ()));}
 int_6805 (addr)
   u_int addr;
 {
+  if (idle_sleeping)
+  {
+    /* Woken from SLP, return to the next instruction */
+    idle_sleeping = 0;
+    reg_incpc (1);
+  }
   pushword (reg_getpc ());
   pushbyte (reg_getix ());
   pushbyte (reg_getacca ());
@@ -0,0 +1,300 @@
+/* <<<                                  */
+/* Copyright (c) 1994-1996 Arne Riiber. */
+/* All rights reserved.                 */
+/* >>>                                  */
+/*
+ * oplist.h - opcode map 6301 cpu core
+ *
+ * Opcode map 1 - the only one for 6301/6303/6803
+ *
+ * Instructions:
+ *  6301 = 6801 + aim/eim/oim/tim/xgdx/slp (ref. Hitatchi).
+ *
+ * Included with OPCODE() defined to build opcodetab[] (optab.c) and the
+ * inlined dispatch engines in instr.c. No include guard on purpose.
+ */
+
+//     opcode, operand bytes, function name, cycles, debug string
+
+  //{0x00, 0, trap,   0,  "---"},
+  OPCODE (0x00, 0, nop_inh, 1, "nop0") // SS
+  OPCODE (0x01, 0, nop_inh, 1, "nop")
+  OPCODE (0x02, 0, trap, 0, "---")
+  OPCODE (0x03, 0, trap, 0, "---")
+  OPCODE (0x04, 0, lsrd_inh, 1, "lsrd")
+  OPCODE (0x05, 0, asld_inh, 1, "asld")
+  OPCODE (0x06, 0, tap_inh, 1, "tap")
+  OPCODE (0x07, 0, tpa_inh, 1, "tpa")
+  OPCODE (0x08, 0, inx_inh, 1, "inx")
+  OPCODE (0x09, 0, dex_inh, 1, "dex")
+  OPCODE (0x0a, 0, clv_inh, 1, "clv")
+  OPCODE (0x0b, 0, sev_inh, 1, "sev")
+  OPCODE (0x0c, 0, clc_inh, 1, "clc")
+  OPCODE (0x0d, 0, sec_inh, 1, "sec")
+  OPCODE (0x0e, 0, cli_inh, 1, "cli")
+  OPCODE (0x0f, 0, sei_inh, 1, "sei")
+
+  OPCODE (0x10, 0, sba_inh, 1, "sba")
+  OPCODE (0x11, 0, cba_inh, 1, "cba")
+  OPCODE (0x12, 0, trap, 0, "---")
+  OPCODE (0x13, 0, trap, 0, "---")
+  OPCODE (0x14, 0, trap, 0, "---")
+  OPCODE (0x15, 0, trap, 0, "---")
+  OPCODE (0x16, 0, tab_inh, 1, "tab")
+  OPCODE (0x17, 0, tba_inh, 1, "tba")
+  OPCODE (0x18, 0, xgdx_inh, 2, "xgdx")
+  OPCODE (0x19, 0, daa_inh, 2, "daa")
+  OPCODE (0x1a, 0, slp_inh, 4, "slp")
+  OPCODE (0x1b, 0, aba_inh, 1, "aba")
+  OPCODE (0x1c, 0, trap, 0, "---")
+  OPCODE (0x1d, 0, trap, 0, "---")
+  OPCODE (0x1e, 0, trap, 0, "---")
+  OPCODE (0x1f, 0, trap, 0, "---")
+
+  OPCODE (0x20, 1, bra_rel, 3, "bra  %02x")
+  OPCODE (0x21, 1, brn_rel, 3, "brn  %02x")
+  OPCODE (0x22, 1, bhi_rel, 3, "bhi  %02x")
+  OPCODE (0x23, 1, bls_rel, 3, "bls  %02x")
+  OPCODE (0x24, 1, bcc_rel, 3, "bcc  %02x")
+  OPCODE (0x25, 1, bcs_rel, 3, "bcs  %02x")
+  OPCODE (0x26, 1, bne_rel, 3, "bne  %02x")
+  OPCODE (0x27, 1, beq_rel, 3, "beq  %02x")
+  OPCODE (0x28, 1, bvc_rel, 3, "bvc  %02x")
+  OPCODE (0x29, 1, bvs_rel, 3, "bvs  %02x")
+  OPCODE (0x2a, 1, bpl_rel, 3, "bpl  %02x")
+  OPCODE (0x2b, 1, bmi_rel, 3, "bmi  %02x")
+  OPCODE (0x2c, 1, bge_rel, 3, "bge  %02x")
+  OPCODE (0x2d, 1, blt_rel, 3, "blt  %02x")
+  OPCODE (0x2e, 1, bgt_rel, 3, "bgt  %02x")
+  OPCODE (0x2f, 1, ble_rel, 3, "ble  %02x")
+
+  OPCODE (0x30, 0, tsx_inh, 1, "tsx")
+  OPCODE (0x31, 0, ins_inh, 1, "ins")
+  OPCODE (0x32, 0, pula_inh, 3, "pula")
+  OPCODE (0x33, 0, pulb_inh, 3, "pulb")
+  OPCODE (0x34, 0, des_inh, 1, "des")
+  OPCODE (0x35, 0, txs_inh, 1, "txs")
+  OPCODE (0x36, 0, psha_inh, 4, "psha")
+  OPCODE (0x37, 0, pshb_inh, 4, "pshb")
+  OPCODE (0x38, 0, pulx_inh, 4, "pulx")
+//  {0x39, 0, rts_inh,  5,  "rts\n"},//ss
+  OPCODE (0x39, 0, rts_inh, 5, "rts")//ss
+  OPCODE (0x3a, 0, abx_inh, 1, "abx")
+  OPCODE (0x3b, 0, rti_inh, 10, "rti") 
+  OPCODE (0x3c, 0, pshx_inh, 5, "pshx")
+  OPCODE (0x3d, 0, mul_inh, 7, "mul")
+  OPCODE (0x3e, 0, wai_inh, 9, "wai")
+  OPCODE (0x3f, 0, swi_inh, 12, "swi")
+
+  OPCODE (0x40, 0, nega_inh, 1, "nega")
+  OPCODE (0x41, 0, trap, 0, "---")
+  OPCODE (0x42, 0, trap, 0, "---")
+  OPCODE (0x43, 0, coma_inh, 1, "coma")
+  OPCODE (0x44, 0, lsra_inh, 1, "lsra")
+  OPCODE (0x45, 0, trap, 0, "---")
+  OPCODE (0x46, 0, rora_inh, 1, "rora")
+  OPCODE (0x47, 0, asra_inh, 1, "asra")
+  OPCODE (0x48, 0, lsla_inh, 1, "lsla")
+  OPCODE (0x49, 0, rola_inh, 1, "rola")
+  OPCODE (0x4a, 0, deca_inh, 1, "deca")
+  OPCODE (0x4b, 0, trap, 0, "---")
+  OPCODE (0x4c, 0, inca_inh, 1, "inca")
+  OPCODE (0x4d, 0, tsta_inh, 1, "tsta")
+  OPCODE (0x4e, 0, trap, 0, "---")
+  OPCODE (0x4f, 0, clra_inh, 1, "clra")
+
+  OPCODE (0x50, 0, negb_inh, 1, "negb")
+  OPCODE (0x51, 0, trap, 0, "---")
+  OPCODE (0x52, 0, trap, 0, "---")
+  OPCODE (0x53, 0, comb_inh, 1, "comb")
+  OPCODE (0x54, 0, lsrb_inh, 1, "lsrb")
+  OPCODE (0x55, 0, trap, 0, "---")
+  OPCODE (0x56, 0, rorb_inh, 1, "rorb")
+  OPCODE (0x57, 0, asrb_inh, 1, "asrb")
+  OPCODE (0x58, 0, lslb_inh, 1, "lslb")
+  OPCODE (0x59, 0, rolb_inh, 1, "rolb")
+  OPCODE (0x5a, 0, decb_inh, 1, "decb")
+  OPCODE (0x5b, 0, trap, 0, "---")
+  OPCODE (0x5c, 0, incb_inh, 1, "incb")
+  OPCODE (0x5d, 0, tstb_inh, 1, "tstb")
+  OPCODE (0x5e, 0, trap, 0, "---")
+  OPCODE (0x5f, 0, clrb_inh, 1, "clrb")
+
+  OPCODE (0x60, 1, neg_ind_x, 6, "neg %02x,x")
+//  {0x61, 1, aim_ind_x,  7,  "aim %02x,x"},  /* 6301 */ //SS
+  OPCODE (0x61, 2, aim_ind_x, 7, "aim (#,addr) %04x,x") /* 6301 */ //SS
+//  {0x62, 1, oim_ind_x,  7,  "oim %02x,x"},  /* 6301 */ //SS
+  OPCODE (0x62, 2, oim_ind_x, 7, "oim %04x,x")  /* 6301 */ //SS
+  OPCODE (0x63, 1, com_ind_x, 6, "com %02x,x")
+  OPCODE (0x64, 1, lsr_ind_x, 6, "lsr %02x,x")
+//  {0x65, 1, eim_ind_x,  7,  "eim %02x,x"},  /* 6301 */ //SS
+  OPCODE (0x65, 2, eim_ind_x, 7, "eim %04x,x")  /* 6301 */ //SS
+  OPCODE (0x66, 1, ror_ind_x, 6, "ror %02x,x")
+  OPCODE (0x67, 1, asr_ind_x, 6, "asr %02x,x")
+  OPCODE (0x68, 1, lsl_ind_x, 6, "lsl %02x,x")
+  OPCODE (0x69, 1, rol_ind_x, 6, "rol %02x,x")
+  OPCODE (0x6a, 1, dec_ind_x, 6, "dec %02x,x")
+//  {0x6b, 1, tim_ind_x,  5,  "tim %02x,x"},  /* 6301 */ //SS
+  OPCODE (0x6b, 2, tim_ind_x, 5, "tim %04x,x")  /* 6301 */ //SS
+  OPCODE (0x6c, 1, inc_ind_x, 6, "inc %02x,x")
+  OPCODE (0x6d, 1, tst_ind_x, 4, "tst %02x,x")
+  OPCODE (0x6e, 1, jmp_ind_x, 3, "jmp %02x,x")
+  OPCODE (0x6f, 1, clr_ind_x, 5, "clr %02x,x")
+
+  OPCODE (0x70, 2, neg_ext, 6, "neg %04x")
+//  {0x71, 0, aim_dir,  6,  "aim %02x"},  /* 6301 */ // SS
+  OPCODE (0x71, 2, aim_dir, 6, "aim %04x")  /* 6301 */ // SS
+//  {0x72, 0, oim_dir,  6,  "oim %02x"},  /* 6301 */ //SS
+  OPCODE (0x72, 2, oim_dir, 6, "oim %02x")  /* 6301 */ //SS
+  OPCODE (0x73, 2, com_ext, 6, "com %04x")
+  OPCODE (0x74, 2, lsr_ext, 6, "lsr %04x")
+//  {0x75, 0, eim_dir,  6,  "eim %02x"},  /* 6301 */ // SS
+  OPCODE (0x75, 2, eim_dir, 6, "eim %04x")  /* 6301 */ // SS
+  OPCODE (0x76, 2, ror_ext, 6, "ror %04x")
+  OPCODE (0x77, 2, asr_ext, 6, "asr %04x")
+  OPCODE (0x78, 2, lsl_ext, 6, "lsl %04x")
+  OPCODE (0x79, 2, rol_ext, 6, "rol %04x")
+  OPCODE (0x7a, 2, dec_ext, 6, "dec %04x")
+//  {0x7b, 0, tim_dir,  4,  "tim %02x"}, //SS
+  OPCODE (0x7b, 2, tim_dir, 4, "tim %04x") //SS
+  OPCODE (0x7c, 2, inc_ext, 6, "inc %04x")
+  OPCODE (0x7d, 2, tst_ext, 6, "tst %04x")
+  OPCODE (0x7e, 2, jmp_ext, 3, "jmp %04x")
+  OPCODE (0x7f, 2, clr_ext, 5, "clr %04x")
+
+  OPCODE (0x80, 1, suba_imm, 2, "suba #%02x")
+  OPCODE (0x81, 1, cmpa_imm, 2, "cmpa #%02x")
+  OPCODE (0x82, 1, sbca_imm, 2, "sbca #%02x")
+  OPCODE (0x83, 2, subd_imm, 3, "subd #%02x")
+  OPCODE (0x84, 1, anda_imm, 2, "anda #%02x")
+  OPCODE (0x85, 1, bita_imm, 2, "bita #%02x")
+  OPCODE (0x86, 1, ldaa_imm, 2, "ldaa #%02x")
+  OPCODE (0x87, 1, trap, 0, "---")
+  OPCODE (0x88, 1, eora_imm, 2, "eora #%02x")
+  OPCODE (0x89, 1, adca_imm, 2, "adca #%02x")
+  OPCODE (0x8a, 1, oraa_imm, 2, "oraa #%02x")
+  OPCODE (0x8b, 1, adda_imm, 2, "adda #%02x")
+  OPCODE (0x8c, 2, cpx_imm, 3, "cpx  #%04x")
+  OPCODE (0x8d, 1, bsr_rel, 5, "bsr  %02x")
+  OPCODE (0x8e, 2, lds_imm, 3, "lds  #%04x")
+  OPCODE (0x8f, 0, trap, 0, "---")
+
+  OPCODE (0x90, 1, suba_dir, 3, "suba %02x")
+  OPCODE (0x91, 1, cmpa_dir, 3, "cmpa %02x")
+  OPCODE (0x92, 1, sbca_dir, 3, "sbca %02x")
+  OPCODE (0x93, 1, subd_dir, 4, "subd %02x")
+  OPCODE (0x94, 1, anda_dir, 3, "anda %02x")
+  OPCODE (0x95, 1, bita_dir, 3, "bita %02x")
+  OPCODE (0x96, 1, ldaa_dir, 3, "ldaa %02x")
+  OPCODE (0x97, 1, staa_dir, 3, "staa %02x")
+  OPCODE (0x98, 1, eora_dir, 3, "eora %02x")
+  OPCODE (0x99, 1, adca_dir, 3, "adca %02x")
+  OPCODE (0x9a, 1, oraa_dir, 3, "oraa %02x")
+  OPCODE (0x9b, 1, adda_dir, 3, "adda %02x")
+  OPCODE (0x9c, 1, cpx_dir, 4, "cpx  %02x")
+//  {0x9d, 1, jsr_dir,  5,  "jsr  %02x\n"},
+  OPCODE (0x9d, 1, jsr_dir, 5, "jsr  %02x") //SS
+  OPCODE (0x9e, 1, lds_dir, 4, "lds  %02x")
+  OPCODE (0x9f, 1, sts_dir, 4, "sts  %02x")
+
+  OPCODE (0xA0, 1, suba_ind_x, 4, "suba %02x,x")
+  OPCODE (0xA1, 1, cmpa_ind_x, 4, "cmpa %02x,x")
+  OPCODE (0xA2, 1, sbca_ind_x, 4, "sbca %02x,x")
+  OPCODE (0xA3, 1, subd_ind_x, 5, "subd %02x,x")
+  OPCODE (0xA4, 1, anda_ind_x, 4, "anda %02x,x")
+  OPCODE (0xA5, 1, bita_ind_x, 4, "bita %02x,x")
+  OPCODE (0xA6, 1, ldaa_ind_x, 4, "ldaa %02x,x")
+  OPCODE (0xA7, 1, staa_ind_x, 4, "staa %02x,x")
+  OPCODE (0xA8, 1, eora_ind_x, 4, "eora %02x,x")
+  OPCODE (0xA9, 1, adca_ind_x, 4, "adca %02x,x")
+  OPCODE (0xAa, 1, oraa_ind_x, 4, "oraa %02x,x")
+  OPCODE (0xAb, 1, adda_ind_x, 4, "adda %02x,x")
+  OPCODE (0xAc, 1, cpx_ind_x, 5, "cpx  %02x,x")
+  OPCODE (0xAd, 1, jsr_ind_x, 5, "jsr  %02x,x")
+  OPCODE (0xAe, 1, lds_ind_x, 5, "lds  %02x,x")
+  OPCODE (0xAf, 1, sts_ind_x, 5, "sts  %02x,x")
+
+  OPCODE (0xB0, 2, suba_ext, 4, "suba %04x")
+  OPCODE (0xB1, 2, cmpa_ext, 4, "cmpa %04x")
+  OPCODE (0xB2, 2, sbca_ext, 4, "sbca %04x")
+  OPCODE (0xB3, 2, subd_ext, 5, "subd %04x")
+  OPCODE (0xB4, 2, anda_ext, 4, "anda %04x")
+  OPCODE (0xB5, 2, bita_ext, 4, "bita %04x")
+  OPCODE (0xB6, 2, ldaa_ext, 4, "ldaa %04x")
+  OPCODE (0xB7, 2, staa_ext, 4, "staa %04x")
+  OPCODE (0xB8, 2, eora_ext, 4, "eora %04x")
+  OPCODE (0xB9, 2, adca_ext, 4, "adca %04x")
+  OPCODE (0xBa, 2, oraa_ext, 4, "oraa %04x")
+  OPCODE (0xBb, 2, adda_ext, 4, "adda %04x")
+  OPCODE (0xBc, 2, cpx_ext, 5, "cpx  %04x")
+  OPCODE (0xBd, 2, jsr_ext, 6, "jsr  %04x")
+  OPCODE (0xBe, 2, lds_ext, 5, "lds  %04x")
+  OPCODE (0xBf, 2, sts_ext, 5, "sts  %04x")
+
+  OPCODE (0xC0, 1, subb_imm, 2, "subb #%02x")
+  OPCODE (0xC1, 1, cmpb_imm, 2, "cmpb #%02x")
+  OPCODE (0xC2, 1, sbcb_imm, 2, "sbcb #%02x")
+  OPCODE (0xC3, 2, addd_imm, 3, "addd #%04x")
+  OPCODE (0xC4, 1, andb_imm, 2, "andb #%02x")
+  OPCODE (0xC5, 1, bitb_imm, 2, "bitb #%02x")
+  OPCODE (0xC6, 1, ldab_imm, 2, "ldab #%02x")
+  OPCODE (0xC7, 0, trap, 0, "---")
+  OPCODE (0xC8, 1, eorb_imm, 2, "eorb #%02x")
+  OPCODE (0xC9, 1, adcb_imm, 2, "adcb #%02x")
+  OPCODE (0xCa, 1, orab_imm, 2, "orab #%02x")
+  OPCODE (0xCb, 1, addb_imm, 2, "addb #%02x")
+  OPCODE (0xCc, 2, ldd_imm, 3, "ldd  #%04x")
+  OPCODE (0xCd, 0, trap, 0, "---")
+  OPCODE (0xCe, 2, ldx_imm, 3, "ldx  #%04x")
+  OPCODE (0xCf, 0, trap, 0, "---")
+
+  OPCODE (0xD0, 1, subb_dir, 3, "subb %02x")
+  OPCODE (0xD1, 1, cmpb_dir, 3, "cmpb %02x")
+  OPCODE (0xD2, 1, sbcb_dir, 3, "sbcb %02x")
+  OPCODE (0xD3, 1, addd_dir, 4, "addd %02x")
+  OPCODE (0xD4, 1, andb_dir, 3, "anda %02x")
+  OPCODE (0xD5, 1, bitb_dir, 3, "bita %02x")
+  OPCODE (0xD6, 1, ldab_dir, 3, "ldab %02x")
+  OPCODE (0xD7, 1, stab_dir, 3, "stab %02x")
+  OPCODE (0xD8, 1, eorb_dir, 3, "eorb %02x")
+  OPCODE (0xD9, 1, adcb_dir, 3, "adcb %02x")
+  OPCODE (0xDa, 1, orab_dir, 3, "orab %02x")
+  OPCODE (0xDb, 1, addb_dir, 3, "addb %02x")
+  OPCODE (0xDc, 1, ldd_dir, 4, "ldd  %02x")
+  OPCODE (0xDd, 1, std_dir, 4, "std  %02x")
+  OPCODE (0xDe, 1, ldx_dir, 4, "ldx  %02x")
+  OPCODE (0xDf, 1, stx_dir, 4, "stx  %02x")
+
+  OPCODE (0xE0, 1, subb_ind_x, 4, "subb %02x,x")
+  OPCODE (0xE1, 1, cmpb_ind_x, 4, "cmpb %02x,x")
+  OPCODE (0xE2, 1, sbcb_ind_x, 4, "sbcb %02x,x")
+  OPCODE (0xE3, 1, addd_ind_x, 5, "addd %02x,x")
+  OPCODE (0xE4, 1, andb_ind_x, 4, "anda %02x,x")
+  OPCODE (0xE5, 1, bitb_ind_x, 4, "bita %02x,x")
+  OPCODE (0xE6, 1, ldab_ind_x, 4, "ldab %02x,x")
+  OPCODE (0xE7, 1, stab_ind_x, 4, "stab %02x,x")
+  OPCODE (0xE8, 1, eorb_ind_x, 4, "eorb %02x,x")
+  OPCODE (0xE9, 1, adcb_ind_x, 4, "adcb %02x,x")
+  OPCODE (0xEa, 1, orab_ind_x, 4, "orab %02x,x")
+  OPCODE (0xEb, 1, addb_ind_x, 4, "addb %02x,x")
+  OPCODE (0xEc, 1, ldd_ind_x, 5, "ldd  %02x,x")
+  OPCODE (0xEd, 1, std_ind_x, 5, "std  %02x,x")
+  OPCODE (0xEe, 1, ldx_ind_x, 5, "ldx  %02x,x")
+  OPCODE (0xEf, 1, stx_ind_x, 5, "stx  %02x,x")
+
+  OPCODE (0xF0, 2, subb_ext, 4, "subb %04x")
+  OPCODE (0xF1, 2, cmpb_ext, 4, "cmpb %04x")
+  OPCODE (0xF2, 2, sbcb_ext, 4, "sbcb %04x")
+  OPCODE (0xF3, 2, addd_ext, 5, "addd %04x")
+  OPCODE (0xF4, 2, andb_ext, 4, "anda %04x")
+  OPCODE (0xF5, 2, bitb_ext, 4, "bita %04x")
+  OPCODE (0xF6, 2, ldab_ext, 4, "ldab %04x")
+  OPCODE (0xF7, 2, stab_ext, 4, "stab %04x")
+  OPCODE (0xF8, 2, eorb_ext, 4, "eorb %04x")
+  OPCODE (0xF9, 2, adcb_ext, 4, "adcb %04x")
+  OPCODE (0xFa, 2, orab_ext, 4, "orab %04x")
+  OPCODE (0xFb, 2, addb_ext, 4, "addb %04x")
+  OPCODE (0xFc, 2, ldd_ext, 5, "ldd  %04x")
+  OPCODE (0xFd, 2, std_ext, 5, "std  %04x")
+  OPCODE (0xFe, 2, ldx_ext, 5, "ldx  %04x")
+  OPCODE (0xFf, 2, stx_ext, 5, "stx  %04x")
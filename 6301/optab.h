@@ -5,14 +5,25 @@
 
 #include "defs.h"
 
+/*
+ * The interpreter only needs the function and the cycle count of an
+ * opcode, they are kept in two arrays of their own so a dispatch touches a
+ * pointer and a byte. The rest, used to print instructions, is in
+ * opcodetab[], which is left out when HD6301_OPINFO is 0.
+ */
+#ifndef HD6301_OPINFO
+# define HD6301_OPINFO 1
+#endif
+
+extern int (*const opfunctab[256]) (); /* Func that "executes" opcode */
+extern const u_char opcyctab[256];      /* No. of clock cycles */
+
 struct opcode {
   u_char    op_value; /* Value of first opcode  */
 #ifdef M6811
   u_char    op_n_opcodes; /* Number of opcode bytes */
 #endif
   u_char    op_n_operands;  /* No. of bytes in operand  */
-  int   (*op_func)(); /* Func that "executes" opcode  */
-  u_char    op_n_cycles;  /* No. of clock cycles    */
   char    *op_mnemonic; /* Printout format string */
 #ifdef M6811
   struct opcode *op_nexttab;  /* Pointer to next opcode table */
@@ -25,11 +36,13 @@ struct opcode {
 # define P_(s) ()
 #endif
 
+#if HD6301_OPINFO
 #ifdef M6811
   extern struct opcode opcodetab[], opcodetab2[], opcodetab3[], opcodetab4[];
 #else
   extern struct opcode opcodetab[]; /* Single page */
 #endif
+#endif
 
 #undef P_
 
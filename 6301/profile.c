@@ -0,0 +1,120 @@
+/*
+ * Atari ST RP2040 IKBD Emulator
+ * Copyright (C) 2021 Roy Hopkins
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#include <stdio.h>
+#include <string.h>
+#include "defs.h"
+#include "cpu.h"
+#include "reg.h"
+#include "symtab.h"
+#include "profile.h"
+
+/*
+Sampling profiler.
+
+instr_run() checks the cycle count against profile_next before each
+instruction, that is the only cost on the hot path. Each sample is weighted
+by the cycles since the one before, so a loop that the idle code fast
+forwards is charged for all the time it stood for. The buckets are written
+by the core running the 6301 and may be read from another core while it
+runs, a sample or two may be torn but that doesn't matter here.
+
+With HD6301_SYMBOLS the dump names the routine each bucket starts in, from
+rom/HD6301V1ST.sym loaded with sym_readfile(). Without it the addresses can
+be looked up in that file by hand.
+*/
+
+COUNTER_VAR profile_next = 0;
+HD6301_STATE unsigned long profile_cycles[PROFILE_BUCKETS];
+static HD6301_STATE COUNTER_VAR profile_last = 0;
+
+void profile_sample (pc)
+  u_int pc;
+{
+  COUNTER_VAR now = cpu_getncycles ();
+  u_int bucket;
+
+  if (pc >= 0xF000)
+    bucket = (pc - 0xF000) >> PROFILE_SHIFT;
+  else
+    bucket = PROFILE_RAM;
+  // The first sample after a clear, or after the counter was reset, has
+  // nothing to charge
+  if (now > profile_last && profile_last)
+    profile_cycles[bucket] += (unsigned long) (now - profile_last);
+  profile_last = now;
+  profile_next = now + PROFILE_PERIOD;
+}
+
+void profile_clear ()
+{
+  memset (profile_cycles, 0, sizeof (profile_cycles));
+  profile_last = 0;
+  profile_next = 0;
+}
+
+/*
+ * profile_dump - print the 'top' buckets with the most cycles
+ */
+void profile_dump (top)
+  int top;
+{
+  static HD6301_STATE u_char done[PROFILE_BUCKETS];
+  unsigned long total = 0;
+  int i, n;
+
+  for (i = 0; i < PROFILE_BUCKETS; i++)
+    total += profile_cycles[i];
+  if (!total)
+    return;
+  memset (done, 0, sizeof (done));
+  for (n = 0; n < top; n++)
+  {
+    int best = -1;
+    u_int addr;
+
+    for (i = 0; i < PROFILE_BUCKETS; i++)
+      if (!done[i] && profile_cycles[i] && (best < 0 || profile_cycles[i] > profile_cycles[best]))
+        best = i;
+    if (best < 0)
+      break;
+    done[best] = 1;
+    if (best == PROFILE_RAM)
+    {
+      printf ("6301 profile: 0080-00ff %6.2f%% internal RAM\n",
+        100.0 * profile_cycles[best] / total);
+      continue;
+    }
+    addr = 0xF000 + (best << PROFILE_SHIFT);
+#if HD6301_SYMBOLS
+    {
+      int base;
+      char *name = sym_find_nearest (addr, &base);
+
+      if (name)
+      {
+        printf ("6301 profile: %04x-%04x %6.2f%% %s+%x\n", addr, addr + PROFILE_BUCKET - 1,
+          100.0 * profile_cycles[best] / total, name, addr - base);
+        continue;
+      }
+    }
+#endif
+    printf ("6301 profile: %04x-%04x %6.2f%%\n", addr, addr + PROFILE_BUCKET - 1,
+      100.0 * profile_cycles[best] / total);
+  }
+}
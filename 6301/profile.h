@@ -0,0 +1,60 @@
+/*
+ * Atari ST RP2040 IKBD Emulator
+ * Copyright (C) 2021 Roy Hopkins
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#ifndef H6301_PROFILE_H
+#define H6301_PROFILE_H
+
+#if defined(__STDC__) || defined(__cplusplus)
+# define P_(s) s
+#else
+# define P_(s) ()
+#endif
+
+/*
+ * Sampling profiler, built with -DHD6301_PROFILE=1. Every PROFILE_PERIOD
+ * cycles the cycles since the last sample are added to the bucket holding
+ * the pc. The ROM is split into PROFILE_BUCKET byte buckets, code running
+ * from internal RAM has one bucket of its own.
+ */
+#ifndef HD6301_PROFILE
+# define HD6301_PROFILE 0
+#endif
+
+#define PROFILE_PERIOD       64
+#define PROFILE_SHIFT        4
+#define PROFILE_BUCKET       (1 << PROFILE_SHIFT)
+#define PROFILE_ROM_BUCKETS  (0x1000 >> PROFILE_SHIFT)
+#define PROFILE_RAM          PROFILE_ROM_BUCKETS  /* Internal RAM bucket */
+#define PROFILE_BUCKETS      (PROFILE_ROM_BUCKETS + 1)
+
+#if HD6301_PROFILE
+extern COUNTER_VAR profile_next;
+extern HD6301_STATE unsigned long profile_cycles[PROFILE_BUCKETS];
+
+extern void profile_sample P_((u_int pc));
+extern void profile_clear P_((void));
+extern void profile_dump P_((int top));
+
+# define PROFILE_SAMPLE() \
+  do { if (cpu_getncycles () >= profile_next) profile_sample (reg_getpc ()); } while (0)
+#else
+# define PROFILE_SAMPLE()
+#endif
+
+#undef P_
+#endif /* H6301_PROFILE_H */
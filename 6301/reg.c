@@ -13,10 +13,52 @@
 #include "callstac.h"
 #endif
 
-struct regs regs;
+HD6301_STATE HD6301_FAST_DATA struct regs regs;
+
+#if HD6301_LAZY_FLAGS
+HD6301_STATE HD6301_FAST_DATA struct lazy_flags lazy_flags;
+
+/*
+ * reg_ccrof - put a CCR together from the other bits and the lazy flags
+ */
+u_int
+reg_ccrof (ccr, f)
+  u_int ccr;
+  const struct lazy_flags *f;
+{
+  return (ccr & ~LAZY_CCR)
+    | ((f->h & 0x10) ? HFLAG : 0)
+    | ((f->n & 0x80) ? NFLAG : 0)
+    | (f->z ? 0 : ZFLAG)
+    | ((f->v & 0x80) ? VFLAG : 0)
+    | (f->c ? CFLAG : 0);
+}
+
+u_int
+reg_ccr ()
+{
+  return reg_ccrof (regs.ccr, &lazy_flags);
+}
+
+/*
+ * reg_putccr - set the whole CCR, e.g. from tap or rti
+ */
+void
+reg_putccr (value)
+  u_int value;
+{
+  regs.ccr = value;
+  reg_sethflag (value & HFLAG);
+  reg_setnflag (value & NFLAG);
+  reg_setzflag (value & ZFLAG);
+  reg_setvflag (value & VFLAG);
+  reg_setcflag (value & CFLAG);
+}
+#endif
 
 reg_setsp (value) u_int value;
 {
+#if HD6301_DEBUG
   if (value > regs.sp)
   {
     /*
@@ -32,6 +74,7 @@ reg_setsp (value) u_int value;
     warning ("sp:%04x, min:%04x\n", regs.sp, cpu_getstackmin());
   else if (value > cpu_getstackmax())
     warning ("sp:%04x, max:%04x\n", regs.sp, cpu_getstackmax());
+#endif
   return regs.sp = value;
 }
 
@@ -33,26 +33,63 @@ enum ccr_flags {
   SFLAG = 0x80
 };
 
+/*
+ * Whole bytes and halfwords rather than bit-fields so each register is a
+ * single load or store, the types still wrap at the register width
+ */
 struct regs {
   struct {
-    unsigned a:8;
-    unsigned b:8; /* Not present in 6805 */
+    u_char a;
+    u_char b;     /* Not present in 6805 */
   } accd;
 
 #ifdef M6805
-  unsigned ix:8;
-  unsigned sp:8;    /* C8: 0xC0-0xFF */
-  unsigned pc:16;   /* C8: 0x0000-0x1FFF */
+  u_char ix;
+  u_char sp;      /* C8: 0xC0-0xFF */
+  u_short pc;     /* C8: 0x0000-0x1FFF */
 #else
-  unsigned ix:16;
-  unsigned sp:16;
-  unsigned pc:16;
+  u_short ix;
+  u_short sp;
+  u_short pc;
 #endif
-  unsigned iy:16;   /* 6811 only */
-  unsigned ccr:8;
+  u_short iy;     /* 6811 only */
+  u_char ccr;
 };
 
-extern struct regs regs;
+extern HD6301_STATE struct regs regs;
+
+/*
+ * Lazy condition codes
+ *
+ * Most flags set by an instruction are overwritten by the next one before
+ * anything looks at them, so the ALU doesn't work out each bit and merge it
+ * into regs.ccr. It stores a value per flag that the bit is read from when
+ * it is needed: Z is set if z is zero, C if c is non-zero and N, V and H are
+ * bits 7, 7 and 4 of n, v and h. Word operations store the high byte in n
+ * and v. regs.ccr only holds the other bits and reg_getccr() puts the CCR
+ * together.
+ */
+#ifndef HD6301_LAZY_FLAGS
+#define HD6301_LAZY_FLAGS 1
+#endif
+
+struct lazy_flags {
+  u_short z;
+  u_char n;
+  u_char v;
+  u_char c;
+  u_char h;
+  u_short spare;  /* A whole number of words to copy */
+};
+
+#define LAZY_CCR (HFLAG | NFLAG | ZFLAG | VFLAG | CFLAG)
+
+#if HD6301_LAZY_FLAGS
+extern HD6301_STATE struct lazy_flags lazy_flags;
+extern u_int reg_ccrof ();
+extern u_int reg_ccr ();
+extern void reg_putccr ();
+#endif
 
 /*
  * The get/setccr() are normally mostly used when interrupt occurs
@@ -65,21 +102,33 @@ extern struct regs regs;
 #define reg_getsp() regs.sp
 #define reg_getpc() regs.pc
 
+#if !HD6301_LAZY_FLAGS
+#  define reg_ccr()     regs.ccr
+#endif
+
 #ifdef M6811
-#  define reg_getccr()  regs.ccr
+#  define reg_getccr()  reg_ccr()
 #else
-#  define reg_getccr()  (regs.ccr | 0xc0) /* High bits always read as logic one */
+#  define reg_getccr()  (reg_ccr() | 0xc0) /* High bits always read as logic one */
 #endif
 
 /*
  * get flag - get flag as 0 or 1
  */
+#if HD6301_LAZY_FLAGS
+#define reg_getcflag()  (lazy_flags.c != 0)
+#define reg_getvflag()  ((lazy_flags.v & 0x80) != 0)
+#define reg_getzflag()  (lazy_flags.z == 0)
+#define reg_getnflag()  ((lazy_flags.n & 0x80) != 0)
+#define reg_gethflag()  ((lazy_flags.h & 0x10) != 0)
+#else
 #define reg_getcflag()  ((regs.ccr & CFLAG) != 0)
 #define reg_getvflag()  ((regs.ccr & VFLAG) != 0)
 #define reg_getzflag()  ((regs.ccr & ZFLAG) != 0)
 #define reg_getnflag()  ((regs.ccr & NFLAG) != 0)
-#define reg_getiflag()  ((regs.ccr & IFLAG) != 0)
 #define reg_gethflag()  ((regs.ccr & HFLAG) != 0)
+#endif
+#define reg_getiflag()  ((regs.ccr & IFLAG) != 0)
 #define reg_getxflag()  ((regs.ccr & XFLAG) != 0)
 #define reg_getsflag()  ((regs.ccr & SFLAG) != 0)
 
@@ -90,11 +139,21 @@ extern struct regs regs;
 #define reg_setix(value)  {regs.ix = value;}
 #define reg_setiy(value)  {regs.iy = value;}
 #define reg_setpc(value)  {regs.pc = value;}
-#define reg_setccr(value) {regs.ccr = value;}
 
 /*
  * set flag - set flag on expression (zero or non-zero)
  */
+#if HD6301_LAZY_FLAGS
+#define reg_setccr(value) {reg_putccr (value);}
+
+#define reg_setcflag(expr)  {lazy_flags.c = (expr) != 0;}
+#define reg_setvflag(expr)  {lazy_flags.v = (expr) ? 0x80 : 0;}
+#define reg_setzflag(expr)  {lazy_flags.z = !(expr);}
+#define reg_setnflag(expr)  {lazy_flags.n = (expr) ? 0x80 : 0;}
+#define reg_sethflag(expr)  {lazy_flags.h = (expr) ? 0x10 : 0;}
+#else
+#define reg_setccr(value) {regs.ccr = value;}
+
 #define reg_setcflag(expr)\
   {if (expr) regs.ccr |= CFLAG; else regs.ccr &= ~CFLAG;}
 
@@ -107,11 +166,12 @@ extern struct regs regs;
 #define reg_setnflag(expr)\
   {if (expr) regs.ccr |= NFLAG; else regs.ccr &= ~NFLAG;}
 
-#define reg_setiflag(expr)\
-  {if (expr) regs.ccr |= IFLAG; else regs.ccr &= ~IFLAG;}
-
 #define reg_sethflag(expr)\
   {if (expr) regs.ccr |= HFLAG; else regs.ccr &= ~HFLAG;}
+#endif
+
+#define reg_setiflag(expr)\
+  {if (expr) regs.ccr |= IFLAG; else regs.ccr &= ~IFLAG;}
 
 #define reg_setxflag(expr)\
   {if (expr) regs.ccr |= XFLAG; else regs.ccr &= ~XFLAG;}
@@ -120,6 +180,8 @@ extern struct regs regs;
   {if (expr) regs.ccr |= SFLAG; else regs.ccr &= ~SFLAG;}
 
 
+extern int reg_setsp ();
+
 /*
  * Pre- and post-increment
  */
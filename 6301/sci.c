@@ -7,8 +7,11 @@
 #include "defs.h"
 #include "chip.h"
 #include "cpu.h"
+#include "instr.h"
 #include "ireg.h"
 #include "sci.h"
+#include "timer.h"
+#include "session.h"
 #include <SerialPort.h>
 
 /*
@@ -26,6 +29,57 @@ $0013    | B | TDR   | Transmit Data Register                         | W0
 ------------------------------------------------------------------------------
 */
 
+/*
+Transmit timing.
+
+TDR is double buffered: a byte written to TDR moves to the shift register
+on the next bit clock if the shift register is idle, otherwise once the
+byte in it has been shifted out. TDRE is set again when that happens, so
+at 7812 baud a byte can be written every 1280 cycles. The cycle at which
+TDRE is next due is scheduled next to the timer events (timer_schedule())
+so the TX interrupt is requested on time. The host side can hold TDRE
+off with hd6301_tx_empty(0) if it can't take any more bytes.
+*/
+HD6301_STATE COUNTER_VAR sci_tdre_at = SCI_NEVER;     /* Cycle at which TDRE is set */
+HD6301_STATE int sci_tx_hold = 0;                     /* Host can't take another byte */
+static HD6301_STATE COUNTER_VAR sci_shift_end = 0;    /* Shift register idle from here */
+HD6301_STATE unsigned long sci_rx_count = 0;          /* Bytes received since boot */
+HD6301_STATE unsigned long sci_tx_count = 0;          /* Bytes written to TDR since boot */
+HD6301_STATE unsigned long sci_overrun_count = 0;     /* Bytes lost to ORFE since boot */
+
+/*
+ * sci_reset - TDR and the shift register are empty
+ */
+sci_reset ()
+{
+  sci_tdre_at = SCI_NEVER;
+  sci_shift_end = 0;
+}
+
+/*
+ * sci_sync - set TDRE if it has become due, called from timer_sync()
+ */
+sci_sync ()
+{
+  if (!sci_tx_hold && cpu_getncycles () >= sci_tdre_at)
+  {
+    iram[TRCSR] |= TDRE;
+    sci_tdre_at = SCI_NEVER;
+    int_update ();
+  }
+}
+
+/*
+ * sci_tx_ready - host side can (or can't) take another byte
+ */
+sci_tx_ready (ready)
+  int ready;
+{
+  sci_tx_hold = !ready;
+  if (!sci_tx_hold && sci_tdre_at < timer_next)
+    timer_next = sci_tdre_at;
+}
+
 /*
  * Pseudo-received data buffer used by rdr_getb() routines
  */
@@ -44,6 +98,7 @@ int nbytes;
   {
     TRACE("6301 OVR SR %X->%X\n", iram[TRCSR], iram[TRCSR] | ORFE);
     iram[TRCSR] |= ORFE; // hardware sets overrun bit
+    ++sci_overrun_count;
   }
   else
   {
@@ -51,6 +106,9 @@ int nbytes;
     TRACE("6301 RDR %X\n", *s);
   }
   iram[TRCSR] |= RDRF; // set RDRF
+  ++sci_rx_count;
+  SESSION_EVENT(SESSION_RX, *s);
+  int_update();
 
 }
 
@@ -112,6 +170,7 @@ u_char value;
   value &= 0x1F;
   value |= (iram[0x11] & 0xE0); // add RO bits 5-7
   ireg_putb(TRCSR, value);
+  int_update();
 }
 
 /*
@@ -141,6 +200,7 @@ u_char rdr_getb(offs)
       TRACE("6301 clear OVR\n");
       iram[TRCSR] &= ~ORFE; // clear overrun bit - we don't check if read TRCSR first
     }
+    int_update();
 
   }
   return ireg_getb(RDR);
@@ -157,24 +217,27 @@ tdr_putb(offs, value)
     u_int offs;
 u_char value;
 {
-  u_char trcsr;
+  COUNTER_VAR start;
 
   ireg_putb(TDR, value);
-  /*
-   * trcsr & TDRE is always non-zero, thus we can
-   * start generating tx int. request immediately
-   */
-
-  trcsr = trcsr_getb(TRCSR);
 
   /*  Double buffer allows 1 byte waiting in TDR while another is being
     shifted, but not more. 
     TDRE = 0 while a byte is waiting in TDR.
 */
   TRACE("6301 TDR %X\n", value);
+  SESSION_EVENT(SESSION_TX, value);
   serial_send(value);
+  ++sci_tx_count;
 
-  // Flag a byte as waiting
+  // Flag a byte as waiting until it moves to the shift register
   iram[TRCSR] &= ~TDRE;
+  start = cpu_getncycles () + SCI_BIT_CYCLES;
+  if (start < sci_shift_end)
+    start = sci_shift_end;
+  sci_tdre_at = start;
+  sci_shift_end = start + SCI_BYTE_CYCLES;
+  sci_tx_ready (!sci_tx_hold);
+  int_update();
 
 }
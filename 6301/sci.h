@@ -18,6 +18,22 @@
 #define serial_int()\
   (((ireg_getb (TRCSR) & RDRF) && (ireg_getb (TRCSR) & RIE))\
    || ((ireg_getb (TRCSR) & TDRE) && (ireg_getb (TRCSR) & TIE)))
+/*
+ * SCI transmit timing, 7812 baud from the 1MHz E clock
+ */
+#define SCI_BIT_CYCLES  128
+#define SCI_BYTE_CYCLES (10 * SCI_BIT_CYCLES)  /* start + 8 data + stop */
+#define SCI_NEVER       ((COUNTER_VAR) 1 << 62)
+
+extern HD6301_STATE COUNTER_VAR sci_tdre_at;
+extern HD6301_STATE int sci_tx_hold;
+extern HD6301_STATE unsigned long sci_rx_count;
+extern HD6301_STATE unsigned long sci_tx_count;
+extern HD6301_STATE unsigned long sci_overrun_count;
+
+extern int sci_reset P_((void));
+extern int sci_sync P_((void));
+extern int sci_tx_ready P_((int ready));
 extern int sci_in P_((u_char *s, int nbytes));
 extern int sci_print P_((void));
 extern u_char trcsr_getb P_((u_int offs));
@@ -0,0 +1,215 @@
+/*
+ * Atari ST RP2040 IKBD Emulator
+ * Copyright (C) 2021 Roy Hopkins
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#include <stdio.h>
+#include <string.h>
+#include "defs.h"
+#include "cpu.h"
+#include "sci.h"
+#include "snapshot.h"
+#include "session.h"
+
+/*
+Session recording.
+
+The hooks are in the places the core meets the outside world: sci_in() and
+tdr_putb() for the serial line, hd6301_set_key() and hd6301_tx_empty()
+for what the host pushes in, the port reads in ireg.c for what the ROM
+pulls from the host, and hd6301_run_clocks() for the wake-up bit, which is
+cleared on slice boundaries. Values pulled by the ROM are only logged when
+they change, the ROM reads the mouse lines thousands of times a second.
+Time is always the cycle count, so the log only depends on what the 6301
+saw and not on when the host got round to it.
+
+This is C and is included by 6301.c after ireg.c, sci.c and snapshot.c so
+the key matrix and TDRE hold can be read.
+*/
+
+HD6301_STATE int session_on = 0;
+
+/* Aligned for the header and snapshot at the start of each half */
+static HD6301_STATE u_char session_ring[2][SESSION_HALF] __attribute__ ((aligned (8)));
+static HD6301_STATE int session_half = 0;      /* Half being written */
+static HD6301_STATE int session_active = 0;    /* A segment has been started */
+static HD6301_STATE int session_new = 0;       /* Start a segment at the next slice */
+static HD6301_STATE u_int session_seq = 0;
+static HD6301_STATE COUNTER_VAR session_last = 0; /* Cycle of the last event */
+static HD6301_STATE int session_value[SESSION_TYPES]; /* Last value of the pulled inputs */
+
+static struct session_header *session_segment (half)
+  int half;
+{
+  return (struct session_header *) session_ring[half];
+}
+
+/*
+ * session_start - clear the log and start recording from the next slice
+ */
+void session_start ()
+{
+  session_segment (0)->magic = 0;
+  session_segment (1)->magic = 0;
+  session_active = 0;
+  session_seq = 0;
+  session_new = 1;
+  session_on = 1;
+}
+
+void session_stop ()
+{
+  session_on = 0;
+}
+
+/*
+ * session_restart - the 6301 has been reset or restored, the current
+ * segment can't be played on from here
+ */
+void session_restart ()
+{
+  session_new = 1;
+}
+
+static void session_begin ()
+{
+  struct session_header *h;
+  int dr1bit, column;
+
+  if (session_active)
+    session_half ^= 1;
+  h = session_segment (session_half);
+  memset (h, 0, sizeof (*h));
+  for (dr1bit = 0; dr1bit < 8; dr1bit++)
+    for (column = 0; column < 15; column++)
+      if (kbd_matrix[dr1bit] & (1 << column))
+      {
+        u_char code = kbd_code[dr1bit][column];
+        h->keys[code >> 3] |= 1 << (code & 7);
+      }
+  h->tx_hold = sci_tx_hold;
+  h->start = cpu_getncycles ();
+  h->seq = session_seq++;
+  h->snap_size = sizeof (struct snapshot);
+  h->length = sizeof (*h) + sizeof (struct snapshot);
+  snapshot_save ((struct snapshot *) (h + 1));
+  h->magic = SESSION_MAGIC;
+
+  session_last = h->start;
+  memset (session_value, 0xff, sizeof (session_value));
+  session_active = 1;
+  session_new = 0;
+}
+
+/*
+ * session_slice - start of a slice, move to the other half if needed
+ */
+void session_slice ()
+{
+  if (session_new ||
+      session_segment (session_half)->length > SESSION_HALF - SESSION_SLACK)
+    session_begin ();
+}
+
+void session_event (type, value)
+  int type;
+  int value;
+{
+  struct session_header *h;
+  COUNTER_VAR delta;
+  u_char *p;
+
+  if (!session_active)
+    return;                     /* The first snapshot will hold it */
+  h = session_segment (session_half);
+  // A type byte, up to 10 bytes of cycles and the value
+  if (h->length + 12 > SESSION_HALF)
+  {
+    h->truncated = 1;
+    return;
+  }
+  p = session_ring[session_half] + h->length;
+  delta = cpu_getncycles () - session_last;
+  session_last = cpu_getncycles ();
+  if (delta < 15)
+    *p++ = type | (delta << 4);
+  else
+  {
+    *p++ = type | 0xf0;
+    delta -= 15;
+    while (delta >= 0x80)
+    {
+      *p++ = (delta & 0x7f) | 0x80;
+      delta >>= 7;
+    }
+    *p++ = delta;
+  }
+  *p++ = value;
+  h->length = p - session_ring[session_half];
+}
+
+/*
+ * session_change - log an input read by the ROM if it isn't what it was
+ * last time, returns it
+ */
+int session_change (type, value)
+  int type;
+  int value;
+{
+  if (session_value[type] != value)
+  {
+    session_value[type] = value;
+    session_event (type, value);
+  }
+  return value;
+}
+
+static void session_dump_segment (f, h)
+  FILE *f;
+  const struct session_header *h;
+{
+  const u_char *p = (const u_char *) h;
+  u_int i;
+
+  fprintf (f, "session: segment %u of %u bytes%s\n", h->seq, h->length,
+    h->truncated ? ", truncated" : "");
+  for (i = 0; i < h->length; i++)
+  {
+    if ((i & 31) == 0)
+      fputc ('>', f);
+    fprintf (f, "%02x", p[i]);
+    if ((i & 31) == 31 || i == h->length - 1)
+      fputc ('\n', f);
+  }
+}
+
+/*
+ * session_dump - write the segments, oldest first, as text that can be
+ * picked out of a console log
+ */
+void session_dump (f)
+  FILE *f;
+{
+  const struct session_header *a = session_segment (session_half ^ 1);
+  const struct session_header *b = session_segment (session_half);
+
+  fprintf (f, "session: begin\n");
+  if (a->magic == SESSION_MAGIC)
+    session_dump_segment (f, a);
+  if (b->magic == SESSION_MAGIC)
+    session_dump_segment (f, b);
+  fprintf (f, "session: end\n");
+}
@@ -0,0 +1,115 @@
+/*
+ * Atari ST RP2040 IKBD Emulator
+ * Copyright (C) 2021 Roy Hopkins
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#ifndef H6301_SESSION_H
+#define H6301_SESSION_H
+
+#include "6301.h"
+
+#if defined(__STDC__) || defined(__cplusplus)
+# define P_(s) s
+#else
+# define P_(s) ()
+#endif
+
+/*
+ * Session recorder, built with -DHD6301_SESSION=1. Everything that reaches
+ * the 6301 from outside is logged with the cycle it happened on, along with
+ * the bytes it sent, so a session can be played back on the host exactly as
+ * it ran (host/replay.cpp).
+ *
+ * The log is kept in two halves. Each half starts with a segment header
+ * holding a snapshot and the state of the inputs, and the recorder moves to
+ * the other half at the start of a slice when the one in use is nearly full
+ * or the 6301 has been reset or restored. The older half is overwritten, so
+ * the last 1-2 halves of the session can always be played back.
+ */
+#ifndef HD6301_SESSION
+# define HD6301_SESSION 0
+#endif
+
+#ifndef SESSION_SIZE
+# define SESSION_SIZE 16384     /* Bytes, both halves */
+#endif
+#define SESSION_HALF  (SESSION_SIZE / 2)
+#define SESSION_SLACK 256       /* Room left for the rest of a slice */
+
+#define SESSION_MAGIC 0x31534553  /* "SES1", bump when the format changes */
+
+/*
+ * Event types. The ones marked pushed happen between slices and the
+ * playback has to split its slices there, the others are read by the ROM
+ * in the middle of an instruction and are handed back through the
+ * callbacks.
+ */
+#define SESSION_RX        1     /* Byte from the ST, pushed */
+#define SESSION_TX        2     /* Byte written to TDR */
+#define SESSION_KEY       3     /* Scancode, bit 7 set if down, pushed */
+#define SESSION_BUTTONS   4     /* st_mouse_buttons() */
+#define SESSION_JOYSTICK  5     /* st_joystick() */
+#define SESSION_MOUSE_EN  6     /* st_mouse_enabled() */
+#define SESSION_MOUSE     7     /* Mouse counters after mouse_tick(), x in bits 0-3, y in 4-7 */
+#define SESSION_TX_READY  8     /* hd6301_tx_empty() argument, pushed */
+#define SESSION_WAKE      9     /* Wake-up bit cleared at the start of a slice, pushed */
+#define SESSION_TYPES     10
+
+/*
+ * Start of each half, followed by snap_size bytes of snapshot (stored the
+ * way the core lays it out, which is the same on the RP2040 and on little
+ * endian 64 bit hosts) and then the events.
+ *
+ * Each event is a byte holding the type in bits 0-3 and the
+ * cycles since the previous event (or the start) in bits 4-7. 15 means
+ * the cycles less 15 follow, 7 bits per byte with bit 7 set on all but the
+ * last. Then comes one byte of data.
+ */
+struct session_header {
+  u_int magic;
+  u_int seq;                    /* Segments started since session_start() */
+  u_int length;                 /* Bytes used including this header and the snapshot */
+  u_char keys[16];              /* Scancodes down, bit (code & 7) of keys[code >> 3] */
+  u_char tx_hold;               /* TDRE held off by the host */
+  u_char truncated;             /* Events were lost when the half filled up */
+  u_char pad[2];
+  COUNTER_VAR start;            /* Cycle the snapshot was taken on */
+  u_int snap_size;
+  u_int pad2;
+};
+
+#if HD6301_SESSION
+extern HD6301_STATE int session_on;
+
+extern void session_start P_((void));
+extern void session_stop P_((void));
+extern void session_restart P_((void));
+extern void session_slice P_((void));
+extern void session_event P_((int type, int value));
+extern int session_change P_((int type, int value));
+extern void session_dump P_((FILE *f));
+
+# define SESSION_EVENT(type, value) \
+  do { if (session_on) session_event ((type), (value)); } while (0)
+# define SESSION_CHANGE(type, value) \
+  (session_on ? session_change ((type), (value)) : (value))
+#else
+# define SESSION_EVENT(type, value)
+# define SESSION_CHANGE(type, value) (value)
+#endif
+
+#undef P_
+#endif /* H6301_SESSION_H */
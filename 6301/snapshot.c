@@ -0,0 +1,115 @@
+/*
+ * Atari ST RP2040 IKBD Emulator
+ * Copyright (C) 2021 Roy Hopkins
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#include <string.h>
+#include "defs.h"
+#include "chip.h"
+#include "cpu.h"
+#include "instr.h"
+#include "ireg.h"
+#include "memory.h"
+#include "reg.h"
+#include "sci.h"
+#include "timer.h"
+#include "idle.h"
+#include "snapshot.h"
+
+/*
+Snapshots of the emulated machine.
+
+A snapshot taken at the end of a slice can be restored at the end of any
+later slice and the 6301 carries on as it would have done from the saved
+point. The cycle counter is not wound back: everything counted in cycles
+is moved by the time between the two so the free running counter, the
+pending timer events and the SCI byte timing keep their distance from
+"now", and the host side never sees time go backwards. What the host
+feeds in (keys, whether TDRE is held off) is kept as it is now.
+
+This is C and lives next to the timer and SCI code so their static state
+can be reached.
+*/
+
+static u_int snapshot_rom_check ()
+{
+  u_int check = 0x811c9dc5;
+  u_int i;
+
+  for (i = 0; i < 0x1000; i++)
+    check = (check ^ ram[256 + i]) * 0x01000193;
+  return check;
+}
+
+void snapshot_save (s)
+  struct snapshot *s;
+{
+  s->magic = SNAPSHOT_MAGIC;
+  s->rom_check = snapshot_rom_check ();
+  s->regs = regs;
+  s->regs.ccr = reg_ccr ();
+  s->cpu = cpu;
+  memcpy (s->iram, iram, NIREGS);
+  memcpy (s->ram, ram, sizeof (s->ram));
+  s->timer_origin = timer_origin;
+  s->timer_ocf = timer_ocf;
+  s->timer_tof = timer_tof;
+  s->timer_next = timer_next;
+  s->tcsr_is_read = tcsr_is_read;
+  s->sci_tdre_at = sci_tdre_at;
+  s->sci_shift_end = sci_shift_end;
+  s->idle_sleeping = idle_sleeping;
+  s->mouse_x_counter = mouse_x_counter;
+  s->mouse_y_counter = mouse_y_counter;
+}
+
+/*
+ * snapshot_restore - returns 0 if the snapshot was not taken with this
+ * layout and ROM
+ */
+int snapshot_restore (s)
+  const struct snapshot *s;
+{
+  COUNTER_VAR now = cpu_getncycles ();
+  COUNTER_VAR delta = now - s->cpu.ncycles;
+
+  if (s->magic != SNAPSHOT_MAGIC || s->rom_check != snapshot_rom_check ())
+    return 0;
+  regs = s->regs;
+  reg_setccr (s->regs.ccr); /* Sets the lazy flags too */
+  cpu = s->cpu;
+  cpu_setncycles (now);
+  memcpy (iram, s->iram, NIREGS);
+  memcpy (ram, s->ram, sizeof (s->ram));
+  timer_origin = s->timer_origin + delta;
+  timer_ocf = s->timer_ocf + delta;
+  timer_tof = s->timer_tof + delta;
+  timer_next = s->timer_next + delta;
+  tcsr_is_read = s->tcsr_is_read;
+  sci_tdre_at = (s->sci_tdre_at == SCI_NEVER) ? SCI_NEVER : s->sci_tdre_at + delta;
+  sci_shift_end = s->sci_shift_end + delta;
+  idle_sleeping = s->idle_sleeping;
+  mouse_x_counter = s->mouse_x_counter;
+  mouse_y_counter = s->mouse_y_counter;
+  crashed = 0;
+
+  // The key matrix follows the keys held now, not when the snapshot was
+  // taken
+  kbd_init ();
+  sci_tx_ready (!sci_tx_hold);
+  int_update ();
+  return 1;
+}
@@ -0,0 +1,59 @@
+/*
+ * Atari ST RP2040 IKBD Emulator
+ * Copyright (C) 2021 Roy Hopkins
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#ifndef H6301_SNAPSHOT_H
+#define H6301_SNAPSHOT_H
+
+#if defined(__STDC__) || defined(__cplusplus)
+# define P_(s) s
+#else
+# define P_(s) ()
+#endif
+
+#define SNAPSHOT_MAGIC 0x36333032  /* "6302", bump when the layout changes */
+
+/*
+ * Everything that has to be put back to carry on from a saved point. The
+ * ROM, the decode table and the page tables are not included, they do not
+ * change once the ROM has been loaded. Cycle counts are saved as they were
+ * and moved to the current cycle count by snapshot_restore().
+ */
+struct snapshot {
+  u_int magic;
+  u_int rom_check;              /* ROM the state belongs to */
+  struct regs regs;
+  struct cpu cpu;
+  u_char iram[NIREGS];
+  u_char ram[256];              /* Direct page, internal RAM at 0x80-0xFF */
+  COUNTER_VAR timer_origin;
+  COUNTER_VAR timer_ocf;
+  COUNTER_VAR timer_tof;
+  COUNTER_VAR timer_next;
+  int tcsr_is_read;
+  COUNTER_VAR sci_tdre_at;
+  COUNTER_VAR sci_shift_end;
+  int idle_sleeping;
+  unsigned int mouse_x_counter;
+  unsigned int mouse_y_counter;
+};
+
+extern void snapshot_save P_((struct snapshot *s));
+extern int snapshot_restore P_((const struct snapshot *s));
+
+#undef P_
+#endif /* H6301_SNAPSHOT_H */
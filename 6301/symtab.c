@@ -28,7 +28,7 @@ struct sym {
   char name[MAXSYMSIZE];
 };
 
-static struct {
+static HD6301_STATE struct {
   int nsymbols;
   struct sym syms[MAXSYMS];
 } symtab;
@@ -49,6 +49,27 @@ char* sym_find_name (value)
 }
 
 
+/*
+ * sym_find_nearest - find the symbol at or closest below value, return
+ * pointer to name and its value in base, or 0
+ */
+char* sym_find_nearest (value, base)
+  int value;
+  int *base;
+{
+  int i, best = -1;
+
+  for (i = 0; i < symtab.nsymbols; i++)
+    if (symtab.syms[i].value <= value &&
+        (best < 0 || symtab.syms[i].value > symtab.syms[best].value))
+      best = i;
+  if (best < 0)
+    return 0;
+  *base = symtab.syms[best].value;
+  return symtab.syms[best].name;
+}
+
+
 sym_find_value (name, value)
   char *name;
   int  *value;
@@ -88,7 +109,7 @@ sym_add (value, name)
   }
 }
 
-#if 0
+#if HD6301_SYMBOLS
 static
 read_aslink_file (ifp)
   FILE *ifp;
@@ -161,8 +182,16 @@ sym_readfile (loadfile, symfile)
   int      len;
 
   if (symfile)
-    /* Use specified symbol file */
+  {
+    /* Use specified symbol file, read as the type its extension says */
+    char *p = strrchr (symfile, '.');
+
+    for (ass = file_ass; ass->ext && !(p && strcmp (p, ass->ext) == 0); ass++)
+      ;
+    if (!ass->ext)
+      ass = &file_ass[1];
     ifp = fopen (symfile, "rt");
+  }
   else
   {
     char *p;
@@ -192,7 +221,7 @@ sym_readfile (loadfile, symfile)
   fclose (ifp);
   return 0;
 }
-#endif//0
+#endif /* HD6301_SYMBOLS */
 
 #ifdef MAIN
 main (argc, argv)
@@ -8,7 +8,16 @@
 # define P_(s) ()
 #endif
 
+/*
+ * Symbol files can be read with -DHD6301_SYMBOLS=1 (host builds), eg to
+ * name the routines in a profile
+ */
+#ifndef HD6301_SYMBOLS
+# define HD6301_SYMBOLS 0
+#endif
+
 extern char *sym_find_name P_((int value));
+extern char *sym_find_nearest P_((int value, int *base));
 extern int sym_find_value P_((char *name, int *value));
 extern int sym_add P_((int value, char *name));
 extern int sym_readfile P_((char *loadfile, char *symfile));
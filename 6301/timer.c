@@ -7,23 +7,123 @@
  */
 #include "defs.h"
 #include "chip.h"           /* chip address definitions */
+#include "cpu.h"
 #include "ireg.h"
 
 #ifdef USE_PROTOTYPES
+#include "instr.h"
 #include "memory.h"
 #include "timer.h"
+#include "sci.h"
 #endif
 
  
-static int tcsr_is_read = 0;
+static HD6301_STATE int tcsr_is_read = 0;
 
 //TODO? it's possible to write on FRC, see Hitachi doc
 
+/*
+ * The free running counter is not stored in iram: it is derived from
+ * cpu.ncycles relative to the cycle at which it was zero. The cycles at
+ * which FRC next matches OCR and next overflows are worked out in advance
+ * and instr_exec() only has to compare cpu.ncycles against timer_next.
+ * timer_sync() raises the flags that are due and schedules the next event.
+ * The SCI transmitter's TDRE event (sci.c) shares timer_next.
+ *
+ * 6801 has prescaler of 1
+ */
+HD6301_STATE COUNTER_VAR timer_next = 0;         /* Cycle of the next OCF/TOF/TDRE event */
+static HD6301_STATE COUNTER_VAR timer_origin = 0;  /* Cycle at which FRC was 0 */
+static HD6301_STATE COUNTER_VAR timer_ocf = 0;     /* Cycle at which FRC reaches OCR */
+static HD6301_STATE COUNTER_VAR timer_tof = 0;     /* Cycle at which FRC overflows */
+
+/*
+ * timer_getfrc - current value of the free running counter
+ */
+u_short timer_getfrc ()
+{
+  return (u_short) (cpu_getncycles () - timer_origin);
+}
+
+/*
+ * timer_schedule - work out when the next compare and overflow happen
+ */
+static void timer_schedule ()
+{
+  u_int frc = timer_getfrc ();
+
+  timer_ocf = cpu_getncycles () + (((ireg_getw (OCR) - frc - 1) & 0xFFFF) + 1);
+  timer_tof = cpu_getncycles () + (0x10000 - frc);
+  timer_next = (timer_ocf < timer_tof) ? timer_ocf : timer_tof;
+  if (!sci_tx_hold && sci_tdre_at < timer_next)
+    timer_next = sci_tdre_at;
+}
+
+/*
+ * timer_sync - raise any timer flags that have become due
+ */
+timer_sync ()
+{
+  // detect overflow (AFAIK nothing uses it)
+  if (cpu_getncycles () >= timer_tof)
+    ireg_putb (TCSR, ireg_getb (TCSR) | TOF);
+
+  //  detect output compare
+  if (cpu_getncycles () >= timer_ocf) {
+    ireg_putb (TCSR, ireg_getb (TCSR) | OCF);
+    tcsr_is_read = 0;
+    int_update ();
+  }
+  sci_sync ();
+  timer_schedule ();
+}
+
+/*
+ * timer_setfrc - load the free running counter, it counts on from there
+ */
+timer_setfrc (frc)
+  u_short frc;
+{
+  timer_origin = cpu_getncycles () - frc;
+  timer_schedule ();
+}
+
+/*
+ * frc_getb - read high/low byte of FRC
+ */
+u_char frc_getb (offs)
+  u_int  offs;
+{
+  u_short frc = timer_getfrc ();
+
+  return (offs == FRC) ? MSB (frc) : LSB (frc);
+}
+
+/*
+ * frc_putb - write high/low byte of FRC, counting carries on from the
+ * new value
+ */
+frc_putb (offs, value)
+  u_int  offs;
+  u_char value;
+{
+  u_short frc;
+
+  timer_update ();
+  frc = timer_getfrc ();
+  if (offs == FRC)
+    frc = (value << 8) | LSB (frc);
+  else
+    frc = (frc & 0xFF00) | value;
+  timer_setfrc (frc);
+}
+
 u_char tcsr_getb (offs)
   u_int  offs;
 {
   u_char tcsr;
 
+  timer_update ();
   if ((tcsr = ireg_getb (TCSR)) & OCF)
     tcsr_is_read = 1;
 
@@ -40,6 +140,7 @@ tcsr_putb (offs, value)
   u_char read_only = (ICF|OCF|TOF);
 
   ireg_putb (TCSR, (ireg_getb (TCSR) & read_only) | (value & ~read_only) );
+  int_update ();
 }
 
 /*
@@ -54,46 +155,13 @@ ocr_putb (offs, value)
 {
 
   ireg_putb (offs, value);
+  timer_schedule ();
   /*
    * Clear OCF if TCSR is read
    */
   if (tcsr_is_read) {
     ireg_putb (TCSR, ireg_getb (TCSR) & ~OCF);
     tcsr_is_read = 0;
+    int_update ();
   }
 }
-
-/*
- * timer_inc - increment timer, given the number of clock cycles passed
- *
- * 6801 has prescaler of 1
- */
-timer_inc (ncycles)
-  u_int ncycles;
-{
-  u_int  frc_old;     /* Free Running Counter */
-  u_short frc_new; // 16 bit, must overflow
-  u_int  ocr;     /* Output Compare Register */
-
-  /*
-   * Get old and compute new timer value
-   */
-  frc_old = ireg_getw (FRC);
-  frc_new = (u_short) (frc_old + ncycles);
-
-  /*
-   * Check against timer compare registers
-   */
-  ocr = ireg_getw (OCR);
-
-  // detect overflow (AFAIK nothing uses it)
-  if(frc_old>frc_new)
-    ireg_putb (TCSR, ireg_getb (TCSR) | TOF);
-
-  //  detect output compare 
-  if(frc_new>=ocr && (frc_old<ocr || frc_old>frc_new)) {
-    ireg_putb (TCSR, ireg_getb (TCSR) | OCF);
-    tcsr_is_read = 0;
-  }
-  ireg_putw (FRC, frc_new);
-}
@@ -10,10 +10,21 @@
 
 
 /* ../../src/arch/h6301/timer.c */
+extern HD6301_STATE COUNTER_VAR timer_next;
+extern u_short timer_getfrc P_((void));
+extern int timer_sync P_((void));
+extern int timer_setfrc P_((u_short frc));
+extern u_char frc_getb P_((u_int offs));
+extern int frc_putb P_((u_int offs, u_char value));
 extern u_char tcsr_getb P_((u_int offs));
 extern int tcsr_putb P_((u_int offs, u_char value));
 extern int ocr_putb P_((u_int offs, u_char value));
-extern int timer_inc P_((u_int ncycles));
+
+/*
+ * timer_update - raise timer flags if an event is due, called after
+ * every instruction
+ */
+#define timer_update() {if (cpu_getncycles () >= timer_next) timer_sync ();}
 
 #undef P_
 #endif /* H6301_TIMER_H */
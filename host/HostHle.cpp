@@ -0,0 +1,100 @@
+/*
+ * Atari ST RP2040 IKBD Emulator
+ * Copyright (C) 2021 Roy Hopkins
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#include "HostHle.h"
+#include <stdlib.h>
+#include <algorithm>
+
+// One per thread, like HostIkbd
+HostHle& HostHle::instance() {
+    static thread_local HostHle host;
+    return host;
+}
+
+void HostHle::reset() {
+    hle = IkbdHle();
+    now = 0;
+    rx_queue.clear();
+    next_rx = 0;
+    rx_cycles.clear();
+    x_period = y_period = 0;
+    last_x = last_y = 0;
+    tx_bytes.clear();
+    hle.reset(now);
+}
+
+void HostHle::run(COUNTER_VAR cycles) {
+    COUNTER_VAR end = now + cycles;
+    while (now < end) {
+        // One byte per poll at most, as HostIkbd delivers one per slice
+        if (!rx_queue.empty() && (now >= next_rx)) {
+            hle.receive(rx_queue.front(), now);
+            rx_queue.pop_front();
+            rx_cycles.push_back(now);
+            next_rx = now + HOST_CYCLES_PER_BYTE;
+        }
+        int dx = steps(now, x_period, last_x);
+        int dy = steps(now, y_period, last_y);
+        if (dx || dy) {
+            hle.add_mouse(dx, dy);
+        }
+        hle.update(now);
+        uint8_t data;
+        while (hle.get_tx(data, now)) {
+            tx_bytes.push_back({ now, data });
+        }
+        now += std::min<COUNTER_VAR>(HOST_HLE_PERIOD, end - now);
+    }
+}
+
+int HostHle::steps(COUNTER_VAR now, int period, COUNTER_VAR& last) {
+    if (period == 0) {
+        last = now;
+        return 0;
+    }
+    int64_t step = std::abs(period);
+    int n = (int)((now - last) / step);
+    last += n * step;
+    return (period > 0) ? n : -n;
+}
+
+void HostHle::send(const std::vector<uint8_t>& data) {
+    rx_queue.insert(rx_queue.end(), data.begin(), data.end());
+}
+
+void HostHle::set_key(uint8_t scancode, bool down) {
+    hle.set_key(scancode, down);
+}
+
+void HostHle::set_mouse_buttons(int buttons) {
+    hle.set_mouse_buttons(buttons);
+}
+
+void HostHle::set_joystick(uint8_t state) {
+    hle.set_joystick(state);
+}
+
+void HostHle::set_mouse_enabled(bool en) {
+    hle.set_mouse_enabled(en);
+}
+
+void HostHle::set_mouse_period(int x_cycles, int y_cycles) {
+    x_period = x_cycles;
+    y_period = y_cycles;
+    last_x = last_y = now;
+}
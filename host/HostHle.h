@@ -0,0 +1,85 @@
+/*
+ * Atari ST RP2040 IKBD Emulator
+ * Copyright (C) 2021 Roy Hopkins
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#pragma once
+
+#include <stdint.h>
+#include <deque>
+#include <vector>
+#include "HostIkbd.h"
+#include "IkbdHle.h"
+
+// How often core1_hle() polls the engine on the Pico (HLE_PERIOD_US)
+#define HOST_HLE_PERIOD 250
+
+/**
+ * The high level engine driven the same way as HostIkbd drives the 6301, so
+ * the same script can be played to both and their output compared. Time is
+ * counted in microseconds, the same as 6301 cycles.
+ */
+class HostHle {
+private:
+    HostHle() = default;
+
+public:
+    static HostHle& instance();
+
+    /**
+     * Power on the engine. All scripted input state and captured output is
+     * cleared.
+     */
+    void reset();
+
+    /**
+     * Run for the given number of cycles, polling the engine every
+     * HOST_HLE_PERIOD the way core1_hle() does. Queued bytes from the ST are
+     * delivered at serial byte timing.
+     */
+    void run(COUNTER_VAR cycles);
+
+    void send(const std::vector<uint8_t>& data);
+    void set_key(uint8_t scancode, bool down);
+    void set_mouse_buttons(int buttons);
+    void set_joystick(uint8_t state);
+    void set_mouse_enabled(bool en);
+
+    /**
+     * Mouse motion as cycles between each count, as HostIkbd::set_mouse_period()
+     */
+    void set_mouse_period(int x_cycles, int y_cycles);
+
+    COUNTER_VAR cycles() const { return now; }
+    const std::vector<HostTxByte>& tx() const { return tx_bytes; }
+    const std::vector<COUNTER_VAR>& rx() const { return rx_cycles; }
+    void clear_tx() { tx_bytes.clear(); }
+
+private:
+    static int steps(COUNTER_VAR now, int period, COUNTER_VAR& last);
+
+private:
+    IkbdHle                 hle;
+    COUNTER_VAR             now = 0;
+    std::deque<uint8_t>     rx_queue;
+    COUNTER_VAR             next_rx = 0;
+    std::vector<COUNTER_VAR> rx_cycles;
+    int                     x_period = 0;
+    int                     y_period = 0;
+    COUNTER_VAR             last_x = 0;
+    COUNTER_VAR             last_y = 0;
+    std::vector<HostTxByte> tx_bytes;
+};
@@ -0,0 +1,197 @@
+/*
+ * Atari ST RP2040 IKBD Emulator
+ * Copyright (C) 2021 Roy Hopkins
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#include "HostIkbd.h"
+#include "cpu.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <mutex>
+
+#define ROMBASE     256
+
+extern unsigned char rom_HD6301V1ST_img[];
+extern unsigned int rom_HD6301V1ST_img_len;
+
+// One per thread, like the 6301 state (HD6301_STATE)
+HostIkbd& HostIkbd::instance() {
+    static thread_local HostIkbd ikbd;
+    return ikbd;
+}
+
+void HostIkbd::reset() {
+    // The cold reset takes the random mouse phase from rand()
+    static std::mutex rand_lock;
+    static thread_local BYTE* pram = nullptr;
+    if (!pram) {
+        pram = hd6301_init();
+        if (!pram) {
+            printf("Failed to initialise HD6301\n");
+            exit(-1);
+        }
+    }
+    // Start from the same state every time so runs can be compared
+    memset(pram, 0, ROMBASE);
+    memcpy(pram + ROMBASE, rom_HD6301V1ST_img, rom_HD6301V1ST_img_len);
+    // Keys are cleared first so the reset builds an empty keyboard matrix
+    memset(key_states, 0, sizeof(key_states));
+    {
+        std::lock_guard<std::mutex> lock(rand_lock);
+        srand(1);
+        hd6301_reset(1);
+    }
+
+    mouse_state = 0;
+    joystick_state = 0;
+    mouse_en = true;
+    x_period = y_period = 0;
+    last_x = last_y = 0;
+    x_reg = y_reg = MOUSE_MASK;
+    rx_queue.clear();
+    next_rx = 0;
+    rx_cycles.clear();
+    tx_bytes.clear();
+}
+
+void HostIkbd::run(COUNTER_VAR cycles) {
+    COUNTER_VAR end = cpu.ncycles + cycles;
+    while (!crashed && (cpu.ncycles < end)) {
+        if (!rx_queue.empty() && (cpu.ncycles >= next_rx) && !hd6301_sci_busy()) {
+            hd6301_receive_byte(rx_queue.front());
+            rx_queue.pop_front();
+            rx_cycles.push_back(cpu.ncycles);
+            next_rx = cpu.ncycles + HOST_CYCLES_PER_BYTE;
+        }
+        hd6301_tx_empty(1);
+        hd6301_run_clocks(std::min<COUNTER_VAR>(HOST_CYCLES_PER_LOOP, end - cpu.ncycles));
+    }
+}
+
+void HostIkbd::send(const std::vector<uint8_t>& data) {
+    rx_queue.insert(rx_queue.end(), data.begin(), data.end());
+}
+
+void HostIkbd::set_key(uint8_t scancode, bool down) {
+    if (scancode < 128) {
+        key_states[scancode] = down ? 1 : 0;
+        hd6301_set_key(scancode, down);
+    }
+}
+
+void HostIkbd::set_mouse_buttons(int buttons) {
+    mouse_state = buttons;
+}
+
+void HostIkbd::set_joystick(uint8_t state) {
+    joystick_state = state;
+}
+
+void HostIkbd::set_mouse_enabled(bool en) {
+    mouse_en = en;
+}
+
+void HostIkbd::set_mouse_period(int x_cycles, int y_cycles) {
+    x_period = x_cycles;
+    y_period = y_cycles;
+    last_x = last_y = cpu.ncycles;
+}
+
+COUNTER_VAR HostIkbd::cycles() const {
+    return cpu.ncycles;
+}
+
+const std::vector<HostTxByte>& HostIkbd::tx() const {
+    return tx_bytes;
+}
+
+const std::vector<COUNTER_VAR>& HostIkbd::rx() const {
+    return rx_cycles;
+}
+
+void HostIkbd::clear_tx() {
+    tx_bytes.clear();
+}
+
+unsigned char HostIkbd::keydown(unsigned char code) const {
+    return (code < 128) ? key_states[code] : 0;
+}
+
+int HostIkbd::mouse_buttons() const {
+    return mouse_state;
+}
+
+unsigned char HostIkbd::joystick() const {
+    return joystick_state;
+}
+
+bool HostIkbd::mouse_enabled() const {
+    return mouse_en;
+}
+
+void HostIkbd::step_axis(int64_t cpu_cycles, int period, int64_t& last, unsigned int& reg) {
+    if (period == 0) {
+        last = cpu_cycles;
+        return;
+    }
+    int64_t step = std::abs(period);
+    while (cpu_cycles - last >= step) {
+        reg = (period > 0) ? _rotr(reg, 1) : _rotl(reg, 1);
+        last += step;
+    }
+}
+
+void HostIkbd::mouse_tick(int64_t cpu_cycles, int* x_counter, int* y_counter) {
+    // The quadrature phase is derived purely from the CPU clock so runs are repeatable
+    step_axis(cpu_cycles, x_period, last_x, x_reg);
+    step_axis(cpu_cycles, y_period, last_y, y_reg);
+    *x_counter = x_reg;
+    *y_counter = y_reg;
+}
+
+void HostIkbd::serial_send(unsigned char data) {
+    tx_bytes.push_back({ cpu.ncycles, data });
+}
+
+extern "C" {
+
+unsigned char st_keydown(const unsigned char code) {
+    return HostIkbd::instance().keydown(code);
+}
+
+int st_mouse_buttons() {
+    return HostIkbd::instance().mouse_buttons();
+}
+
+unsigned char st_joystick() {
+    return HostIkbd::instance().joystick();
+}
+
+int st_mouse_enabled() {
+    return HostIkbd::instance().mouse_enabled() ? 1 : 0;
+}
+
+void mouse_tick(int64_t cpu_cycles, int* x_counter, int* y_counter) {
+    HostIkbd::instance().mouse_tick(cpu_cycles, x_counter, y_counter);
+}
+
+void serial_send(unsigned char data) {
+    HostIkbd::instance().serial_send(data);
+}
+
+}
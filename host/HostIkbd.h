@@ -0,0 +1,118 @@
+/*
+ * Atari ST RP2040 IKBD Emulator
+ * Copyright (C) 2021 Roy Hopkins
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#pragma once
+
+#include <stdint.h>
+#include <deque>
+#include <vector>
+#include "6301.h"
+
+// The same slice length used by core1_entry() on the Pico
+#define HOST_CYCLES_PER_LOOP 1000
+
+// One byte at 7812 baud, 8N1, in 1MHz 6301 cycles
+#define HOST_CYCLES_PER_BYTE 1280
+
+/**
+ * A byte sent by the 6301 to the ST, stamped with the CPU cycle it was written to TDR
+ */
+struct HostTxByte {
+    COUNTER_VAR cycle;
+    uint8_t     data;
+};
+
+/**
+ * Host replacement for the Pico side of the emulator. Provides the keyboard,
+ * mouse, joystick and serial callbacks used by the 6301 core with state that
+ * can be scripted, and captures everything the ROM transmits.
+ */
+class HostIkbd {
+private:
+    HostIkbd() = default;
+
+public:
+    static HostIkbd& instance();
+
+    /**
+     * Load the ROM and cold reset the 6301. All scripted input state and
+     * captured output is cleared.
+     */
+    void reset();
+
+    /**
+     * Run the 6301 for the given number of cycles, in slices of
+     * HOST_CYCLES_PER_LOOP the same way core1_entry() does. Queued bytes from
+     * the ST are delivered at serial byte timing.
+     */
+    void run(COUNTER_VAR cycles);
+
+    /**
+     * Queue bytes to be received by the 6301 as if sent from the ST
+     */
+    void send(const std::vector<uint8_t>& data);
+
+    void set_key(uint8_t scancode, bool down);
+    void set_mouse_buttons(int buttons);
+    void set_joystick(uint8_t state);
+    void set_mouse_enabled(bool en);
+
+    /**
+     * Set the mouse motion as a number of CPU cycles between each quadrature
+     * step. The sign gives the direction, 0 stops the axis.
+     */
+    void set_mouse_period(int x_cycles, int y_cycles);
+
+    COUNTER_VAR cycles() const;
+    const std::vector<HostTxByte>& tx() const;
+
+    /**
+     * The cycle each byte from the ST was handed to the 6301 on
+     */
+    const std::vector<COUNTER_VAR>& rx() const;
+    void clear_tx();
+
+    // Callbacks from the 6301 core
+    unsigned char keydown(unsigned char code) const;
+    int mouse_buttons() const;
+    unsigned char joystick() const;
+    bool mouse_enabled() const;
+    void mouse_tick(int64_t cpu_cycles, int* x_counter, int* y_counter);
+    void serial_send(unsigned char data);
+
+private:
+    void step_axis(int64_t cpu_cycles, int period, int64_t& last, unsigned int& reg);
+
+private:
+    uint8_t                 key_states[128] = { 0 };
+    int                     mouse_state = 0;
+    unsigned char           joystick_state = 0;
+    bool                    mouse_en = true;
+
+    int                     x_period = 0;
+    int                     y_period = 0;
+    int64_t                 last_x = 0;
+    int64_t                 last_y = 0;
+    unsigned int            x_reg = 0;
+    unsigned int            y_reg = 0;
+
+    std::deque<uint8_t>     rx_queue;
+    COUNTER_VAR             next_rx = 0;
+    std::vector<COUNTER_VAR> rx_cycles;
+    std::vector<HostTxByte> tx_bytes;
+};
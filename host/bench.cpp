@@ -0,0 +1,297 @@
+/*
+ * Atari ST RP2040 IKBD Emulator
+ * Copyright (C) 2021 Roy Hopkins
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/*
+ * Host benchmark for the HD6301 core. Runs the real ROM against scripted
+ * input and reports how fast the interpreter runs compared with the 1MHz
+ * budget that core1_entry() has to meet on the Pico.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+#include "HostIkbd.h"
+
+// Emulated time to let the ROM finish its RAM test and checksum before measuring
+#define WARMUP_CYCLES   500000
+#define CYCLES_PER_MS   1000
+
+struct Workload {
+    const char* name;
+    const char* description;
+    std::function<void(HostIkbd&)> setup;
+    // Called once per emulated millisecond
+    std::function<void(HostIkbd&, int ms)> tick;
+};
+
+static const uint8_t scan_keys[] = {
+    0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x1e, 0x1f, 0x20, 0x21, 0x2c, 0x2d, 0x39, 0x1c
+};
+
+static const uint8_t joy_patterns[] = {
+    0x01, 0x09, 0x08, 0x0a, 0x02, 0x06, 0x04, 0x05, 0x00, 0x10, 0x80, 0x20, 0x40, 0x00
+};
+
+static std::vector<Workload> workloads() {
+    return {
+        { "idle", "No input, ROM polling only",
+            [](HostIkbd&) { },
+            [](HostIkbd&, int) { } },
+        { "mouse", "Relative mouse packets, both axes moving",
+            [](HostIkbd& ikbd) { ikbd.set_mouse_period(250, -400); },
+            [](HostIkbd& ikbd, int ms) {
+                // Reverse direction every 250ms
+                if ((ms % 250) == 0) {
+                    bool fwd = ((ms / 250) % 2) == 0;
+                    ikbd.set_mouse_period(fwd ? 250 : -250, fwd ? -400 : 400);
+                }
+                ikbd.set_mouse_buttons(((ms / 100) % 4) == 1 ? 2 : 0);
+            } },
+        { "keyboard", "Key make/break every 30ms through the matrix",
+            [](HostIkbd&) { },
+            [](HostIkbd& ikbd, int ms) {
+                if ((ms % 30) == 0) {
+                    int n = (ms / 30);
+                    uint8_t key = scan_keys[(n / 2) % sizeof(scan_keys)];
+                    ikbd.set_key(key, (n % 2) == 0);
+                }
+            } },
+        { "joystick", "Joystick event mode, both sticks changing every 20ms",
+            [](HostIkbd& ikbd) {
+                // Disable mouse, joystick event reporting
+                ikbd.set_mouse_enabled(false);
+                ikbd.send({ 0x12, 0x14 });
+            },
+            [](HostIkbd& ikbd, int ms) {
+                if ((ms % 20) == 0) {
+                    ikbd.set_joystick(joy_patterns[(ms / 20) % sizeof(joy_patterns)]);
+                }
+            } },
+    };
+}
+
+struct Result {
+    COUNTER_VAR cycles = 0;
+    double      seconds = 0;
+    uint64_t    instructions = 0;
+    size_t      tx_bytes = 0;
+    COUNTER_VAR idle = 0;
+    unsigned long ocf_ints = 0;
+    unsigned long sci_ints = 0;
+};
+
+static Result run_workload(const Workload& w, int ms) {
+    HostIkbd& ikbd = HostIkbd::instance();
+    ikbd.reset();
+    ikbd.run(WARMUP_CYCLES);
+    ikbd.clear_tx();
+    w.setup(ikbd);
+
+#if defined(HD6301_OPCODE_STATS)
+    memset(hd6301_opcode_stats, 0, sizeof(hd6301_opcode_stats));
+#endif
+#if defined(HD6301_IREG_STATS)
+    hd6301_ireg_clear();
+#endif
+#if defined(HD6301_PROFILE) && HD6301_PROFILE
+    hd6301_profile_clear();
+#endif
+    Result r;
+    COUNTER_VAR start = ikbd.cycles();
+    COUNTER_VAR idle_start = hd6301_idle_cycles();
+    unsigned long ocf_start = hd6301_int_count(HD6301_INT_OCF);
+    unsigned long sci_start = hd6301_int_count(HD6301_INT_SCI);
+    auto t0 = std::chrono::steady_clock::now();
+    for (int i = 0; i < ms; ++i) {
+        w.tick(ikbd, i);
+        ikbd.run(CYCLES_PER_MS);
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    r.cycles = ikbd.cycles() - start;
+    r.seconds = std::chrono::duration<double>(t1 - t0).count();
+    r.tx_bytes = ikbd.tx().size();
+    r.idle = hd6301_idle_cycles() - idle_start;
+    r.ocf_ints = hd6301_int_count(HD6301_INT_OCF) - ocf_start;
+    r.sci_ints = hd6301_int_count(HD6301_INT_SCI) - sci_start;
+#if defined(HD6301_OPCODE_STATS)
+    for (int i = 0; i < 256; ++i) {
+        r.instructions += hd6301_opcode_stats[i];
+    }
+#endif
+    if (crashed) {
+        printf("%s: 6301 crashed at cycle %lld\n", w.name, (long long)ikbd.cycles());
+        hd6301_trace_freeze();
+        hd6301_trace_dump();
+    }
+    return r;
+}
+
+/**
+ * Run the workload on several threads at once, each with its own 6301. The
+ * cycles and instructions are the total over all threads and the time is
+ * the wall clock time for all of them.
+ */
+static Result run_parallel(const Workload& w, int ms, int jobs, bool idle_skip) {
+    std::vector<Result> results(jobs);
+    std::vector<std::thread> threads;
+    auto t0 = std::chrono::steady_clock::now();
+    for (int j = 0; j < jobs; ++j) {
+        threads.emplace_back([&, j]() {
+            hd6301_set_idle_skip(idle_skip);
+            results[j] = run_workload(w, ms);
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    auto t1 = std::chrono::steady_clock::now();
+
+    Result r = results[0];
+    for (int j = 1; j < jobs; ++j) {
+        // Every thread runs the same script so must send the same bytes
+        if (results[j].tx_bytes != r.tx_bytes || results[j].cycles != r.cycles) {
+            printf("%s: thread %d sent %zu bytes in %lld cycles, thread 0 sent %zu in %lld\n", w.name, j,
+                results[j].tx_bytes, (long long)results[j].cycles, r.tx_bytes, (long long)r.cycles);
+        }
+        r.instructions += results[j].instructions;
+    }
+    r.cycles *= jobs;
+    r.idle *= jobs;
+    r.seconds = std::chrono::duration<double>(t1 - t0).count();
+    return r;
+}
+
+static void print_histogram(const Result& r, int top) {
+#if defined(HD6301_OPCODE_STATS)
+    std::vector<int> ops(256);
+    for (int i = 0; i < 256; ++i) {
+        ops[i] = i;
+    }
+    std::sort(ops.begin(), ops.end(), [](int a, int b) {
+        return hd6301_opcode_stats[a] > hd6301_opcode_stats[b];
+    });
+    for (int i = 0; i < top && hd6301_opcode_stats[ops[i]]; ++i) {
+        unsigned long n = hd6301_opcode_stats[ops[i]];
+        printf("    %02X %-8s %10lu %6.2f%%\n", ops[i], hd6301_opcode_name(ops[i]), n,
+            100.0 * n / (double)r.instructions);
+    }
+#endif
+}
+
+static void print_iregs(const Result& r) {
+#if defined(HD6301_IREG_STATS)
+    // Busiest internal registers first, with accesses per 1000 cycles
+    std::vector<int> regs(HD6301_NIREGS);
+    for (int i = 0; i < HD6301_NIREGS; ++i) {
+        regs[i] = i;
+    }
+    auto total = [](int reg) { return hd6301_ireg_count(0, reg) + hd6301_ireg_count(1, reg); };
+    std::sort(regs.begin(), regs.end(), [&](int a, int b) { return total(a) > total(b); });
+    for (int reg : regs) {
+        if (!total(reg)) {
+            break;
+        }
+        printf("    $%02X %-6s read %10lu write %10lu %8.2f/kcycle\n", reg, hd6301_ireg_name(reg),
+            hd6301_ireg_count(0, reg), hd6301_ireg_count(1, reg), 1000.0 * total(reg) / (double)r.cycles);
+    }
+#endif
+}
+
+static void usage(const char* prog) {
+    printf("Usage: %s [-t emulated_seconds] [-w workload] [-n top_opcodes] [-r repeats] [-s] [-j threads]\n", prog);
+    printf("The fastest of the repeated runs is reported. -s disables idle loop skipping.\n");
+    printf("-j runs each workload on that many threads at once and reports the total rate.\n");
+    printf("Workloads:\n");
+    for (auto& w : workloads()) {
+        printf("  %-10s %s\n", w.name, w.description);
+    }
+}
+
+int main(int argc, char** argv) {
+    double seconds = 10.0;
+    int top = 10;
+    int repeats = 3;
+    int jobs = 1;
+    bool idle_skip = true;
+    std::string only;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "t:w:n:r:sj:h")) != -1) {
+        switch (opt) {
+        case 't': seconds = atof(optarg); break;
+        case 'w': only = optarg; break;
+        case 'n': top = atoi(optarg); break;
+        case 'r': repeats = std::max(1, atoi(optarg)); break;
+        case 's': idle_skip = false; break;
+        case 'j': jobs = std::max(1, atoi(optarg)); break;
+        default:
+            usage(argv[0]);
+            return (opt == 'h') ? 0 : 1;
+        }
+    }
+
+    int ms = (int)(seconds * 1000);
+    hd6301_set_idle_skip(idle_skip);
+#if defined(IKBD_SYMBOL_FILE)
+    if (hd6301_load_symbols(IKBD_SYMBOL_FILE)) {
+        printf("Couldn't load the ROM symbols from %s\n", IKBD_SYMBOL_FILE);
+    }
+#endif
+    if (hd6301_debug_ram()) {
+        printf("6301 debug support (call stack, symbol table) uses %lu bytes\n", hd6301_debug_ram());
+    }
+    printf("%-10s %12s %10s %9s %9s %9s %9s %7s %8s %8s\n",
+        "workload", "cycles", "host ms", "emu MHz", "ns/instr", "ns/cycle", "tx bytes", "idle %",
+        "OCF int", "SCI int");
+    for (auto& w : workloads()) {
+        if (!only.empty() && only != w.name) {
+            continue;
+        }
+        auto run = [&]() { return (jobs > 1) ? run_parallel(w, ms, jobs, idle_skip) : run_workload(w, ms); };
+        Result r = run();
+        for (int i = 1; i < repeats; ++i) {
+            Result again = run();
+            if (again.seconds < r.seconds) {
+                r = again;
+            }
+        }
+        double mhz = r.cycles / r.seconds / 1e6;
+        double ns_instr = r.instructions ? (r.seconds * 1e9 / r.instructions) : 0;
+        printf("%-10s %12lld %10.1f %9.2f %9.2f %9.2f %9zu %7.2f %8lu %8lu\n", w.name, (long long)r.cycles,
+            r.seconds * 1000, mhz, ns_instr, r.seconds * 1e9 / r.cycles, r.tx_bytes,
+            100.0 * r.idle / r.cycles, r.ocf_ints, r.sci_ints);
+        if (jobs > 1) {
+            // The opcode counts and the profile belong to the threads
+            continue;
+        }
+        print_histogram(r, top);
+        print_iregs(r);
+#if defined(HD6301_PROFILE) && HD6301_PROFILE
+        // Where the ROM spent the cycles of the last run
+        hd6301_profile_dump(top);
+#endif
+    }
+    return 0;
+}
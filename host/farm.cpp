@@ -0,0 +1,1023 @@
+/*
+ * Atari ST RP2040 IKBD Emulator
+ * Copyright (C) 2021 Roy Hopkins
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+/*
+ * Regression and fuzz runner for the HD6301 core. Every case cold boots its
+ * own 6301 and feeds it an IKBD command stream and input script generated
+ * from the case number, then reduces everything the ROM sent back, with the
+ * cycle it was sent on, to a hash. The cases are spread over a pool of
+ * threads, each with its own 6301 (HD6301_STATE), and the results can be
+ * saved as a reference and compared against after a change to the core.
+ *
+ * With -d every case is also played to the high level engine (IkbdHle). What
+ * the two send is split into streams, the answers to commands, keys, mouse
+ * and joystick reports and joystick monitoring, and each stream is compared
+ * in order. A case whose streams match but whose bytes are interleaved or
+ * timed differently only differs in timing, any other difference is in the
+ * content. How long each engine takes to answer each command is reported
+ * too.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+#include "HostIkbd.h"
+#include "HostHle.h"
+
+// The ROM has finished its self test and sent 0xF1 by this point
+#define BOOT_CYCLES     100000
+#define CYCLES_PER_MS   1000
+
+// Without glitches (-d) a key is held, and left up, for two of the ROM's
+// 30ms keyboard scans, and the joystick and buttons stay put for longer
+// than the ROM's 9ms debounce. Nothing changes this long either side of a
+// command reaching the IKBD, so neither engine can act on it a scan earlier.
+#define KEY_HOLD_MS     60
+#define INPUT_HOLD_MS   20
+
+// The ROM reads the keyboard every 30ms, up to 31ms apart in the joystick
+// modes, and a command can change whether it reads it at all. Without
+// glitches no command reaches the IKBD within this long of a key change, so
+// both engines have reported it, or not, under the same mode.
+#define KEY_SCAN_MS     35
+
+// Without glitches joystick 0 is only pushed this long after the mouse port
+// was last given to it, long enough for the command to reach the ROM
+#define PORT_SETTLE_MS  20
+
+// Without glitches a case ends with this long with no input
+#define DRAIN_MS        50
+
+// Without glitches nothing changes, no command is completed and the case
+// doesn't end this close to when a 0x17 report is due, so both engines
+// sample the same joystick state and send the same reports. The ROM acts on
+// a command as soon as its last byte is in, the host 6301 is given a byte
+// at most every COMMAND_BYTE_MS.
+#define MONITOR_HOLD_MS 15
+#define COMMAND_BYTE_MS 2
+
+// The ROM only looks for a command between joystick monitoring reports,
+// the first of which is at least 11ms after 0x17
+#define MONITOR_GRACE   (2 * HOST_CYCLES_PER_BYTE)
+#define MONITOR_FIRST   5000
+
+/**
+ * Small generator so a case is the same on every host and library
+ */
+class CaseRandom {
+public:
+    explicit CaseRandom(uint64_t seed) : state(seed * 0x9E3779B97F4A7C15ull + 1) { }
+
+    uint32_t next() {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return (uint32_t)(state >> 32);
+    }
+
+    int range(int n) { return (int)(next() % (uint32_t)n); }
+    bool chance(int percent) { return range(100) < percent; }
+    uint8_t byte() { return (uint8_t)next(); }
+    uint8_t bcd(int n) { int v = range(n); return (uint8_t)(((v / 10) << 4) | (v % 10)); }
+
+private:
+    uint64_t state;
+};
+
+struct CaseResult {
+    size_t      tx_bytes = 0;
+    uint64_t    hash = 0;
+    COUNTER_VAR last_tx = 0;    // Cycle of the last byte sent
+    COUNTER_VAR idle = 0;       // Cycles fast-forwarded, for information only
+    bool        crashed = false;
+
+    // Fast-forwarding must not change what is sent so -s is checked against the same reference
+    bool operator!=(const CaseResult& o) const {
+        return tx_bytes != o.tx_bytes || hash != o.hash || last_tx != o.last_tx || crashed != o.crashed;
+    }
+};
+
+/**
+ * What the generated script is allowed to do. Everything is enabled for the
+ * regression cases, the comparison with the high level engine leaves out
+ * what that can't reproduce.
+ */
+struct TraceOptions {
+    bool motion = true;     // Mouse movement, the HLE packs it into fewer packets
+    bool memory = true;     // Loading, reading and executing 6301 RAM
+    bool glitches = true;   // Inputs that change again before the ROM has seen them
+};
+
+/**
+ * A command from the script
+ */
+struct SentCommand {
+    COUNTER_VAR cycle;      // When it was queued to be sent
+    uint8_t     command;
+    uint8_t     reply;      // Header byte of the answer, 0 if it has none
+    long        last;       // Index of its last byte among those sent, -1 for the power on
+};
+
+static uint64_t fnv(uint64_t h, uint64_t v) {
+    for (int i = 0; i < 8; ++i) {
+        h ^= (v >> (i * 8)) & 0xFF;
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+/**
+ * One IKBD command with plausible parameters
+ */
+static std::vector<uint8_t> random_command(CaseRandom& rnd) {
+    static const uint8_t inquiries[] = {
+        0x87, 0x88, 0x89, 0x8a, 0x8b, 0x8c, 0x8f, 0x90, 0x92, 0x94, 0x95, 0x99, 0x9a
+    };
+    // Internal RAM the ROM does not use for its own state
+    static const uint8_t scratch[] = { 0xe0, 0xe8, 0xf0 };
+
+    switch (rnd.range(22)) {
+    case 0:  return { 0x07, (uint8_t)rnd.range(8) };
+    case 1:  return { 0x08 };
+    case 2:  return { 0x09, (uint8_t)rnd.range(2), rnd.byte(), (uint8_t)rnd.range(2), rnd.byte() };
+    case 3:  return { 0x0a, (uint8_t)(1 + rnd.range(8)), (uint8_t)(1 + rnd.range(8)) };
+    case 4:  return { 0x0b, (uint8_t)(1 + rnd.range(16)), (uint8_t)(1 + rnd.range(16)) };
+    case 5:  return { 0x0c, (uint8_t)(1 + rnd.range(8)), (uint8_t)(1 + rnd.range(8)) };
+    case 6:  return { 0x0d };
+    case 7:  return { 0x0e, 0x00, (uint8_t)rnd.range(2), rnd.byte(), (uint8_t)rnd.range(2), rnd.byte() };
+    case 8:  return { (uint8_t)(rnd.chance(50) ? 0x0f : 0x10) };
+    case 9:  return { (uint8_t)(rnd.chance(50) ? 0x11 : 0x13) };
+    case 10: return { 0x12 };
+    case 11: return { 0x14 };
+    case 12: return { 0x15 };
+    case 13: return { 0x16 };
+    case 14: return { 0x17, (uint8_t)(1 + rnd.range(20)) };
+    case 15: return { 0x19, (uint8_t)(1 + rnd.range(10)), (uint8_t)(1 + rnd.range(10)),
+                      (uint8_t)(1 + rnd.range(10)), (uint8_t)(1 + rnd.range(10)),
+                      (uint8_t)(1 + rnd.range(10)), (uint8_t)(1 + rnd.range(10)) };
+    case 16: return { 0x1a };
+    case 17: return { 0x1b, rnd.bcd(100), (uint8_t)(rnd.bcd(12) + 1), (uint8_t)(rnd.bcd(28) + 1),
+                      rnd.bcd(24), rnd.bcd(60), rnd.bcd(60) };
+    case 18: return { 0x1c };
+    case 19: {
+        // Load a few bytes ending in rts and sometimes execute them
+        uint8_t addr = scratch[rnd.range(sizeof(scratch))];
+        std::vector<uint8_t> cmd = { 0x20, 0x00, addr, 4 };
+        cmd.push_back(0x01);                  // nop
+        cmd.push_back(0x01);
+        cmd.push_back(0x01);
+        cmd.push_back(0x39);                  // rts
+        if (rnd.chance(50)) {
+            cmd.insert(cmd.end(), { 0x22, 0x00, addr });
+        }
+        return cmd;
+    }
+    case 20: return { 0x21, 0x00, (uint8_t)(0x80 + rnd.range(0x80)) };
+    default: return { inquiries[rnd.range(sizeof(inquiries))] };
+    }
+}
+
+static bool memory_command(uint8_t command) {
+    return command >= 0x20 && command <= 0x22;
+}
+
+/**
+ * Whether a 0x17 report that started 'start' ms into the case and repeats
+ * every 'period' cycles is due within MONITOR_HOLD_MS of 'ms'
+ */
+static bool monitor_due(int ms, int start, int64_t period) {
+    if (start < 0 || ms < start) {
+        return false;
+    }
+    int64_t phase = ((int64_t)(ms - start) * CYCLES_PER_MS) % period;
+    return phase < MONITOR_HOLD_MS * CYCLES_PER_MS || period - phase < MONITOR_HOLD_MS * CYCLES_PER_MS;
+}
+
+/**
+ * 1 if 'cmd' has the ROM read the mouse port as the mouse, 0 if it stops
+ * reading the mouse, -1 if it leaves the port alone
+ */
+static int mouse_port_command(const std::vector<uint8_t>& cmd) {
+    switch (cmd[0]) {
+    case 0x08: case 0x09: case 0x0a:
+        return 1;
+    case 0x12: case 0x14: case 0x15: case 0x17: case 0x18: case 0x19:
+        return 0;
+    case 0x80:
+        return (cmd.size() > 1 && cmd[1] == 0x01) ? 1 : -1;
+    default:
+        return -1;
+    }
+}
+
+/**
+ * Header of the packet that answers 'cmd', or 0 if it has no direct answer
+ */
+static uint8_t reply_header(const std::vector<uint8_t>& cmd) {
+    switch (cmd[0]) {
+    case 0x0d: return 0xf7;
+    case 0x16: return 0xfd;
+    case 0x1c: return 0xfc;
+    case 0x21: return 0xf6;
+    case 0x80: return (cmd.size() > 1 && cmd[1] == 0x01) ? 0xf1 : 0;
+    default:   return (cmd[0] >= 0x87 && cmd[0] <= 0x9a) ? 0xf6 : 0;
+    }
+}
+
+static bool engine_crashed(HostIkbd&) { return crashed != 0; }
+static bool engine_crashed(HostHle&) { return false; }
+static COUNTER_VAR engine_idle(HostIkbd&) { return hd6301_idle_cycles(); }
+static COUNTER_VAR engine_idle(HostHle&) { return 0; }
+
+/**
+ * Cold boot 'ikbd', then play the script for case 'seed' to it for 'ms'
+ * emulated milliseconds. The script depends only on the seed and options so
+ * every engine is given the same input at the same times. Returns the cycles
+ * fast-forwarded after the boot.
+ */
+template <class Engine>
+static COUNTER_VAR play_case(Engine& ikbd, uint64_t seed, int ms, const TraceOptions& opt,
+        std::vector<SentCommand>* sent) {
+    static const uint8_t keys[] = {
+        0x01, 0x10, 0x11, 0x12, 0x1c, 0x1d, 0x1e, 0x2a, 0x36, 0x38, 0x39, 0x3b, 0x48, 0x50, 0x62, 0x72
+    };
+    CaseRandom rnd(seed);
+    long queued = 0;
+    uint8_t held = 0;           // Without glitches, the one key that is down
+    int key_ms = -KEY_HOLD_MS;  // When it went down or up
+    int input_ms = -INPUT_HOLD_MS;
+    int line_ms = 0;            // When the last command will have been sent
+    int monitor_ms = -1;        // When 0x17 reached the IKBD, -1 when not monitoring
+                                // (moved on by how long it was paused)
+    int pause_ms = -1;          // When 0x13 paused the output, -1 when not paused
+    int64_t monitor_period = 1;
+    // Without glitches, joystick 0 is left alone while the ROM reads the
+    // mouse port as a mouse, as with no mouse plugged in it would read the
+    // joystick as mouse movement
+    bool mouse_read = true;
+    int port_ms = 0;            // When the port was last given to joystick 0
+    uint8_t joystick = 0;
+    bool plugged = true;
+
+    ikbd.reset();
+    if (sent) {
+        // The power on version byte is answered like a reset command
+        sent->push_back({ 0, 0x80, 0xf1, -1 });
+    }
+    ikbd.run(BOOT_CYCLES);
+    COUNTER_VAR idle_start = engine_idle(ikbd);
+    for (int i = 0; i < ms && !engine_crashed(ikbd); ++i) {
+        std::vector<uint8_t> cmd;
+        if (rnd.chance(4)) {
+            do {
+                cmd = random_command(rnd);
+            } while (!opt.memory && memory_command(cmd[0]));
+        }
+        int port = cmd.empty() ? -1 : mouse_port_command(cmd);
+        if (!opt.glitches && !cmd.empty()) {
+            int done_ms = std::max(line_ms, i) + (int)cmd.size() * COMMAND_BYTE_MS;
+            if ((i - input_ms < INPUT_HOLD_MS) || (i - line_ms < INPUT_HOLD_MS) || (i - key_ms < KEY_SCAN_MS) ||
+                monitor_due(done_ms, monitor_ms, monitor_period)) {
+                cmd.clear();
+            } else if ((port == 1) && !plugged && (joystick & 0x0f)) {
+                // Let go of joystick 0 first, the command is left out
+                joystick &= 0xf0;
+                ikbd.set_joystick(joystick);
+                input_ms = i;
+                cmd.clear();
+            }
+        }
+        if (!cmd.empty()) {
+            line_ms = std::max(line_ms, i) +
+                (int)(cmd.size() * HOST_CYCLES_PER_BYTE + CYCLES_PER_MS - 1) / CYCLES_PER_MS;
+            queued += cmd.size();
+            if (sent) {
+                sent->push_back({ ikbd.cycles(), cmd[0], reply_header(cmd), queued - 1 });
+            }
+            ikbd.send(cmd);
+            if (cmd[0] == 0x13) {
+                pause_ms = (pause_ms < 0) ? line_ms : pause_ms;
+            } else if ((pause_ms >= 0) && (cmd[0] != 0x0d) && (cmd[0] != 0x20) &&
+                       !((monitor_ms >= 0) && (cmd[0] == 0x16 || cmd[0] >= 0x87))) {
+                // The 0x17 period stands still while paused, a reset ends both
+                monitor_ms += (monitor_ms >= 0) ? line_ms - pause_ms : 0;
+                pause_ms = -1;
+            }
+            if (cmd[0] == 0x17) {
+                monitor_ms = line_ms;
+                monitor_period = (int64_t)std::max<int>(cmd[1], 1) * HLE_MONITOR_UNIT;
+            } else if ((port == 1) || (port == 0 && cmd[0] != 0x12) || (cmd[0] == 0x1a)) {
+                monitor_ms = -1;
+            }
+            if (port == 0) {
+                port_ms = mouse_read ? i : port_ms;
+                mouse_read = false;
+            } else if (port == 1) {
+                mouse_read = true;
+            }
+        }
+        if (rnd.chance(3)) {
+            // In this order to keep the cases of earlier versions, where both
+            // were drawn in the arguments of set_key()
+            bool down = rnd.chance(50);
+            uint8_t key = keys[rnd.range(sizeof(keys))];
+            if (opt.glitches) {
+                ikbd.set_key(key, down);
+            } else if ((i - key_ms >= KEY_HOLD_MS) && (i - line_ms >= KEY_SCAN_MS) &&
+                       (i - input_ms >= INPUT_HOLD_MS) && (down ? !held : (key == held))) {
+                ikbd.set_key(key, down);
+                held = down ? key : 0;
+                key_ms = input_ms = i;
+            }
+        }
+        // The random numbers are drawn whether or not the change is made so
+        // every case is the same script with or without glitches
+        bool settled = opt.glitches ||
+            ((i - input_ms >= INPUT_HOLD_MS) && (i - line_ms >= INPUT_HOLD_MS) &&
+             !monitor_due(i, monitor_ms, monitor_period));
+        if (rnd.chance(2)) {
+            int x = rnd.range(2000) - 1000;
+            int y = rnd.range(2000) - 1000;
+            if (opt.motion) {
+                ikbd.set_mouse_period((std::abs(x) < 100) ? 0 : x, (std::abs(y) < 100) ? 0 : y);
+            }
+        }
+        if (rnd.chance(2)) {
+            int buttons = rnd.range(4);
+            if (settled) {
+                ikbd.set_mouse_buttons(buttons);
+                input_ms = i;
+                settled = opt.glitches;
+            }
+        }
+        bool port0 = opt.glitches || (!mouse_read && (i - port_ms >= PORT_SETTLE_MS));
+        if (rnd.chance(2)) {
+            uint8_t state = rnd.byte();
+            if (settled) {
+                joystick = port0 ? state : (state & 0xf0);
+                ikbd.set_joystick(joystick);
+                input_ms = i;
+                settled = opt.glitches;
+            }
+        }
+        if (rnd.chance(1)) {
+            // Plugging the mouse in or out changes what joystick 0 reads
+            bool en = rnd.chance(70);
+            if (settled && (port0 || !(joystick & 0x0f))) {
+                ikbd.set_mouse_enabled(en);
+                plugged = en;
+                input_ms = i;
+            }
+        }
+        ikbd.run(CYCLES_PER_MS);
+    }
+    if (!opt.glitches) {
+        // Time for the slower engine to send what the last inputs made
+        ikbd.run(DRAIN_MS * CYCLES_PER_MS);
+        int end = ms + DRAIN_MS;
+        for (int i = end; (i - end) * CYCLES_PER_MS < monitor_period && monitor_due(i, monitor_ms, monitor_period); ++i) {
+            ikbd.run(CYCLES_PER_MS);
+        }
+    }
+    return engine_idle(ikbd) - idle_start;
+}
+
+/**
+ * Run case 'seed' on the 6301
+ */
+static CaseResult run_case(uint64_t seed, int ms, bool verbose) {
+    HostIkbd& ikbd = HostIkbd::instance();
+    COUNTER_VAR idle = play_case(ikbd, seed, ms, TraceOptions(), nullptr);
+
+    CaseResult r;
+    uint64_t h = 1469598103934665603ull;
+    for (auto& b : ikbd.tx()) {
+        h = fnv(h, b.cycle);
+        h = fnv(h, b.data);
+        if (verbose) {
+            printf("%10lld %02x\n", (long long)b.cycle, b.data);
+        }
+    }
+    r.tx_bytes = ikbd.tx().size();
+    r.hash = h;
+    r.last_tx = r.tx_bytes ? ikbd.tx().back().cycle : 0;
+    r.idle = idle;
+    r.crashed = crashed != 0;
+    if (verbose && crashed) {
+        hd6301_trace_freeze();
+        hd6301_trace_dump();
+    }
+    return r;
+}
+
+/**
+ * Time taken to answer one kind of command, summed over the cases
+ */
+struct LatencyStats {
+    int         count = 0;      // Answered by both engines
+    int         missing = 0;    // Answered by only one of them
+    int64_t     lle_total = 0;
+    int64_t     hle_total = 0;
+};
+
+/**
+ * What a packet sent to the ST is part of. Each stream is compared in order
+ * on its own, so packets that are only interleaved differently still match.
+ */
+enum TxStream {
+    STREAM_REPLY,       // Answers to commands, 0xF1, 0xF6, 0xFC and 0xFD
+    STREAM_KEY,
+    STREAM_BUTTON_KEY,  // 0x74 and 0x75, the mouse buttons acting as keys
+    STREAM_MOUSE,       // 0xF8-0xFB relative packets
+    STREAM_ABSOLUTE,    // 0xF7 from 0x0d or a button action
+    STREAM_JOYSTICK0,   // 0xFE events, the order of the two joysticks' events
+    STREAM_JOYSTICK1,   // depends on when the ROM scans them
+    STREAM_MONITOR,     // 0x17 and 0x18 reports
+    STREAMS
+};
+
+static const char* const stream_names[STREAMS] = {
+    "replies", "keys", "button keys", "mouse", "absolute", "joystick 0", "joystick 1", "monitor"
+};
+
+/**
+ * The joystick monitoring modes, whose reports have no header
+ */
+enum MonitorMode {
+    MONITOR_OFF,
+    MONITOR_JOYSTICK,
+    MONITOR_FIRE
+};
+
+/**
+ * How the output of the two engines compares for one case
+ */
+struct CaseDiff {
+    size_t      lle_bytes = 0;
+    size_t      hle_bytes = 0;
+    long        first = -1;     // Index of the first byte that differs, -1 if none
+    int         stream = -1;    // First stream whose packets differ, -1 if they all match
+    long        packet = -1;    // Index in that stream of the first packet that differs
+    size_t      lle_packets = 0; // Packets in that stream
+    size_t      hle_packets = 0;
+    std::string lle_context;
+    std::string hle_context;
+    size_t      stamped = 0;    // Packets that match
+    int64_t     stamp_total = 0; // Sum of the cycle differences of those packets
+    int64_t     stamp_max = 0;
+    std::map<uint8_t, LatencyStats> latency;
+
+    bool same() const { return first < 0; }
+    bool content() const { return stream >= 0; }
+};
+
+/**
+ * A packet sent to the ST
+ */
+struct TxPacket {
+    COUNTER_VAR             cycle;
+    uint8_t                 header;
+    TxStream                stream;
+    std::vector<uint8_t>    data;
+};
+
+static int packet_length(uint8_t header) {
+    switch (header) {
+    case 0xf6: return 8;
+    case 0xf7: return 6;
+    case 0xf8: case 0xf9: case 0xfa: case 0xfb: return 3;
+    case 0xfc: return 7;
+    case 0xfd: return 3;
+    case 0xfe: case 0xff: return 2;
+    default:   return 1;
+    }
+}
+
+static TxStream packet_stream(uint8_t header) {
+    switch (header) {
+    case 0xf1: case 0xf6: case 0xfc: case 0xfd: return STREAM_REPLY;
+    case 0xf7: return STREAM_ABSOLUTE;
+    case 0xf8: case 0xf9: case 0xfa: case 0xfb: return STREAM_MOUSE;
+    case 0xfe: return STREAM_JOYSTICK0;
+    case 0xff: return STREAM_JOYSTICK1;
+    case 0x74: case 0x75: case 0xf4: case 0xf5: return STREAM_BUTTON_KEY;
+    default:   return STREAM_KEY;
+    }
+}
+
+/**
+ * The monitoring mode 'c' leaves the IKBD in
+ */
+static MonitorMode monitor_after(const SentCommand& c, MonitorMode mode) {
+    switch (c.command) {
+    case 0x17: return MONITOR_JOYSTICK;
+    case 0x18: return MONITOR_FIRE;
+    case 0x08: case 0x09: case 0x0a: case 0x14: case 0x15: case 0x19: case 0x1a:
+        return MONITOR_OFF;
+    case 0x80: return c.reply ? MONITOR_OFF : mode;
+    default:   return mode;
+    }
+}
+
+/**
+ * Split the output into packets by their header byte, keycodes are a packet
+ * each. The monitoring reports have no header so the mode is followed from
+ * the cycle each command reached the engine on ('rx'). An engine may still
+ * send reports for 'grace' cycles after a command ends monitoring, and
+ * bytes queued before it started are sent ahead of the first report.
+ */
+static std::vector<TxPacket> tx_packets(const std::vector<HostTxByte>& tx,
+        const std::vector<SentCommand>& sent, const std::vector<COUNTER_VAR>& rx, COUNTER_VAR grace) {
+    std::vector<TxPacket> packets;
+    MonitorMode mode = MONITOR_OFF;
+    MonitorMode left_mode = MONITOR_OFF;
+    COUNTER_VAR entered = 0;
+    COUNTER_VAR left = 0;
+    size_t c = 0;
+    for (size_t i = 0; i < tx.size(); ) {
+        for (; c < sent.size(); ++c) {
+            long last = sent[c].last;
+            if (last >= 0 && ((size_t)last >= rx.size() || rx[last] > tx[i].cycle)) {
+                break;
+            }
+            MonitorMode next = monitor_after(sent[c], mode);
+            COUNTER_VAR at = (last >= 0) ? rx[last] : 0;
+            if (next != MONITOR_OFF && mode == MONITOR_OFF) {
+                entered = at;
+            }
+            if (next == MONITOR_OFF && mode != MONITOR_OFF) {
+                left_mode = mode;
+                left = at;
+            }
+            mode = next;
+        }
+        MonitorMode m = mode;
+        if (m == MONITOR_OFF && tx[i].cycle < left + grace) {
+            m = left_mode;
+        }
+        bool report = (m == MONITOR_FIRE) ||
+            (m == MONITOR_JOYSTICK && tx[i].data <= 3 && tx[i].cycle >= entered + MONITOR_FIRST);
+        size_t n = report ? ((m == MONITOR_JOYSTICK) ? 2 : 1) : packet_length(tx[i].data);
+        if (n > tx.size() - i) {
+            // Cut short by the end of the case, the other engine may not
+            // have started it yet
+            break;
+        }
+        TxPacket p = { tx[i].cycle, tx[i].data, report ? STREAM_MONITOR : packet_stream(tx[i].data), {} };
+        for (size_t j = 0; j < n; ++j) {
+            p.data.push_back(tx[i + j].data);
+        }
+        packets.push_back(p);
+        i += n;
+    }
+    return packets;
+}
+
+/**
+ * The packets of one stream. How many monitoring reports are sent depends on
+ * timing, so a report that repeats the one before is left out.
+ */
+static std::vector<const TxPacket*> tx_stream(const std::vector<TxPacket>& packets, int stream) {
+    std::vector<const TxPacket*> out;
+    for (auto& p : packets) {
+        if (p.stream == stream &&
+            !(stream == STREAM_MONITOR && !out.empty() && out.back()->data == p.data)) {
+            out.push_back(&p);
+        }
+    }
+    return out;
+}
+
+/**
+ * Cycles from each command being queued to the start of its answer, -1 if it
+ * has none or no answer was found. Answers with the same header are taken in
+ * order.
+ */
+static std::vector<COUNTER_VAR> reply_latency(const std::vector<SentCommand>& sent,
+        const std::vector<TxPacket>& packets) {
+    std::vector<COUNTER_VAR> latency;
+    size_t next[256] = { 0 };
+    for (auto& c : sent) {
+        size_t& i = next[c.reply];
+        while (c.reply && i < packets.size() && (packets[i].header != c.reply ||
+                packets[i].stream == STREAM_MONITOR || packets[i].cycle < c.cycle)) {
+            ++i;
+        }
+        if (c.reply && i < packets.size()) {
+            latency.push_back(packets[i++].cycle - c.cycle);
+        } else {
+            latency.push_back(-1);
+        }
+    }
+    return latency;
+}
+
+static std::string tx_context(const std::vector<HostTxByte>& tx, size_t at) {
+    std::string s;
+    char buf[32];
+    size_t from = (at > 4) ? at - 4 : 0;
+    for (size_t i = from; i < std::min(tx.size(), at + 5); ++i) {
+        snprintf(buf, sizeof(buf), (i == at) ? "[%02x] " : "%02x ", tx[i].data);
+        s += buf;
+    }
+    if (at < tx.size()) {
+        snprintf(buf, sizeof(buf), "at cycle %lld", (long long)tx[at].cycle);
+        s += buf;
+    } else {
+        s += "(ended)";
+    }
+    return s;
+}
+
+static std::string packet_context(const std::vector<const TxPacket*>& packets, size_t at) {
+    std::string s;
+    char buf[32];
+    size_t from = (at > 2) ? at - 2 : 0;
+    for (size_t i = from; i < std::min(packets.size(), at + 3); ++i) {
+        s += (i == at) ? "[" : "";
+        for (size_t j = 0; j < packets[i]->data.size(); ++j) {
+            snprintf(buf, sizeof(buf), j ? " %02x" : "%02x", packets[i]->data[j]);
+            s += buf;
+        }
+        s += (i == at) ? "] " : " ";
+    }
+    if (at < packets.size()) {
+        snprintf(buf, sizeof(buf), "at cycle %lld", (long long)packets[at]->cycle);
+        s += buf;
+    } else {
+        s += "(ended)";
+    }
+    return s;
+}
+
+/**
+ * Play case 'seed' to the 6301 and then to the high level engine and compare
+ * what they sent
+ */
+static CaseDiff diff_case(uint64_t seed, int ms, const TraceOptions& opt, bool verbose) {
+    HostIkbd& lle = HostIkbd::instance();
+    HostHle& hle = HostHle::instance();
+    std::vector<SentCommand> sent;
+    std::vector<SentCommand> hle_sent;
+
+    // The same commands at the same points in the script, each stamped with
+    // its own engine's clock
+    play_case(lle, seed, ms, opt, &sent);
+    play_case(hle, seed, ms, opt, &hle_sent);
+    const std::vector<HostTxByte>& a = lle.tx();
+    const std::vector<HostTxByte>& b = hle.tx();
+    // The high level engine acts on a command as soon as it has it
+    std::vector<TxPacket> lle_packets = tx_packets(a, sent, lle.rx(), MONITOR_GRACE);
+    std::vector<TxPacket> hle_packets = tx_packets(b, hle_sent, hle.rx(), 0);
+
+    CaseDiff d;
+    d.lle_bytes = a.size();
+    d.hle_bytes = b.size();
+    size_t n = std::min(a.size(), b.size());
+    size_t i = 0;
+    while (i < n && a[i].data == b[i].data) {
+        ++i;
+    }
+    if (i < a.size() || i < b.size()) {
+        d.first = (long)i;
+    }
+
+    for (int s = 0; s < STREAMS; ++s) {
+        std::vector<const TxPacket*> x = tx_stream(lle_packets, s);
+        std::vector<const TxPacket*> y = tx_stream(hle_packets, s);
+        size_t k = 0;
+        for (; k < std::min(x.size(), y.size()) && x[k]->data == y[k]->data; ++k) {
+            int64_t delta = std::abs((int64_t)(y[k]->cycle - x[k]->cycle));
+            d.stamp_total += delta;
+            d.stamp_max = std::max(d.stamp_max, delta);
+        }
+        d.stamped += k;
+        if ((k < x.size() || k < y.size()) && !d.content()) {
+            d.stream = s;
+            d.packet = (long)k;
+            d.lle_packets = x.size();
+            d.hle_packets = y.size();
+            d.lle_context = packet_context(x, k);
+            d.hle_context = packet_context(y, k);
+        }
+        if (verbose) {
+            printf("%-11s %4zu /%4zu packets  %s\n", stream_names[s], x.size(), y.size(),
+                (k < x.size() || k < y.size()) ? "differ" : "match");
+        }
+    }
+    if (d.first >= 0 && !d.content()) {
+        d.lle_context = tx_context(a, i);
+        d.hle_context = tx_context(b, i);
+    }
+
+    std::vector<COUNTER_VAR> lle_latency = reply_latency(sent, lle_packets);
+    std::vector<COUNTER_VAR> hle_latency = reply_latency(hle_sent, hle_packets);
+    for (size_t c = 0; c < sent.size(); ++c) {
+        if (!sent[c].reply) {
+            continue;
+        }
+        LatencyStats& l = d.latency[sent[c].command];
+        if (lle_latency[c] >= 0 && hle_latency[c] >= 0) {
+            ++l.count;
+            l.lle_total += lle_latency[c];
+            l.hle_total += hle_latency[c];
+        } else if (lle_latency[c] >= 0 || hle_latency[c] >= 0) {
+            ++l.missing;
+        }
+    }
+
+    if (verbose) {
+        printf("%-20s %s\n", "6301", "HLE");
+        for (size_t j = 0; j < std::max(a.size(), b.size()); ++j) {
+            char left[32] = "";
+            if (j < a.size()) {
+                snprintf(left, sizeof(left), "%10lld %02x", (long long)a[j].cycle, a[j].data);
+            }
+            if (j < b.size()) {
+                printf("%-20s %10lld %02x%s\n", left, (long long)b[j].cycle, b[j].data,
+                    (j < a.size() && a[j].data != b[j].data) ? " *" : "");
+            } else {
+                printf("%s\n", left);
+            }
+        }
+        printf("%10s command  6301 took  HLE took\n", "queued");
+        for (size_t c = 0; c < sent.size(); ++c) {
+            if (sent[c].reply) {
+                printf("%10lld   0x%02x %10lld %9lld\n", (long long)sent[c].cycle, sent[c].command,
+                    (long long)lle_latency[c], (long long)hle_latency[c]);
+            } else {
+                printf("%10lld   0x%02x\n", (long long)sent[c].cycle, sent[c].command);
+            }
+        }
+    }
+    return d;
+}
+
+/**
+ * Print the comparison of all the cases, returns the number whose content
+ * differs
+ */
+static int report_diff(const std::vector<CaseDiff>& diffs, uint64_t first) {
+    int timing = 0;
+    int content = 0;
+    int streams[STREAMS] = { 0 };
+    size_t stamped = 0;
+    int64_t stamp_total = 0;
+    int64_t stamp_max = 0;
+    std::map<uint8_t, LatencyStats> latency;
+
+    for (size_t i = 0; i < diffs.size(); ++i) {
+        const CaseDiff& d = diffs[i];
+        if (d.content()) {
+            ++streams[d.stream];
+            if (++content <= 10) {
+                printf("case %llu differs in its %s at packet %ld of %zu/%zu, run with -d -v %llu to see both\n",
+                    (unsigned long long)(first + i), stream_names[d.stream], d.packet,
+                    d.lle_packets, d.hle_packets, (unsigned long long)(first + i));
+                printf("  6301 %s\n  HLE  %s\n", d.lle_context.c_str(), d.hle_context.c_str());
+            }
+        } else if (!d.same()) {
+            ++timing;
+        }
+        stamped += d.stamped;
+        stamp_total += d.stamp_total;
+        stamp_max = std::max(stamp_max, d.stamp_max);
+        for (auto& it : d.latency) {
+            LatencyStats& l = latency[it.first];
+            l.count += it.second.count;
+            l.missing += it.second.missing;
+            l.lle_total += it.second.lle_total;
+            l.hle_total += it.second.hle_total;
+        }
+    }
+    printf("%d of %zu cases identical, %d differ only in timing, %d in content\n",
+        (int)diffs.size() - timing - content, diffs.size(), timing, content);
+    for (int s = 0; s < STREAMS; ++s) {
+        if (streams[s]) {
+            printf("  %d first differ in their %s\n", streams[s], stream_names[s]);
+        }
+    }
+    printf("send time difference over %zu matching packets: avg %.1f max %lld cycles\n",
+        stamped, stamped ? (double)stamp_total / stamped : 0.0, (long long)stamp_max);
+    printf("command  answered  6301 avg   HLE avg     delta  one only\n");
+    for (auto& it : latency) {
+        const LatencyStats& l = it.second;
+        double lle_avg = l.count ? (double)l.lle_total / l.count : 0.0;
+        double hle_avg = l.count ? (double)l.hle_total / l.count : 0.0;
+        printf("  0x%02x   %8d %9.0f %9.0f %+9.0f  %8d\n", it.first, l.count, lle_avg, hle_avg,
+            hle_avg - lle_avg, l.missing);
+    }
+    return content;
+}
+
+static void print_result(FILE* f, uint64_t seed, const CaseResult& r) {
+    fprintf(f, "%llu %zu %016llx %lld %lld %d\n", (unsigned long long)seed, r.tx_bytes,
+        (unsigned long long)r.hash, (long long)r.last_tx, (long long)r.idle, r.crashed ? 1 : 0);
+}
+
+static bool read_result(FILE* f, uint64_t& seed, CaseResult& r) {
+    unsigned long long s, hash;
+    long long last, idle;
+    size_t n;
+    int c;
+    if (fscanf(f, "%llu %zu %llx %lld %lld %d", &s, &n, &hash, &last, &idle, &c) != 6) {
+        return false;
+    }
+    seed = s;
+    r.tx_bytes = n;
+    r.hash = hash;
+    r.last_tx = last;
+    r.idle = idle;
+    r.crashed = c != 0;
+    return true;
+}
+
+static void usage(const char* prog) {
+    printf("Usage: %s [-n cases] [-b first_case] [-t ms_per_case] [-j threads] [-s] [-o out] [-c reference] [-v case [-R session]] [-d [-m]]\n", prog);
+    printf("  -o  write one line per case to a reference file\n");
+    printf("  -c  compare against a reference file written by -o, exits 1 on any difference\n");
+    printf("  -v  run a single case and print every byte it sends\n");
+    printf("  -s  disable idle loop skipping\n");
+    printf("  -d  compare the 6301 with the high level engine, without memory commands\n");
+    printf("  -m  include mouse movement in the -d comparison\n");
+#if HD6301_SESSION
+    printf("  -R  with -v, record the case's session to a file for ikbd_replay\n");
+#endif
+}
+
+int main(int argc, char** argv) {
+    int cases = 1000;
+    uint64_t first = 0;
+    int ms = 300;
+    int jobs = std::max(1u, std::thread::hardware_concurrency());
+    bool idle_skip = true;
+    const char* out = nullptr;
+    const char* ref = nullptr;
+    long long verbose = -1;
+    const char* session = nullptr;
+    bool diff = false;
+    TraceOptions diff_opt;
+    diff_opt.motion = false;
+    diff_opt.memory = false;
+    diff_opt.glitches = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:b:t:j:so:c:v:dmR:h")) != -1) {
+        switch (opt) {
+        case 'n': cases = std::max(1, atoi(optarg)); break;
+        case 'b': first = strtoull(optarg, nullptr, 0); break;
+        case 't': ms = std::max(1, atoi(optarg)); break;
+        case 'j': jobs = std::max(1, atoi(optarg)); break;
+        case 's': idle_skip = false; break;
+        case 'o': out = optarg; break;
+        case 'c': ref = optarg; break;
+        case 'v': verbose = atoll(optarg); break;
+        case 'd': diff = true; break;
+        case 'm': diff_opt.motion = true; break;
+        case 'R': session = optarg; break;
+        default:
+            usage(argv[0]);
+            return (opt == 'h') ? 0 : 1;
+        }
+    }
+
+    if (verbose >= 0 && diff) {
+        hd6301_set_idle_skip(idle_skip);
+        std::vector<CaseDiff> d = { diff_case(verbose, ms, diff_opt, true) };
+        return report_diff(d, verbose) ? 1 : 0;
+    }
+    if (verbose >= 0) {
+        hd6301_set_idle_skip(idle_skip);
+#if HD6301_SESSION
+        // The reset in run_case() starts the first segment
+        if (session) {
+            hd6301_session_start();
+        }
+#endif
+        CaseResult r = run_case(verbose, ms, true);
+        print_result(stdout, verbose, r);
+#if HD6301_SESSION
+        if (session) {
+            hd6301_session_stop();
+            FILE* f = fopen(session, "w");
+            if (!f) {
+                printf("Couldn't write %s\n", session);
+                return 1;
+            }
+            hd6301_session_dump(f);
+            fclose(f);
+        }
+#endif
+        return 0;
+    }
+
+    // Threads take the next case as they finish one so slow cases even out
+    std::vector<CaseResult> results(cases);
+    std::atomic<int> next(0);
+    std::vector<std::thread> pool;
+    auto t0 = std::chrono::steady_clock::now();
+    if (diff) {
+        std::vector<CaseDiff> diffs(cases);
+        for (int j = 0; j < jobs; ++j) {
+            pool.emplace_back([&]() {
+                hd6301_set_idle_skip(idle_skip);
+                for (int i; (i = next++) < cases; ) {
+                    diffs[i] = diff_case(first + i, ms, diff_opt, false);
+                }
+            });
+        }
+        for (auto& t : pool) {
+            t.join();
+        }
+        return report_diff(diffs, first) ? 1 : 0;
+    }
+    for (int j = 0; j < jobs; ++j) {
+        pool.emplace_back([&]() {
+            hd6301_set_idle_skip(idle_skip);
+            for (int i; (i = next++) < cases; ) {
+                results[i] = run_case(first + i, ms, false);
+            }
+        });
+    }
+    for (auto& t : pool) {
+        t.join();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+    uint64_t digest = 1469598103934665603ull;
+    size_t tx_total = 0;
+    int crashes = 0;
+    for (auto& r : results) {
+        digest = fnv(digest, r.hash);
+        tx_total += r.tx_bytes;
+        crashes += r.crashed ? 1 : 0;
+    }
+    printf("%d cases of %dms on %d threads in %.2fs (%.1f emulated MHz), %zu bytes sent, %d crashed, digest %016llx\n",
+        cases, ms, jobs, seconds, (double)cases * (BOOT_CYCLES + ms * CYCLES_PER_MS) / seconds / 1e6,
+        tx_total, crashes, (unsigned long long)digest);
+
+    if (out) {
+        FILE* f = fopen(out, "w");
+        if (!f) {
+            printf("Couldn't write %s\n", out);
+            return 1;
+        }
+        for (int i = 0; i < cases; ++i) {
+            print_result(f, first + i, results[i]);
+        }
+        fclose(f);
+    }
+
+    int failed = 0;
+    if (ref) {
+        FILE* f = fopen(ref, "r");
+        if (!f) {
+            printf("Couldn't read %s\n", ref);
+            return 1;
+        }
+        uint64_t seed;
+        CaseResult expected;
+        int compared = 0;
+        while (read_result(f, seed, expected)) {
+            if (seed < first || seed >= first + cases) {
+                continue;
+            }
+            ++compared;
+            const CaseResult& got = results[seed - first];
+            if (got != expected) {
+                if (++failed <= 10) {
+                    printf("case %llu differs, run with -v %llu to see its output\n  expected ",
+                        (unsigned long long)seed, (unsigned long long)seed);
+                    print_result(stdout, seed, expected);
+                    printf("  got      ");
+                    print_result(stdout, seed, got);
+                }
+            }
+        }
+        fclose(f);
+        printf("%d of %d cases compared differ\n", failed, compared);
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,387 @@
+/*
+ * Atari ST RP2040 IKBD Emulator
+ * Copyright (C) 2021 Roy Hopkins
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+/*
+ * Plays back 6301 sessions recorded by a firmware or host build with
+ * HD6301_SESSION=1 (see 6301/session.h). Each segment of the log is
+ * restored from its snapshot and then given exactly what the recorded 6301
+ * was given, at the same cycles, so the ROM runs through the same code. The
+ * bytes it sends are checked against the ones in the log, and the run can be
+ * timed, profiled or single stepped on the host like any other workload.
+ */
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "6301.h"
+#include "cpu.h"
+#include "session.h"
+
+#define ROMBASE     256
+
+extern unsigned char rom_HD6301V1ST_img[];
+extern unsigned int rom_HD6301V1ST_img_len;
+
+struct SessionEvent {
+    COUNTER_VAR cycle;          // As recorded
+    uint8_t     type;
+    uint8_t     value;
+};
+
+struct Segment {
+    session_header              header;
+    std::vector<uint8_t>        snapshot;
+    std::vector<SessionEvent>   events;
+};
+
+/**
+ * Values the ROM reads through one of the callbacks, as they were recorded
+ */
+struct PulledInput {
+    std::vector<SessionEvent> changes;
+    size_t      next = 0;
+    int         value = 0;
+
+    int at(COUNTER_VAR cycle) {
+        while (next < changes.size() && changes[next].cycle <= cycle) {
+            value = changes[next++].value;
+        }
+        return value;
+    }
+};
+
+/**
+ * Everything the callbacks need while a segment is played
+ */
+struct Playback {
+    const Segment*  segment = nullptr;
+    COUNTER_VAR     offset = 0;         // Add to a recorded cycle to get ours
+    PulledInput     pulled[SESSION_TYPES];
+    std::vector<SessionEvent> tx;       // Recorded bytes sent
+    size_t          tx_next = 0;
+    size_t          tx_extra = 0;       // Bytes sent that weren't recorded
+    long            first_error = -1;   // Index into tx, or tx.size() for an extra byte
+    COUNTER_VAR     error_cycle = 0;
+    uint8_t         error_data = 0;
+    bool            verbose = false;
+};
+
+static Playback playback;
+
+static const char* event_name(int type) {
+    static const char* names[SESSION_TYPES] = {
+        "?", "rx", "tx", "key", "buttons", "joystick", "mouse en", "mouse", "tx ready", "wake"
+    };
+    return (type > 0 && type < SESSION_TYPES) ? names[type] : "?";
+}
+
+/**
+ * Pick the hex dumps of the segments out of a console log
+ */
+static bool read_log(const char* path, std::vector<std::vector<uint8_t>>& raw) {
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        printf("Couldn't read %s\n", path);
+        return false;
+    }
+    char line[512];
+    bool in_session = false;
+    while (fgets(line, sizeof(line), f)) {
+        if (strstr(line, "session: begin")) {
+            // A later dump replaces an earlier one
+            raw.clear();
+            in_session = true;
+        } else if (strstr(line, "session: end")) {
+            in_session = false;
+        } else if (in_session && strstr(line, "session: segment")) {
+            raw.emplace_back();
+        } else if (in_session && line[0] == '>' && !raw.empty()) {
+            for (char* p = line + 1; isxdigit((unsigned char)p[0]) && isxdigit((unsigned char)p[1]); p += 2) {
+                char hex[3] = { p[0], p[1], 0 };
+                raw.back().push_back((uint8_t)strtoul(hex, nullptr, 16));
+            }
+        }
+    }
+    fclose(f);
+    return true;
+}
+
+static bool decode(const std::vector<uint8_t>& raw, Segment& seg) {
+    if (raw.size() < sizeof(session_header)) {
+        return false;
+    }
+    memcpy(&seg.header, raw.data(), sizeof(session_header));
+    if (seg.header.magic != SESSION_MAGIC || seg.header.length != raw.size() ||
+            sizeof(session_header) + seg.header.snap_size > raw.size()) {
+        return false;
+    }
+    size_t i = sizeof(session_header);
+    seg.snapshot.assign(raw.begin() + i, raw.begin() + i + seg.header.snap_size);
+    i += seg.header.snap_size;
+    COUNTER_VAR cycle = seg.header.start;
+    while (i < raw.size()) {
+        uint8_t b = raw[i++];
+        COUNTER_VAR delta = b >> 4;
+        if (delta == 15) {
+            int shift = 0;
+            uint8_t more;
+            do {
+                if (i >= raw.size()) {
+                    return false;
+                }
+                more = raw[i++];
+                delta += (COUNTER_VAR)(more & 0x7f) << shift;
+                shift += 7;
+            } while (more & 0x80);
+        }
+        if (i >= raw.size()) {
+            return false;
+        }
+        cycle += delta;
+        seg.events.push_back({ cycle, (uint8_t)(b & 0x0f), raw[i++] });
+    }
+    return true;
+}
+
+static bool pushed(int type) {
+    return type == SESSION_RX || type == SESSION_KEY || type == SESSION_TX_READY || type == SESSION_WAKE;
+}
+
+struct SegmentResult {
+    COUNTER_VAR cycles = 0;
+    size_t      tx_matched = 0;
+    size_t      late = 0;           // Pushed events we couldn't stop the 6301 for in time
+    bool        ok = false;
+};
+
+/**
+ * Restore the segment's snapshot and feed it its events
+ */
+static SegmentResult play(const Segment& seg, bool verbose) {
+    static BYTE* pram = nullptr;
+    if (!pram) {
+        pram = hd6301_init();
+        if (!pram) {
+            printf("Failed to initialise HD6301\n");
+            exit(-1);
+        }
+    }
+    playback = Playback();
+    playback.segment = &seg;
+    playback.verbose = verbose;
+    for (auto& e : seg.events) {
+        if (e.type == SESSION_TX) {
+            playback.tx.push_back(e);
+        } else if (!pushed(e.type) && e.type < SESSION_TYPES) {
+            playback.pulled[e.type].changes.push_back(e);
+        }
+    }
+
+    // The reset builds the decode tables, the snapshot then replaces the rest.
+    // The key matrix is rebuilt from the keys held when it was taken.
+    memset(pram, 0, ROMBASE);
+    memcpy(pram + ROMBASE, rom_HD6301V1ST_img, rom_HD6301V1ST_img_len);
+    hd6301_reset(1);
+    hd6301_tx_empty(!seg.header.tx_hold);
+    SegmentResult r;
+    if ((int)seg.snapshot.size() != hd6301_snapshot_size() ||
+            !hd6301_restore(seg.snapshot.data(), (int)seg.snapshot.size())) {
+        printf("  snapshot was taken with a different ROM or core\n");
+        return r;
+    }
+    playback.offset = cpu.ncycles - seg.header.start;
+    COUNTER_VAR start = cpu.ncycles;
+
+    for (auto& e : seg.events) {
+        if (!pushed(e.type)) {
+            continue;
+        }
+        COUNTER_VAR at = e.cycle + playback.offset;
+        if (cpu.ncycles < at) {
+            hd6301_run_clocks(at - cpu.ncycles);
+        }
+        if (cpu.ncycles != at) {
+            ++r.late;
+        }
+        if (verbose) {
+            printf("%10lld %-9s %02x\n", (long long)e.cycle, event_name(e.type), e.value);
+        }
+        switch (e.type) {
+        case SESSION_RX:        hd6301_receive_byte(e.value); break;
+        case SESSION_KEY:       hd6301_set_key(e.value & 0x7f, e.value & 0x80); break;
+        case SESSION_TX_READY:  hd6301_tx_empty(e.value); break;
+        default:                break;  // The wake-up bit is cleared by the next slice
+        }
+    }
+    // Run on to the last event so the final bytes sent are checked too
+    if (!seg.events.empty()) {
+        COUNTER_VAR end = seg.events.back().cycle + playback.offset + 1;
+        if (cpu.ncycles < end) {
+            hd6301_run_clocks(end - cpu.ncycles);
+        }
+    }
+    r.cycles = cpu.ncycles - start;
+    r.tx_matched = playback.tx_next;
+    r.ok = playback.first_error < 0 && playback.tx_next == playback.tx.size() && !r.late;
+    return r;
+}
+
+extern "C" {
+
+unsigned char st_keydown(const unsigned char code) {
+    const session_header& h = playback.segment->header;
+    return (h.keys[(code >> 3) & 15] >> (code & 7)) & 1;
+}
+
+int st_mouse_buttons() {
+    return playback.pulled[SESSION_BUTTONS].at(cpu.ncycles - playback.offset);
+}
+
+unsigned char st_joystick() {
+    return playback.pulled[SESSION_JOYSTICK].at(cpu.ncycles - playback.offset);
+}
+
+int st_mouse_enabled() {
+    return playback.pulled[SESSION_MOUSE_EN].at(cpu.ncycles - playback.offset);
+}
+
+void mouse_tick(int64_t cpu_cycles, int* x_counter, int* y_counter) {
+    PulledInput& mouse = playback.pulled[SESSION_MOUSE];
+    int value = mouse.at(cpu_cycles - playback.offset);
+    if (mouse.next) {
+        // The counters are a repeating 4 bit pattern
+        *x_counter = (int)((value & 0x0f) * 0x11111111u);
+        *y_counter = (int)((value >> 4) * 0x11111111u);
+    }
+}
+
+void serial_send(unsigned char data) {
+    Playback& p = playback;
+    COUNTER_VAR cycle = cpu.ncycles - p.offset;
+    if (p.verbose) {
+        printf("%10lld %-9s %02x\n", (long long)cycle, "sent", data);
+    }
+    if (p.tx_next < p.tx.size()) {
+        const SessionEvent& e = p.tx[p.tx_next];
+        if ((e.cycle != cycle || e.value != data) && p.first_error < 0) {
+            p.first_error = (long)p.tx_next;
+            p.error_cycle = cycle;
+            p.error_data = data;
+        }
+        ++p.tx_next;
+    } else {
+        if (p.first_error < 0) {
+            p.first_error = (long)p.tx.size();
+            p.error_cycle = cycle;
+            p.error_data = data;
+        }
+        ++p.tx_extra;
+    }
+}
+
+}
+
+static void usage(const char* prog) {
+    printf("Usage: %s [-s] [-v] log\n", prog);
+    printf("  Plays back the last session dump found in a console log\n");
+    printf("  -s  disable idle loop skipping\n");
+    printf("  -v  print the pushed events and the bytes sent\n");
+}
+
+int main(int argc, char** argv) {
+    bool idle_skip = true;
+    bool verbose = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "svh")) != -1) {
+        switch (opt) {
+        case 's': idle_skip = false; break;
+        case 'v': verbose = true; break;
+        default:
+            usage(argv[0]);
+            return (opt == 'h') ? 0 : 1;
+        }
+    }
+    if (optind >= argc) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    std::vector<std::vector<uint8_t>> raw;
+    if (!read_log(argv[optind], raw)) {
+        return 1;
+    }
+    if (raw.empty()) {
+        printf("No session found in %s\n", argv[optind]);
+        return 1;
+    }
+    hd6301_set_idle_skip(idle_skip);
+#if defined(IKBD_SYMBOL_FILE)
+    if (hd6301_load_symbols(IKBD_SYMBOL_FILE)) {
+        printf("Couldn't load the ROM symbols from %s\n", IKBD_SYMBOL_FILE);
+    }
+#endif
+#if defined(HD6301_PROFILE) && HD6301_PROFILE
+    hd6301_profile_clear();
+#endif
+
+    int failed = 0;
+    COUNTER_VAR total = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < raw.size(); ++i) {
+        Segment seg;
+        if (!decode(raw[i], seg)) {
+            printf("segment %zu: damaged, skipped\n", i);
+            ++failed;
+            continue;
+        }
+        SegmentResult r = play(seg, verbose);
+        total += r.cycles;
+        printf("segment %u: %lld cycles from %lld, %zu events, %zu of %zu bytes sent match%s%s\n",
+            seg.header.seq, (long long)r.cycles, (long long)seg.header.start, seg.events.size(),
+            r.tx_matched, playback.tx.size(), seg.header.truncated ? ", truncated when recorded" : "",
+            r.ok ? "" : ", DIFFERS");
+        if (playback.first_error >= 0) {
+            size_t e = (size_t)playback.first_error;
+            printf("  byte %zu: sent %02x at cycle %lld", e, playback.error_data, (long long)playback.error_cycle);
+            if (e < playback.tx.size()) {
+                printf(", recorded %02x at cycle %lld\n", playback.tx[e].value, (long long)playback.tx[e].cycle);
+            } else {
+                printf(", nothing recorded\n");
+            }
+        }
+        if (r.late) {
+            printf("  %zu events arrived after the cycle they were recorded on\n", r.late);
+        }
+        if (!r.ok) {
+            ++failed;
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    printf("%lld cycles played in %.3fs (%.1f emulated MHz), %d of %zu segments differ\n",
+        (long long)total, seconds, total / seconds / 1e6, failed, raw.size());
+#if defined(HD6301_PROFILE) && HD6301_PROFILE
+    hd6301_profile_dump(16);
+#endif
+    return failed ? 1 : 0;
+}
@@ -17,11 +17,11 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 */
 #include <stdint.h>
-#include "pico/stdlib.h"
 
 #pragma once
 
 #ifdef __cplusplus 
+#include "pico/stdlib.h"
 
 class AtariSTMouse {
 private:
@@ -33,37 +33,41 @@ public:
 public:
 
     /**
-     * Set the speed of the mouse. The value is transformed into a frequency at which the
+     * Set the speed of the mouse. The value is transformed into a period at which the
      * mouse quadrature encoder value rotates. The units are fairly arbritrary but range from
      * 0 for stationary up to a maximum of about +/- 50. Make sure the USB mouse routine scales the
      * values accordingly.
      */
     void set_speed(int x, int y);
 
-    /**
-     * Periodic update function. Call as fast as possible.
-     */
-    void update();
-
     const int get_x_reg() const;
     const int get_y_reg() const;
 
 private:
-    void set_speed_internal(int speed, int& period);
-
-private:
-    // Time in microseconds between each rotation of the mouse state.
-    // The sign is used to indicate the direction.
-    int x_period_us = 0;
-    int y_period_us = 0;
+    /**
+     * One quadrature encoder. A hardware alarm rotates the register every period so
+     * the steps are evenly spaced whatever core0 is doing.
+     */
+    struct Axis {
+        // Time in microseconds between each rotation of the mouse state.
+        // The sign is used to indicate the direction.
+        volatile int period_us = 0;
+        // The last time the register was rotated
+        absolute_time_t last;
+        // Pending alarm, 0 if the axis is stopped
+        alarm_id_t alarm = 0;
+        // The mouse register
+        volatile unsigned int reg;
+        int pin_a = -1;
+        int pin_b = -1;
+    };
 
-    // The last time each register was rotated
-    absolute_time_t last_x_us;
-    absolute_time_t last_y_us;
+    void set_speed_internal(int speed, Axis& axis);
+    static int64_t on_alarm(alarm_id_t id, void* user_data);
 
-    // The mouse registers
-    unsigned int x_reg;
-    unsigned int y_reg;
+private:
+    Axis x;
+    Axis y;
 };
 
 extern "C" {
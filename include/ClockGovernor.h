@@ -0,0 +1,86 @@
+/*
+ * Atari ST RP2040 IKBD Emulator
+ * Copyright (C) 2021 Roy Hopkins
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#pragma once
+
+#include <stdint.h>
+#include "config.h"
+
+// Time for the regulator to reach a higher voltage before the clock goes up
+#define CLOCK_VREG_SETTLE_US    1000
+
+class UserInterface;
+
+/**
+ * Runs the RP2040 at the lowest system clock that leaves core1 time to
+ * spare. Each step of the table pairs a clock with the core voltage it is
+ * run at, 1.10V for all of them unless CLOCK_UNDERVOLT is defined.
+ *
+ * Once a second EmulatorLoad publishes the busiest core1 slice as a share
+ * of its budget. The clock goes down a step when that slice, scaled to the
+ * lower clock, would still leave CLOCK_MARGIN_PERCENT of its budget, and up
+ * a step when the margin is gone. A missed deadline goes straight to the top
+ * step, as does the ST being switched back on, and the ST being off drops
+ * to the bottom one. The window in progress when the clock changed is
+ * ignored.
+ *
+ * The UART and I2C dividers are worked out from clk_peri and clk_sys, which
+ * both follow the system clock, so they are set again on each change. While
+ * the PLL relocks clk_peri runs from clk_ref, so the change waits until no
+ * byte is going out to the ST, nothing has come in for two byte times with
+ * the line high, and no display flush is in progress. The ST can still start
+ * a byte in the few hundred microseconds the change takes, and that one byte
+ * is then lost. The microsecond timer runs from the crystal and is not
+ * affected.
+ */
+class ClockGovernor {
+private:
+    ClockGovernor() = default;
+
+public:
+    static ClockGovernor& instance();
+
+    void set_ui(UserInterface& ui) { ui_ = &ui; }
+
+    /**
+     * Core0: called every millisecond while CLOCK_GOVERNOR is defined
+     */
+    void update();
+
+    /**
+     * The system clock now, in kHz
+     */
+    uint32_t khz() const;
+
+    /**
+     * Print the clock and the number of changes to stdio
+     */
+    void dump() const;
+
+private:
+    void set(int next);
+
+private:
+    UserInterface*  ui_ = nullptr;
+    int             step = -1;          // Index in the table, -1 until the first update
+    bool            dormant = false;
+    bool            settle = false;     // Skip the window in progress at the change
+    uint32_t        window_seen = 0;
+    uint32_t        missed_seen = 0;
+    uint32_t        changes = 0;
+};
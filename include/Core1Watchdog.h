@@ -0,0 +1,101 @@
+/*
+ * Atari ST RP2040 IKBD Emulator
+ * Copyright (C) 2021 Roy Hopkins
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#pragma once
+
+#include <stdint.h>
+
+// Core1 is restarted when it hasn't finished a slice for this long
+#define WATCHDOG_STALL_US       5000
+// The hardware watchdog reboots the chip if core0 hasn't fed it for this
+// long, longer than the worst flash sector erase
+#define WATCHDOG_TIMEOUT_MS     1000
+// Restarts in a row without core1 coming back before the hardware watchdog
+// is left to reboot the chip
+#define WATCHDOG_MAX_RESTARTS   3
+
+/**
+ * Core0 watches a heartbeat that core1 gives at the end of every slice, and
+ * while it is parked. If it stops for WATCHDOG_STALL_US core1 is reset and
+ * launched again without touching USB, the UART or the display. The 6301 is
+ * restored from the last good snapshot ReadySnapshot keeps, so the modes the
+ * ST selected are kept, or from the ready snapshot if that didn't come back
+ * either. Bytes from the ST still queued for the old core1 are dropped so
+ * the SCI starts on a command boundary.
+ *
+ * A 6301 program crash is already recovered on core1 by ReadySnapshot, this
+ * catches core1 itself hanging. If core0 hangs, or core1 can't be brought
+ * back, the RP2040 hardware watchdog reboots the chip.
+ */
+class Core1Watchdog {
+private:
+    Core1Watchdog() = default;
+
+public:
+    static Core1Watchdog& instance();
+
+    /**
+     * Core0: launch core1 running entry and start the hardware watchdog
+     */
+    void start(void (*entry)());
+
+    /**
+     * Core0: called every millisecond, feeds the hardware watchdog
+     */
+    void update();
+
+    /**
+     * Core1: a slice has finished
+     */
+    void beat() { beats = beats + 1; }
+
+    /**
+     * Core1: stop or start watching, for when core1 stands still on purpose
+     */
+    void hold(bool en) { held = en; }
+
+    /**
+     * Core1: true when it has been launched again after a stall, and whether
+     * the last good snapshot should be tried before the ready one
+     */
+    bool restarted() const { return restarts != 0; }
+    bool good_first() const { return failing <= 1; }
+
+    /**
+     * Restarts since boot and the time from the last restart to the first
+     * heartbeat after it
+     */
+    uint32_t restart_count() const { return restarts; }
+    uint32_t failover_time_us() const { return failover_us; }
+
+private:
+    void restart(uint32_t now);
+
+private:
+    void                (*entry_)() = nullptr;
+    volatile uint32_t   beats = 0;
+    volatile bool       held = false;
+    volatile uint32_t   restarts = 0;
+    volatile uint32_t   failing = 0;    // Restarts since the last heartbeat
+    uint32_t            seen = 0;       // Heartbeat count last seen
+    uint32_t            seen_us = 0;    // When it was seen to change
+    uint32_t            checked_us = 0; // Last update()
+    uint32_t            stalled_us = 0; // Last heartbeat before the restarts
+    uint32_t            restart_us = 0;
+    uint32_t            failover_us = 0;
+};
@@ -0,0 +1,48 @@
+/*
+ * Atari ST RP2040 IKBD Emulator
+ * Copyright (C) 2021 Roy Hopkins
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#pragma once
+
+#include <stdint.h>
+#include "pico/time.h"
+
+/**
+ * A hardware alarm owned by one core, used to put that core to sleep with
+ * WFE until a deadline. The alarm interrupt is taken on the core that called
+ * init(), so waking up does not depend on the other core, unlike the SDK
+ * sleep_until() whose alarm pool interrupt is handled on core0.
+ */
+class CoreAlarm {
+public:
+    /**
+     * Claim an alarm for the calling core. Falls back to spinning if none
+     * are free. Can be called again after the core has been reset.
+     */
+    void init();
+
+    /**
+     * Sleep until the given time
+     */
+    void sleep_until(absolute_time_t t);
+
+private:
+    static void on_alarm(unsigned int alarm_num);
+
+private:
+    int     alarm_num = -1;
+};
@@ -0,0 +1,214 @@
+/*
+ * Atari ST RP2040 IKBD Emulator
+ * Copyright (C) 2021 Roy Hopkins
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#pragma once
+
+#include <stdint.h>
+#include "SpscQueue.h"
+#include "MouseModel.h"
+
+class IkbdHle;
+
+// Queue sizes, each must be a power of two
+#define LINK_INPUT_QUEUE 64
+#define LINK_RX_QUEUE    64
+#define LINK_TX_QUEUE    16
+
+// Time for one byte at 7812 baud, 10 bits including start and stop, in
+// 6301 cycles (1MHz)
+#define LINK_CYCLES_PER_BYTE 1280
+
+// Input events taken off the queue and waiting to be applied on core1
+#define LINK_PENDING_INPUTS 32
+
+// Input is applied this long after it was posted so that an event posted
+// while core1 is running a slice still lands in the next one at the right
+// offset. One slice.
+#define LINK_INPUT_DELAY_CYCLES 1000
+
+// Shortest time each state of a key, the mouse buttons or a joystick is held
+// so the ROM sees it. The ROM scans one keyboard column about every 2ms so
+// it takes 30ms to see the whole matrix. The buttons and joystick are
+// checked more often. Measured with the host harness.
+#define LINK_KEY_HOLD_CYCLES     32000
+#define LINK_BUTTON_HOLD_CYCLES  12000
+#define LINK_JOYSTICK_HOLD_CYCLES 6000
+
+enum InputEventType {
+    INPUT_KEY,              // code is the ST scancode, value 1 for down
+    INPUT_MOUSE_BUTTONS,
+    INPUT_JOYSTICK,
+    INPUT_MOUSE_ENABLED,
+    INPUT_MOUSE_X,          // value is the motion in ST mouse counts
+    INPUT_MOUSE_Y,
+};
+
+struct InputEvent {
+    uint8_t  type;
+    uint8_t  code;
+    int16_t  value;
+    uint32_t time_us;       // When core0 saw the change
+};
+
+/**
+ * Carries input changes and serial bytes between core0, which runs USB, the
+ * UART and the UI, and core1, which runs the HD6301. Each queue has a single
+ * producer and a single consumer so the two cores never share writable state.
+ * Bytes from the ST are queued by the UART interrupt and handed to the SCI
+ * no faster than the real serial line could deliver them. Bytes to the ST
+ * are queued by core1 and sent by the UART interrupt, so core1 never waits
+ * for the UART.
+ *
+ * The input state seen by the HD6301 is a copy owned by core1 that is only
+ * changed by poll(). Input events carry the time they were posted and are
+ * applied at the same point in emulated time, one slice later. Each state of
+ * a key, the buttons or a joystick is held long enough for the ROM to scan
+ * it, so a tap shorter than a scan, or a press and release close together,
+ * is still seen.
+ */
+class CoreLink {
+private:
+    CoreLink() = default;
+
+public:
+    static CoreLink& instance();
+
+    /**
+     * Core0: queue an input change, stamped with the current time. Returns
+     * false if the queue is full, the caller should try again later.
+     */
+    bool post_input(InputEventType type, uint8_t code, int16_t value);
+
+    /**
+     * Core0 UART interrupt: queue a byte received from the ST. The byte is
+     * dropped and counted if the queue is full.
+     */
+    void post_rx(uint8_t data);
+
+    /**
+     * Core1: called at the start of each slice with the time the slice
+     * represents, relates the input timestamps to the cycle counter
+     */
+    void sync_clock(uint32_t time_us, int64_t cycles);
+
+    /**
+     * Core1: the 6301 runs 1 << turbo cycles per microsecond. Called before
+     * the first poll().
+     */
+    void set_turbo(int shift) { turbo = shift; }
+
+    /**
+     * Core1: apply input changes that are due and pass the next received
+     * byte to the HD6301 if its receive register is free and a byte time has
+     * passed since the last one. Returns the number of cycles until another
+     * byte could be delivered or an input change is due, or 0 if there is
+     * nothing waiting.
+     */
+    int64_t poll(int64_t cycles);
+
+    /**
+     * Core1: queue a byte to send to the ST. Returns false if the queue is
+     * full, hd6301_tx_empty() holds TDRE off so that shouldn't happen.
+     */
+    bool post_tx(uint8_t data);
+
+    /**
+     * Core1: hand the input and the bytes from the ST to the high level
+     * engine instead of the HD6301. Bytes are passed on as they arrive and
+     * input is applied without the delay and hold times the ROM needs.
+     * Called before the first poll().
+     */
+    void set_hle(IkbdHle* engine) { hle = engine; }
+
+    /**
+     * Core1: bytes from the ST are waiting to be delivered
+     */
+    bool rx_pending() const { return !rx.empty(); }
+
+    /**
+     * Core1: drop the bytes from the ST that haven't been delivered, the
+     * line noise while the ST was off
+     */
+    void discard_rx() { uint8_t data; while (rx.pop(data)) { } }
+    bool tx_full() const { return tx.full(); }
+
+    /**
+     * Core0 UART interrupt: take the next byte to send to the ST
+     */
+    bool get_tx(uint8_t& data) { return tx.pop(data); }
+    bool tx_empty() const { return tx.empty(); }
+
+    /**
+     * Bytes waiting in the queues, for the protocol analyser
+     */
+    uint32_t rx_depth() const { return rx.size(); }
+    uint32_t tx_depth() const { return tx.size(); }
+
+    /**
+     * Bytes from the ST lost because the receive queue was full
+     */
+    uint32_t rx_dropped() const { return dropped; }
+
+    // Core1 view of the inputs
+    uint8_t keydown(uint8_t code) const { return (code < 128) ? keys[code] : 0; }
+    int mouse_buttons() const { return buttons; }
+    uint8_t joystick() const { return joy; }
+    bool mouse_enabled() const { return mouse_en; }
+    MouseModel& mouse() { return mouse_model; }
+
+private:
+    // Inputs whose states are held, the keys are 0-127
+    enum {
+        SLOT_BUTTONS = 128,
+        SLOT_JOYSTICK,
+        SLOT_COUNT,
+        SLOT_NONE = SLOT_COUNT
+    };
+
+    struct PendingInput {
+        InputEvent  event;
+        int64_t     due;
+    };
+
+    static int slot(const InputEvent& event);
+    int64_t poll_input(int64_t cycles);
+    void apply(const InputEvent& event, int64_t cycles);
+    void apply_hle(const InputEvent& event);
+
+private:
+    SpscQueue<InputEvent, LINK_INPUT_QUEUE> input;
+    SpscQueue<uint8_t, LINK_RX_QUEUE>       rx;
+    SpscQueue<uint8_t, LINK_TX_QUEUE>       tx;
+    volatile uint32_t                       dropped = 0;
+    int64_t                                 next_rx = 0;
+
+    // Core1 only
+    PendingInput                            pending[LINK_PENDING_INPUTS];
+    int                                     pending_count = 0;
+    uint32_t                                clock_us = 0;
+    int64_t                                 clock_cycles = 0;
+    int                                     turbo = 0;
+    int64_t                                 hold_until[SLOT_COUNT] = {};
+
+    uint8_t                                 keys[128] = {};
+    int                                     buttons = 0;
+    uint8_t                                 joy = 0;
+    bool                                    mouse_en = true;
+    MouseModel                              mouse_model;
+    IkbdHle*                                hle = nullptr;
+};
@@ -0,0 +1,96 @@
+/*
+ * Atari ST RP2040 IKBD Emulator
+ * Copyright (C) 2021 Roy Hopkins
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#pragma once
+
+#include <stdint.h>
+
+// Emulation time summarised in each published window
+#define LOAD_WINDOW_US 1000000
+
+/**
+ * Summary of the core1 emulation slices over one window
+ */
+struct EmulatorLoadStats {
+    uint32_t slices;            // Slices in this window
+    uint64_t budget_total_us;   // Time allowed for all the slices
+    uint64_t busy_total_us;     // Time spent in hd6301_run_clocks()
+    uint32_t busy_max_us;       // Longest slice
+    uint32_t load_max;          // Busiest slice, percent of its budget
+    int32_t  slack_min_us;      // Least time left before the deadline (-ve is an overrun)
+    uint32_t missed_total;      // Deadlines missed since boot
+    uint32_t overrun_worst_us;  // Largest overrun since boot
+    uint64_t dropped_total_us;  // Emulated time given up since boot
+};
+
+/**
+ * Records how long each core1 emulation slice takes compared to its real-time
+ * budget. Slices are recorded on core1 and a completed window is published so
+ * core0 can read it without locking.
+ */
+class EmulatorLoad {
+private:
+    EmulatorLoad() = default;
+
+public:
+    static EmulatorLoad& instance();
+
+    /**
+     * Called by core1 after every slice with the time spent emulating and the
+     * time remaining until the slice deadline.
+     */
+    void record(uint32_t busy_us, int32_t slack_us, uint32_t budget_us);
+
+    /**
+     * Called by core1 when it has fallen too far behind and gives up some
+     * emulated time rather than catching up
+     */
+    void dropped(uint32_t us) { current.dropped_total_us += us; }
+
+    /**
+     * Get the most recently completed window. Returns false if no window has
+     * been completed yet.
+     */
+    bool get(EmulatorLoadStats& stats) const;
+
+    /**
+     * Percentage of the budget used in the given window
+     */
+    static int utilisation(const EmulatorLoadStats& stats);
+
+    /**
+     * Print the most recent window to stdio
+     */
+    void dump() const;
+
+    /**
+     * Number of windows published so far
+     */
+    uint32_t windows() const { return seq >> 1; }
+
+    /**
+     * Deadlines missed since boot, up to date after every slice
+     */
+    uint32_t missed() const { return missed_now; }
+
+private:
+    EmulatorLoadStats           current = {};
+    EmulatorLoadStats           published = {};
+    volatile uint32_t           seq = 0;
+    volatile uint32_t           missed_now = 0;
+};
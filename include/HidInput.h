@@ -18,10 +18,15 @@
 */
 #pragma once
 
+// The keyboards and mice are checked at least this often, in microseconds
+#define HID_POLL_ALL_US 10000
+
 #ifdef __cplusplus
 #include <stdexcept>
-#include <vector>
 #include "UserInterface.h"
+#include "HidLayout.h"
+#include "pico/time.h"
+#include "config.h"
 
 class HidInputException: public std::runtime_error {
 public:
@@ -43,28 +48,108 @@ public:
      */
     void open(const std::string& kbdev, const std::string& mousedev, const std::string joystickdev = "");
 
-    void handle_keyboard();
-    void handle_mouse(const int64_t cpu_cycles);
+    /**
+     * Handle the keyboard and mouse reports that have arrived since the last
+     * call. Called on every pass of the core0 main loop.
+     */
+    void poll(const int64_t cpu_cycles);
+
+    /**
+     * Handle the keyboards and mice whose address bit is set in ready, a
+     * device is only read when its report has arrived
+     */
+    void handle_keyboard(uint32_t ready = 0xffffffffu);
+    void handle_mouse(const int64_t cpu_cycles, uint32_t ready = 0xffffffffu);
     void handle_joystick();
 
     void reset();
 
+    /**
+     * Press and release the keys that differ between the usages a keyboard
+     * was holding and those in its new report, then update held
+     */
+    void update_keys(uint32_t held[HID_KEY_WORDS], const uint32_t keys[HID_KEY_WORDS]);
+
     unsigned char keydown(const unsigned char code) const;
     int mouse_buttons() const; 
     unsigned char joystick() const;
     bool mouse_enabled() const;
 
+#ifdef JOYSTICK_DIRECT
+    /**
+     * Core1: replace the bits of the DB-9 joysticks in the copy of the
+     * joystick byte and buttons held by CoreLink with the pins as they are
+     * now. Joystick 0 is only read while the mouse is off.
+     */
+    void read_direct(uint8_t& joystick, int& buttons, bool mouse_en) const;
+#endif
+
 private:
     bool get_usb_joystick(int addr, uint8_t& axis, uint8_t& button);
+
+    /**
+     * Address bits of the devices in a list
+     */
+    static uint32_t device_mask(const struct HidDeviceList& list);
+
+    /**
+     * Report layout of a mouse or joystick
+     */
+    const HidLayout& get_layout(int addr);
+
+    /**
+     * Scale a mouse delta by an 8.8 fixed point gain, carrying the fraction
+     * in frac
+     */
+    static int32_t scale_motion(int32_t delta, int32_t gain, int32_t& frac);
+
+    /**
+     * A keyboard usage has been pressed or released
+     */
+    void key_event(int usage, bool down);
+
+    /**
+     * Update the state of an ST key and the 6301 keyboard matrix
+     */
+    void set_key(int code, bool down);
+
+    /**
+     * Send any change to the mouse buttons, joystick or mouse mode and any
+     * mouse motion to core1
+     */
+    void publish();
     
 private:
     int keyboard_handle = -1;
     int mouse_handle = -1;
     int joystick_handle = -1;
-    std::vector<unsigned char> key_states;
+    unsigned char key_states[128] = {};
+    // Number of USB keys down for each ST key, and in all
+    uint8_t key_refs[128] = {};
+    int keys_held = 0;
+    // Layout the keys are translated with, see handle_keyboard()
+    uint8_t key_layout = KEY_LAYOUT_ISO;
+    // A key change couldn't be queued for core1
+    bool key_retry = false;
+    absolute_time_t poll_tm = {};
     int mouse_state = 0;
     unsigned char joystick_state = 0;
     bool mouse_en = true;
+    int published_mouse_state = 0;
+    int published_joystick_state = 0;
+    int published_mouse_en = 1;
+    // Mouse motion not yet queued for core1
+    int32_t mouse_dx = 0;
+    int32_t mouse_dy = 0;
+    // Fractions of a count left over from scaling, 8.8 fixed point
+    int32_t mouse_frac_x = 0;
+    int32_t mouse_frac_y = 0;
+#ifdef JOYSTICK_DIRECT
+    // Joystick byte (bits 0-7) and buttons (bits 8-9) for each byte of gpio_get_all()
+    uint16_t joystick_pins[4][256] = {};
+    // Joysticks assigned to the DB-9 ports, bit 0 for joystick 0
+    volatile uint8_t direct_ports = 0;
+#endif
 };
 
 extern "C" {
@@ -0,0 +1,145 @@
+/*
+ * Atari ST RP2040 IKBD Emulator
+ * Copyright (C) 2021 Roy Hopkins
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#pragma once
+
+#include <stdint.h>
+#include "tusb.h"
+
+// Most buttons recorded for one device
+#define HID_LAYOUT_BUTTONS 16
+
+// Most runs of keyboard keys recorded for one device
+#define HID_LAYOUT_KEY_RUNS 4
+
+// Words in a bitmap of keyboard usages 0-255
+#define HID_KEY_WORDS 8
+
+/**
+ * Position of one value in a HID report
+ */
+struct HidField {
+    uint16_t bit_offset = 0;
+    uint8_t  bit_size = 0;     // 0 if the device doesn't have this field
+    uint8_t  report_id = 0;    // 0 if the device doesn't use report IDs
+
+    bool present() const { return bit_size != 0; }
+
+    /**
+     * Extract the field from a report. Returns false if the report doesn't
+     * contain it, in the same way as USB_GetHIDReportItemInfo().
+     */
+    bool get(const uint8_t* report, uint32_t& value) const {
+        if (!bit_size) {
+            return false;
+        }
+        if (report_id) {
+            if (report[0] != report_id) {
+                return false;
+            }
+            ++report;
+        }
+        const uint8_t* p = report + (bit_offset >> 3);
+        unsigned shift = bit_offset & 7;
+        if (shift == 0 && bit_size == 8) {
+            value = p[0];
+        }
+        else if (shift == 0 && bit_size == 16) {
+            value = p[0] | (p[1] << 8);
+        }
+        else if (shift + bit_size <= 8) {
+            value = (p[0] >> shift) & ((1u << bit_size) - 1);
+        }
+        else {
+            value = 0;
+            for (unsigned i = 0; i < bit_size; ++i, ++shift) {
+                if (p[shift >> 3] & (1 << (shift & 7))) {
+                    value |= 1u << i;
+                }
+            }
+        }
+        return true;
+    }
+
+    /**
+     * As get() but sign extended from the field size
+     */
+    bool get_signed(const uint8_t* report, int32_t& value) const {
+        uint32_t raw;
+        if (!get(report, raw)) {
+            return false;
+        }
+        if ((bit_size < 32) && (raw & (1u << (bit_size - 1)))) {
+            raw |= ~((1u << bit_size) - 1);
+        }
+        value = (int32_t)raw;
+        return true;
+    }
+};
+
+/**
+ * A run of keyboard usages in a report, either one bit per key (NKRO) or an
+ * array of slots each holding the usage of a key that is down
+ */
+struct HidKeyRun {
+    HidField first;     // First bit or slot
+    uint8_t  usage;     // Usage of the first bit, not used for an array
+    uint8_t  count;     // Number of bits or slots
+    bool     array;
+};
+
+/**
+ * The input fields of a keyboard, mouse or joystick report, found once from the
+ * parsed report descriptor when the device is mounted so that each report
+ * only has to pull out the few values that are used.
+ */
+struct HidLayout {
+    bool     valid = false;
+    HidField x;
+    HidField y;
+    HidField wheel;
+    HidField hat;
+    // Buttons in the order they are found and the button number (usage) of each
+    HidField buttons[HID_LAYOUT_BUTTONS];
+    uint8_t  button_usage[HID_LAYOUT_BUTTONS] = {};
+    uint8_t  button_count = 0;
+    HidKeyRun keys[HID_LAYOUT_KEY_RUNS] = {};
+    uint8_t  key_run_count = 0;
+
+    /**
+     * True if the keys are reported as a bitmap rather than only as an
+     * array of the keys that are down
+     */
+    bool nkro() const;
+
+    /**
+     * Set a bit in keys for each usage that is down in the report. Returns
+     * false if the report doesn't contain the keys or is reporting a
+     * rollover error.
+     */
+    bool get_keys(const uint8_t* report, uint32_t keys[HID_KEY_WORDS]) const;
+
+    /**
+     * Fill in the layout from TinyUSB's parsed descriptor. Leaves the layout
+     * invalid if info is null.
+     */
+    void parse(const HID_ReportInfo_t* info);
+
+private:
+    void add_key(const HID_ReportItem_t* item);
+};
@@ -0,0 +1,110 @@
+/*
+ * Atari ST RP2040 IKBD Emulator
+ * Copyright (C) 2021 Roy Hopkins
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#pragma once
+
+#include <stdint.h>
+
+// Kinds of packet told apart by the analyser
+enum IkbdPacket {
+    IKBD_PACKET_COMMAND,        // From the ST, including memory load data
+    IKBD_PACKET_IGNORED,        // From the ST, not a command so the ROM skips it
+    IKBD_PACKET_KEY_MAKE,       // 0x01-0x7F
+    IKBD_PACKET_KEY_BREAK,      // 0x80-0xF5, 0xF1 is also the answer to a reset
+    IKBD_PACKET_MOUSE_RELATIVE, // 0xF8-0xFB
+    IKBD_PACKET_MOUSE_ABSOLUTE, // 0xF7
+    IKBD_PACKET_JOYSTICK,       // 0xFD-0xFF and the monitoring modes
+    IKBD_PACKET_STATUS,         // 0xF6 status and memory read
+    IKBD_PACKET_CLOCK,          // 0xFC
+    IKBD_PACKETS
+};
+
+/**
+ * Counts over one second of the protocol
+ */
+struct IkbdAnalyserStats {
+    uint32_t packets[IKBD_PACKETS];
+    uint32_t rx_bytes;          // Bytes from the ST
+    uint32_t tx_bytes;          // Bytes to the ST
+    uint32_t rx_depth_max;      // Most bytes seen waiting in the CoreLink queues
+    uint32_t tx_depth_max;
+};
+
+/**
+ * Decodes the bytes passing between the ST and the IKBD into packets on
+ * core0. It follows SerialTrace from its own position, so core1 only
+ * records the bytes as it always does, and counts the trace entries that
+ * were overwritten before they were read as lost. Bytes to the ST are split
+ * into packets by their header byte, or by the joystick monitoring mode
+ * IkbdMode has seen selected, whose reports have no header. Bytes from the
+ * ST are split by the command lengths of IkbdHle.
+ */
+class IkbdAnalyser {
+private:
+    IkbdAnalyser() = default;
+
+public:
+    static IkbdAnalyser& instance();
+
+    /**
+     * Core0: decode what has been traced since the last call, called every
+     * couple of milliseconds so the trace doesn't wrap
+     */
+    void update();
+
+    /**
+     * The last complete second
+     */
+    const IkbdAnalyserStats& get() const { return published; }
+
+    /**
+     * Trace entries lost since boot because update() fell behind
+     */
+    uint32_t lost() const { return trace_lost; }
+
+    /**
+     * The first byte of the last packet each way, and what it was
+     */
+    uint8_t last_rx() const { return rx_head; }
+    uint8_t last_tx() const { return tx_head; }
+    IkbdPacket last_tx_packet() const { return tx_kind; }
+
+    static const char* name(IkbdPacket packet);
+
+private:
+    void receive(uint8_t data);
+    void send(uint8_t data);
+    void depth();
+
+private:
+    IkbdAnalyserStats   current = {};
+    IkbdAnalyserStats   published = {};
+    uint32_t            window_start = 0;
+    bool                started = false;
+    uint32_t            next = 0;       // Next SerialTrace entry to read
+    uint32_t            trace_lost = 0;
+
+    // Packet in progress each way
+    int                 rx_need = 0;    // Bytes still to come
+    uint8_t             rx_cmd = 0;
+    int                 rx_len = 0;
+    uint8_t             rx_head = 0;
+    int                 tx_need = 0;
+    uint8_t             tx_head = 0;
+    IkbdPacket          tx_kind = IKBD_PACKET_KEY_MAKE;
+};
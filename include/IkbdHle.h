@@ -0,0 +1,233 @@
+/*
+ * Atari ST RP2040 IKBD Emulator
+ * Copyright (C) 2021 Roy Hopkins
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#pragma once
+
+#include <stdint.h>
+
+// Output held for the ST, must be a power of two. Big enough for a status
+// report on top of a burst of key and mouse packets.
+#define HLE_TX_QUEUE        64
+
+// Bytes leave at the 7812 baud byte rate (LINK_CYCLES_PER_BYTE) so reports
+// are made from the latest input rather than queued behind older ones
+#define HLE_CYCLES_PER_BYTE 1280
+
+// Longest IKBD command including its parameters (0x19 and 0x1b)
+#define HLE_MAX_COMMAND     7
+
+// The ROM's power on self test, nothing is sent for this long after a reset
+#define HLE_RESET_CYCLES    64000
+
+// The ROM times the 0x17 monitoring rate in units of 11.18ms, not hundredths
+#define HLE_MONITOR_UNIT    11180
+
+// 0x18 samples the fire button this often, eight samples to a byte
+#define HLE_FIRE_SAMPLE     220
+
+// After 0x14 and 0x15 the ROM takes this long to read the fire buttons again
+#define HLE_FIRE_REREAD     8000
+
+// The ROM's 0x19 tenth of a second is 102.7ms long
+#define HLE_KEYCODE_TENTH   102700
+
+/**
+ * High level emulation of the IKBD. The protocol described in the Atari
+ * "Intelligent Keyboard (ikbd) Protocol" document is implemented directly
+ * instead of running the 6301 ROM: keys, the mouse in relative, absolute
+ * and keycode modes, the joystick event, interrogation, monitoring, fire
+ * button and keycode modes, the time-of-day clock and the status
+ * inquiries.
+ *
+ * There is no 6301, so programs that load and execute their own 6301 code
+ * (0x20 and 0x22) need the HD6301 emulation. The bytes they load are kept so
+ * that memory reads of them work.
+ *
+ * All times are in microseconds, the same as 6301 cycles at 1MHz. Input is
+ * applied as it arrives, without the ROM's key scan and debounce times,
+ * reports are made by update() and leave through get_tx().
+ */
+class IkbdHle {
+public:
+    IkbdHle();
+
+    /**
+     * Power on state, the ST is sent 0xF1 HLE_RESET_CYCLES later as the ROM
+     * does after its self test
+     */
+    void reset(int64_t now);
+
+    /**
+     * A byte from the ST
+     */
+    void receive(uint8_t data, int64_t now);
+
+    /**
+     * ST scancode pressed or released
+     */
+    void set_key(uint8_t code, bool down);
+
+    /**
+     * Bit 1 left (joystick 0 fire), bit 0 right (joystick 1 fire)
+     */
+    void set_mouse_buttons(int buttons);
+
+    /**
+     * Joystick 0 in the low nibble, joystick 1 in the high nibble. Bit 0 up,
+     * 1 down, 2 left and 3 right.
+     */
+    void set_joystick(uint8_t state);
+
+    /**
+     * False while joystick 0 is plugged into the mouse port instead
+     */
+    void set_mouse_enabled(bool en);
+
+    /**
+     * Relative motion in ST mouse counts
+     */
+    void add_mouse(int dx, int dy);
+
+    /**
+     * Make the reports that are due
+     */
+    void update(int64_t now);
+
+    /**
+     * Take the next byte for the ST if the previous one has had time to be
+     * sent. Returns false if there is nothing to send yet.
+     */
+    bool get_tx(uint8_t& data, int64_t now);
+
+    /**
+     * Number of parameter bytes that follow a command, -1 if the ROM
+     * ignores the byte
+     */
+    static int command_length(uint8_t cmd);
+
+private:
+    enum MouseMode {
+        MOUSE_RELATIVE,
+        MOUSE_ABSOLUTE,
+        MOUSE_KEYCODE,
+        MOUSE_OFF
+    };
+
+    enum JoystickMode {
+        JOY_EVENT,
+        JOY_INTERROGATE,
+        JOY_MONITOR,
+        JOY_FIRE_MONITOR,
+        JOY_KEYCODE,
+        JOY_OFF
+    };
+
+    struct Clock {
+        uint8_t bcd[6];         // YY MM DD hh mm ss
+        int64_t next;           // When the seconds next go up
+    };
+
+    void defaults();
+    void command(int64_t now);
+    bool ignored(uint8_t command) const;
+    void mouse_port();
+    void latch_fire();
+    void resume(int64_t now);
+    void status(uint8_t inquiry);
+    bool monitoring() const;
+    void scan_keys();
+
+    void update_mouse();
+    void update_joystick(int64_t now);
+    void update_clock(int64_t now);
+
+    void mouse_relative();
+    void mouse_absolute();
+    void mouse_keycode();
+    void mouse_keys(int32_t& acc, int32_t delta, uint8_t minus, uint8_t plus);
+    void buttons_changed();
+
+    uint8_t joystick_byte(int stick) const;
+    void joystick_keys(int64_t now);
+
+    bool room(int n) const;
+    bool put(const uint8_t* data, int n);
+    void put_key(uint8_t code);
+
+private:
+    // Output
+    uint8_t         tx[HLE_TX_QUEUE];
+    uint32_t        tx_head = 0;
+    uint32_t        tx_tail = 0;
+    int64_t         tx_next = 0;
+    bool            paused = false;
+    int64_t         paused_at = 0;      // When 0x13 paused the output
+
+    // Command being received
+    uint8_t         cmd[HLE_MAX_COMMAND];
+    int             cmd_len = 0;
+    int             cmd_need = 0;
+    int             load_left = 0;      // Data bytes of a memory load still to come
+    uint16_t        load_addr = 0;
+
+    // Inputs
+    uint8_t         keys_down[128 / 8] = { 0 };
+    uint8_t         keys_sent[128 / 8] = { 0 }; // As last reported, not scanned while monitoring
+    int64_t         scan_after = 0;     // The keys aren't scanned during the self test
+    int             buttons = 0;
+    uint8_t         joy = 0;
+    bool            mouse_en = true;
+    int32_t         mouse_dx = 0;
+    int32_t         mouse_dy = 0;
+
+    // Mouse
+    MouseMode       mouse_mode;
+    bool            mouse_disabled;     // 0x12, or a joystick mode command
+    bool            mouse_off;          // 0x12 alone, which is what 0x92 reports
+    int             fire_latch;         // Joystick 1 fire while the mouse is read, see latch_fire()
+    int64_t         fire_after;         // Until when fire_latch is read after 0x14 or 0x15, or 0
+    bool            y_bottom;
+    uint8_t         button_action;
+    uint8_t         threshold_x, threshold_y;
+    uint8_t         scale_x, scale_y;
+    uint8_t         keycode_dx, keycode_dy;
+    uint16_t        max_x, max_y;
+    int32_t         abs_x, abs_y;
+    int32_t         scale_acc_x, scale_acc_y;
+    uint8_t         abs_buttons;        // Changes since the last 0x0d, as reported by it
+    int             reported_buttons;
+    int             mouse_buttons;      // The buttons as the ROM last read them from the mouse
+
+    // Joystick
+    JoystickMode    joy_mode;
+    bool            joy_disabled;
+    bool            joy_port0;          // Joystick 0 is read instead of the mouse
+    uint8_t         monitor_rate;       // 0x17, hundredths of a second
+    int64_t         monitor_next;
+    uint8_t         fire_samples;       // 0x18 byte being built, the first sample ends in bit 7
+    int             fire_count;
+    uint8_t         keycode_params[6];  // 0x19 RX RY TX TY VX VY, tenths of a second
+    int64_t         key_since[2];       // When the joystick 0 x and y directions were pressed
+    int64_t         key_next[2];
+    int             key_dir[2];         // Which way each axis was pressed
+    bool            key_fire;           // Joystick 0 fire was sent as key 0x74
+    uint8_t         reported_joy[2];
+
+    Clock           clock;
+    uint8_t         ram[256];           // What memory loads have written
+};
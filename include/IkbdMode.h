@@ -0,0 +1,97 @@
+/*
+ * Atari ST RP2040 IKBD Emulator
+ * Copyright (C) 2021 Roy Hopkins
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#pragma once
+
+#include <stdint.h>
+
+enum IkbdMouseMode {
+    IKBD_MOUSE_RELATIVE,
+    IKBD_MOUSE_ABSOLUTE,
+    IKBD_MOUSE_KEYCODE,
+    IKBD_MOUSE_OFF
+};
+
+enum IkbdJoystickMode {
+    IKBD_JOY_EVENT,
+    IKBD_JOY_INTERROGATE,
+    IKBD_JOY_MONITOR,
+    IKBD_JOY_FIRE_MONITOR,
+    IKBD_JOY_KEYCODE,
+    IKBD_JOY_OFF
+};
+
+/**
+ * Follows the commands the ST sends to the IKBD to know which mouse and
+ * joystick modes it has selected, so USB input the ST isn't reading can be
+ * left alone. The commands are seen by core0 as they are received and are
+ * the same for the 6301 emulation and the high level engine.
+ *
+ * Once the ST runs its own 6301 code (0x22) nothing is known about what it
+ * reads, everything is then reported as in use until the next reset.
+ */
+class IkbdMode {
+private:
+    IkbdMode();
+
+public:
+    static IkbdMode& instance();
+
+    /**
+     * Power on modes, the mouse relative and joystick events
+     */
+    void reset();
+
+    /**
+     * A byte from the ST, called by the UART interrupt
+     */
+    void receive(uint8_t data);
+
+    IkbdMouseMode mouse() const { return mouse_mode; }
+    IkbdJoystickMode joystick() const { return joy_mode; }
+
+    /**
+     * True while the ST is reading mouse movement
+     */
+    bool mouse_motion() const {
+        return !known || (mouse_mode != IKBD_MOUSE_OFF);
+    }
+
+    /**
+     * True while the ST is reading the mouse buttons or the joysticks. The
+     * mouse buttons are the joystick fire buttons, so both are needed
+     * unless the mouse and the joysticks are off.
+     */
+    bool buttons() const {
+        return !known || (mouse_mode != IKBD_MOUSE_OFF) || (joy_mode != IKBD_JOY_OFF);
+    }
+
+private:
+    void command();
+
+private:
+    volatile IkbdMouseMode      mouse_mode;
+    volatile IkbdJoystickMode   joy_mode;
+    volatile bool               known;
+
+    // Command being received
+    uint8_t     cmd[2];
+    int         cmd_len = 0;
+    int         cmd_need = 0;
+    int         load_left = 0;
+};
@@ -0,0 +1,119 @@
+/*
+ * Atari ST RP2040 IKBD Emulator
+ * Copyright (C) 2021 Roy Hopkins
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#pragma once
+
+#include <stdint.h>
+
+// Histogram buckets, the last one also counts anything longer
+#define LATENCY_BUCKETS     64
+#define LATENCY_BUCKET_US   1000
+
+#ifdef __cplusplus
+
+enum LatencyInput {
+    LATENCY_KEY,
+    LATENCY_MOUSE,
+    LATENCY_JOYSTICK,
+    LATENCY_INPUTS
+};
+
+enum LatencyStage {
+    LATENCY_TO_READ,        // Report to the ROM reading the port
+    LATENCY_TO_SENT,        // Report to the first byte sent to the ST
+    LATENCY_STAGES
+};
+
+struct LatencyHistogram {
+    uint32_t count;
+    uint32_t min_us;
+    uint32_t max_us;
+    uint64_t total_us;
+    uint32_t buckets[LATENCY_BUCKETS];
+};
+
+/**
+ * Measures how long an input change takes to reach the ST. The time core0
+ * handled the USB report travels with the input event. Core1 notes when
+ * the ROM next reads the port the input is wired to and when the next byte
+ * of the matching kind goes to the serial port. Only the oldest change of
+ * each kind waiting is timed, later ones until it completes are folded in.
+ * Only built with LATENCY_TRACE defined.
+ */
+class LatencyTrace {
+private:
+    LatencyTrace() = default;
+
+public:
+    static LatencyTrace& instance();
+
+    /**
+     * Core1: an input change that core0 saw at time_us has been applied
+     */
+    void input(LatencyInput in, uint32_t time_us);
+
+    /**
+     * Core1: the ROM has read port 1, 2 or 4
+     */
+    void port_read(int port);
+
+    /**
+     * Core1: a byte has been queued for the ST
+     */
+    void byte_sent(uint8_t data);
+
+    /**
+     * Copy of one histogram, may be slightly inconsistent if core1 is
+     * updating it
+     */
+    void get(LatencyInput in, LatencyStage stage, LatencyHistogram& hist) const;
+
+    /**
+     * Upper limit of the bucket containing the given percentile
+     */
+    static uint32_t percentile(const LatencyHistogram& hist, int pct);
+
+    /**
+     * Print all of the histograms to stdio
+     */
+    void dump() const;
+
+    static const char* name(LatencyInput in);
+
+private:
+    void sample(LatencyInput in, LatencyStage stage, uint32_t now_us);
+
+private:
+    LatencyHistogram    hist[LATENCY_INPUTS][LATENCY_STAGES] = {};
+    uint32_t            since[LATENCY_INPUTS][LATENCY_STAGES] = {};
+    bool                waiting[LATENCY_INPUTS][LATENCY_STAGES] = {};
+    // Bytes left in the packet being sent
+    int                 packet_left = 0;
+};
+
+extern "C" {
+#endif
+
+/**
+ * Called by ireg.c when the ROM reads DR1, DR2 or DR4
+ */
+void latency_read(int port);
+
+#ifdef __cplusplus
+}
+#endif
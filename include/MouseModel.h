@@ -0,0 +1,79 @@
+/*
+ * Atari ST RP2040 IKBD Emulator
+ * Copyright (C) 2021 Roy Hopkins
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#pragma once
+
+#include <stdint.h>
+
+// Minimum spacing between two steps of one axis in 6301 cycles. Not every
+// DR4 read is a quadrature sample, the ROM misses steps that are closer
+// together than this. 400 cycles is 2500 counts per second per axis.
+#define MOUSE_MIN_STEP_CYCLES   400
+
+// The counts waiting on an axis are spread over this many cycles, about one
+// USB mouse report interval, so motion is smooth rather than in bursts
+#define MOUSE_SPREAD_CYCLES     8000
+
+// Counts held per axis before new motion is dropped. Only reached if the ROM
+// stops reading the mouse.
+#define MOUSE_MAX_PENDING       4096
+
+/**
+ * Quadrature encoder model clocked by the 6301 cycle counter. USB motion is
+ * added as counts and each axis moves its register by at most one step per
+ * DR4 read and no faster than the ROM can decode, so nothing is lost or
+ * reversed however fast the mouse moves. Motion beyond that rate is kept
+ * and caught up. Owned by core1, the deltas arrive through
+ * CoreLink.
+ */
+class MouseModel {
+public:
+    MouseModel();
+
+    /**
+     * Add relative motion in ST mouse counts
+     */
+    void add(int dx, int dy);
+
+    /**
+     * Drop any motion not yet seen by the ROM
+     */
+    void clear();
+
+    /**
+     * Called for each DR4 read with the current cycle count, returns the
+     * quadrature registers
+     */
+    void tick(int64_t cpu_cycles, int* x_counter, int* y_counter);
+
+private:
+    struct Axis {
+        // Counts still to step, the sign is the direction
+        int32_t pending = 0;
+        // Earliest cycle for the next step
+        int64_t next = 0;
+        unsigned int reg;
+    };
+
+    static void add_axis(Axis& axis, int delta);
+    static void step_axis(Axis& axis, int64_t cpu_cycles);
+
+private:
+    Axis x;
+    Axis y;
+};
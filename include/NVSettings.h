@@ -20,6 +20,25 @@
 
 #include <stdint.h>
 #include <hardware/flash.h>
+#include "pico/time.h"
+
+// Time without changes before the settings are written to flash
+#define NV_COMMIT_DELAY_US  3000000
+
+// Settings::engine
+#define ENGINE_LLE          0   // The HD6301 runs the IKBD ROM
+#define ENGINE_HLE          1   // The IKBD protocol is implemented by IkbdHle
+
+// Settings::turbo, the 6301 clock and serial rate are multiplied by 1 << turbo
+#define TURBO_MAX           3
+// Published load windows in a row in which core1 gave up emulated time
+// before a turbo setting is dropped back to the real 1MHz
+#define TURBO_FALLBACK_WINDOWS  3
+
+// Settings::key_layout, the table of ST scancodes for the USB keys
+#define KEY_LAYOUT_ISO      0   // GB, DE, FR and other ISO keyboards
+#define KEY_LAYOUT_ANSI     1   // US keyboards
+#define KEY_LAYOUT_MAX      1
 
 struct Settings {
     // Version - used to detect if this is the first time we have read from flash.
@@ -36,14 +55,56 @@ struct Settings {
     // Bit0 = Joystick 0
     // Bit1 = Joystick 1
     uint8_t     joy_device;
+
+    // ENGINE_LLE or ENGINE_HLE, used from the next power on
+    uint8_t     engine;
+
+    // 0 for the real 1MHz 6301 and 7812 baud, up to TURBO_MAX to run both
+    // 2, 4 or 8 times faster. Used from the next power on.
+    uint8_t     turbo;
+
+    // KEY_LAYOUT_ISO or KEY_LAYOUT_ANSI
+    uint8_t     key_layout;
 };
 
+/**
+ * Settings kept in flash. Each change is appended as a new record to a log
+ * spread over the last few sectors, the newest valid record wins. A sector is
+ * only erased when the log wraps round to it, so a change costs one page
+ * program rather than a sector erase. Changes are held in RAM and committed
+ * once the settings have been left alone for a few seconds, so a run of
+ * button presses is one write.
+ */
 class NVSettings {
 public:
     NVSettings();
     Settings& get_settings();
+
+    /**
+     * Note that the settings have changed, they are committed by update()
+     */
     void write();
+
+    /**
+     * Commit a pending change now
+     */
+    void flush();
+
+    /**
+     * Called regularly, commits a pending change once the settings have not
+     * changed for NV_COMMIT_DELAY_US
+     */
+    void update();
+
     void read();
 
-};
+private:
+    void program(uint32_t slot);
 
+private:
+    bool            pending = false;
+    absolute_time_t changed_tm;
+    // Sequence number of the newest record and the slot for the next one
+    uint32_t        seq = 0;
+    uint32_t        next_slot = 0;
+};
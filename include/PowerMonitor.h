@@ -0,0 +1,67 @@
+/*
+ * Atari ST RP2040 IKBD Emulator
+ * Copyright (C) 2021 Roy Hopkins
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#pragma once
+
+#include <stdint.h>
+#include "pico/time.h"
+
+// The line from the ST has to be low this long before it is taken as off
+#define ST_OFF_US       1000000
+
+class UserInterface;
+
+/**
+ * Notices when the Atari is switched off and parks the emulator until it
+ * comes back. An ST that is on holds its serial line high between bytes, a
+ * byte is never low for more than 9 bit times. Once the line has been low
+ * for ST_OFF_US the emulator goes dormant: core1 stops running the 6301,
+ * core0 stops servicing USB and the display is switched off. Both cores
+ * only wake for their timers until the line goes high again.
+ *
+ * The ST powers up expecting a keyboard that has just been reset, so core1
+ * then starts the 6301 again from the ready snapshot, which takes well under
+ * a millisecond, or with a cold reset if there isn't one yet.
+ *
+ * A level shifter that pulls the Pico side of the line up when the ST is
+ * off keeps the emulator running as before.
+ */
+class PowerMonitor {
+private:
+    PowerMonitor();
+
+public:
+    static PowerMonitor& instance();
+
+    void set_ui(UserInterface& ui) { ui_ = &ui; }
+
+    /**
+     * Core0: sample the line from the ST, called every millisecond
+     */
+    void update();
+
+    /**
+     * The ST is off, read by both cores
+     */
+    bool dormant() const { return asleep; }
+
+private:
+    UserInterface*  ui_ = nullptr;
+    absolute_time_t low_since;
+    volatile bool   asleep = false;
+};
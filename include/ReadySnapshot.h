@@ -0,0 +1,100 @@
+/*
+ * Atari ST RP2040 IKBD Emulator
+ * Copyright (C) 2021 Roy Hopkins
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#pragma once
+
+#include <stdint.h>
+#include <hardware/flash.h>
+
+// Room for hd6301_save(), a whole number of flash pages
+#define READY_SNAPSHOT_BYTES    (2 * FLASH_PAGE_SIZE)
+// Slices between the snapshots kept for Core1Watchdog
+#define SNAPSHOT_GOOD_SLICES    100
+
+/**
+ * Snapshot of the 6301 taken just before the ROM sends its first byte after
+ * a cold reset, when the power-on RAM test and ROM checksum have finished.
+ *
+ * The snapshot is captured on core1 during the first boot. If a crash is
+ * detected core1 restores it instead of running the reset sequence again.
+ * With READY_SNAPSHOT defined in config.h it is also kept in flash and
+ * restored at power on, so the ROM is ready straight away.
+ *
+ * Every SNAPSHOT_GOOD_SLICES slices the running 6301 is also saved, in turn
+ * to one of two buffers so there is always a whole one, for Core1Watchdog
+ * to go back to if core1 itself stops.
+ */
+class ReadySnapshot {
+private:
+    ReadySnapshot() = default;
+
+public:
+    static ReadySnapshot& instance();
+
+    /**
+     * Copy a stored snapshot from flash. Called on core0 before core1 is
+     * started so core1 never has to read the flash.
+     */
+    void load();
+
+    /**
+     * Cold reset the 6301 on core1, then restore the stored snapshot if
+     * there is one for this ROM. Otherwise watch the reset sequence for the
+     * ready point.
+     */
+    void boot();
+
+    /**
+     * Called on core1 at the end of every slice
+     */
+    void slice_end();
+
+    /**
+     * Core1, after Core1Watchdog has launched it again: restore the last
+     * good snapshot if good_first and there is one, otherwise the ready
+     * snapshot, otherwise cold reset as boot() does
+     */
+    void failover(bool good_first);
+
+    /**
+     * Called on core0, prints the instruction trace after a crash and writes
+     * a newly captured snapshot to flash once the ST has stopped sending
+     */
+    void update();
+
+    /**
+     * Number of times the 6301 has been recovered after a crash
+     */
+    uint32_t recoveries() const { return recovered; }
+
+private:
+    void recover();
+    void program();
+
+private:
+    uint8_t             ready[READY_SNAPSHOT_BYTES] __attribute__((aligned(4)));
+    uint8_t             candidate[READY_SNAPSHOT_BYTES] __attribute__((aligned(4)));
+    volatile bool       ready_valid = false;
+    bool                capturing = false;
+    volatile bool       stored = false;
+    volatile uint32_t   recovered = 0;
+    uint32_t            reported = 0;
+    uint8_t             good[2][READY_SNAPSHOT_BYTES] __attribute__((aligned(4)));
+    volatile int        good_index = -1;    // The last whole one, -1 for none
+    uint32_t            good_slices = 0;
+};
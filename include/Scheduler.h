@@ -0,0 +1,71 @@
+/*
+ * Atari ST RP2040 IKBD Emulator
+ * Copyright (C) 2021 Roy Hopkins
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#pragma once
+
+#include <stdint.h>
+#include "pico/time.h"
+
+// Most tasks that can be added
+#define SCHEDULER_MAX_TASKS 16
+
+/**
+ * Cooperative scheduler for the core0 main loop. Each task runs when its
+ * period has passed, a period of 0 runs it on every pass of the loop. Tasks
+ * must return quickly, nothing is pre-empted.
+ *
+ * With sleeping enabled the core waits with WFE between passes until the
+ * next periodic task is due or an interrupt (USB, the UART, an alarm) wakes
+ * it, so the tasks run on every pass only need to run after an interrupt.
+ */
+class Scheduler {
+public:
+    typedef void (*Task)();
+
+    /**
+     * Add a task. Returns false if there is no room.
+     */
+    bool add(Task task, uint32_t period_us);
+
+    /**
+     * Sleep between passes rather than spinning
+     */
+    void set_sleep(bool en) { sleep = en; }
+
+    /**
+     * Run every task that is due once. Returns the time the next periodic
+     * task is due.
+     */
+    absolute_time_t run_once();
+
+    /**
+     * Run the tasks for ever
+     */
+    void run();
+
+private:
+    struct Entry {
+        Task            task;
+        uint32_t        period_us;
+        absolute_time_t next;
+    };
+
+    Entry   tasks[SCHEDULER_MAX_TASKS];
+    int     count = 0;
+    bool    sleep = false;
+};
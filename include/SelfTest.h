@@ -0,0 +1,117 @@
+/*
+ * Atari ST RP2040 IKBD Emulator
+ * Copyright (C) 2021 Roy Hopkins
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#pragma once
+
+#include <stdint.h>
+
+// Times each command in the test is sent
+#define SELFTEST_ROUNDS       100
+// A command not answered in this time is counted as lost
+#define SELFTEST_TIMEOUT_US   100000
+// Time for core1 to come out of the dormant state before the first command
+#define SELFTEST_START_US     20000
+
+/**
+ * Results of the last loopback test
+ */
+struct SelfTestResult {
+    uint32_t commands;      // Commands answered
+    uint32_t lost;          // Commands that weren't answered in time
+    uint32_t min_us;        // Command at the SCI to the first byte of the answer
+    uint32_t max_us;
+    uint64_t total_us;
+    uint32_t bytes;         // Bytes in the answers
+    uint32_t elapsed_us;    // Time for the whole test
+};
+
+/**
+ * Loopback benchmark of the IKBD command latency, run on the unit without an
+ * ST attached. Core0 plays the part of the ST's ACIA: each command is queued
+ * as if it had been received by the UART, so core1 is given it at the serial
+ * byte rate, and the answer is picked up from SerialTrace. The latency is
+ * from the command reaching the SCI to the ROM (or the high level engine)
+ * writing the first byte of the answer, both as timestamped by core1.
+ *
+ * The mouse is put in absolute mode so it can be interrogated and the IKBD
+ * is reset when the test is over. The answers are sent out of the UART as
+ * usual.
+ */
+class SelfTest {
+private:
+    SelfTest() = default;
+
+public:
+    static SelfTest& instance();
+
+    /**
+     * Start a test, nothing happens if one is already running
+     */
+    void start();
+
+    /**
+     * A test is in progress
+     */
+    bool running() const { return state != IDLE; }
+
+    /**
+     * Commands sent so far in the test in progress
+     */
+    uint32_t progress() const { return index; }
+    static uint32_t total();
+
+    /**
+     * Called on core0 every millisecond, sends the next command once the
+     * last one has been answered
+     */
+    void update();
+
+    /**
+     * Get the results of the last test. Returns false if there hasn't been
+     * one.
+     */
+    bool get(SelfTestResult& r) const;
+
+    /**
+     * Print the last results to stdio
+     */
+    void dump() const;
+
+private:
+    enum State {
+        IDLE,
+        STARTING,
+        WAITING
+    };
+
+    void send(const uint8_t* data, int n);
+    void issue(uint32_t now);
+    void finish(uint32_t now);
+
+private:
+    volatile State  state = IDLE;
+    uint32_t        index = 0;          // Command being waited for
+    uint32_t        started_us = 0;
+    uint32_t        sent_us = 0;        // When the command was queued
+    uint32_t        sci_us = 0;         // When it reached the SCI
+    bool            at_sci = false;
+    int             received = 0;       // Bytes of the answer seen
+    uint32_t        seen = 0;           // SerialTrace entries looked at
+    SelfTestResult  result = {};
+    bool            done = false;
+};
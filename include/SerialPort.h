@@ -20,7 +20,6 @@
 
 #ifdef __cplusplus 
 #include <stdexcept>
-#include "UserInterface.h"
 
 class SerialPortException: public std::runtime_error {
 public:
@@ -37,15 +36,10 @@ public:
     static SerialPort& instance();
 
     /**
-     * Open the serial port.
+     * Open the serial port at 7812 baud shifted left by turbo.
      * Throws an exception if the port cannot be opened.
      */
-    void open();
-
-    /**
-     * Set UI for logging
-     */
-    void set_ui(UserInterface& ui);
+    void open(int turbo = 0);
 
     /**
      * Close the serial port if it was previously opened
@@ -53,29 +47,64 @@ public:
     void close();
 
     /**
-     * Send data to the Atari ST over the serial port
+     * Send data to the Atari ST over the serial port. Doesn't block, the
+     * byte is queued and sent from the UART interrupt.
      */
     void send(const unsigned char data);
 
     /**
-     * Attempt to receive data from the Atari ST over the serial port.
-     * This function does not block.
-     * Returns true if a byte was received, otherwise returns false
+     * Query whether the transmit queue is full. The HD6301 holds TDRE off
+     * while it is so bytes are never written faster than they can be sent.
+     */
+    bool send_buf_full() const;
+
+    /**
+     * Core0: nothing is queued for the ST or being shifted out of the UART
+     */
+    bool tx_idle() const;
+
+    /**
+     * Core0: nothing has been received for two byte times and the line
+     * from the ST is high, so no byte is on its way in as far as can be
+     * told
+     */
+    bool rx_idle() const;
+
+    /**
+     * Core0: nothing has been received for us microseconds and the line
+     * from the ST is high
+     */
+    bool rx_quiet(uint32_t us) const;
+
+    /**
+     * Core0: enable the UART receive FIFO while interrupts have to be held
+     * off for longer than a byte time, a flash write. Disabling it waits
+     * for the interrupt to empty it first. Only called with the line quiet.
      */
-    bool recv(unsigned char& data) const;
+    void buffer_rx(bool en);
 
     /**
-     * Query whether the transmit buffer is empty.
-     * This can be used to synchronise a sender with the serial transmit rate. Although
-     * this class can handle an arbitrarily sized tx buffer we might want to ensure
-     * data is queued no fast than it can be sent.
+     * Core0: set the UART divider again after the system clock has changed
      */
-    bool send_buf_empty() const;
+    void clock_changed();
+
+    /**
+     * Core0: change the rate to 7812 baud shifted left by turbo
+     */
+    void set_turbo(int turbo);
 
 private:
     void configure();
+
+    /**
+     * UART interrupt, queues bytes from the ST for core1 and sends the bytes
+     * core1 has queued
+     */
+    static void on_irq();
+
 private:
-    UserInterface*              ui = nullptr;
+    int turbo_ = 0;
+    volatile uint32_t last_rx_us = 0;   // time_us_32() of the last byte from the ST
 };
 
 extern "C" {
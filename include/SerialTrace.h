@@ -0,0 +1,76 @@
+/*
+ * Atari ST RP2040 IKBD Emulator
+ * Copyright (C) 2021 Roy Hopkins
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#pragma once
+
+#include <stdint.h>
+
+// Entries kept, must be a power of two
+#define SERIAL_TRACE_SIZE 64
+
+struct SerialTraceEntry {
+    uint32_t time_us;       // time_us_32() when the byte passed the SCI
+    uint8_t  send;          // 1 if sent to the ST, 0 if received from it
+    uint8_t  data;
+};
+
+/**
+ * Fixed size trace of the bytes passing between the HD6301 and the ST. Core1
+ * records every byte without locking or allocating, overwriting the oldest
+ * entries. The UI copies out the most recent ones only when the serial
+ * page is on screen and IkbdAnalyser reads all of them as they come.
+ */
+class SerialTrace {
+private:
+    SerialTrace() = default;
+
+public:
+    static SerialTrace& instance();
+
+    /**
+     * Core1: add a byte to the trace
+     */
+    void record(bool send, uint8_t data);
+
+    /**
+     * Total number of bytes recorded, can be used to see if anything new
+     * has been added
+     */
+    uint32_t count() const { return head; }
+
+    /**
+     * Copy up to max of the most recent entries, oldest first. Entries that
+     * were overwritten while they were being copied are left out. Returns
+     * the number copied. If end is given it is set to count() as it was
+     * when the last entry was copied.
+     */
+    int latest(SerialTraceEntry* entries, int max, uint32_t* end = nullptr) const;
+
+    /**
+     * Copy up to max entries, oldest first, starting with entry number next
+     * (counted from boot as count() is), and move next on past them. Entries
+     * that were overwritten before they could be copied are added to lost.
+     * Returns the number copied. Lets a reader follow every byte as long as
+     * it keeps up.
+     */
+    int read(uint32_t& next, SerialTraceEntry* entries, int max, uint32_t& lost) const;
+
+private:
+    SerialTraceEntry    ring[SERIAL_TRACE_SIZE] = {};
+    volatile uint32_t   head = 0;   // Entries recorded since boot
+};
@@ -0,0 +1,86 @@
+/*
+ * Atari ST RP2040 IKBD Emulator
+ * Copyright (C) 2021 Roy Hopkins
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#pragma once
+
+#include <stdint.h>
+#include "hardware/sync.h"
+
+/**
+ * Lock-free queue with one producer and one consumer, normally on different
+ * cores. The producer only writes head and the consumer only writes tail, so
+ * no locking is needed. SIZE must be a power of two.
+ */
+template <typename T, uint32_t SIZE>
+class SpscQueue {
+    static_assert((SIZE & (SIZE - 1)) == 0, "SpscQueue size must be a power of two");
+
+public:
+    /**
+     * Add an item. Returns false, leaving the queue unchanged, if it is full.
+     * Producer only.
+     */
+    bool push(const T& item) {
+        uint32_t h = head;
+        if ((h - tail) == SIZE) {
+            return false;
+        }
+        items[h & (SIZE - 1)] = item;
+        // The item must be visible before the consumer sees the new head
+        __dmb();
+        head = h + 1;
+        return true;
+    }
+
+    /**
+     * Remove the oldest item. Returns false if the queue is empty.
+     * Consumer only.
+     */
+    bool pop(T& item) {
+        uint32_t t = tail;
+        if (t == head) {
+            return false;
+        }
+        __dmb();
+        item = items[t & (SIZE - 1)];
+        // Finish reading the item before the producer can reuse its slot
+        __dmb();
+        tail = t + 1;
+        return true;
+    }
+
+    bool empty() const {
+        return head == tail;
+    }
+
+    bool full() const {
+        return (head - tail) == SIZE;
+    }
+
+    /**
+     * Items in the queue, may be out of date by the time it is used
+     */
+    uint32_t size() const {
+        return head - tail;
+    }
+
+private:
+    T                   items[SIZE];
+    volatile uint32_t   head = 0;   // Next slot to write, producer owned
+    volatile uint32_t   tail = 0;   // Next slot to read, consumer owned
+};
@@ -0,0 +1,113 @@
+/*
+ * Atari ST RP2040 IKBD Emulator
+ * Copyright (C) 2021 Roy Hopkins
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#pragma once
+
+#include <stdint.h>
+
+// USB addresses 1 to this have a report counter of their own
+#define TELEMETRY_HID_DEVICES   8
+
+/**
+ * Counters kept on core0. Each one is only changed from one place, an
+ * interrupt handler or the main loop, so they need no locking.
+ */
+enum TelemetryCounter {
+    TELEMETRY_UART_RX,          // Bytes received from the ST
+    TELEMETRY_UART_TX,          // Bytes sent to the ST
+    TELEMETRY_FLASH_WRITES,     // Flash programs, settings and snapshot
+    TELEMETRY_UI_REDRAWS,       // Display frames drawn
+    TELEMETRY_UI_REDRAW_US,     // Time spent drawing them
+    TELEMETRY_UI_REDRAW_MAX_US, // Longest frame since the last record
+    TELEMETRY_COUNTERS
+};
+
+/**
+ * Points in the power on sequence, in the order they are normally reached
+ */
+enum TelemetryBoot {
+    TELEMETRY_BOOT_SERIAL,      // Settings read and the UART open
+    TELEMETRY_BOOT_CORE1,       // Core1 started
+    TELEMETRY_BOOT_READY,       // The ST has been sent 0xF1, the end of the self test
+    TELEMETRY_BOOT_USB,         // USB host started
+    TELEMETRY_BOOT_DISPLAY,     // Display initialised
+    TELEMETRY_BOOT_HID,         // First USB keyboard, mouse or joystick mounted
+    TELEMETRY_BOOT_PHASES
+};
+
+/**
+ * Performance counters for both cores, printed to the UART console as one
+ * CSV record. Core1's counters are the ones the 6301 core and EmulatorLoad
+ * already keep and are read in place, a 32 bit read is atomic. Every value
+ * is a 32 bit count since boot that wraps, so a graph should use the
+ * difference between records, apart from the longest redraw.
+ */
+class Telemetry {
+private:
+    Telemetry() = default;
+
+public:
+    static Telemetry& instance();
+
+    void count(TelemetryCounter c, uint32_t n = 1) { counters[c] = counters[c] + n; }
+
+    /**
+     * Core0 USB interrupt: a report arrived from the device at addr
+     */
+    void hid_report(uint8_t addr) {
+        if ((addr >= 1) && (addr <= TELEMETRY_HID_DEVICES)) {
+            hid_reports[addr - 1] = hid_reports[addr - 1] + 1;
+        }
+    }
+
+    /**
+     * The power on sequence has reached a phase, only the first time is
+     * kept. Called from either core.
+     */
+    void boot(TelemetryBoot phase);
+
+    /**
+     * Print the time since power on each phase was reached, starting "boot"
+     */
+    void dump_boot() const;
+
+    /**
+     * True once every phase but TELEMETRY_BOOT_HID has been reached
+     */
+    bool booted() const;
+
+    /**
+     * A display frame took us to draw
+     */
+    void ui_redraw(uint32_t us);
+
+    /**
+     * Print the CSV column names, the first is "#tm"
+     */
+    static void header();
+
+    /**
+     * Print one record, starting "tm", and start a new longest redraw
+     */
+    void dump();
+
+private:
+    volatile uint32_t counters[TELEMETRY_COUNTERS] = {};
+    volatile uint32_t hid_reports[TELEMETRY_HID_DEVICES] = {};
+    volatile uint32_t boot_us[TELEMETRY_BOOT_PHASES] = {};
+};
@@ -21,11 +21,13 @@
 #include "ssd1306.h"
 #include "NVSettings.h"
 #include <string>
-#include <deque>
 
 #define MOUSE_MIN -7
 #define MOUSE_MAX 8
 
+// Bytes shown on the serial page
+#define SERIAL_LINES 7
+
 class UserInterface {
 public:
     UserInterface();
@@ -34,11 +36,35 @@ public:
         PAGE_MOUSE,
         PAGE_JOY0,
         PAGE_JOY1,
-        PAGE_SERIAL
+        PAGE_CLOCK,
+        PAGE_LAYOUT,
+        PAGE_SERIAL,
+        PAGE_PROTOCOL,
+        PAGE_PERF,
+#ifdef LATENCY_TRACE
+        PAGE_LATENCY,
+#endif
+        PAGE_COUNT
     };
 
+    /**
+     * Check the settings and set up the buttons. The display is set up by
+     * the first update() so core1 and USB don't wait for it at power on.
+     */
     void init();
 
+    /**
+     * Set the display's I2C divider again after the system clock has
+     * changed
+     */
+    void clock_changed();
+
+    /**
+     * No display flush is in progress, so the I2C controller can be
+     * reprogrammed
+     */
+    bool display_idle() const;
+
     /**
      * Update the user interface with the current USB connection state
      */
@@ -64,33 +90,80 @@ public:
     uint8_t get_mouse_enabled();
     void set_mouse_enabled(uint8_t en);
 
+    /**
+     * The engine chosen at power on, ENGINE_LLE or ENGINE_HLE. The setting
+     * can be changed on the core load page and is used from the next power
+     * on.
+     */
+    uint8_t get_engine() const { return engine; }
+
+    /**
+     * The 6301 clock and serial rate multiplier chosen at power on, as a
+     * shift from 0 to TURBO_MAX. Changed on the clock page and used from
+     * the next power on.
+     */
+    uint8_t get_turbo() const { return turbo; }
+
+    /**
+     * Core1 couldn't keep up with the turbo setting and the 6301 is back at
+     * 1MHz, which is saved for the next power on too
+     */
+    void turbo_fallback();
+
+    /**
+     * The USB keyboard layout, KEY_LAYOUT_ISO or KEY_LAYOUT_ANSI. Changed on
+     * the layout page.
+     */
+    uint8_t get_key_layout() { return settings.get_settings().key_layout; }
+
     /**
      * Update the display if necessary
      */
     void update();
 
     /**
-     * Serial transmission for logging to screen
+     * Switch the display off, nothing is drawn until it is switched on
+     * again
      */
-    void serial(bool send, uint8_t data);
+    void set_blank(bool en);
 
 private:
+    void init_display();
     void update_serial();
+    void update_protocol();
     void update_status();
     void update_mouse();
     void update_joy(int index);
+    void update_clock();
+    void update_layout();
+    void update_perf();
+    void update_latency();
+    void update_selftest();
     void handle_buttons();
     void on_button_down(int i);
 
+    /**
+     * Start flushing the frame drawn since draw_tm to the display
+     */
+    void show();
+
 private:
     PAGE        page = PAGE_MOUSE;
     NVSettings  settings;
+    uint8_t     engine = ENGINE_LLE;
+    uint8_t     turbo = 0;
     bool        dirty = true;
+    bool        blank = false;
+    bool        display_up = false;
+    bool        selftest_shown = false; // The serial page shows the loopback test
+    bool        combo = false;          // Left and right were both down
     int         num_kb = 0;
     int         num_mouse = 0;
     int         num_joy = 0;
-    std::deque<std::string> serial_lines;
+    uint32_t    serial_count = 0;
     absolute_time_t serial_tm;
+    absolute_time_t perf_tm;
+    absolute_time_t draw_tm;
     uint        btn_gpio[3];
     int         btn_count[3];
 };
@@ -49,3 +49,57 @@
 #define JOY0_LEFT           21
 #define JOY0_RIGHT          22
 #define JOY0_FIRE           26
+
+// Read the DB-9 joystick pins on core1 each time the ROM reads the joystick
+// port, rather than using the copy core0 takes every millisecond. Comment
+// out to only use the copy.
+#define JOYSTICK_DIRECT
+
+// Step the mouse quadrature registers from the 6301 cycle counter as the ROM
+// reads them. Comment out to step them from hardware alarms in real time,
+// which is needed for the optional outputs below.
+#define MOUSE_CYCLE_MODEL
+
+// Restore the 6301 at power on from a snapshot taken the first time the ROM
+// finished its self test, rather than running the test on every boot. The
+// snapshot is kept in flash. Comment out to always cold reset.
+#define READY_SNAPSHOT
+
+// Between slices core1 sleeps with WFE until its own hardware alarm fires,
+// and core0 sleeps between scheduler passes until an interrupt or the next
+// periodic task. Comment out to spin instead.
+#define LOW_POWER_SLEEP
+
+// Park both cores, stop servicing USB and switch the display off while the
+// ST is off, which is taken from its serial line staying low. Comment out to
+// keep running.
+#define ST_POWER_DETECT
+
+// Restart core1 from a snapshot of the 6301 if it stops finishing slices,
+// and reboot the chip with the hardware watchdog if core0 stops, see
+// Core1Watchdog.h. Comment out to leave a hung core alone.
+#define CORE1_WATCHDOG
+
+// Run the RP2040 at the lowest system clock that leaves CLOCK_MARGIN_PERCENT
+// of every core1 slice spare, see ClockGovernor.h. The UART and display
+// rates at the lower clocks have not been checked on hardware yet.
+// Uncomment to enable, otherwise the SDK's 125MHz is kept.
+//#define CLOCK_GOVERNOR
+#define CLOCK_MARGIN_PERCENT    30
+
+// With CLOCK_GOVERNOR, also lower the core voltage below the 1.10V the
+// RP2040 is rated at on the slower clocks. This runs the chip out of its
+// datasheet spec. Uncomment to enable.
+//#define CLOCK_UNDERVOLT
+
+// Print a CSV record of the performance counters of both cores to the UART
+// console every second. Comment out to only print one when t is typed on
+// the console.
+#define TELEMETRY_STREAM
+
+// Optional quadrature outputs, bits 0 and 1 of each mouse register, for
+// driving a real ST mouse port. Uncomment to enable.
+//#define MOUSE_XA            2
+//#define MOUSE_XB            3
+//#define MOUSE_YA            6
+//#define MOUSE_YB            7
@@ -20,6 +20,10 @@
 #include <math.h>
 #include "util.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include "hardware/sync.h"
+#include "config.h"
+#include "CoreLink.h"
 
 #define MOUSE_MASK 0x33333333
 #define MAX_SPEED 50000.0
@@ -31,56 +35,56 @@ AtariSTMouse& AtariSTMouse::instance() {
 }
 
 AtariSTMouse::AtariSTMouse() {
-    /*
-    gpio_init(14);
-    gpio_init(15);
-    gpio_set_dir(14, GPIO_OUT);
-    gpio_set_dir(15, GPIO_OUT);
-    gpio_set_pulls(14, true, true);
-    gpio_set_pulls(15, true, true);
-    */
-    x_reg = MOUSE_MASK;
-    y_reg = MOUSE_MASK;
+    x.reg = MOUSE_MASK;
+    y.reg = MOUSE_MASK;
     
     // internal mouse state is random: A239/Jumping Jackson, Droid SE WIP
-    x_reg = _rotl(x_reg, rand() % 16);
-    y_reg = _rotl(x_reg, rand() % 16);
+    x.reg = _rotl(x.reg, rand() % 16);
+    y.reg = _rotl(x.reg, rand() % 16);
 
-    last_x_us = last_y_us = get_absolute_time();
+    x.last = y.last = get_absolute_time();
+
+#if defined(MOUSE_XA) && defined(MOUSE_XB) && defined(MOUSE_YA) && defined(MOUSE_YB)
+    x.pin_a = MOUSE_XA;
+    x.pin_b = MOUSE_XB;
+    y.pin_a = MOUSE_YA;
+    y.pin_b = MOUSE_YB;
+    const int pins[] = { MOUSE_XA, MOUSE_XB, MOUSE_YA, MOUSE_YB };
+    for (int pin : pins) {
+        gpio_init(pin);
+        gpio_set_dir(pin, GPIO_OUT);
+    }
+    gpio_put(x.pin_a, x.reg & 1);
+    gpio_put(x.pin_b, (x.reg & 2) ? 1 : 0);
+    gpio_put(y.pin_a, y.reg & 1);
+    gpio_put(y.pin_b, (y.reg & 2) ? 1 : 0);
+#endif
 }
 
-void AtariSTMouse::update() {
-    // Get the current time to see if we need to update the next cycle.
-    absolute_time_t tm = get_absolute_time();
-    // If either axis is currently moving then see if we've exceeded the next rotation time
-    if (x_period_us != 0) {
-        // Find out what time we should rotate at
-        absolute_time_t cycle_time = delayed_by_us(last_x_us, abs(x_period_us));
-        if (absolute_time_diff_us(tm, cycle_time) < 0) {
-            // Time to cycle
-            last_x_us = tm;
-            x_reg = (x_period_us > 0) ? _rotr(x_reg, 1) : _rotl(x_reg, 1);
-            //gpio_put(14, x_reg & 1);
-            //gpio_put(15, (x_reg & 2) ? 1 : 0);
-        }
+int64_t AtariSTMouse::on_alarm(alarm_id_t id, void* user_data) {
+    Axis& axis = *(Axis*)user_data;
+    int period = axis.period_us;
+    if (period == 0) {
+        axis.alarm = 0;
+        return 0;
     }
-    if (y_period_us != 0) {
-        // Find out what time we should rotate at
-        absolute_time_t cycle_time = delayed_by_us(last_y_us, abs(y_period_us));
-        if (absolute_time_diff_us(tm, cycle_time) < 0) {
-            // Time to cycle
-            last_y_us = tm;
-            y_reg = (y_period_us > 0) ? _rotr(y_reg, 1) : _rotl(y_reg, 1);
-        }
+    axis.last = get_absolute_time();
+    axis.reg = (period > 0) ? _rotr(axis.reg, 1) : _rotl(axis.reg, 1);
+    if (axis.pin_a >= 0) {
+        gpio_put(axis.pin_a, axis.reg & 1);
+        gpio_put(axis.pin_b, (axis.reg & 2) ? 1 : 0);
     }
+    // Negative means relative to when this alarm was due, so there is no drift
+    return -(int64_t)abs(period);
 }
 
-void AtariSTMouse::set_speed(int x, int y) {
-    set_speed_internal(x, x_period_us);
-    set_speed_internal(y, y_period_us);
+void AtariSTMouse::set_speed(int x_speed, int y_speed) {
+    set_speed_internal(x_speed, x);
+    set_speed_internal(y_speed, y);
 }
 
-void AtariSTMouse::set_speed_internal(int speed, int& period) {
+void AtariSTMouse::set_speed_internal(int speed, Axis& axis) {
+    int period;
     if (speed == 0) {
         period = 0;
     }
@@ -93,17 +97,41 @@ void AtariSTMouse::set_speed_internal(int speed, int& period) {
             period = -MIN_SPEED;
         }
     }
+    if (period == axis.period_us) {
+        return;
+    }
+
+    // The alarm runs on this core, keep it out while the axis is changed
+    uint32_t irq = save_and_disable_interrupts();
+    axis.period_us = period;
+    if (axis.alarm) {
+        cancel_alarm(axis.alarm);
+        axis.alarm = 0;
+    }
+    if (period != 0) {
+        // The next step is one new period after the last one, or straight
+        // away if that has already passed
+        axis.alarm = add_alarm_at(delayed_by_us(axis.last, abs(period)), on_alarm, &axis, true);
+        if (axis.alarm < 0) {
+            axis.alarm = 0;
+        }
+    }
+    restore_interrupts(irq);
 }
 
 const int AtariSTMouse::get_x_reg() const {
-    return x_reg;
+    return x.reg;
 }
 
 const int AtariSTMouse::get_y_reg() const{
-    return y_reg;
+    return y.reg;
 }
 
 void mouse_tick(int64_t cpu_cycles, int* x_counter, int* y_counter) {
+#ifdef MOUSE_CYCLE_MODEL
+    CoreLink::instance().mouse().tick(cpu_cycles, x_counter, y_counter);
+#else
     *x_counter = AtariSTMouse::instance().get_x_reg();
     *y_counter = AtariSTMouse::instance().get_y_reg();
+#endif
 }
@@ -0,0 +1,145 @@
+/*
+ * Atari ST RP2040 IKBD Emulator
+ * Copyright (C) 2021 Roy Hopkins
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#include "ClockGovernor.h"
+#include "EmulatorLoad.h"
+#include "PowerMonitor.h"
+#include "SerialPort.h"
+#include "UserInterface.h"
+#include "pico/stdlib.h"
+#include "hardware/clocks.h"
+#include "hardware/vreg.h"
+#include "hardware/sync.h"
+#include <stdio.h>
+
+struct ClockStep {
+    uint32_t            khz;
+    enum vreg_voltage   vreg;
+};
+
+// Lowest first, the last is the SDK default the firmware boots at. Each
+// clock can be made exactly by the system PLL from the 12MHz crystal. The
+// datasheet only rates the RP2040 at 1.10V, the lower voltages of
+// CLOCK_UNDERVOLT are out of spec.
+static const ClockStep clock_steps[] = {
+#ifdef CLOCK_UNDERVOLT
+    { 48000,  VREG_VOLTAGE_0_95 },
+    { 64000,  VREG_VOLTAGE_1_00 },
+    { 96000,  VREG_VOLTAGE_1_05 },
+#else
+    { 48000,  VREG_VOLTAGE_1_10 },
+    { 64000,  VREG_VOLTAGE_1_10 },
+    { 96000,  VREG_VOLTAGE_1_10 },
+#endif
+    { 125000, VREG_VOLTAGE_1_10 },
+};
+#define CLOCK_STEPS ((int)(sizeof(clock_steps) / sizeof(clock_steps[0])))
+#define CLOCK_TOP   (CLOCK_STEPS - 1)
+
+ClockGovernor& ClockGovernor::instance() {
+    static ClockGovernor governor;
+    return governor;
+}
+
+void ClockGovernor::update() {
+    EmulatorLoad& load = EmulatorLoad::instance();
+    if (step < 0) {
+        step = CLOCK_TOP;
+        window_seen = load.windows();
+        missed_seen = load.missed();
+    }
+
+    int next = step;
+    bool off = PowerMonitor::instance().dormant();
+    uint32_t missed = load.missed();
+    if (missed != missed_seen) {
+        missed_seen = missed;
+        next = CLOCK_TOP;
+    }
+    else if (off) {
+        next = 0;
+    }
+    else if (dormant) {
+        // Back on, the 6301 restarts from the snapshot
+        next = CLOCK_TOP;
+    }
+    else if (load.windows() != window_seen) {
+        window_seen = load.windows();
+        EmulatorLoadStats stats;
+        if (settle) {
+            settle = false;
+        }
+        else if (load.get(stats)) {
+            const uint32_t limit = 100 - CLOCK_MARGIN_PERCENT;
+            if (stats.load_max > limit) {
+                if (step < CLOCK_TOP) {
+                    next = step + 1;
+                }
+            }
+            else if ((step > 0) &&
+                ((uint64_t)stats.load_max * clock_steps[step].khz <= (uint64_t)limit * clock_steps[step - 1].khz)) {
+                next = step - 1;
+            }
+        }
+    }
+    dormant = off;
+
+    // The UART and I2C dividers can't be changed under a transfer, so the
+    // step waits for both lines and the display flush to be idle. The line
+    // from the ST is held low while it is off.
+    SerialPort& serial = SerialPort::instance();
+    if ((next != step) && serial.tx_idle() && (off || serial.rx_idle()) && (!ui_ || ui_->display_idle())) {
+        set(next);
+    }
+}
+
+void ClockGovernor::set(int next) {
+    const ClockStep& to = clock_steps[next];
+    bool up = to.khz > clock_steps[step].khz;
+    if (up && (to.vreg != clock_steps[step].vreg)) {
+        vreg_set_voltage(to.vreg);
+        busy_wait_us(CLOCK_VREG_SETTLE_US);
+    }
+    // The UART runs at the wrong rate from the clock change until its
+    // divider is set again, so that is done with interrupts off
+    uint32_t irq = save_and_disable_interrupts();
+    set_sys_clock_khz(to.khz, true);
+    SerialPort::instance().clock_changed();
+#if LIB_PICO_STDIO_UART
+    uart_set_baudrate(uart_default, PICO_DEFAULT_UART_BAUD_RATE);
+#endif
+    restore_interrupts(irq);
+    if (!up && (to.vreg != clock_steps[step].vreg)) {
+        vreg_set_voltage(to.vreg);
+    }
+    if (ui_) {
+        ui_->clock_changed();
+    }
+    step = next;
+    settle = true;
+    ++changes;
+}
+
+uint32_t ClockGovernor::khz() const {
+    return clock_get_hz(clk_sys) / 1000;
+}
+
+void ClockGovernor::dump() const {
+    printf("clock: %luMHz changes %lu\n",
+        (unsigned long)(khz() / 1000), (unsigned long)changes);
+}
@@ -0,0 +1,92 @@
+/*
+ * Atari ST RP2040 IKBD Emulator
+ * Copyright (C) 2021 Roy Hopkins
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#include "Core1Watchdog.h"
+#include "IkbdMode.h"
+#include "6301.h"
+#include "pico/stdlib.h"
+#include "pico/multicore.h"
+#include "hardware/watchdog.h"
+#include <stdio.h>
+
+Core1Watchdog& Core1Watchdog::instance() {
+    static Core1Watchdog watchdog;
+    return watchdog;
+}
+
+void Core1Watchdog::start(void (*entry)()) {
+    if (watchdog_caused_reboot()) {
+        printf("Rebooted by the watchdog\n");
+    }
+    entry_ = entry;
+    checked_us = seen_us = time_us_32();
+    multicore_launch_core1(entry);
+    watchdog_enable(WATCHDOG_TIMEOUT_MS, true);
+}
+
+void Core1Watchdog::update() {
+    if (!entry_) {
+        return;
+    }
+    uint32_t now = time_us_32();
+    uint32_t beat = beats;
+    // If core0 was held up itself, by a flash write, core1 may have been
+    // fine all along, so it gets another full period
+    bool late = (now - checked_us) > WATCHDOG_STALL_US;
+    checked_us = now;
+    if (beat != seen) {
+        if (failing) {
+            failover_us = now - restart_us;
+            failing = 0;
+            printf("core1: stalled, restarted in %luus after %luus without a slice\n",
+                (unsigned long)failover_us, (unsigned long)(now - stalled_us));
+            // The instructions the 6301 was running when it stopped
+            hd6301_trace_dump();
+        }
+        seen = beat;
+        seen_us = now;
+    }
+    else if (held || late) {
+        seen_us = now;
+    }
+    else if (now - seen_us >= WATCHDOG_STALL_US) {
+        restart(now);
+    }
+
+    if (failing <= WATCHDOG_MAX_RESTARTS) {
+        watchdog_update();
+    }
+}
+
+void Core1Watchdog::restart(uint32_t now) {
+    multicore_reset_core1();
+    hd6301_trace_freeze();
+    if (!failing) {
+        stalled_us = seen_us;
+    }
+    failing = failing + 1;
+    restarts = restarts + 1;
+    if (!good_first()) {
+        // Core1 starts the 6301 from the ready snapshot, in the power on
+        // modes
+        IkbdMode::instance().reset();
+    }
+    restart_us = now;
+    seen_us = now;
+    multicore_launch_core1(entry_);
+}
@@ -0,0 +1,51 @@
+/*
+ * Atari ST RP2040 IKBD Emulator
+ * Copyright (C) 2021 Roy Hopkins
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#include "CoreAlarm.h"
+#include "hardware/timer.h"
+#include "hardware/sync.h"
+
+void CoreAlarm::init() {
+    if (alarm_num < 0) {
+        alarm_num = hardware_alarm_claim_unused(false);
+    }
+    else {
+        // Called again by a core that was reset, it keeps the alarm but the
+        // interrupt is set up afresh
+        hardware_alarm_set_callback(alarm_num, nullptr);
+    }
+    if (alarm_num >= 0) {
+        hardware_alarm_set_callback(alarm_num, on_alarm);
+    }
+}
+
+void CoreAlarm::on_alarm(unsigned int alarm_num) {
+    // Sets the event register in case the alarm fired before the WFE
+    __sev();
+}
+
+void CoreAlarm::sleep_until(absolute_time_t t) {
+    // hardware_alarm_set_target() returns true if the time has already passed
+    if ((alarm_num < 0) || hardware_alarm_set_target(alarm_num, t)) {
+        busy_wait_until(t);
+        return;
+    }
+    while (!time_reached(t)) {
+        __wfe();
+    }
+}
@@ -0,0 +1,218 @@
+/*
+ * Atari ST RP2040 IKBD Emulator
+ * Copyright (C) 2021 Roy Hopkins
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#include "CoreLink.h"
+#include "6301.h"
+#include "IkbdHle.h"
+#include "SerialTrace.h"
+#include "pico/time.h"
+#ifdef LATENCY_TRACE
+#include "LatencyTrace.h"
+#endif
+
+CoreLink& CoreLink::instance() {
+    static CoreLink link;
+    return link;
+}
+
+bool CoreLink::post_input(InputEventType type, uint8_t code, int16_t value) {
+    InputEvent event = { (uint8_t)type, code, value, time_us_32() };
+    return input.push(event);
+}
+
+void CoreLink::post_rx(uint8_t data) {
+    if (!rx.push(data)) {
+        dropped = dropped + 1;
+    }
+}
+
+void CoreLink::sync_clock(uint32_t time_us, int64_t cycles) {
+    clock_us = time_us;
+    clock_cycles = cycles;
+}
+
+int64_t CoreLink::poll(int64_t cycles) {
+    int64_t next_input = poll_input(cycles);
+    int64_t next_byte = 0;
+    uint8_t data;
+    if (hle) {
+        // The ST's UART has already spaced the bytes out
+        while (rx.pop(data)) {
+            hle->receive(data, cycles);
+            SerialTrace::instance().record(false, data);
+        }
+        return next_input;
+    }
+    if (rx.empty()) {
+        next_byte = 0;
+    }
+    else if (cycles < next_rx) {
+        next_byte = next_rx - cycles;
+    }
+    else if (!hd6301_sci_busy() && rx.pop(data)) {
+        hd6301_receive_byte(data);
+        next_rx = cycles + LINK_CYCLES_PER_BYTE;
+        SerialTrace::instance().record(false, data);
+        next_byte = rx.empty() ? 0 : LINK_CYCLES_PER_BYTE;
+    }
+    // Otherwise wait for the ROM to read RDR, checked again next slice
+
+    if (next_input && next_byte) {
+        return (next_input < next_byte) ? next_input : next_byte;
+    }
+    return next_input ? next_input : next_byte;
+}
+
+int CoreLink::slot(const InputEvent& event) {
+    switch (event.type) {
+    case INPUT_KEY:             return (event.code < 128) ? event.code : SLOT_NONE;
+    case INPUT_MOUSE_BUTTONS:   return SLOT_BUTTONS;
+    case INPUT_JOYSTICK:        return SLOT_JOYSTICK;
+    default:                    return SLOT_NONE;
+    }
+}
+
+int64_t CoreLink::poll_input(int64_t cycles) {
+    // Move new events off the queue so a held key doesn't hold up the rest
+    InputEvent event;
+    while ((pending_count < LINK_PENDING_INPUTS) && input.pop(event)) {
+        PendingInput& p = pending[pending_count++];
+        p.event = event;
+        p.due = clock_cycles + (int64_t)(int32_t)(event.time_us - clock_us) * (1 << turbo) +
+            (hle ? 0 : (LINK_INPUT_DELAY_CYCLES << turbo));
+    }
+
+    // Apply what is due in order, an event waits for any earlier one for
+    // the same input
+    uint32_t blocked[(SLOT_COUNT + 31) / 32] = {};
+    int64_t next = 0;
+    int kept = 0;
+    for (int i = 0; i < pending_count; ++i) {
+        PendingInput& p = pending[i];
+        int s = slot(p.event);
+        int64_t ready = p.due;
+        if (s != SLOT_NONE) {
+            if (ready < hold_until[s]) {
+                ready = hold_until[s];
+            }
+            if (blocked[s >> 5] & (1u << (s & 31))) {
+                ready = INT64_MAX;
+            }
+        }
+        if (ready <= cycles) {
+            apply(p.event, cycles);
+            continue;
+        }
+        if (s != SLOT_NONE) {
+            blocked[s >> 5] |= 1u << (s & 31);
+        }
+        if ((ready != INT64_MAX) && (!next || (ready - cycles < next))) {
+            next = ready - cycles;
+        }
+        pending[kept++] = p;
+    }
+    pending_count = kept;
+    return next;
+}
+
+bool CoreLink::post_tx(uint8_t data) {
+    if (!tx.push(data)) {
+        return false;
+    }
+    SerialTrace::instance().record(true, data);
+    return true;
+}
+
+void CoreLink::apply(const InputEvent& event, int64_t cycles) {
+#ifdef LATENCY_TRACE
+    static const int8_t traced[] = {
+        LATENCY_KEY, LATENCY_MOUSE, LATENCY_JOYSTICK, -1, LATENCY_MOUSE, LATENCY_MOUSE
+    };
+    if ((event.type < sizeof(traced)) && (traced[event.type] >= 0)) {
+        LatencyTrace::instance().input((LatencyInput)traced[event.type], event.time_us);
+    }
+#endif
+    if (hle) {
+        apply_hle(event);
+        return;
+    }
+    switch (event.type) {
+    case INPUT_KEY:
+        if (event.code < 128) {
+            keys[event.code] = event.value;
+            hd6301_set_key(event.code, event.value);
+            hold_until[event.code] = cycles + LINK_KEY_HOLD_CYCLES;
+        }
+        break;
+    case INPUT_MOUSE_BUTTONS:
+        buttons = event.value;
+        hold_until[SLOT_BUTTONS] = cycles + LINK_BUTTON_HOLD_CYCLES;
+        break;
+    case INPUT_JOYSTICK:
+        joy = event.value;
+        hold_until[SLOT_JOYSTICK] = cycles + LINK_JOYSTICK_HOLD_CYCLES;
+        break;
+    case INPUT_MOUSE_ENABLED:
+        mouse_en = event.value != 0;
+        if (!mouse_en) {
+            // The ROM isn't reading the mouse, don't let motion build up
+            mouse_model.clear();
+        }
+        break;
+    case INPUT_MOUSE_X:
+        if (mouse_en) {
+            mouse_model.add(event.value, 0);
+        }
+        break;
+    case INPUT_MOUSE_Y:
+        if (mouse_en) {
+            mouse_model.add(0, event.value);
+        }
+        break;
+    }
+}
+
+void CoreLink::apply_hle(const InputEvent& event) {
+    // Every change reaches the engine so nothing has to be held
+    switch (event.type) {
+    case INPUT_KEY:
+        if (event.code < 128) {
+            keys[event.code] = event.value;
+            hle->set_key(event.code, event.value != 0);
+        }
+        break;
+    case INPUT_MOUSE_BUTTONS:
+        buttons = event.value;
+        hle->set_mouse_buttons(event.value);
+        break;
+    case INPUT_JOYSTICK:
+        joy = event.value;
+        hle->set_joystick(event.value);
+        break;
+    case INPUT_MOUSE_ENABLED:
+        mouse_en = event.value != 0;
+        hle->set_mouse_enabled(mouse_en);
+        break;
+    case INPUT_MOUSE_X:
+        hle->add_mouse(event.value, 0);
+        break;
+    case INPUT_MOUSE_Y:
+        hle->add_mouse(0, event.value);
+        break;
+    }
+}
@@ -0,0 +1,96 @@
+/*
+ * Atari ST RP2040 IKBD Emulator
+ * Copyright (C) 2021 Roy Hopkins
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#include "EmulatorLoad.h"
+#include "hardware/sync.h"
+#include <stdio.h>
+
+EmulatorLoad& EmulatorLoad::instance() {
+    static EmulatorLoad load;
+    return load;
+}
+
+void EmulatorLoad::record(uint32_t busy_us, int32_t slack_us, uint32_t budget_us) {
+    if (current.slices == 0) {
+        current.busy_total_us = 0;
+        current.budget_total_us = 0;
+        current.busy_max_us = 0;
+        current.load_max = 0;
+        current.slack_min_us = INT32_MAX;
+    }
+    ++current.slices;
+    current.budget_total_us += budget_us;
+    current.busy_total_us += busy_us;
+    if (busy_us > current.busy_max_us) {
+        current.busy_max_us = busy_us;
+    }
+    if (budget_us && (busy_us * 100 / budget_us > current.load_max)) {
+        current.load_max = busy_us * 100 / budget_us;
+    }
+    if (slack_us < current.slack_min_us) {
+        current.slack_min_us = slack_us;
+    }
+    if (slack_us < 0) {
+        ++current.missed_total;
+        missed_now = current.missed_total;
+        if ((uint32_t)-slack_us > current.overrun_worst_us) {
+            current.overrun_worst_us = -slack_us;
+        }
+    }
+
+    if (current.budget_total_us >= LOAD_WINDOW_US) {
+        // Odd sequence number tells the reader a copy is in progress
+        seq = seq + 1;
+        __dmb();
+        published = current;
+        __dmb();
+        seq = seq + 1;
+        current.slices = 0;
+    }
+}
+
+bool EmulatorLoad::get(EmulatorLoadStats& stats) const {
+    uint32_t s;
+    do {
+        s = seq;
+        __dmb();
+        stats = published;
+        __dmb();
+    } while ((s & 1) || (s != seq));
+    return stats.slices != 0;
+}
+
+int EmulatorLoad::utilisation(const EmulatorLoadStats& stats) {
+    return stats.budget_total_us ? (int)((stats.busy_total_us * 100) / stats.budget_total_us) : 0;
+}
+
+void EmulatorLoad::dump() const {
+    EmulatorLoadStats stats;
+    if (get(stats)) {
+        printf("core1: load %d%% slices %lu busy avg %luus max %luus (%lu%%) slack min %ldus missed %lu worst overrun %luus dropped %lluus\n",
+            utilisation(stats),
+            (unsigned long)stats.slices,
+            (unsigned long)(stats.busy_total_us / stats.slices),
+            (unsigned long)stats.busy_max_us,
+            (unsigned long)stats.load_max,
+            (long)stats.slack_min_us,
+            (unsigned long)stats.missed_total,
+            (unsigned long)stats.overrun_worst_us,
+            (unsigned long long)stats.dropped_total_us);
+    }
+}
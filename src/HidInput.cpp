@@ -22,7 +22,13 @@
 #include "bsp/board.h"
 #include "tusb.h"
 #include "config.h"
-#include <map>
+#include "CoreLink.h"
+#include "HidLayout.h"
+#include "Telemetry.h"
+#include "IkbdMode.h"
+#include "hardware/sync.h"
+#include <algorithm>
+#include <string.h>
 
 // Mouse toggle key is set to Scroll Lock
 #define TOGGLE_MOUSE_MODE 71
@@ -32,78 +38,220 @@
 #define ATARI_ALT    56
 #define ATARI_CTRL   29
 
-#define GET_I32_VALUE(item)     (int32_t)(item->Value | ((item->Value & (1 << (item->Attributes.BitSize-1))) ? ~((1 << item->Attributes.BitSize) - 1) : 0))
 #define JOY_GPIO_INIT(io)       gpio_init(io); gpio_set_dir(io, GPIO_IN); gpio_pull_up(io);
 
-static std::map<int, uint8_t*> device;
+// Mouse gain for each speed setting from MOUSE_MIN to MOUSE_MAX, 1 + 0.1 *
+// speed in 8.8 fixed point
+static const int16_t mouse_gain[MOUSE_MAX - MOUSE_MIN + 1] = {
+     77, 102, 128, 154, 179, 205, 230, 256,
+    282, 307, 333, 358, 384, 410, 435, 461
+};
+
+// Largest report kept for a device, a report is one full speed packet
+#define HID_REPORT_MAX  64
+
+#ifdef CFG_TUSB_HOST_DEVICE_MAX
+#define HID_DEVICE_MAX  CFG_TUSB_HOST_DEVICE_MAX
+#else
+#define HID_DEVICE_MAX  8
+#endif
+
+/**
+ * A mounted keyboard, mouse or joystick and the buffer its reports are
+ * received into
+ */
+struct HidDevice {
+    bool      mounted;
+    HID_TYPE  type;
+    uint8_t   report[HID_REPORT_MAX];
+    HidLayout layout;
+    // Keyboard: usages down in the last report and whether it sends a bitmap
+    uint32_t  keys[HID_KEY_WORDS];
+    bool      nkro;
+    // Mouse: buttons held in the last report, bit 1 left and bit 0 right
+    uint8_t   buttons;
+    // Not asked for reports because the ST isn't reading the device
+    bool      parked;
+};
+
+/**
+ * Addresses of the mounted devices of one type in address order
+ */
+struct HidDeviceList {
+    uint8_t count;
+    uint8_t addr[HID_DEVICE_MAX];
+
+    void add(uint8_t dev_addr) {
+        int i = count++;
+        for (; (i > 0) && (addr[i - 1] > dev_addr); --i) {
+            addr[i] = addr[i - 1];
+        }
+        addr[i] = dev_addr;
+    }
+
+    void remove(uint8_t dev_addr) {
+        int j = 0;
+        for (int i = 0; i < count; ++i) {
+            if (addr[i] != dev_addr) {
+                addr[j++] = addr[i];
+            }
+        }
+        count = j;
+    }
+};
+
+// Indexed by device address, TinyUSB addresses start at 1
+static HidDevice device[HID_DEVICE_MAX + 1];
+static HidDeviceList keyboards;
+static HidDeviceList mice;
+static HidDeviceList joysticks;
 static UserInterface* ui_ = nullptr;
-static int kb_count = 0;
-static int mouse_count = 0;
-static int joy_count = 0;
+
+// USB joystick in each slot, 0 if the slot is free. A joystick keeps its
+// slot until it is unmounted, slot 0 feeds the first ST port set to USB.
+#define JOYSTICK_SLOTS  2
+static uint8_t joystick_slot[JOYSTICK_SLOTS];
+
+// Bit n is set when a report from the device at address n has arrived
+// since the last poll. Each device is asked for its next report as soon as
+// one is handled so it is polled at its own interval.
+#define READY_ALL       0xffffffffu
+static volatile uint32_t report_ready = 0;
+static_assert(HID_DEVICE_MAX < 32, "report_ready has a bit for each address");
+
+/**
+ * Give a USB joystick that doesn't have a slot the first free one
+ */
+static void joystick_attach(uint8_t dev_addr) {
+    for (int i = 0; i < JOYSTICK_SLOTS; ++i) {
+        if (joystick_slot[i] == dev_addr) {
+            return;
+        }
+    }
+    for (int i = 0; i < JOYSTICK_SLOTS; ++i) {
+        if (!joystick_slot[i]) {
+            joystick_slot[i] = dev_addr;
+            printf("Joystick (address %d) is USB joystick %d\r\n", dev_addr, i);
+            return;
+        }
+    }
+}
+
+/**
+ * Stop asking a mouse or joystick for reports while the ST isn't reading
+ * it. When it is wanted again the report left in the buffer is out of date,
+ * so the next one is asked for without handling it. Returns true if the
+ * report should be handled.
+ */
+static bool device_wanted(uint8_t dev_addr, bool used) {
+    HidDevice& dev = device[dev_addr];
+    if (!used) {
+        dev.parked = true;
+        return false;
+    }
+    if (dev.parked) {
+        dev.parked = false;
+        tuh_hid_get_report(dev_addr, dev.report);
+        return false;
+    }
+    return true;
+}
+
+static HidDeviceList* device_list(HID_TYPE tp) {
+    switch (tp) {
+    case HID_KEYBOARD:  return &keyboards;
+    case HID_MOUSE:     return &mice;
+    case HID_JOYSTICK:  return &joysticks;
+    default:            return nullptr;
+    }
+}
 
 extern "C" {
 
 void tuh_hid_mounted_cb(uint8_t dev_addr) {
     HID_TYPE tp = tuh_hid_get_type(dev_addr);
-    if (tp == HID_KEYBOARD) {
-        printf("A keyboard device (address %d) is mounted\r\n", dev_addr);
-        device[dev_addr] = new uint8_t[sizeof(hid_keyboard_report_t)];
-        tuh_hid_get_report(dev_addr, device[dev_addr]);
-        ++kb_count;
-    }
-    else if (tp == HID_MOUSE) {
-        printf("A mouse device (address %d) is mounted\r\n", dev_addr);
-        device[dev_addr] = new uint8_t[tuh_hid_get_report_size(dev_addr)];
-        tuh_hid_get_report(dev_addr, device[dev_addr]);
-        ++mouse_count;
-    }
-    else if (tp == HID_JOYSTICK) {
-        printf("A joystick device (address %d) is mounted\r\n", dev_addr);
-        device[dev_addr] = new uint8_t[tuh_hid_get_report_size(dev_addr)];
-        tuh_hid_get_report(dev_addr, device[dev_addr]);
-        ++joy_count;
+    HidDeviceList* list = device_list(tp);
+    if (!list) {
+        return;
+    }
+    if ((dev_addr == 0) || (dev_addr > HID_DEVICE_MAX) || device[dev_addr].mounted) {
+        printf("Device (address %d) not supported\r\n", dev_addr);
+        return;
+    }
+    HidDevice& dev = device[dev_addr];
+    dev.layout.parse(tuh_hid_get_report_info(dev_addr));
+    // A keyboard in the boot protocol sends the boot report whatever its
+    // descriptor says, only use the descriptor if the report is larger
+    uint32_t size = tuh_hid_get_report_size(dev_addr);
+    dev.nkro = (tp == HID_KEYBOARD) && dev.layout.nkro() && (size > sizeof(hid_keyboard_report_t));
+    if ((tp == HID_KEYBOARD) && !dev.nkro) {
+        size = sizeof(hid_keyboard_report_t);
+    }
+    if (size > HID_REPORT_MAX) {
+        printf("Device (address %d, report size %lu) not supported\r\n", dev_addr, (unsigned long)size);
+        return;
     }
+    printf("A %s device (address %d) is mounted\r\n",
+        (tp == HID_KEYBOARD) ? "keyboard" : (tp == HID_MOUSE) ? "mouse" : "joystick", dev_addr);
+    dev.mounted = true;
+    dev.type = tp;
+    Telemetry::instance().boot(TELEMETRY_BOOT_HID);
+    memset(dev.keys, 0, sizeof(dev.keys));
+    dev.buttons = 0;
+    dev.parked = false;
+    list->add(dev_addr);
+    if (tp == HID_JOYSTICK) {
+        joystick_attach(dev_addr);
+    }
+    tuh_hid_get_report(dev_addr, dev.report);
     if (ui_) {
-        ui_->usb_connect_state(kb_count, mouse_count, joy_count);
+        ui_->usb_connect_state(keyboards.count, mice.count, joysticks.count);
     }
 }
 
 void tuh_hid_unmounted_cb(uint8_t dev_addr) {
-    HID_TYPE tp = tuh_hid_get_type(dev_addr);
-    if (tp == HID_KEYBOARD) {
-        printf("A keyboard device (address %d) is unmounted\r\n", dev_addr);
-        --kb_count;
+    if ((dev_addr > HID_DEVICE_MAX) || !device[dev_addr].mounted) {
+        return;
     }
-    else if (tp == HID_MOUSE) {
-        printf("A mouse device (address %d) is unmounted\r\n", dev_addr);
-        --mouse_count;
+    HidDevice& dev = device[dev_addr];
+    printf("A %s device (address %d) is unmounted\r\n",
+        (dev.type == HID_KEYBOARD) ? "keyboard" : (dev.type == HID_MOUSE) ? "mouse" : "joystick", dev_addr);
+    device_list(dev.type)->remove(dev_addr);
+    if (dev.type == HID_KEYBOARD) {
+        // Release anything this keyboard was holding down
+        const uint32_t none[HID_KEY_WORDS] = {};
+        HidInput::instance().update_keys(dev.keys, none);
     }
-    else if (tp == HID_JOYSTICK) {
-        printf("A joystick device (address %d) is unmounted\r\n", dev_addr);
-        --joy_count;
-    }
-    auto it = device.find(dev_addr);
-    if (it != device.end()) {
-        delete[] it->second;
-        device.erase(it);
+    if (dev.type == HID_JOYSTICK) {
+        // A joystick that was waiting, lowest address first, takes the slot
+        for (int i = 0; i < JOYSTICK_SLOTS; ++i) {
+            if (joystick_slot[i] == dev_addr) {
+                joystick_slot[i] = 0;
+            }
+        }
+        for (int i = 0; i < joysticks.count; ++i) {
+            joystick_attach(joysticks.addr[i]);
+        }
     }
+    dev.mounted = false;
+    dev.layout = HidLayout();
     if (ui_) {
-        ui_->usb_connect_state(kb_count, mouse_count, joy_count);
+        ui_->usb_connect_state(keyboards.count, mice.count, joysticks.count);
     }
 }
 
 // invoked ISR context
 void tuh_hid_isr(uint8_t dev_addr, xfer_result_t event) {
-    (void) dev_addr;
-    (void) event;
+    if ((event != XFER_RESULT_SUCCESS) || (dev_addr > HID_DEVICE_MAX) || !device[dev_addr].mounted) {
+        return;
+    }
+    report_ready = report_ready | (1u << dev_addr);
+    Telemetry::instance().hid_report(dev_addr);
 }
 
 }
 
 HidInput::HidInput() {
-    key_states.resize(128);
-    std::fill(key_states.begin(), key_states.end(), 0);
-
     JOY_GPIO_INIT(JOY1_UP);
     JOY_GPIO_INIT(JOY1_DOWN);
     JOY_GPIO_INIT(JOY1_LEFT);
@@ -114,6 +262,23 @@ HidInput::HidInput() {
     JOY_GPIO_INIT(JOY0_LEFT);
     JOY_GPIO_INIT(JOY0_RIGHT);
     JOY_GPIO_INIT(JOY0_FIRE);
+
+#ifdef JOYSTICK_DIRECT
+    // Pressed pulls a pin low. The buttons are as st_mouse_buttons(), the
+    // left one is joystick 0 fire.
+    static const struct { uint8_t pin; uint16_t bits; } pins[] = {
+        { JOY0_UP, 0x01 }, { JOY0_DOWN, 0x02 }, { JOY0_LEFT, 0x04 }, { JOY0_RIGHT, 0x08 },
+        { JOY1_UP, 0x10 }, { JOY1_DOWN, 0x20 }, { JOY1_LEFT, 0x40 }, { JOY1_RIGHT, 0x80 },
+        { JOY0_FIRE, 0x200 }, { JOY1_FIRE, 0x100 }
+    };
+    for (auto& p : pins) {
+        for (int value = 0; value < 256; ++value) {
+            if (value & (1 << (p.pin & 7))) {
+                joystick_pins[p.pin >> 3][value] |= p.bits;
+            }
+        }
+    }
+#endif
 }
 
 HidInput& HidInput::instance() {
@@ -128,141 +293,245 @@ void HidInput::set_ui(UserInterface& ui) {
 void HidInput::open(const std::string& kbdev, const std::string& mousedev, const std::string joystickdev) {
 }
 
-void HidInput::handle_keyboard() {
-    for (auto it : device) {
-        if (tuh_hid_get_type(it.first) != HID_KEYBOARD) {
-            continue;
+// Boot report modifier bits in order, usages 0xe0-0xe7
+static const uint8_t st_modifier[8] = {
+    ATARI_CTRL, ATARI_LSHIFT, ATARI_ALT, 0, ATARI_CTRL, ATARI_RSHIFT, ATARI_ALT, 0
+};
+
+static bool boot_keys(const hid_keyboard_report_t* kb, uint32_t keys[HID_KEY_WORDS]) {
+    for (int i = 0; i < 6; ++i) {
+        // Every slot says rollover when too many keys are down, keep the
+        // keys as they were
+        if (kb->keycode[i] == 0x01) {
+            return false;
         }
-        if (tuh_hid_is_mounted(it.first) && !tuh_hid_is_busy(it.first)) {
-            hid_keyboard_report_t* kb = (hid_keyboard_report_t*)it.second;
-
-            // Translate the USB HID codes into ST keys that are currently down
-            char st_keys[6];
-            for (int i = 0; i < 6; ++i) {
-                if ((kb->keycode[i] > 0) && (kb->keycode[i] < 128)) {
-                    st_keys[i] = st_key_lookup_hid_gb[kb->keycode[i]];
-                    if (kb->keycode[i] == TOGGLE_MOUSE_MODE) {
-                        ui_->set_mouse_enabled(!ui_->get_mouse_enabled());
-                    }
-                }
-                else {
-                    st_keys[i] = 0;
-                }
-            }
-            // Go through all ST keys and update their state
-            for (int i = 1; i < key_states.size(); ++i) {
-                bool down = false;
-                for (int j = 0; j < 6; ++j) {
-                    if (st_keys[j] == i) {
-                        down = true;
-                        break;
-                    }
-                }
-                key_states[i] = down ? 1 : 0;
-            }
+        if (kb->keycode[i]) {
+            keys[kb->keycode[i] >> 5] |= 1u << (kb->keycode[i] & 31);
+        }
+    }
+    keys[0xe0 >> 5] |= (uint32_t)kb->modifier << (0xe0 & 31);
+    return true;
+}
 
-            // Handle modifier keys
-            key_states[ATARI_LSHIFT] = (kb->modifier & KEYBOARD_MODIFIER_LEFTSHIFT) ? 1 : 0;
-            key_states[ATARI_RSHIFT] = (kb->modifier & KEYBOARD_MODIFIER_RIGHTSHIFT) ? 1 : 0;
-            key_states[ATARI_CTRL] = ((kb->modifier & KEYBOARD_MODIFIER_LEFTCTRL) ||
-                                      (kb->modifier & KEYBOARD_MODIFIER_RIGHTCTRL)) ? 1 : 0;
-            key_states[ATARI_ALT] = ((kb->modifier & KEYBOARD_MODIFIER_LEFTALT) ||
-                                      (kb->modifier & KEYBOARD_MODIFIER_RIGHTALT)) ? 1 : 0;
+void HidInput::poll(const int64_t cpu_cycles) {
+    uint32_t irq = save_and_disable_interrupts();
+    uint32_t ready = report_ready;
+    report_ready = 0;
+    restore_interrupts(irq);
+
+    // Check everything now and again in case a completion was missed, this
+    // also retries anything that couldn't be queued for core1
+    absolute_time_t tm = get_absolute_time();
+    if (absolute_time_diff_us(poll_tm, tm) >= HID_POLL_ALL_US) {
+        poll_tm = tm;
+        ready = READY_ALL;
+    }
+    if (ready & device_mask(keyboards)) {
+        handle_keyboard(ready);
+    }
+    if (ready & device_mask(mice)) {
+        handle_mouse(cpu_cycles, ready);
+    }
+    // A USB joystick is read as soon as it reports as well as on the
+    // regular joystick poll
+    if (ready != READY_ALL && (ready & device_mask(joysticks))) {
+        handle_joystick();
+    }
+}
+
+uint32_t HidInput::device_mask(const HidDeviceList& list) {
+    uint32_t mask = 0;
+    for (int d = 0; d < list.count; ++d) {
+        mask |= 1u << list.addr[d];
+    }
+    return mask;
+}
+
+void HidInput::handle_keyboard(uint32_t ready) {
+    // A new layout is taken up once no key is held, so every key is
+    // released with the scancode it was pressed with
+    if (!keys_held) {
+        key_layout = ui_->get_key_layout();
+    }
+    for (int d = 0; d < keyboards.count; ++d) {
+        uint8_t addr = keyboards.addr[d];
+        HidDevice& dev = device[addr];
+        if ((ready & (1u << addr)) && tuh_hid_is_mounted(addr) && !tuh_hid_is_busy(addr)) {
+            uint32_t keys[HID_KEY_WORDS] = {};
+            bool ok = dev.nkro ? dev.layout.get_keys(dev.report, keys) :
+                                 boot_keys((const hid_keyboard_report_t*)dev.report, keys);
+            if (ok) {
+                update_keys(dev.keys, keys);
+            }
             // Trigger the next report
-            tuh_hid_get_report(it.first, it.second);
+            tuh_hid_get_report(addr, dev.report);
         }
     }
+    if (key_retry) {
+        key_retry = false;
+        for (int i = 1; i < (int)sizeof(key_states); ++i) {
+            set_key(i, key_refs[i] != 0);
+        }
+    }
+    publish();
 }
 
-void HidInput::handle_mouse(const int64_t cpu_cycles) {
-    int32_t x = 0;
-    int32_t y = 0;
-    for (auto it : device) {
-        if (tuh_hid_get_type(it.first) != HID_MOUSE) {
-            continue;
+void HidInput::update_keys(uint32_t held[HID_KEY_WORDS], const uint32_t keys[HID_KEY_WORDS]) {
+    for (int w = 0; w < HID_KEY_WORDS; ++w) {
+        uint32_t changed = held[w] ^ keys[w];
+        while (changed) {
+            int bit = __builtin_ctz(changed);
+            changed &= changed - 1;
+            key_event((w << 5) | bit, (keys[w] >> bit) & 1);
         }
-        if (tuh_hid_is_mounted(it.first) && !tuh_hid_is_busy(it.first)) {
-            hid_mouse_report_t* mouse = (hid_mouse_report_t*)it.second;
+        held[w] = keys[w];
+    }
+}
 
-            const uint8_t* js = it.second;
-            HID_ReportInfo_t* info = tuh_hid_get_report_info(it.first);
-            if (info) {
-                // Get the data from the HID report
-                int8_t buttons = 0;
+void HidInput::key_event(int usage, bool down) {
+    if ((usage == TOGGLE_MOUSE_MODE) && down) {
+        ui_->set_mouse_enabled(!ui_->get_mouse_enabled());
+    }
+    int code = 0;
+    if (usage < 128) {
+        code = st_key_lookup_hid[key_layout][usage];
+    }
+    else if (usage >= 0xe0 && usage <= 0xe7) {
+        code = st_modifier[usage - 0xe0];
+    }
+    if ((code <= 0) || (code >= 128)) {
+        return;
+    }
+    // Count the USB keys holding each ST key down, so two keyboards or
+    // both shift keys don't release it early
+    if (down) {
+        ++key_refs[code];
+        ++keys_held;
+    }
+    else if (key_refs[code]) {
+        --key_refs[code];
+        --keys_held;
+    }
+    set_key(code, key_refs[code] != 0);
+}
 
-                for (uint8_t i = 0; i < info->TotalReportItems; ++i) {
-                    HID_ReportItem_t* item = &info->ReportItems[i];
-                    // Update the report item value if it is contained within the current report
-                    if (!(USB_GetHIDReportItemInfo((const uint8_t*)js, item)))
-                        continue;
-                    // Determine what report item is being tested, process updated value as needed
-                    if ((item->Attributes.Usage.Page == USAGE_PAGE_BUTTON) && (item->ItemType == HID_REPORT_ITEM_In)) {
-                        buttons |= (item->Value ? 1 : 0) << (item->Attributes.Usage.Usage - 1);
-                    }
-                    else if ((item->Attributes.Usage.Page == USAGE_PAGE_GENERIC_DCTRL) &&
-                                ((item->Attributes.Usage.Usage == USAGE_X) ||
-                                 (item->Attributes.Usage.Usage == USAGE_Y)) &&
-                                 (item->ItemType == HID_REPORT_ITEM_In)) {
-                        if (item->Attributes.Usage.Usage == USAGE_X) {
-                            x = GET_I32_VALUE(item);
-                        }
-                        else {
-                            y = GET_I32_VALUE(item);
-                        }
-                    }
+void HidInput::handle_mouse(const int64_t cpu_cycles, uint32_t ready) {
+    // Motion is added up over all the mice and a button is down if it is
+    // down on any of them. Movement is only read while the ST is reading
+    // the mouse, and the mice aren't polled at all while the buttons aren't
+    // read either.
+    const IkbdMode& mode = IkbdMode::instance();
+    bool motion = mode.mouse_motion();
+    int32_t x = 0;
+    int32_t y = 0;
+    bool reported = false;
+    uint8_t held = 0;
+    for (int d = 0; d < mice.count; ++d) {
+        uint8_t addr = mice.addr[d];
+        if ((ready & (1u << addr)) && tuh_hid_is_mounted(addr) && !tuh_hid_is_busy(addr) &&
+            device_wanted(addr, mode.buttons())) {
+            const uint8_t* report = device[addr].report;
+            const HidLayout& l = get_layout(addr);
+            if (l.valid) {
+                int32_t value;
+                if (motion && l.x.get_signed(report, value)) {
+                    x += value;
+                }
+                if (motion && l.y.get_signed(report, value)) {
+                    y += value;
                 }
                 // Update button state
-                mouse_state = (mouse_state & 0xfd) | ((buttons & MOUSE_BUTTON_LEFT) ? 2 : 0);
-                mouse_state = (mouse_state & 0xfe) | ((buttons & MOUSE_BUTTON_RIGHT) ? 1 : 0);
+                int8_t buttons = 0;
+                for (uint8_t i = 0; i < l.button_count; ++i) {
+                    uint32_t down;
+                    if ((l.button_usage[i] >= 1) && (l.button_usage[i] <= 8) &&
+                        l.buttons[i].get(report, down)) {
+                        buttons |= (down ? 1 : 0) << (l.button_usage[i] - 1);
+                    }
+                }
+                device[addr].buttons = ((buttons & MOUSE_BUTTON_LEFT) ? 2 : 0) |
+                                       ((buttons & MOUSE_BUTTON_RIGHT) ? 1 : 0);
+                reported = true;
             }
             // Trigger the next report
-            tuh_hid_get_report(it.first, it.second);
+            tuh_hid_get_report(addr, device[addr].report);
         }
+        held |= device[addr].buttons;
+    }
+    if (reported) {
+        mouse_state = (mouse_state & ~3) | held;
     }
     // Handle the mouse acceleration/deceleration configured in the UI.
-    double accel = 1.0 + ((double)ui_->get_mouse_speed() * 0.1);
-    AtariSTMouse::instance().set_speed((int)((double)x * accel), (int)((double)y * accel));
+    int speed = std::max(MOUSE_MIN, std::min(MOUSE_MAX, (int)ui_->get_mouse_speed()));
+    int32_t gain = mouse_gain[speed - MOUSE_MIN];
+    x = scale_motion(x, gain, mouse_frac_x);
+    y = scale_motion(y, gain, mouse_frac_y);
+#ifndef MOUSE_CYCLE_MODEL
+    if (ui_->get_engine() != ENGINE_HLE) {
+        AtariSTMouse::instance().set_speed(x, y);
+        x = y = 0;
+    }
+#endif
+    // Counts for the cycle model or the high level engine
+    mouse_dx += x;
+    mouse_dy += y;
+    publish();
+}
+
+int32_t HidInput::scale_motion(int32_t delta, int32_t gain, int32_t& frac) {
+    // The fraction left over is kept for the next report so slow movement
+    // isn't lost. The shift rounds down so frac is always 0-255.
+    int32_t scaled = delta * gain + frac;
+    int32_t counts = scaled >> 8;
+    frac = scaled - counts * 256;
+    return counts;
+}
+
+const HidLayout& HidInput::get_layout(int addr) {
+    // Parse now if the descriptor wasn't ready when the device was mounted
+    HidLayout& l = device[addr].layout;
+    if (!l.valid) {
+        l.parse(tuh_hid_get_report_info(addr));
+    }
+    return l;
 }
 
 bool HidInput::get_usb_joystick(int addr, uint8_t& axis, uint8_t& button) {
-    if (tuh_hid_is_mounted(addr) && !tuh_hid_is_busy(addr)) {
-        const uint8_t* js = device[addr];
-        HID_ReportInfo_t* info = tuh_hid_get_report_info(addr);
-        if (info) {
-            for (uint8_t i = 0; i < info->TotalReportItems; ++i) {
-                HID_ReportItem_t* item = &info->ReportItems[i];
-                // Update the report item value if it is contained within the current report
-                if (!(USB_GetHIDReportItemInfo((const uint8_t*)js, item)))
-                    continue;
-                // Determine what report item is being tested, process updated value as needed
-                if ((item->Attributes.Usage.Page == USAGE_PAGE_BUTTON) && (item->ItemType == HID_REPORT_ITEM_In)) {
-                    button |= item->Value;
+    if (tuh_hid_is_mounted(addr) && !tuh_hid_is_busy(addr) &&
+        device_wanted(addr, IkbdMode::instance().buttons())) {
+        const uint8_t* report = device[addr].report;
+        const HidLayout& l = get_layout(addr);
+        if (l.valid) {
+            uint32_t value;
+            for (uint8_t i = 0; i < l.button_count; ++i) {
+                if (l.buttons[i].get(report, value)) {
+                    button |= value;
                 }
-                else if ((item->Attributes.Usage.Page   == USAGE_PAGE_GENERIC_DCTRL) &&
-                            ((item->Attributes.Usage.Usage == USAGE_X) || (item->Attributes.Usage.Usage == USAGE_Y)) &&
-                            (item->ItemType == HID_REPORT_ITEM_In)) {
-                    int bit;
-                    if (item->Attributes.Usage.Usage == USAGE_X) {
-                        bit = 2;
-                    }
-                    else {
-                        bit = 0;
-                    }
-                    // Up and left have a value < 0x80 (0 for digital)
-                    // Down and right have a value > 0x80 (0xff for digital)
-                    axis &= ~(0x3 << bit);
-                    if (item->Value < 0x80) {
-                        axis |= 1 << bit;
-                    }
-                    else if (item->Value > 0x80) {
-                        axis |= 1 << (bit + 1);
-                    }
+            }
+            // Up and left have a value < 0x80 (0 for digital)
+            // Down and right have a value > 0x80 (0xff for digital)
+            if (l.x.get(report, value)) {
+                axis &= ~(0x3 << 2);
+                if (value < 0x80) {
+                    axis |= 1 << 2;
+                }
+                else if (value > 0x80) {
+                    axis |= 1 << 3;
+                }
+            }
+            if (l.y.get(report, value)) {
+                axis &= ~0x3;
+                if (value < 0x80) {
+                    axis |= 1;
+                }
+                else if (value > 0x80) {
+                    axis |= 2;
                 }
             }
         }
 
         // Trigger the next report
-        tuh_hid_get_report(addr, device[addr]);
+        tuh_hid_get_report(addr, device[addr].report);
         return true;
     }
     return false;
@@ -272,16 +541,13 @@ void HidInput::handle_joystick() {
     uint8_t axis = 0;
     uint8_t button = 0;
 
-    // Find the joystick addresses
-    std::vector<int> joystick_addr;
     int next_joystick = 0;
-    for (auto it : device) {
-        if (tuh_hid_get_type(it.first) == HID_JOYSTICK) {
-            joystick_addr.push_back(it.first);
-        }
-    }
 
-    // See if the joysticks are GPIO or USB
+#ifdef JOYSTICK_DIRECT
+    direct_ports = ui_->get_joystick() & 3;
+#endif
+    // See if the joysticks are GPIO or USB, the USB joysticks take the
+    // ports set to USB in slot order
     for (int joystick = 1; joystick >= 0; --joystick) {
         if (ui_->get_joystick() & (1 << joystick)) {
             // GPIO
@@ -306,8 +572,9 @@ void HidInput::handle_joystick() {
         }
         else {
             // See if there is a USB joystick
-            if (next_joystick < joystick_addr.size()) {
-                if (get_usb_joystick(joystick_addr[next_joystick], axis, button)) {
+            if (next_joystick < JOYSTICK_SLOTS) {
+                uint8_t addr = joystick_slot[next_joystick];
+                if (addr && get_usb_joystick(addr, axis, button)) {
                     if (joystick == 0) {
                         if (!ui_->get_mouse_enabled()) {
                             mouse_state = (mouse_state & 0xfd) | (button ? 2 : 0);
@@ -325,10 +592,56 @@ void HidInput::handle_joystick() {
             }
         }
     }
+    publish();
 }
 
 void HidInput::reset() {
-     std::fill(key_states.begin(), key_states.end(), 0);   
+    for (int i = 1; i < (int)sizeof(key_states); ++i) {
+        set_key(i, false);
+    }
+}
+
+void HidInput::set_key(int code, bool down) {
+    unsigned char state = down ? 1 : 0;
+    // If core1 hasn't caught up the key stays as it was and is sent again
+    // on the next keyboard poll
+    if (key_states[code] != state) {
+        if (CoreLink::instance().post_input(INPUT_KEY, code, state)) {
+            key_states[code] = state;
+        }
+        else {
+            key_retry = true;
+        }
+    }
+}
+
+void HidInput::publish() {
+    CoreLink& link = CoreLink::instance();
+    if ((mouse_state != published_mouse_state) &&
+        link.post_input(INPUT_MOUSE_BUTTONS, 0, mouse_state)) {
+        published_mouse_state = mouse_state;
+    }
+    if ((joystick_state != published_joystick_state) &&
+        link.post_input(INPUT_JOYSTICK, 0, joystick_state)) {
+        published_joystick_state = joystick_state;
+    }
+    int en = mouse_enabled() ? 1 : 0;
+    if ((en != published_mouse_en) && link.post_input(INPUT_MOUSE_ENABLED, 0, en)) {
+        published_mouse_en = en;
+    }
+    // Motion that doesn't fit in the queue is kept and sent next time
+    if (mouse_dx) {
+        int16_t dx = (int16_t)std::max(-INT16_MAX, std::min((int)INT16_MAX, (int)mouse_dx));
+        if (link.post_input(INPUT_MOUSE_X, 0, dx)) {
+            mouse_dx -= dx;
+        }
+    }
+    if (mouse_dy) {
+        int16_t dy = (int16_t)std::max(-INT16_MAX, std::min((int)INT16_MAX, (int)mouse_dy));
+        if (link.post_input(INPUT_MOUSE_Y, 0, dy)) {
+            mouse_dy -= dy;
+        }
+    }
 }
 
 unsigned char HidInput::keydown(const unsigned char code) const {
@@ -350,18 +663,47 @@ bool HidInput::mouse_enabled() const {
     return ui_->get_mouse_enabled();
 }
 
+#ifdef JOYSTICK_DIRECT
+void HidInput::read_direct(uint8_t& joystick, int& buttons, bool mouse_en) const {
+    uint8_t ports = direct_ports & (mouse_en ? 2 : 3);
+    if (!ports) {
+        return;
+    }
+    uint32_t low = ~gpio_get_all();
+    uint16_t state = joystick_pins[0][low & 0xff] | joystick_pins[1][(low >> 8) & 0xff] |
+        joystick_pins[2][(low >> 16) & 0xff] | joystick_pins[3][low >> 24];
+    uint16_t mask = ((ports & 1) ? 0x20f : 0) | ((ports & 2) ? 0x1f0 : 0);
+    joystick = (uint8_t)((joystick & ~mask) | (state & mask));
+    buttons = (buttons & ~(mask >> 8)) | ((state & mask) >> 8);
+}
+#endif
+
+// The HD6301 runs on core1 and sees the copy of the inputs kept by CoreLink
+
 unsigned char st_keydown(const unsigned char code){
-    return HidInput::instance().keydown(code);
+    return CoreLink::instance().keydown(code);
 }
 
 int st_mouse_buttons() {
-    return HidInput::instance().mouse_buttons();
+    CoreLink& link = CoreLink::instance();
+    int buttons = link.mouse_buttons();
+#ifdef JOYSTICK_DIRECT
+    uint8_t joystick = link.joystick();
+    HidInput::instance().read_direct(joystick, buttons, link.mouse_enabled());
+#endif
+    return buttons;
 }
 
 unsigned char st_joystick() {
-    return HidInput::instance().joystick();
+    CoreLink& link = CoreLink::instance();
+    uint8_t joystick = link.joystick();
+#ifdef JOYSTICK_DIRECT
+    int buttons = link.mouse_buttons();
+    HidInput::instance().read_direct(joystick, buttons, link.mouse_enabled());
+#endif
+    return joystick;
 }
 
 int st_mouse_enabled() {
-    return HidInput::instance().mouse_enabled() ? 1 : 0;
+    return CoreLink::instance().mouse_enabled() ? 1 : 0;
 }
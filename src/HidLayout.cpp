@@ -0,0 +1,141 @@
+/*
+ * Atari ST RP2040 IKBD Emulator
+ * Copyright (C) 2021 Roy Hopkins
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#include "HidLayout.h"
+
+#ifndef USAGE_WHEEL
+#define USAGE_WHEEL     0x38
+#endif
+#ifndef USAGE_HAT
+#define USAGE_HAT       0x39
+#endif
+#ifndef USAGE_PAGE_KEYBOARD
+#define USAGE_PAGE_KEYBOARD 0x07
+#endif
+#ifndef HID_IOF_VARIABLE
+#define HID_IOF_VARIABLE (1 << 1)
+#endif
+
+// Keyboard usage reported in every array slot when too many keys are down
+#define KEY_ERROR_ROLLOVER 0x01
+
+static void set_field(HidField& field, const HID_ReportItem_t* item) {
+    field.bit_offset = item->BitOffset;
+    field.bit_size = item->Attributes.BitSize;
+    field.report_id = item->ReportID;
+}
+
+void HidLayout::parse(const HID_ReportInfo_t* info) {
+    *this = HidLayout();
+    if (!info) {
+        return;
+    }
+    for (uint8_t i = 0; i < info->TotalReportItems; ++i) {
+        const HID_ReportItem_t* item = &info->ReportItems[i];
+        if ((item->ItemType != HID_REPORT_ITEM_In) || (item->Attributes.BitSize == 0) ||
+            (item->Attributes.BitSize > 32)) {
+            continue;
+        }
+        if (item->Attributes.Usage.Page == USAGE_PAGE_KEYBOARD) {
+            add_key(item);
+        }
+        else if (item->Attributes.Usage.Page == USAGE_PAGE_BUTTON) {
+            if (button_count < HID_LAYOUT_BUTTONS) {
+                set_field(buttons[button_count], item);
+                button_usage[button_count] = item->Attributes.Usage.Usage;
+                ++button_count;
+            }
+        }
+        else if (item->Attributes.Usage.Page == USAGE_PAGE_GENERIC_DCTRL) {
+            // The first of each is used if a device reports more than one
+            HidField* field = nullptr;
+            switch (item->Attributes.Usage.Usage) {
+            case USAGE_X:       field = &x;     break;
+            case USAGE_Y:       field = &y;     break;
+            case USAGE_WHEEL:   field = &wheel; break;
+            case USAGE_HAT:     field = &hat;   break;
+            }
+            if (field && !field->present()) {
+                set_field(*field, item);
+            }
+        }
+    }
+    valid = true;
+}
+
+void HidLayout::add_key(const HID_ReportItem_t* item) {
+    bool array = !(item->ItemFlags & HID_IOF_VARIABLE);
+    if (array ? (item->Attributes.BitSize != 8) : (item->Attributes.BitSize != 1)) {
+        return;
+    }
+    // Items that follow on from the last run are added to it
+    if (key_run_count) {
+        HidKeyRun& run = keys[key_run_count - 1];
+        if ((run.array == array) && (run.first.report_id == item->ReportID) && (run.count < 255) &&
+            (item->BitOffset == run.first.bit_offset + run.count * run.first.bit_size) &&
+            (array || (item->Attributes.Usage.Usage == run.usage + run.count))) {
+            ++run.count;
+            return;
+        }
+    }
+    if ((key_run_count < HID_LAYOUT_KEY_RUNS) && (item->Attributes.Usage.Usage < 256)) {
+        HidKeyRun& run = keys[key_run_count++];
+        set_field(run.first, item);
+        run.usage = item->Attributes.Usage.Usage;
+        run.count = 1;
+        run.array = array;
+    }
+}
+
+bool HidLayout::nkro() const {
+    for (uint8_t i = 0; i < key_run_count; ++i) {
+        // The modifiers are always a bitmap, look for more than them
+        if (!keys[i].array && (keys[i].count > 8)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool HidLayout::get_keys(const uint8_t* report, uint32_t keys_down[HID_KEY_WORDS]) const {
+    bool found = false;
+    for (uint8_t i = 0; i < key_run_count; ++i) {
+        const HidKeyRun& run = keys[i];
+        HidField field = run.first;
+        for (unsigned j = 0; j < run.count; ++j, field.bit_offset += field.bit_size) {
+            uint32_t value;
+            if (!field.get(report, value)) {
+                break;
+            }
+            found = true;
+            if (run.array) {
+                if (value == KEY_ERROR_ROLLOVER) {
+                    return false;
+                }
+                if (value && (value < 256)) {
+                    keys_down[value >> 5] |= 1u << (value & 31);
+                }
+            }
+            else if (value && (run.usage + j < 256)) {
+                unsigned usage = run.usage + j;
+                keys_down[usage >> 5] |= 1u << (usage & 31);
+            }
+        }
+    }
+    return found;
+}
@@ -0,0 +1,163 @@
+/*
+ * Atari ST RP2040 IKBD Emulator
+ * Copyright (C) 2021 Roy Hopkins
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#include "IkbdAnalyser.h"
+#include "SerialTrace.h"
+#include "CoreLink.h"
+#include "IkbdHle.h"
+#include "IkbdMode.h"
+#include "pico/stdlib.h"
+
+// Trace entries decoded at a time
+#define ANALYSER_BATCH      16
+#define ANALYSER_WINDOW_US  1000000
+
+IkbdAnalyser& IkbdAnalyser::instance() {
+    static IkbdAnalyser analyser;
+    return analyser;
+}
+
+void IkbdAnalyser::update() {
+    SerialTrace& trace = SerialTrace::instance();
+    uint32_t now = time_us_32();
+    if (!started) {
+        started = true;
+        window_start = now;
+        next = trace.count();
+    }
+
+    SerialTraceEntry entries[ANALYSER_BATCH];
+    int n;
+    do {
+        n = trace.read(next, entries, ANALYSER_BATCH, trace_lost);
+        for (int i = 0; i < n; ++i) {
+            if (entries[i].send) {
+                send(entries[i].data);
+            }
+            else {
+                receive(entries[i].data);
+            }
+        }
+    } while (n == ANALYSER_BATCH);
+    depth();
+
+    if (now - window_start >= ANALYSER_WINDOW_US) {
+        published = current;
+        current = {};
+        window_start += ANALYSER_WINDOW_US;
+        if (now - window_start >= ANALYSER_WINDOW_US) {
+            // Not called for a while, start again from now
+            window_start = now;
+        }
+    }
+}
+
+void IkbdAnalyser::receive(uint8_t data) {
+    ++current.rx_bytes;
+    if (rx_need) {
+        --rx_need;
+        ++rx_len;
+        if (!rx_need && (rx_cmd == 0x20) && (rx_len == 4)) {
+            // The last byte of a memory load is the number of data bytes
+            rx_need = data;
+        }
+        return;
+    }
+    rx_head = data;
+    int n = IkbdHle::command_length(data);
+    if (n < 0) {
+        ++current.packets[IKBD_PACKET_IGNORED];
+        return;
+    }
+    ++current.packets[IKBD_PACKET_COMMAND];
+    rx_cmd = data;
+    rx_len = 1;
+    rx_need = n;
+}
+
+void IkbdAnalyser::send(uint8_t data) {
+    ++current.tx_bytes;
+    if (tx_need) {
+        --tx_need;
+        return;
+    }
+    tx_head = data;
+    int len = 1;
+    IkbdJoystickMode joy = IkbdMode::instance().joystick();
+    if ((joy == IKBD_JOY_MONITOR) || (joy == IKBD_JOY_FIRE_MONITOR)) {
+        // Nothing else is sent in these modes and there is no header
+        tx_kind = IKBD_PACKET_JOYSTICK;
+        len = (joy == IKBD_JOY_MONITOR) ? 2 : 1;
+    }
+    else if (data < 0x80) {
+        tx_kind = IKBD_PACKET_KEY_MAKE;
+    }
+    else if (data < 0xf6) {
+        tx_kind = IKBD_PACKET_KEY_BREAK;
+    }
+    else {
+        switch (data) {
+        case 0xf6:
+            tx_kind = IKBD_PACKET_STATUS;
+            len = 8;
+            break;
+        case 0xf7:
+            tx_kind = IKBD_PACKET_MOUSE_ABSOLUTE;
+            len = 6;
+            break;
+        case 0xfc:
+            tx_kind = IKBD_PACKET_CLOCK;
+            len = 7;
+            break;
+        case 0xfd:
+            tx_kind = IKBD_PACKET_JOYSTICK;
+            len = 3;
+            break;
+        case 0xfe:
+        case 0xff:
+            tx_kind = IKBD_PACKET_JOYSTICK;
+            len = 2;
+            break;
+        default:
+            tx_kind = IKBD_PACKET_MOUSE_RELATIVE;
+            len = 3;
+            break;
+        }
+    }
+    ++current.packets[tx_kind];
+    tx_need = len - 1;
+}
+
+void IkbdAnalyser::depth() {
+    CoreLink& link = CoreLink::instance();
+    uint32_t rx = link.rx_depth();
+    uint32_t tx = link.tx_depth();
+    if (rx > current.rx_depth_max) {
+        current.rx_depth_max = rx;
+    }
+    if (tx > current.tx_depth_max) {
+        current.tx_depth_max = tx;
+    }
+}
+
+const char* IkbdAnalyser::name(IkbdPacket packet) {
+    static const char* const names[IKBD_PACKETS] = {
+        "cmd", "skip", "make", "break", "rel", "abs", "joy", "status", "clock"
+    };
+    return (packet < IKBD_PACKETS) ? names[packet] : "?";
+}
@@ -0,0 +1,836 @@
+/*
+ * Atari ST RP2040 IKBD Emulator
+ * Copyright (C) 2021 Roy Hopkins
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#include "IkbdHle.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Keys sent for the mouse buttons when they act like keys (0x07 bit 2)
+#define KEY_MOUSE_LEFT      0x74
+#define KEY_MOUSE_RIGHT     0x75
+
+// Cursor keys sent in the mouse and joystick keycode modes
+#define KEY_UP              0x48
+#define KEY_DOWN            0x50
+#define KEY_LEFT            0x4b
+#define KEY_RIGHT           0x4d
+#define KEY_BREAK           0x80
+
+// The widest a relative mouse packet can move each axis
+#define MOUSE_PACKET_MAX    127
+
+#define US_PER_SECOND       1000000
+
+IkbdHle::IkbdHle() {
+    memset(&clock, 0, sizeof(clock));
+    memset(ram, 0, sizeof(ram));
+    defaults();
+}
+
+void IkbdHle::defaults() {
+    mouse_mode = MOUSE_RELATIVE;
+    mouse_disabled = false;
+    mouse_off = false;
+    fire_latch = 0;
+    fire_after = 0;
+    y_bottom = false;
+    button_action = 0;
+    threshold_x = threshold_y = 1;
+    scale_x = scale_y = 1;
+    keycode_dx = keycode_dy = 1;
+    max_x = max_y = 0;
+    abs_x = abs_y = 0;
+    scale_acc_x = scale_acc_y = 0;
+    abs_buttons = 0;
+    reported_buttons = buttons;
+    mouse_buttons = buttons;
+    mouse_dx = mouse_dy = 0;
+
+    joy_mode = JOY_EVENT;
+    joy_disabled = false;
+    joy_port0 = false;
+    monitor_rate = 0;
+    monitor_next = 0;
+    fire_samples = 0;
+    fire_count = 0;
+    memset(keycode_params, 0, sizeof(keycode_params));
+    key_since[0] = key_since[1] = 0;
+    key_next[0] = key_next[1] = 0;
+    key_dir[0] = key_dir[1] = 0;
+    key_fire = false;
+    reported_joy[0] = joystick_byte(0);
+    reported_joy[1] = joystick_byte(1);
+
+    paused = false;
+    cmd_len = cmd_need = 0;
+    load_left = 0;
+}
+
+void IkbdHle::reset(int64_t now) {
+    defaults();
+    tx_head = tx_tail = 0;
+    // Keys still held once the self test is over are reported again
+    memset(keys_sent, 0, sizeof(keys_sent));
+    scan_after = now + HLE_RESET_CYCLES;
+    // Commands that arrive during the self test are answered after the 0xF1
+    uint8_t version = 0xf1;
+    put(&version, 1);
+    tx_next = now + HLE_RESET_CYCLES;
+    if (!clock.next) {
+        clock.next = now + US_PER_SECOND;
+    }
+}
+
+int IkbdHle::command_length(uint8_t cmd) {
+    switch (cmd) {
+    case 0x07: return 1;
+    case 0x08: return 0;
+    case 0x09: return 4;
+    case 0x0a:
+    case 0x0b:
+    case 0x0c: return 2;
+    case 0x0d: return 0;
+    case 0x0e: return 5;
+    case 0x0f: case 0x10: case 0x11: case 0x12: case 0x13:
+    case 0x14: case 0x15: case 0x16: return 0;
+    case 0x17: return 1;
+    case 0x18: return 0;
+    case 0x19: return 6;
+    case 0x1a: return 0;
+    case 0x1b: return 6;
+    case 0x1c: return 0;
+    case 0x20: return 3;
+    case 0x21:
+    case 0x22: return 2;
+    case 0x80: return 1;
+    case 0x87: case 0x88: case 0x89: case 0x8a: case 0x8b: case 0x8c:
+    case 0x8f: case 0x90: case 0x92: case 0x94: case 0x95: case 0x99:
+    case 0x9a: return 0;
+    default:   return -1;
+    }
+}
+
+void IkbdHle::receive(uint8_t data, int64_t now) {
+    if (load_left) {
+        ram[load_addr++ & 0xff] = data;
+        --load_left;
+        return;
+    }
+    if (!cmd_need) {
+        int n = command_length(data);
+        if (n < 0) {
+            // Not a command, the ROM ignores it
+            return;
+        }
+        if (paused && (data >= 0x87)) {
+            // Status inquiries are dropped while paused
+            return;
+        }
+        if ((data != 0x0d) && (data != 0x20) && (data != 0x80) && !ignored(data)) {
+            // Any other command ends the pause, 0x0d only when it is
+            // answered, a reset by starting again and one the monitoring
+            // modes ignore not at all
+            resume(now);
+        }
+        cmd[0] = data;
+        cmd_len = 1;
+        cmd_need = n;
+    }
+    else {
+        cmd[cmd_len++] = data;
+        --cmd_need;
+    }
+    if (!cmd_need) {
+        command(now);
+    }
+}
+
+bool IkbdHle::ignored(uint8_t command) const {
+    if (!monitoring()) {
+        return false;
+    }
+    // The monitoring loops only act on commands that change the mode or
+    // the settings, and 0x17 answers the clock
+    switch (command) {
+    case 0x0d:
+    case 0x16:
+        return true;
+    case 0x1c:
+        return joy_mode == JOY_FIRE_MONITOR;
+    default:
+        return command >= 0x87;
+    }
+}
+
+void IkbdHle::resume(int64_t now) {
+    if (!paused) {
+        return;
+    }
+    paused = false;
+    if (joy_mode == JOY_MONITOR) {
+        // The 0x17 period doesn't run while paused
+        monitor_next += now - paused_at;
+    }
+}
+
+void IkbdHle::mouse_port() {
+    // The mouse is read again, and the monitoring and keycode modes end in
+    // event mode with whatever is held reported again. This is so even when
+    // 0x1a ended the monitoring.
+    latch_fire();
+    if ((joy_mode == JOY_MONITOR) || (joy_mode == JOY_FIRE_MONITOR) || (joy_mode == JOY_KEYCODE)) {
+        joy_mode = JOY_EVENT;
+        joy_disabled = false;
+        reported_joy[0] = reported_joy[1] = 0;
+    }
+    joy_port0 = false;
+    mouse_disabled = false;
+    mouse_off = false;
+    mouse_buttons = buttons;
+}
+
+void IkbdHle::command(int64_t now) {
+    if (ignored(cmd[0])) {
+        return;
+    }
+    switch (cmd[0]) {
+    case 0x07:
+        // No packet is made for the buttons that are already down
+        button_action = cmd[1];
+        reported_buttons = (button_action & 0x04) ? 0 : buttons;
+        break;
+    case 0x08:
+        mouse_mode = MOUSE_RELATIVE;
+        mouse_port();
+        break;
+    case 0x09:
+        mouse_mode = MOUSE_ABSOLUTE;
+        mouse_port();
+        max_x = (cmd[1] << 8) | cmd[2];
+        max_y = (cmd[3] << 8) | cmd[4];
+        // The position is kept, as set by 0x0e or left by an earlier 0x09
+        scale_acc_x = scale_acc_y = 0;
+        break;
+    case 0x0a:
+        mouse_mode = MOUSE_KEYCODE;
+        mouse_port();
+        keycode_dx = cmd[1] ? cmd[1] : 1;
+        keycode_dy = cmd[2] ? cmd[2] : 1;
+        break;
+    case 0x0b:
+        threshold_x = cmd[1] ? cmd[1] : 1;
+        threshold_y = cmd[2] ? cmd[2] : 1;
+        break;
+    case 0x0c:
+        scale_x = cmd[1] ? cmd[1] : 1;
+        scale_y = cmd[2] ? cmd[2] : 1;
+        break;
+    case 0x0d:
+        if ((mouse_mode == MOUSE_ABSOLUTE) && !mouse_disabled) {
+            resume(now);
+            update_mouse();
+            uint8_t report[] = { 0xf7, abs_buttons,
+                (uint8_t)(abs_x >> 8), (uint8_t)abs_x, (uint8_t)(abs_y >> 8), (uint8_t)abs_y };
+            if (put(report, sizeof(report))) {
+                abs_buttons = 0;
+            }
+        }
+        break;
+    case 0x0e:
+        // The ROM goes to absolute mode as well, reading the mouse again
+        // unless it was stopped for a joystick mode, and forgets the button
+        // changes 0x0d would report. A button changed while the mouse was
+        // stopped is seen as changing now.
+        mouse_mode = MOUSE_ABSOLUTE;
+        if (!joy_port0) {
+            mouse_disabled = false;
+        }
+        mouse_off = false;
+        abs_buttons = 0;
+        abs_x = (cmd[2] << 8) | cmd[3];
+        abs_y = (cmd[4] << 8) | cmd[5];
+        if (buttons != mouse_buttons) {
+            buttons_changed();
+        }
+        break;
+    case 0x0f:
+        y_bottom = true;
+        break;
+    case 0x10:
+        y_bottom = false;
+        break;
+    case 0x11:
+        break;
+    case 0x12:
+        mouse_disabled = true;
+        mouse_off = true;
+        break;
+    case 0x13:
+        if (!paused) {
+            paused = true;
+            paused_at = now;
+        }
+        break;
+    case 0x14:
+    case 0x15:
+        // The ROM stops reading the mouse, joystick 0 shares its port
+        joy_mode = (cmd[0] == 0x14) ? JOY_EVENT : JOY_INTERROGATE;
+        joy_disabled = false;
+        joy_port0 = true;
+        mouse_disabled = true;
+        // Whatever is held is reported again, the fire buttons only once
+        // the ROM has read them
+        reported_joy[0] = reported_joy[1] = 0;
+        fire_latch = 0;
+        fire_after = now + HLE_FIRE_REREAD;
+        break;
+    case 0x16: {
+        // Not answered while disabled or in the monitoring and keycode modes
+        if (!joy_disabled && (joy_mode == JOY_EVENT || joy_mode == JOY_INTERROGATE)) {
+            uint8_t report[] = { 0xfd, joystick_byte(0), joystick_byte(1) };
+            put(report, sizeof(report));
+        }
+        break;
+    }
+    case 0x17:
+        // The first report is one period later
+        joy_mode = JOY_MONITOR;
+        joy_disabled = false;
+        joy_port0 = true;
+        mouse_disabled = true;
+        monitor_rate = cmd[1] ? cmd[1] : 1;
+        monitor_next = now + (int64_t)monitor_rate * HLE_MONITOR_UNIT;
+        break;
+    case 0x18:
+        joy_mode = JOY_FIRE_MONITOR;
+        joy_disabled = false;
+        joy_port0 = true;
+        mouse_disabled = true;
+        monitor_next = now;
+        fire_samples = 0;
+        fire_count = 0;
+        break;
+    case 0x19:
+        joy_mode = JOY_KEYCODE;
+        joy_disabled = false;
+        joy_port0 = true;
+        mouse_disabled = true;
+        memcpy(keycode_params, &cmd[1], sizeof(keycode_params));
+        key_since[0] = key_since[1] = 0;
+        key_fire = false;
+        break;
+    case 0x1a:
+        joy_disabled = true;
+        break;
+    case 0x1b:
+        // Digits that aren't BCD leave that field as it is
+        for (int i = 0; i < 6; ++i) {
+            if (((cmd[i + 1] >> 4) < 10) && ((cmd[i + 1] & 0xf) < 10)) {
+                clock.bcd[i] = cmd[i + 1];
+            }
+        }
+        clock.next = now + US_PER_SECOND;
+        break;
+    case 0x1c: {
+        update_clock(now);
+        uint8_t report[7] = { 0xfc };
+        memcpy(&report[1], clock.bcd, sizeof(clock.bcd));
+        put(report, sizeof(report));
+        break;
+    }
+    case 0x20:
+        load_addr = (cmd[1] << 8) | cmd[2];
+        load_left = cmd[3];
+        break;
+    case 0x21: {
+        uint16_t addr = (cmd[1] << 8) | cmd[2];
+        uint8_t report[8] = { 0xf6, 0x20 };
+        for (int i = 0; i < 6; ++i) {
+            report[2 + i] = ram[(addr + i) & 0xff];
+        }
+        put(report, sizeof(report));
+        break;
+    }
+    case 0x22:
+        // There is no 6301 to run the code on
+        break;
+    case 0x80:
+        if (cmd[1] == 0x01) {
+            reset(now);
+        }
+        break;
+    default:
+        status(cmd[0]);
+        break;
+    }
+}
+
+void IkbdHle::status(uint8_t inquiry) {
+    // The reply has the same form as the command that sets the mode
+    uint8_t report[8] = { 0xf6 };
+    switch (inquiry) {
+    case 0x87:
+        report[1] = 0x07;
+        report[2] = button_action;
+        break;
+    case 0x88:
+    case 0x89:
+    case 0x8a:
+        if (mouse_mode == MOUSE_ABSOLUTE) {
+            report[1] = 0x09;
+            report[2] = max_x >> 8;
+            report[3] = max_x;
+            report[4] = max_y >> 8;
+            report[5] = max_y;
+        }
+        else if (mouse_mode == MOUSE_KEYCODE) {
+            report[1] = 0x0a;
+            report[2] = keycode_dx;
+            report[3] = keycode_dy;
+        }
+        else {
+            report[1] = 0x08;
+        }
+        break;
+    case 0x8b:
+        report[1] = 0x0b;
+        report[2] = threshold_x;
+        report[3] = threshold_y;
+        break;
+    case 0x8c:
+        report[1] = 0x0c;
+        report[2] = scale_x;
+        report[3] = scale_y;
+        break;
+    case 0x8f:
+    case 0x90:
+        report[1] = y_bottom ? 0x0f : 0x10;
+        break;
+    case 0x92:
+        // The joystick modes stop the mouse without the ROM saying so
+        report[1] = mouse_off ? 0x12 : 0x00;
+        break;
+    case 0x94:
+    case 0x95:
+    case 0x99:
+        if (joy_mode == JOY_KEYCODE) {
+            report[1] = 0x19;
+            memcpy(&report[2], keycode_params, sizeof(keycode_params));
+        }
+        else {
+            report[1] = (joy_mode == JOY_INTERROGATE) ? 0x15 : 0x14;
+        }
+        break;
+    case 0x9a:
+        report[1] = joy_disabled ? 0x1a : 0x00;
+        break;
+    }
+    put(report, sizeof(report));
+}
+
+void IkbdHle::set_key(uint8_t code, bool down) {
+    if (code && (code < 0x80)) {
+        uint8_t bit = 1 << (code & 7);
+        if (down) {
+            keys_down[code >> 3] |= bit;
+        }
+        else {
+            keys_down[code >> 3] &= ~bit;
+        }
+        if (!monitoring()) {
+            scan_keys();
+        }
+    }
+}
+
+void IkbdHle::scan_keys() {
+    // The ROM scans the matrix so only changes are reported. It doesn't
+    // scan while monitoring the joystick, keys that changed meanwhile are
+    // reported once it stops.
+    for (int i = 0; i < (int)sizeof(keys_down); ++i) {
+        uint8_t changed = keys_down[i] ^ keys_sent[i];
+        for (int b = 0; changed && (b < 8); ++b) {
+            uint8_t bit = 1 << b;
+            if (changed & bit) {
+                uint8_t code = (i << 3) | b;
+                code = (keys_down[i] & bit) ? code : (code | KEY_BREAK);
+                if (!put(&code, 1)) {
+                    return;
+                }
+                keys_sent[i] ^= bit;
+                changed &= ~bit;
+            }
+        }
+    }
+}
+
+void IkbdHle::set_mouse_buttons(int state) {
+    int old_buttons = buttons;
+    buttons = state & 3;
+    if (buttons != old_buttons) {
+        buttons_changed();
+    }
+}
+
+void IkbdHle::set_joystick(uint8_t state) {
+    joy = state;
+}
+
+void IkbdHle::set_mouse_enabled(bool en) {
+    mouse_en = en;
+    if (!en) {
+        mouse_dx = mouse_dy = 0;
+    }
+}
+
+void IkbdHle::add_mouse(int dx, int dy) {
+    if (mouse_en) {
+        mouse_dx += dx;
+        mouse_dy += dy;
+    }
+}
+
+void IkbdHle::buttons_changed() {
+    if (mouse_disabled) {
+        // They are the joystick fire buttons, reported by update_joystick()
+        return;
+    }
+    int old_buttons = mouse_buttons;
+    mouse_buttons = buttons;
+    int pressed = buttons & ~old_buttons;
+    int released = old_buttons & ~buttons;
+    uint8_t changes = 0;
+    if (pressed & 2) changes |= 0x04;
+    if (released & 2) changes |= 0x08;
+    if (pressed & 1) changes |= 0x01;
+    if (released & 1) changes |= 0x02;
+    if (mouse_mode == MOUSE_ABSOLUTE) {
+        abs_buttons |= changes;
+    }
+
+    if ((button_action & 0x04) || (mouse_mode == MOUSE_KEYCODE)) {
+        // Act like keys instead of being reported with the mouse, the ROM
+        // looks at the right button first
+        if ((pressed | released) & 1) {
+            put_key((buttons & 1) ? KEY_MOUSE_RIGHT : (KEY_MOUSE_RIGHT | KEY_BREAK));
+        }
+        if ((pressed | released) & 2) {
+            put_key((buttons & 2) ? KEY_MOUSE_LEFT : (KEY_MOUSE_LEFT | KEY_BREAK));
+        }
+        return;
+    }
+    if ((mouse_mode == MOUSE_ABSOLUTE) &&
+        (((button_action & 0x01) && pressed) || ((button_action & 0x02) && released))) {
+        // The report has just this change, 0x0d still reports every change
+        // since the last one
+        update_mouse();
+        uint8_t report[] = { 0xf7, changes,
+            (uint8_t)(abs_x >> 8), (uint8_t)abs_x, (uint8_t)(abs_y >> 8), (uint8_t)abs_y };
+        put(report, sizeof(report));
+    }
+    // A relative packet for the change is made by update_mouse()
+}
+
+void IkbdHle::update(int64_t now) {
+    if (fire_after && (now >= fire_after)) {
+        fire_after = 0;
+    }
+    latch_fire();
+    if (!monitoring() && (now >= scan_after)) {
+        scan_keys();
+    }
+    update_clock(now);
+    update_joystick(now);
+    update_mouse();
+}
+
+void IkbdHle::update_mouse() {
+    if (mouse_disabled) {
+        mouse_dx = mouse_dy = 0;
+    } else if (mouse_mode == MOUSE_RELATIVE) {
+        mouse_relative();
+        return;
+    } else if (mouse_mode == MOUSE_ABSOLUTE) {
+        mouse_absolute();
+    } else {
+        mouse_keycode();
+    }
+    // The buttons are still followed, a change made while there are no
+    // relative packets isn't reported when there are again
+    reported_buttons = (button_action & 0x04) ? 0 : buttons;
+}
+
+void IkbdHle::mouse_relative() {
+    int report_buttons = (button_action & 0x04) ? 0 : buttons;
+    // Wait for the line to clear so the packet has the latest motion in it
+    while (((abs(mouse_dx) >= threshold_x) || (abs(mouse_dy) >= threshold_y) ||
+            (report_buttons != reported_buttons)) && room(3) && (paused || (tx_head == tx_tail))) {
+        int32_t dx = mouse_dx;
+        int32_t dy = y_bottom ? -mouse_dy : mouse_dy;
+        dx = (dx > MOUSE_PACKET_MAX) ? MOUSE_PACKET_MAX : (dx < -MOUSE_PACKET_MAX) ? -MOUSE_PACKET_MAX : dx;
+        dy = (dy > MOUSE_PACKET_MAX) ? MOUSE_PACKET_MAX : (dy < -MOUSE_PACKET_MAX) ? -MOUSE_PACKET_MAX : dy;
+        uint8_t report[] = { (uint8_t)(0xf8 | report_buttons), (uint8_t)dx, (uint8_t)dy };
+        put(report, sizeof(report));
+        mouse_dx -= dx;
+        mouse_dy -= y_bottom ? -dy : dy;
+        reported_buttons = report_buttons;
+    }
+}
+
+void IkbdHle::mouse_absolute() {
+    // Each unit of position is 'scale' mouse counts
+    scale_acc_x += mouse_dx;
+    scale_acc_y += y_bottom ? -mouse_dy : mouse_dy;
+    mouse_dx = mouse_dy = 0;
+    int32_t dx = scale_acc_x / scale_x;
+    int32_t dy = scale_acc_y / scale_y;
+    scale_acc_x %= scale_x;
+    scale_acc_y %= scale_y;
+    // A position set by 0x0e is only kept in range once that axis moves
+    if (dx) {
+        abs_x += dx;
+        abs_x = (abs_x < 0) ? 0 : (abs_x > max_x) ? max_x : abs_x;
+    }
+    if (dy) {
+        abs_y += dy;
+        abs_y = (abs_y < 0) ? 0 : (abs_y > max_y) ? max_y : abs_y;
+    }
+}
+
+void IkbdHle::mouse_keycode() {
+    mouse_keys(mouse_dx, keycode_dx, KEY_LEFT, KEY_RIGHT);
+    mouse_keys(mouse_dy, keycode_dy, KEY_UP, KEY_DOWN);
+}
+
+void IkbdHle::mouse_keys(int32_t& acc, int32_t delta, uint8_t minus, uint8_t plus) {
+    while ((acc >= delta) && room(2)) {
+        put_key(plus);
+        put_key(plus | KEY_BREAK);
+        acc -= delta;
+    }
+    while ((acc <= -delta) && room(2)) {
+        put_key(minus);
+        put_key(minus | KEY_BREAK);
+        acc += delta;
+    }
+}
+
+void IkbdHle::latch_fire() {
+    // The ROM keeps the joystick 1 fire button it last read in the event
+    // and interrogation modes, and reports that while it reads the mouse.
+    // The monitoring and keycode modes clear it.
+    if (!mouse_disabled || joy_disabled || fire_after) {
+        return;
+    }
+    if ((joy_mode == JOY_EVENT) || (joy_mode == JOY_INTERROGATE)) {
+        fire_latch = buttons & 1;
+    } else {
+        fire_latch = 0;
+    }
+}
+
+bool IkbdHle::monitoring() const {
+    return !joy_disabled && ((joy_mode == JOY_MONITOR) || (joy_mode == JOY_FIRE_MONITOR));
+}
+
+uint8_t IkbdHle::joystick_byte(int stick) const {
+    // Joystick 0 is the mouse port, there are no directions to read while a
+    // mouse is plugged in. The fire buttons are the mouse buttons, so read
+    // as latch_fire() left them while the ROM reads the mouse, or hasn't
+    // read them again after 0x14 or 0x15. Joystick 0 is only read once a
+    // joystick mode took the port, 0x12 alone is not enough.
+    if ((stick == 0) && !joy_port0) {
+        return 0;
+    }
+    uint8_t dirs = (stick == 0) ? (mouse_en ? 0 : (joy & 0x0f)) : (joy >> 4);
+    int fire_buttons = (mouse_disabled && !fire_after) ? buttons : fire_latch;
+    uint8_t fire = (stick == 0) ? (fire_buttons & 2) : (fire_buttons & 1);
+    return dirs | (fire ? 0x80 : 0);
+}
+
+void IkbdHle::update_joystick(int64_t now) {
+    if (joy_disabled) {
+        return;
+    }
+    switch (joy_mode) {
+    case JOY_EVENT:
+        for (int stick = 0; stick < 2; ++stick) {
+            uint8_t state = joystick_byte(stick);
+            if ((stick == 0) && !joy_port0) {
+                // The ROM only reports joystick 1 until a joystick mode
+                // command gives joystick 0 the mouse port
+                continue;
+            }
+            if ((state != reported_joy[stick]) && room(2)) {
+                uint8_t report[] = { (uint8_t)(0xfe + stick), state };
+                put(report, sizeof(report));
+                reported_joy[stick] = state;
+            }
+        }
+        break;
+    case JOY_MONITOR:
+        // Reports aren't made while paused
+        if (!paused && (now >= monitor_next)) {
+            uint8_t j0 = joystick_byte(0);
+            uint8_t j1 = joystick_byte(1);
+            uint8_t report[] = {
+                (uint8_t)(((j0 & 0x80) >> 6) | ((j1 & 0x80) >> 7)),
+                (uint8_t)(((j0 & 0x0f) << 4) | (j1 & 0x0f))
+            };
+            put(report, sizeof(report));
+            monitor_next += (int64_t)monitor_rate * HLE_MONITOR_UNIT;
+            if (monitor_next <= now) {
+                monitor_next = now + (int64_t)monitor_rate * HLE_MONITOR_UNIT;
+            }
+        }
+        break;
+    case JOY_FIRE_MONITOR:
+        // Each byte has eight samples of the joystick 1 fire button, taken
+        // every HLE_FIRE_SAMPLE
+        if (paused || (monitor_next + 8 * HLE_FIRE_SAMPLE < now)) {
+            monitor_next = now;
+        }
+        while (!paused && (now >= monitor_next)) {
+            fire_samples = (fire_samples << 1) | ((joystick_byte(1) & 0x80) ? 1 : 0);
+            monitor_next += HLE_FIRE_SAMPLE;
+            if (++fire_count == 8) {
+                put(&fire_samples, 1);
+                fire_count = 0;
+            }
+        }
+        break;
+    case JOY_KEYCODE:
+        joystick_keys(now);
+        break;
+    default:
+        break;
+    }
+}
+
+void IkbdHle::joystick_keys(int64_t now) {
+    // Joystick 0 makes cursor keys, one press and release when a direction
+    // is pushed, repeated every TX/TY tenths of a second for the first RX/RY
+    // tenths and every VX/VY after that. Its fire button is key 0x74, the
+    // joystick 1 fire button isn't reported.
+    uint8_t state = joystick_byte(0);
+    bool fire = (state & 0x80) != 0;
+    if ((fire != key_fire) && room(1)) {
+        key_fire = fire;
+        put_key(key_fire ? KEY_MOUSE_LEFT : (KEY_MOUSE_LEFT | KEY_BREAK));
+    }
+    uint8_t dirs = state & 0x0f;
+    static const uint8_t keys[2][2] = { { KEY_LEFT, KEY_RIGHT }, { KEY_UP, KEY_DOWN } };
+    static const uint8_t masks[2][2] = { { 0x04, 0x08 }, { 0x01, 0x02 } };
+    for (int axis = 0; axis < 2; ++axis) {
+        // Both directions of an axis at once make no key
+        uint8_t pushed = dirs & (masks[axis][0] | masks[axis][1]);
+        int dir = (pushed == masks[axis][0]) ? 0 : (pushed == masks[axis][1]) ? 1 : -1;
+        if (dir < 0) {
+            key_since[axis] = 0;
+            continue;
+        }
+        if (!key_since[axis] || (dir != key_dir[axis])) {
+            // Pushed the other way is a new press
+            key_since[axis] = now;
+            key_dir[axis] = dir;
+            key_next[axis] = now;
+        }
+        if ((now >= key_next[axis]) && room(2)) {
+            put_key(keys[axis][dir]);
+            put_key(keys[axis][dir] | KEY_BREAK);
+            int64_t held = now - key_since[axis];
+            uint8_t r = keycode_params[axis];
+            uint8_t t = keycode_params[2 + axis];
+            uint8_t v = keycode_params[4 + axis];
+            uint8_t every = (held < (int64_t)r * HLE_KEYCODE_TENTH) ? t : v;
+            // A rate of 0 sends the key once
+            key_next[axis] = every ? (now + (int64_t)every * HLE_KEYCODE_TENTH) : INT64_MAX;
+        }
+    }
+}
+
+static uint8_t from_bcd(uint8_t v) {
+    return (v >> 4) * 10 + (v & 0xf);
+}
+
+static uint8_t to_bcd(uint8_t v) {
+    return ((v / 10) << 4) | (v % 10);
+}
+
+void IkbdHle::update_clock(int64_t now) {
+    static const uint8_t days[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+    while (clock.next && (now >= clock.next)) {
+        clock.next += US_PER_SECOND;
+        uint8_t t[6];
+        for (int i = 0; i < 6; ++i) {
+            t[i] = from_bcd(clock.bcd[i]);
+        }
+        uint8_t month_days = ((t[1] >= 1) && (t[1] <= 12)) ? days[t[1] - 1] : 31;
+        if ((t[1] == 2) && !(t[0] & 3)) {
+            month_days = 29;
+        }
+        if (++t[5] >= 60) {
+            t[5] = 0;
+            if (++t[4] >= 60) {
+                t[4] = 0;
+                if (++t[3] >= 24) {
+                    t[3] = 0;
+                    if (++t[2] > month_days) {
+                        t[2] = 1;
+                        if (++t[1] > 12) {
+                            t[1] = 1;
+                            t[0] = (t[0] + 1) % 100;
+                        }
+                    }
+                }
+            }
+        }
+        for (int i = 0; i < 6; ++i) {
+            clock.bcd[i] = to_bcd(t[i]);
+        }
+    }
+}
+
+bool IkbdHle::room(int n) const {
+    return (HLE_TX_QUEUE - (tx_head - tx_tail)) >= (uint32_t)n;
+}
+
+bool IkbdHle::put(const uint8_t* data, int n) {
+    // Packets are never split, one that doesn't fit is dropped as the ROM
+    // drops events when its buffer is full
+    if (!room(n)) {
+        return false;
+    }
+    for (int i = 0; i < n; ++i) {
+        tx[tx_head++ & (HLE_TX_QUEUE - 1)] = data[i];
+    }
+    return true;
+}
+
+void IkbdHle::put_key(uint8_t code) {
+    put(&code, 1);
+}
+
+bool IkbdHle::get_tx(uint8_t& data, int64_t now) {
+    if (paused || (tx_head == tx_tail) || (now < tx_next)) {
+        return false;
+    }
+    data = tx[tx_tail++ & (HLE_TX_QUEUE - 1)];
+    tx_next = now + HLE_CYCLES_PER_BYTE;
+    return true;
+}
@@ -0,0 +1,107 @@
+/*
+ * Atari ST RP2040 IKBD Emulator
+ * Copyright (C) 2021 Roy Hopkins
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#include "IkbdMode.h"
+#include "IkbdHle.h"
+
+IkbdMode::IkbdMode() {
+    reset();
+}
+
+IkbdMode& IkbdMode::instance() {
+    static IkbdMode mode;
+    return mode;
+}
+
+void IkbdMode::reset() {
+    mouse_mode = IKBD_MOUSE_RELATIVE;
+    joy_mode = IKBD_JOY_EVENT;
+    known = true;
+    cmd_len = cmd_need = 0;
+    load_left = 0;
+}
+
+void IkbdMode::receive(uint8_t data) {
+    if (load_left) {
+        --load_left;
+        return;
+    }
+    if (!cmd_need) {
+        int n = IkbdHle::command_length(data);
+        if (n < 0) {
+            return;
+        }
+        cmd_len = 0;
+        cmd_need = n;
+    }
+    else {
+        --cmd_need;
+    }
+    // Only the first two bytes are needed, the memory load length is the
+    // last byte of 0x20
+    if (cmd_len < (int)sizeof(cmd)) {
+        cmd[cmd_len] = data;
+    }
+    ++cmd_len;
+    if (!cmd_need) {
+        if (cmd[0] == 0x20) {
+            load_left = data;
+        }
+        command();
+    }
+}
+
+void IkbdMode::command() {
+    switch (cmd[0]) {
+    case 0x08:
+        mouse_mode = IKBD_MOUSE_RELATIVE;
+        break;
+    case 0x09:
+        mouse_mode = IKBD_MOUSE_ABSOLUTE;
+        break;
+    case 0x0a:
+        mouse_mode = IKBD_MOUSE_KEYCODE;
+        break;
+    case 0x12:
+        mouse_mode = IKBD_MOUSE_OFF;
+        break;
+    case 0x14:
+    case 0x15:
+    case 0x17:
+    case 0x18:
+    case 0x19:
+        // The ROM stops reading the mouse, joystick 0 shares its port
+        joy_mode = (cmd[0] == 0x14) ? IKBD_JOY_EVENT :
+                   (cmd[0] == 0x15) ? IKBD_JOY_INTERROGATE :
+                   (cmd[0] == 0x17) ? IKBD_JOY_MONITOR :
+                   (cmd[0] == 0x18) ? IKBD_JOY_FIRE_MONITOR : IKBD_JOY_KEYCODE;
+        mouse_mode = IKBD_MOUSE_OFF;
+        break;
+    case 0x1a:
+        joy_mode = IKBD_JOY_OFF;
+        break;
+    case 0x22:
+        known = false;
+        break;
+    case 0x80:
+        if (cmd[1] == 0x01) {
+            reset();
+        }
+        break;
+    }
+}
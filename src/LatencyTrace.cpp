@@ -0,0 +1,146 @@
+/*
+ * Atari ST RP2040 IKBD Emulator
+ * Copyright (C) 2021 Roy Hopkins
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#include "LatencyTrace.h"
+#include "pico/time.h"
+#include <stdio.h>
+
+LatencyTrace& LatencyTrace::instance() {
+    static LatencyTrace trace;
+    return trace;
+}
+
+void LatencyTrace::input(LatencyInput in, uint32_t time_us) {
+    for (int stage = 0; stage < LATENCY_STAGES; ++stage) {
+        if (!waiting[in][stage]) {
+            waiting[in][stage] = true;
+            since[in][stage] = time_us;
+        }
+    }
+}
+
+void LatencyTrace::port_read(int port) {
+    // Called for every read, most of the time nothing is waiting
+    if (!waiting[LATENCY_KEY][LATENCY_TO_READ] && !waiting[LATENCY_MOUSE][LATENCY_TO_READ] &&
+        !waiting[LATENCY_JOYSTICK][LATENCY_TO_READ]) {
+        return;
+    }
+    uint32_t now = time_us_32();
+    switch (port) {
+    case 1:
+        sample(LATENCY_KEY, LATENCY_TO_READ, now);
+        break;
+    case 2:
+        // The mouse buttons
+        sample(LATENCY_MOUSE, LATENCY_TO_READ, now);
+        break;
+    case 4:
+        sample(LATENCY_MOUSE, LATENCY_TO_READ, now);
+        sample(LATENCY_JOYSTICK, LATENCY_TO_READ, now);
+        break;
+    }
+}
+
+void LatencyTrace::byte_sent(uint8_t data) {
+    // Only the first byte of a packet says what it is
+    if (packet_left) {
+        --packet_left;
+        return;
+    }
+    uint32_t now = time_us_32();
+    if ((data >= 0xf8) && (data <= 0xfb)) {
+        // Relative mouse, buttons in the header then X and Y
+        packet_left = 2;
+        sample(LATENCY_MOUSE, LATENCY_TO_SENT, now);
+    }
+    else if ((data == 0xfe) || (data == 0xff)) {
+        packet_left = 1;
+        sample(LATENCY_JOYSTICK, LATENCY_TO_SENT, now);
+    }
+    else if (data < 0xf6) {
+        sample(LATENCY_KEY, LATENCY_TO_SENT, now);
+    }
+}
+
+void LatencyTrace::sample(LatencyInput in, LatencyStage stage, uint32_t now_us) {
+    if (!waiting[in][stage]) {
+        return;
+    }
+    waiting[in][stage] = false;
+    uint32_t us = now_us - since[in][stage];
+    LatencyHistogram& h = hist[in][stage];
+    if ((h.count == 0) || (us < h.min_us)) {
+        h.min_us = us;
+    }
+    if (us > h.max_us) {
+        h.max_us = us;
+    }
+    h.total_us += us;
+    uint32_t bucket = us / LATENCY_BUCKET_US;
+    ++h.buckets[(bucket < LATENCY_BUCKETS) ? bucket : (LATENCY_BUCKETS - 1)];
+    ++h.count;
+}
+
+void LatencyTrace::get(LatencyInput in, LatencyStage stage, LatencyHistogram& h) const {
+    h = hist[in][stage];
+}
+
+uint32_t LatencyTrace::percentile(const LatencyHistogram& h, int pct) {
+    uint64_t want = ((uint64_t)h.count * pct + 99) / 100;
+    uint64_t seen = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; ++i) {
+        seen += h.buckets[i];
+        if (seen >= want) {
+            return (i + 1) * LATENCY_BUCKET_US;
+        }
+    }
+    return LATENCY_BUCKETS * LATENCY_BUCKET_US;
+}
+
+const char* LatencyTrace::name(LatencyInput in) {
+    switch (in) {
+    case LATENCY_KEY:       return "key";
+    case LATENCY_MOUSE:     return "mouse";
+    case LATENCY_JOYSTICK:  return "joy";
+    default:                return "?";
+    }
+}
+
+void LatencyTrace::dump() const {
+    static const char* stage_name[LATENCY_STAGES] = { "read", "sent" };
+    for (int in = 0; in < LATENCY_INPUTS; ++in) {
+        for (int stage = 0; stage < LATENCY_STAGES; ++stage) {
+            LatencyHistogram h;
+            get((LatencyInput)in, (LatencyStage)stage, h);
+            if (h.count == 0) {
+                continue;
+            }
+            printf("latency: %s to %s n %lu min %luus avg %luus p99 <%luus max %luus\n",
+                name((LatencyInput)in), stage_name[stage],
+                (unsigned long)h.count,
+                (unsigned long)h.min_us,
+                (unsigned long)(h.total_us / h.count),
+                (unsigned long)percentile(h, 99),
+                (unsigned long)h.max_us);
+        }
+    }
+}
+
+void latency_read(int port) {
+    LatencyTrace::instance().port_read(port);
+}
@@ -0,0 +1,78 @@
+/*
+ * Atari ST RP2040 IKBD Emulator
+ * Copyright (C) 2021 Roy Hopkins
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#include "MouseModel.h"
+#include "util.h"
+#include <stdlib.h>
+
+#define MOUSE_MASK 0x33333333
+
+MouseModel::MouseModel() {
+    // internal mouse state is random: A239/Jumping Jackson, Droid SE WIP
+    x.reg = _rotl(MOUSE_MASK, rand() % 16);
+    y.reg = _rotl(MOUSE_MASK, rand() % 16);
+}
+
+void MouseModel::add(int dx, int dy) {
+    add_axis(x, dx);
+    add_axis(y, dy);
+}
+
+void MouseModel::clear() {
+    x.pending = 0;
+    y.pending = 0;
+}
+
+void MouseModel::add_axis(Axis& axis, int delta) {
+    int32_t pending = axis.pending + delta;
+    if (pending > MOUSE_MAX_PENDING) {
+        pending = MOUSE_MAX_PENDING;
+    }
+    else if (pending < -MOUSE_MAX_PENDING) {
+        pending = -MOUSE_MAX_PENDING;
+    }
+    axis.pending = pending;
+}
+
+void MouseModel::step_axis(Axis& axis, int64_t cpu_cycles) {
+    if ((axis.pending == 0) || (cpu_cycles < axis.next)) {
+        return;
+    }
+    if (axis.pending > 0) {
+        axis.reg = _rotr(axis.reg, 1);
+        --axis.pending;
+    }
+    else {
+        axis.reg = _rotl(axis.reg, 1);
+        ++axis.pending;
+    }
+    // The more that is waiting the closer together the steps, a large
+    // backlog catches up at the fastest rate the ROM can follow
+    int64_t spacing = axis.pending ? MOUSE_SPREAD_CYCLES / abs(axis.pending) : 0;
+    if (spacing < MOUSE_MIN_STEP_CYCLES) {
+        spacing = MOUSE_MIN_STEP_CYCLES;
+    }
+    axis.next = cpu_cycles + spacing;
+}
+
+void MouseModel::tick(int64_t cpu_cycles, int* x_counter, int* y_counter) {
+    step_axis(x, cpu_cycles);
+    step_axis(y, cpu_cycles);
+    *x_counter = x.reg;
+    *y_counter = y.reg;
+}
@@ -16,45 +16,282 @@
  * along with this program; if not, write to the Free Software
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 */
-
 #include "NVSettings.h"
+#include "Telemetry.h"
 #include <hardware/sync.h>
 #include <string.h>
+#include <stddef.h>
+#if !PICO_COPY_TO_RAM
+#include "pico/multicore.h"
+#endif
 
 // The PICO has 2Mb of flash storage. We will assume the code will not be taking
-// all of this and carve 4K out near the end
-#define FLASH_LOCATION  (0x200000-FLASH_SECTOR_SIZE)
+// all of this and carve a few sectors out near the end for the settings log.
+#define NV_SECTORS      4
+#define NV_LOCATION     (0x200000 - NV_SECTORS * FLASH_SECTOR_SIZE)
+#define NV_SLOTS        (NV_SECTORS * FLASH_SECTOR_SIZE / FLASH_PAGE_SIZE)
+#define NV_MAGIC        0x4b424434  // "KBD4"
+// Records from before Settings::key_layout, Settings::turbo and
+// Settings::engine, only read to carry them over
+#define NV_MAGIC_V3     0x4b424433  // "KBD3"
+#define NV_MAGIC_V2     0x4b424432  // "KBD2"
+#define NV_MAGIC_V1     0x4b424431  // "KBD1"
+
+// Where the settings were kept before the log, only read to carry them over
+#define OLD_LOCATION    (0x200000 - FLASH_SECTOR_SIZE)
 
-static union {
+/**
+ * One log entry, written at the start of a flash page
+ */
+struct NVRecord {
+    uint32_t magic;
+    uint32_t seq;
     Settings settings;
-    uint8_t  raw[FLASH_SECTOR_SIZE];
-} storage;
+    uint32_t check;
+};
+
+/**
+ * The settings and log entry before Settings::engine was added
+ */
+struct SettingsV1 {
+    uint8_t     version;
+    int8_t      mouse_speed;
+    uint8_t     mouse_enabled;
+    uint8_t     joy_device;
+};
+
+struct NVRecordV1 {
+    uint32_t    magic;
+    uint32_t    seq;
+    SettingsV1  settings;
+    uint32_t    check;
+};
+
+/**
+ * The settings and log entry before Settings::turbo was added
+ */
+struct SettingsV2 {
+    uint8_t     version;
+    int8_t      mouse_speed;
+    uint8_t     mouse_enabled;
+    uint8_t     joy_device;
+    uint8_t     engine;
+};
+
+struct NVRecordV2 {
+    uint32_t    magic;
+    uint32_t    seq;
+    SettingsV2  settings;
+    uint32_t    check;
+};
+
+/**
+ * The settings and log entry before Settings::key_layout was added
+ */
+struct SettingsV3 {
+    uint8_t     version;
+    int8_t      mouse_speed;
+    uint8_t     mouse_enabled;
+    uint8_t     joy_device;
+    uint8_t     engine;
+    uint8_t     turbo;
+};
+
+struct NVRecordV3 {
+    uint32_t    magic;
+    uint32_t    seq;
+    SettingsV3  settings;
+    uint32_t    check;
+};
+
+static Settings settings;
+
+template <typename T>
+static uint32_t record_check(const T& rec) {
+    const uint8_t* p = (const uint8_t*)&rec;
+    uint32_t check = 0x811c9dc5;
+    for (size_t i = 0; i < offsetof(T, check); ++i) {
+        check = (check ^ p[i]) * 0x01000193;
+    }
+    return check;
+}
+
+template <typename T = NVRecord>
+static const T* slot_record(uint32_t slot) {
+    return (const T*)(XIP_BASE + NV_LOCATION + slot * FLASH_PAGE_SIZE);
+}
+
+static void from_v1(const SettingsV1& old) {
+    memset(&settings, 0, sizeof(Settings));
+    settings.version = old.version;
+    settings.mouse_speed = old.mouse_speed;
+    settings.mouse_enabled = old.mouse_enabled;
+    settings.joy_device = old.joy_device;
+    settings.engine = ENGINE_LLE;
+}
+
+static void from_v2(const SettingsV2& old) {
+    memset(&settings, 0, sizeof(Settings));
+    settings.version = old.version;
+    settings.mouse_speed = old.mouse_speed;
+    settings.mouse_enabled = old.mouse_enabled;
+    settings.joy_device = old.joy_device;
+    settings.engine = old.engine;
+}
+
+static void from_v3(const SettingsV3& old) {
+    memset(&settings, 0, sizeof(Settings));
+    settings.version = old.version;
+    settings.mouse_speed = old.mouse_speed;
+    settings.mouse_enabled = old.mouse_enabled;
+    settings.joy_device = old.joy_device;
+    settings.engine = old.engine;
+    settings.turbo = old.turbo;
+    settings.key_layout = KEY_LAYOUT_ISO;
+}
+
+/**
+ * Newest valid record of one format in the log, or nullptr
+ */
+template <typename T>
+static const T* newest_record(uint32_t magic, uint32_t& newest_slot) {
+    const T* newest = nullptr;
+    for (uint32_t slot = 0; slot < NV_SLOTS; ++slot) {
+        const T* rec = slot_record<T>(slot);
+        if ((rec->magic == magic) && (rec->check == record_check(*rec)) &&
+            (!newest || ((int32_t)(rec->seq - newest->seq) > 0))) {
+            newest = rec;
+            newest_slot = slot;
+        }
+    }
+    return newest;
+}
+
+static bool sector_erased(uint32_t sector) {
+    const uint32_t* p = (const uint32_t*)(XIP_BASE + NV_LOCATION + sector * FLASH_SECTOR_SIZE);
+    for (uint32_t i = 0; i < FLASH_SECTOR_SIZE / sizeof(uint32_t); ++i) {
+        if (p[i] != 0xffffffff) {
+            return false;
+        }
+    }
+    return true;
+}
 
 NVSettings::NVSettings() {
-    // NV settings disabled for now as the RP2040 seems to crash if you write flash with
-    // interrupts enabled or disabled.
     read();
 }
 
 Settings& NVSettings::get_settings() {
-    return storage.settings;
+    return settings;
 }
 
 void NVSettings::write() {
+    pending = true;
+    changed_tm = get_absolute_time();
+}
+
+void NVSettings::update() {
+    if (pending && (absolute_time_diff_us(changed_tm, get_absolute_time()) >= NV_COMMIT_DELAY_US)) {
+        flush();
+    }
+}
+
+void NVSettings::flush() {
+    if (!pending) {
+        return;
+    }
+    pending = false;
+    const NVRecord* last = slot_record((next_slot + NV_SLOTS - 1) % NV_SLOTS);
+    if ((last->magic == NV_MAGIC) && (last->seq == seq) && !memcmp(&last->settings, &settings, sizeof(Settings))) {
+        // Changed back to what is already stored
+        return;
+    }
+    program(next_slot);
+    next_slot = (next_slot + 1) % NV_SLOTS;
+}
+
+void NVSettings::program(uint32_t slot) {
+    static uint8_t page[FLASH_PAGE_SIZE];
+    NVRecord rec;
+    rec.magic = NV_MAGIC;
+    rec.seq = ++seq;
+    rec.settings = settings;
+    rec.check = record_check(rec);
+    memset(page, 0xff, sizeof(page));
+    memcpy(page, &rec, sizeof(rec));
+
+    uint32_t sector = slot / (FLASH_SECTOR_SIZE / FLASH_PAGE_SIZE);
+    bool erase = ((slot % (FLASH_SECTOR_SIZE / FLASH_PAGE_SIZE)) == 0) && !sector_erased(sector);
+
+    // The firmware is copied to RAM so core1 never touches the flash and
+    // carries on emulating. Otherwise it has to be parked while the flash
+    // is busy.
+#if !PICO_COPY_TO_RAM
+    multicore_lockout_start_blocking();
+#endif
     uint32_t ints = save_and_disable_interrupts();
-    flash_range_erase(FLASH_LOCATION, FLASH_SECTOR_SIZE);
-    flash_range_program(FLASH_LOCATION, &storage.raw[0], FLASH_PAGE_SIZE);
-    restore_interrupts (ints);
+    if (erase) {
+        // The log has come round to the oldest sector
+        flash_range_erase(NV_LOCATION + sector * FLASH_SECTOR_SIZE, FLASH_SECTOR_SIZE);
+    }
+    flash_range_program(NV_LOCATION + slot * FLASH_PAGE_SIZE, page, FLASH_PAGE_SIZE);
+    restore_interrupts(ints);
+    Telemetry::instance().count(TELEMETRY_FLASH_WRITES);
+#if !PICO_COPY_TO_RAM
+    multicore_lockout_end_blocking();
+#endif
 }
 
 void NVSettings::read() {
-    // Copy from flash to our structure
-    memcpy(&storage.raw[0], (void*)(XIP_BASE + FLASH_LOCATION), FLASH_SECTOR_SIZE);
-    // Make sure flash contained a valid structure
-    if (storage.settings.version != 1) {
-        memset(&storage.raw[0], 0, FLASH_SECTOR_SIZE);
-        storage.settings.version = 1;
+    // Find the newest valid record
+    uint32_t newest_slot = 0;
+    const NVRecord* newest = newest_record<NVRecord>(NV_MAGIC, newest_slot);
+    if (newest) {
+        settings = newest->settings;
+        seq = newest->seq;
+        next_slot = (newest_slot + 1) % NV_SLOTS;
+        return;
+    }
+
+    // Carry over the newest record in an old format, the log carries on
+    // after it
+    const NVRecordV3* v3 = newest_record<NVRecordV3>(NV_MAGIC_V3, newest_slot);
+    if (v3) {
+        from_v3(v3->settings);
+        seq = v3->seq;
+        next_slot = (newest_slot + 1) % NV_SLOTS;
         write();
+        flush();
+        return;
+    }
+    const NVRecordV2* v2 = newest_record<NVRecordV2>(NV_MAGIC_V2, newest_slot);
+    if (v2) {
+        from_v2(v2->settings);
+        seq = v2->seq;
+        next_slot = (newest_slot + 1) % NV_SLOTS;
+        write();
+        flush();
+        return;
+    }
+    const NVRecordV1* old = newest_record<NVRecordV1>(NV_MAGIC_V1, newest_slot);
+    if (old) {
+        from_v1(old->settings);
+        seq = old->seq;
+        next_slot = (newest_slot + 1) % NV_SLOTS;
+        write();
+        flush();
+        return;
     }
-}
 
+    // Nothing logged yet, use the settings from before the log if there
+    // are any
+    from_v1(*(const SettingsV1*)(XIP_BASE + OLD_LOCATION));
+    if (settings.version != 1) {
+        memset(&settings, 0, sizeof(Settings));
+        settings.version = 1;
+    }
+    seq = 0;
+    next_slot = 0;
+    write();
+    flush();
+}
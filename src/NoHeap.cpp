@@ -0,0 +1,74 @@
+/*
+ * Atari ST RP2040 IKBD Emulator
+ * Copyright (C) 2021 Roy Hopkins
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#include "pico/stdlib.h"
+#include <new>
+
+// The firmware keeps everything in fixed static storage. Built with NO_HEAP
+// (see CMakeLists.txt) any C++ allocation stops the firmware with the
+// address of the caller, so one added later is found on the first run
+// rather than as a stall on core1 when the heap is fragmented. Deleting a
+// null pointer is allowed and does nothing. C malloc() is not caught, the
+// C code (the SSD1306 driver included) keeps its buffers static too.
+#ifdef NO_HEAP
+
+static void __attribute__((noreturn, noinline)) heap_used(void* caller) {
+    panic("heap allocation from %p with NO_HEAP", caller);
+}
+
+void* operator new(std::size_t) {
+    heap_used(__builtin_return_address(0));
+}
+
+void* operator new[](std::size_t) {
+    heap_used(__builtin_return_address(0));
+}
+
+void* operator new(std::size_t, const std::nothrow_t&) noexcept {
+    heap_used(__builtin_return_address(0));
+}
+
+void* operator new[](std::size_t, const std::nothrow_t&) noexcept {
+    heap_used(__builtin_return_address(0));
+}
+
+void operator delete(void* p) noexcept {
+    if (p) {
+        heap_used(__builtin_return_address(0));
+    }
+}
+
+void operator delete[](void* p) noexcept {
+    if (p) {
+        heap_used(__builtin_return_address(0));
+    }
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+    if (p) {
+        heap_used(__builtin_return_address(0));
+    }
+}
+
+void operator delete[](void* p, std::size_t) noexcept {
+    if (p) {
+        heap_used(__builtin_return_address(0));
+    }
+}
+
+#endif
@@ -0,0 +1,60 @@
+/*
+ * Atari ST RP2040 IKBD Emulator
+ * Copyright (C) 2021 Roy Hopkins
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#include "PowerMonitor.h"
+#include "UserInterface.h"
+#include "IkbdMode.h"
+#include "SelfTest.h"
+#include "config.h"
+#include "pico/stdlib.h"
+#include <stdio.h>
+
+PowerMonitor::PowerMonitor() {
+    low_since = get_absolute_time();
+}
+
+PowerMonitor& PowerMonitor::instance() {
+    static PowerMonitor monitor;
+    return monitor;
+}
+
+void PowerMonitor::update() {
+    // The UART has the pin but its level can still be read. The loopback
+    // test is run without an ST, so it counts as on meanwhile.
+    bool high = gpio_get(UART_RX) || SelfTest::instance().running();
+    absolute_time_t tm = get_absolute_time();
+    if (high) {
+        low_since = tm;
+        if (asleep) {
+            asleep = false;
+            printf("ST is on, resuming\n");
+            // The 6301 starts again in its power on modes
+            IkbdMode::instance().reset();
+            if (ui_) {
+                ui_->set_blank(false);
+            }
+        }
+    }
+    else if (!asleep && (absolute_time_diff_us(low_since, tm) >= ST_OFF_US)) {
+        asleep = true;
+        printf("ST is off, going dormant\n");
+        if (ui_) {
+            ui_->set_blank(true);
+        }
+    }
+}
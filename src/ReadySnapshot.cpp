@@ -0,0 +1,152 @@
+/*
+ * Atari ST RP2040 IKBD Emulator
+ * Copyright (C) 2021 Roy Hopkins
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#include "ReadySnapshot.h"
+#include "Telemetry.h"
+#include "SerialPort.h"
+#include "config.h"
+#include "6301.h"
+#include <hardware/sync.h>
+#include <string.h>
+#if !PICO_COPY_TO_RAM
+#include "pico/multicore.h"
+#endif
+
+// The sector just below the settings log (NVSettings.cpp)
+#define SNAPSHOT_LOCATION   (0x200000 - 5 * FLASH_SECTOR_SIZE)
+// The ST starts sending commands as soon as the ROM is ready, the snapshot
+// is written once nothing has come from it for this long
+#define SNAPSHOT_QUIET_US   500000
+
+ReadySnapshot& ReadySnapshot::instance() {
+    static ReadySnapshot snapshot;
+    return snapshot;
+}
+
+void ReadySnapshot::load() {
+#ifdef READY_SNAPSHOT
+    // hd6301_restore() checks it is a snapshot for this ROM
+    memcpy(ready, (const void*)(XIP_BASE + SNAPSHOT_LOCATION), sizeof(ready));
+    stored = true;
+#endif
+}
+
+void ReadySnapshot::boot() {
+    hd6301_reset(1);
+    if (stored && hd6301_restore(ready, sizeof(ready))) {
+        __dmb();
+        ready_valid = true;
+        return;
+    }
+    stored = false;
+    capturing = true;
+}
+
+void ReadySnapshot::slice_end() {
+    if (crashed) {
+        recover();
+        return;
+    }
+    if (!capturing) {
+        if (++good_slices >= SNAPSHOT_GOOD_SLICES) {
+            good_slices = 0;
+            int next = (good_index == 0) ? 1 : 0;
+            hd6301_save(good[next], sizeof(good[next]));
+            // The buffer must be complete before it is pointed at
+            __dmb();
+            good_index = next;
+        }
+        return;
+    }
+    if (hd6301_sci_count(0)) {
+        // The ST has already sent a command, this isn't a plain power on
+        capturing = false;
+    }
+    else if (hd6301_sci_count(1) == 0) {
+        hd6301_save(candidate, sizeof(candidate));
+    }
+    else {
+        // The first byte went out during this slice, the end of the last
+        // slice is the ready point
+        capturing = false;
+        memcpy(ready, candidate, sizeof(ready));
+        __dmb();
+        ready_valid = true;
+    }
+}
+
+void ReadySnapshot::failover(bool good_first) {
+    int index = good_index;
+    if (good_first && (index >= 0)) {
+        hd6301_reset(1);
+        if (hd6301_restore(good[index], sizeof(good[index]))) {
+            return;
+        }
+    }
+    good_index = -1;
+    if (ready_valid) {
+        hd6301_reset(1);
+        if (hd6301_restore(ready, sizeof(ready))) {
+            return;
+        }
+    }
+    boot();
+}
+
+void ReadySnapshot::recover() {
+    // Keep the instructions that led up to it, printed by update()
+    hd6301_trace_freeze();
+    ++recovered;
+    if (ready_valid && hd6301_restore(ready, sizeof(ready))) {
+        return;
+    }
+    hd6301_reset(1);
+}
+
+void ReadySnapshot::update() {
+    if (reported != recovered) {
+        reported = recovered;
+        hd6301_trace_dump();
+    }
+#ifdef READY_SNAPSHOT
+    if (ready_valid && !stored && SerialPort::instance().rx_quiet(SNAPSHOT_QUIET_US)) {
+        stored = true;
+        program();
+    }
+#endif
+}
+
+void ReadySnapshot::program() {
+    // The snapshot is only written once, core1 never touches it again
+    // after ready_valid is set
+#if !PICO_COPY_TO_RAM
+    multicore_lockout_start_blocking();
+#endif
+    // Interrupts are off for the erase, tens of milliseconds. Bytes the
+    // ST sends meanwhile wait in the UART FIFO, 32 of them is 40ms.
+    SerialPort::instance().buffer_rx(true);
+    uint32_t ints = save_and_disable_interrupts();
+    flash_range_erase(SNAPSHOT_LOCATION, FLASH_SECTOR_SIZE);
+    flash_range_program(SNAPSHOT_LOCATION, ready, sizeof(ready));
+    restore_interrupts(ints);
+    SerialPort::instance().buffer_rx(false);
+    Telemetry::instance().count(TELEMETRY_FLASH_WRITES);
+#if !PICO_COPY_TO_RAM
+    multicore_lockout_end_blocking();
+#endif
+}
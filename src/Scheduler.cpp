@@ -0,0 +1,63 @@
+/*
+ * Atari ST RP2040 IKBD Emulator
+ * Copyright (C) 2021 Roy Hopkins
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#include "Scheduler.h"
+
+bool Scheduler::add(Task task, uint32_t period_us) {
+    if (count == SCHEDULER_MAX_TASKS) {
+        return false;
+    }
+    Entry& e = tasks[count++];
+    e.task = task;
+    e.period_us = period_us;
+    e.next = get_absolute_time();
+    return true;
+}
+
+absolute_time_t Scheduler::run_once() {
+    absolute_time_t tm = get_absolute_time();
+    absolute_time_t next = at_the_end_of_time;
+    for (int i = 0; i < count; ++i) {
+        Entry& e = tasks[i];
+        if (e.period_us == 0) {
+            e.task();
+        }
+        else if (absolute_time_diff_us(e.next, tm) >= 0) {
+            // Stay on the original cadence unless a whole period was missed
+            e.next = delayed_by_us(e.next, e.period_us);
+            if (absolute_time_diff_us(e.next, tm) >= 0) {
+                e.next = delayed_by_us(tm, e.period_us);
+            }
+            e.task();
+        }
+        if (e.period_us && (absolute_time_diff_us(e.next, next) > 0)) {
+            next = e.next;
+        }
+    }
+    return next;
+}
+
+void Scheduler::run() {
+    while (true) {
+        absolute_time_t next = run_once();
+        if (sleep) {
+            // Returns early on any interrupt
+            best_effort_wfe_or_timeout(next);
+        }
+    }
+}
@@ -0,0 +1,179 @@
+/*
+ * Atari ST RP2040 IKBD Emulator
+ * Copyright (C) 2021 Roy Hopkins
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#include "SelfTest.h"
+#include "CoreLink.h"
+#include "IkbdMode.h"
+#include "SerialTrace.h"
+#include "pico/stdlib.h"
+#include "hardware/sync.h"
+#include <stdio.h>
+
+/**
+ * A command in the test and the answer it gets
+ */
+struct SelfTestCommand {
+    uint8_t cmd;
+    uint8_t header;         // First byte of the answer
+    uint8_t length;         // Bytes in the answer including the header
+};
+
+static const SelfTestCommand commands[] = {
+    { 0x87, 0xf6, 8 },      // Mouse button action inquiry
+    { 0x0d, 0xf7, 6 },      // Interrogate mouse position
+    { 0x1c, 0xfc, 7 },      // Read the time-of-day clock
+};
+#define SELFTEST_COMMANDS   (sizeof(commands) / sizeof(commands[0]))
+
+// Absolute mouse mode, 320 by 200, so 0x0d is answered
+static const uint8_t setup[] = { 0x09, 0x01, 0x3f, 0x00, 0xc7 };
+static const uint8_t reset[] = { 0x80, 0x01 };
+
+SelfTest& SelfTest::instance() {
+    static SelfTest test;
+    return test;
+}
+
+uint32_t SelfTest::total() {
+    return SELFTEST_ROUNDS * SELFTEST_COMMANDS;
+}
+
+void SelfTest::start() {
+    if (state != IDLE) {
+        return;
+    }
+    printf("Loopback test starting\n");
+    started_us = time_us_32();
+    index = 0;
+    state = STARTING;
+}
+
+void SelfTest::send(const uint8_t* data, int n) {
+    // The UART interrupt queues received bytes too, keep it out while these
+    // go in
+    CoreLink& link = CoreLink::instance();
+    uint32_t irq = save_and_disable_interrupts();
+    for (int i = 0; i < n; ++i) {
+        link.post_rx(data[i]);
+        IkbdMode::instance().receive(data[i]);
+    }
+    restore_interrupts(irq);
+}
+
+void SelfTest::issue(uint32_t now) {
+    if (index >= total()) {
+        finish(now);
+        return;
+    }
+    sent_us = now;
+    at_sci = false;
+    received = 0;
+    state = WAITING;
+    send(&commands[index % SELFTEST_COMMANDS].cmd, 1);
+}
+
+void SelfTest::finish(uint32_t now) {
+    result.elapsed_us = now - started_us;
+    send(reset, sizeof(reset));
+    state = IDLE;
+    done = true;
+    dump();
+}
+
+void SelfTest::update() {
+    if (state == IDLE) {
+        return;
+    }
+    uint32_t now = time_us_32();
+    if (state == STARTING) {
+        if (now - started_us >= SELFTEST_START_US) {
+            result = {};
+            result.min_us = UINT32_MAX;
+            seen = SerialTrace::instance().count();
+            started_us = now;
+            send(setup, sizeof(setup));
+            issue(now);
+        }
+        return;
+    }
+
+    // Look through the bytes core1 has passed since the last call
+    SerialTraceEntry entries[SERIAL_TRACE_SIZE - 1];
+    uint32_t count;
+    int n = SerialTrace::instance().latest(entries, SERIAL_TRACE_SIZE - 1, &count);
+    int first = n - (int)(count - seen);
+    seen = count;
+    const SelfTestCommand& c = commands[index % SELFTEST_COMMANDS];
+    for (int i = (first > 0) ? first : 0; i < n; ++i) {
+        const SerialTraceEntry& e = entries[i];
+        if (!e.send) {
+            if (!at_sci && (e.data == c.cmd)) {
+                at_sci = true;
+                sci_us = e.time_us;
+            }
+            continue;
+        }
+        // Anything sent before the answer starts, a key for instance, is
+        // left out
+        if (!at_sci || (!received && (e.data != c.header))) {
+            continue;
+        }
+        if (!received) {
+            uint32_t us = e.time_us - sci_us;
+            result.total_us += us;
+            if (us < result.min_us) {
+                result.min_us = us;
+            }
+            if (us > result.max_us) {
+                result.max_us = us;
+            }
+        }
+        ++result.bytes;
+        if (++received == c.length) {
+            ++result.commands;
+            ++index;
+            issue(now);
+            return;
+        }
+    }
+    if (now - sent_us >= SELFTEST_TIMEOUT_US) {
+        ++result.lost;
+        ++index;
+        issue(now);
+    }
+}
+
+bool SelfTest::get(SelfTestResult& r) const {
+    r = result;
+    return done;
+}
+
+void SelfTest::dump() const {
+    if (!result.commands) {
+        printf("Loopback test: no answers, %lu lost\n", (unsigned long)result.lost);
+        return;
+    }
+    printf("Loopback test: %lu answered %lu lost, latency min %luus avg %luus max %luus, %lu commands/s %lu bytes/s\n",
+        (unsigned long)result.commands,
+        (unsigned long)result.lost,
+        (unsigned long)result.min_us,
+        (unsigned long)(result.total_us / result.commands),
+        (unsigned long)result.max_us,
+        (unsigned long)((uint64_t)result.commands * 1000000 / result.elapsed_us),
+        (unsigned long)((uint64_t)result.bytes * 1000000 / result.elapsed_us));
+}
@@ -19,7 +19,15 @@
 #include "SerialPort.h"
 #include "pico/stdlib.h"
 #include "hardware/uart.h"
+#include "hardware/irq.h"
+#include "hardware/sync.h"
 #include "config.h"
+#include "CoreLink.h"
+#include "Telemetry.h"
+#include "IkbdMode.h"
+#ifdef LATENCY_TRACE
+#include "LatencyTrace.h"
+#endif
 
 #define UART_ID uart1
 // The HD6301 in the ST communicates at 7812 baud
@@ -27,11 +35,8 @@
 #define DATA_BITS 8
 #define STOP_BITS 1
 #define PARITY    UART_PARITY_NONE
-
-// We flag the buffer as 'empty' if it has less than this amount of bytes queued. This
-// provides a small queue that optimises the serial port performance. Important for
-// smooth mouse handling.
-#define BUFFER_SIZE 8
+// One byte on the line, 10 bits including start and stop, before turbo
+#define BYTE_US   (10 * 1000000 / BAUD_RATE)
 
 SerialPort::~SerialPort() {
     close();
@@ -42,11 +47,12 @@ SerialPort& SerialPort::instance() {
     return serial;
 }
 
-void SerialPort::open() {
+void SerialPort::open(int turbo) {
+    turbo_ = turbo;
     uart_init(UART_DEVICE, 2400);
     gpio_set_function(UART_TX, GPIO_FUNC_UART);
     gpio_set_function(UART_RX, GPIO_FUNC_UART);
-    int actual = uart_set_baudrate(UART_ID, BAUD_RATE);
+    int actual = uart_set_baudrate(UART_ID, BAUD_RATE << turbo);
 
     // No hardware flow control
     uart_set_hw_flow(UART_ID, false, false);
@@ -55,38 +61,103 @@ void SerialPort::open() {
 
     // We don't want to use the FIFO otherwise we get mouse lag as the serial comms drains.
     uart_set_fifo_enabled(UART_ID, false);
+
+    // Received bytes are queued for core1 by the interrupt as they arrive.
+    // The transmit interrupt is only enabled while core1 has queued bytes.
+    int irq = (UART_ID == uart0) ? UART0_IRQ : UART1_IRQ;
+    irq_set_exclusive_handler(irq, on_irq);
+    irq_set_enabled(irq, true);
+    uart_set_irq_enables(UART_ID, true, false);
 }
 
-void SerialPort::set_ui(UserInterface& ui) {
-    this->ui = &ui;
+void SerialPort::on_irq() {
+    CoreLink& link = CoreLink::instance();
+    Telemetry& telemetry = Telemetry::instance();
+    IkbdMode& mode = IkbdMode::instance();
+    unsigned char data;
+    while (uart_is_readable(UART_ID)) {
+        data = uart_getc(UART_ID);
+        instance().last_rx_us = time_us_32();
+        link.post_rx(data);
+        mode.receive(data);
+        telemetry.count(TELEMETRY_UART_RX);
+    }
+    while (uart_is_writable(UART_ID) && link.get_tx(data)) {
+        uart_putc_raw(UART_ID, data);
+        telemetry.count(TELEMETRY_UART_TX);
+    }
+    if (link.tx_empty()) {
+        // Core1 may queue a byte and enable the interrupt between the test
+        // and here, so test again once it is disabled
+        hw_clear_bits(&uart_get_hw(UART_ID)->imsc, UART_UARTIMSC_TXIM_BITS);
+        if (!link.tx_empty()) {
+            hw_set_bits(&uart_get_hw(UART_ID)->imsc, UART_UARTIMSC_TXIM_BITS);
+        }
+    }
 }
 
 void SerialPort::close() {
 }
 
 void SerialPort::send(const unsigned char data) {
-    uart_putc(UART_ID, data);
-    if (ui) {
-        ui->serial(true, data);
+    // Called on core1, the byte is sent by the core0 UART interrupt. The
+    // atomic set alias is used as core0 clears the bit from the interrupt.
+    if (CoreLink::instance().post_tx(data)) {
+        hw_set_bits(&uart_get_hw(UART_ID)->imsc, UART_UARTIMSC_TXIM_BITS);
+#ifdef LATENCY_TRACE
+        LatencyTrace::instance().byte_sent(data);
+#endif
     }
 }
 
-bool SerialPort::recv(unsigned char& data) const {
-    if (uart_is_readable(UART_ID)) {
-        data = uart_getc(UART_ID);
-        if (ui) {
-            ui->serial(false, data);
+bool SerialPort::tx_idle() const {
+    return CoreLink::instance().tx_empty() && !(uart_get_hw(UART_ID)->fr & UART_UARTFR_BUSY_BITS);
+}
+
+bool SerialPort::rx_idle() const {
+    return rx_quiet((2 * BYTE_US) >> turbo_);
+}
+
+bool SerialPort::rx_quiet(uint32_t us) const {
+    return ((time_us_32() - last_rx_us) >= us) && gpio_get(UART_RX);
+}
+
+void SerialPort::buffer_rx(bool en) {
+    if (en) {
+        uart_set_fifo_enabled(UART_ID, true);
+        return;
+    }
+    // The interrupt takes bytes out of the FIFO at half full or after 32 bit
+    // times without one, wait for that so none are left when it goes
+    while (true) {
+        uint32_t ints = save_and_disable_interrupts();
+        if (!uart_is_readable(UART_ID)) {
+            uart_set_fifo_enabled(UART_ID, false);
+            restore_interrupts(ints);
+            return;
         }
-        return true;
+        restore_interrupts(ints);
+        tight_loop_contents();
     }
-    return false;
+}
+
+void SerialPort::clock_changed() {
+    // The divider is worked out from clk_peri
+    uart_set_baudrate(UART_ID, BAUD_RATE << turbo_);
+}
+
+void SerialPort::set_turbo(int turbo) {
+    uint32_t irq = save_and_disable_interrupts();
+    turbo_ = turbo;
+    uart_set_baudrate(UART_ID, BAUD_RATE << turbo_);
+    restore_interrupts(irq);
 }
 
 void SerialPort::configure() {
 }
 
-bool SerialPort::send_buf_empty() const {
-    return uart_is_writable(UART_ID);
+bool SerialPort::send_buf_full() const {
+    return CoreLink::instance().tx_full();
 }
 
 void serial_send(unsigned char data) {
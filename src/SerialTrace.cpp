@@ -0,0 +1,99 @@
+/*
+ * Atari ST RP2040 IKBD Emulator
+ * Copyright (C) 2021 Roy Hopkins
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#include "SerialTrace.h"
+#include "pico/stdlib.h"
+#include "hardware/sync.h"
+
+SerialTrace& SerialTrace::instance() {
+    static SerialTrace trace;
+    return trace;
+}
+
+void SerialTrace::record(bool send, uint8_t data) {
+    uint32_t h = head;
+    SerialTraceEntry& entry = ring[h & (SERIAL_TRACE_SIZE - 1)];
+    entry.time_us = time_us_32();
+    entry.send = send ? 1 : 0;
+    entry.data = data;
+    // The entry must be complete before the reader sees it
+    __dmb();
+    head = h + 1;
+}
+
+int SerialTrace::latest(SerialTraceEntry* entries, int max, uint32_t* last) const {
+    if (max > SERIAL_TRACE_SIZE - 1) {
+        max = SERIAL_TRACE_SIZE - 1;
+    }
+    uint32_t end = head;
+    if (last) {
+        *last = end;
+    }
+    uint32_t first = (end > (uint32_t)max) ? end - max : 0;
+    __dmb();
+    for (uint32_t i = first; i < end; ++i) {
+        entries[i - first] = ring[i & (SERIAL_TRACE_SIZE - 1)];
+    }
+    __dmb();
+    // The writer may have lapped the copy. It can be part way through the
+    // slot after its head, so only entries after that one are still good.
+    uint32_t now = head;
+    uint32_t valid = (now >= SERIAL_TRACE_SIZE - 1) ? now - (SERIAL_TRACE_SIZE - 1) : 0;
+    if (valid <= first) {
+        return end - first;
+    }
+    if (valid >= end) {
+        return 0;
+    }
+    for (uint32_t i = valid; i < end; ++i) {
+        entries[i - valid] = entries[i - first];
+    }
+    return end - valid;
+}
+
+int SerialTrace::read(uint32_t& next, SerialTraceEntry* entries, int max, uint32_t& lost) const {
+    uint32_t end = head;
+    uint32_t first = next;
+    if (end - first > SERIAL_TRACE_SIZE - 1) {
+        lost += end - (SERIAL_TRACE_SIZE - 1) - first;
+        first = end - (SERIAL_TRACE_SIZE - 1);
+    }
+    uint32_t stop = (end - first > (uint32_t)max) ? first + max : end;
+    __dmb();
+    for (uint32_t i = first; i < stop; ++i) {
+        entries[i - first] = ring[i & (SERIAL_TRACE_SIZE - 1)];
+    }
+    __dmb();
+    next = stop;
+    // As in latest(), only the entries after the slot past the writer's
+    // head are still good
+    uint32_t now = head;
+    uint32_t valid = (now >= SERIAL_TRACE_SIZE - 1) ? now - (SERIAL_TRACE_SIZE - 1) : 0;
+    if (valid <= first) {
+        return stop - first;
+    }
+    if (valid >= stop) {
+        lost += stop - first;
+        return 0;
+    }
+    lost += valid - first;
+    for (uint32_t i = valid; i < stop; ++i) {
+        entries[i - valid] = entries[i - first];
+    }
+    return stop - valid;
+}
@@ -0,0 +1,113 @@
+/*
+ * Atari ST RP2040 IKBD Emulator
+ * Copyright (C) 2021 Roy Hopkins
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+#include "Telemetry.h"
+#include "EmulatorLoad.h"
+#include "ReadySnapshot.h"
+#include "Core1Watchdog.h"
+#include "6301.h"
+#include "cpu.h"
+#include "pico/time.h"
+#include <stdio.h>
+
+Telemetry& Telemetry::instance() {
+    static Telemetry telemetry;
+    return telemetry;
+}
+
+void Telemetry::boot(TelemetryBoot phase) {
+    if (!boot_us[phase]) {
+        // 0 is kept for not reached yet
+        uint32_t us = (uint32_t)to_us_since_boot(get_absolute_time());
+        boot_us[phase] = us ? us : 1;
+    }
+}
+
+bool Telemetry::booted() const {
+    for (int i = 0; i < TELEMETRY_BOOT_PHASES; ++i) {
+        if ((i != TELEMETRY_BOOT_HID) && !boot_us[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void Telemetry::dump_boot() const {
+    static const char* const names[TELEMETRY_BOOT_PHASES] = {
+        "serial", "core1", "ready", "usb", "display", "hid"
+    };
+    printf("boot:");
+    for (int i = 0; i < TELEMETRY_BOOT_PHASES; ++i) {
+        if (boot_us[i]) {
+            printf(" %s %luus", names[i], (unsigned long)boot_us[i]);
+        }
+        else {
+            printf(" %s -", names[i]);
+        }
+    }
+    printf("\n");
+}
+
+void Telemetry::ui_redraw(uint32_t us) {
+    count(TELEMETRY_UI_REDRAWS);
+    count(TELEMETRY_UI_REDRAW_US, us);
+    if (us > counters[TELEMETRY_UI_REDRAW_MAX_US]) {
+        counters[TELEMETRY_UI_REDRAW_MAX_US] = us;
+    }
+}
+
+void Telemetry::header() {
+    printf("#tm,ms,instructions,cycles,idle_cycles,int_ocf,int_sci,sci_rx,sci_tx,sci_overruns,"
+        "uart_rx,uart_tx,hid1,hid2,hid3,hid4,hid5,hid6,hid7,hid8,flash_writes,"
+        "load_pct,slices_missed,crashes,core1_restarts,failover_us,ui_redraws,ui_redraw_us,ui_redraw_max_us\n");
+}
+
+void Telemetry::dump() {
+    EmulatorLoadStats stats;
+    if (!EmulatorLoad::instance().get(stats)) {
+        stats = {};
+    }
+    // Core1 only ever adds to its counters, reading them from here gives
+    // either the old or the new value
+    printf("tm,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu",
+        (unsigned long)to_ms_since_boot(get_absolute_time()),
+        hd6301_instr_count(),
+        (unsigned long)(uint32_t)cpu.ncycles,
+        (unsigned long)(uint32_t)hd6301_idle_cycles(),
+        hd6301_int_count(HD6301_INT_OCF),
+        hd6301_int_count(HD6301_INT_SCI),
+        hd6301_sci_count(0),
+        hd6301_sci_count(1),
+        hd6301_sci_overruns(),
+        (unsigned long)counters[TELEMETRY_UART_RX],
+        (unsigned long)counters[TELEMETRY_UART_TX]);
+    for (int i = 0; i < TELEMETRY_HID_DEVICES; ++i) {
+        printf(",%lu", (unsigned long)hid_reports[i]);
+    }
+    printf(",%lu,%d,%lu,%lu,%lu,%lu,%lu,%lu,%lu\n",
+        (unsigned long)counters[TELEMETRY_FLASH_WRITES],
+        EmulatorLoad::utilisation(stats),
+        (unsigned long)stats.missed_total,
+        (unsigned long)ReadySnapshot::instance().recoveries(),
+        (unsigned long)Core1Watchdog::instance().restart_count(),
+        (unsigned long)Core1Watchdog::instance().failover_time_us(),
+        (unsigned long)counters[TELEMETRY_UI_REDRAWS],
+        (unsigned long)counters[TELEMETRY_UI_REDRAW_US],
+        (unsigned long)counters[TELEMETRY_UI_REDRAW_MAX_US]);
+    counters[TELEMETRY_UI_REDRAW_MAX_US] = 0;
+}
@@ -19,9 +19,20 @@
 #include "UserInterface.h"
 #include "pico/stdlib.h"
 #include "bsp/board.h"
+#include "hardware/clocks.h"
 #include "config.h"
+#include "EmulatorLoad.h"
+#include "SerialTrace.h"
+#include "IkbdAnalyser.h"
+#include "CoreLink.h"
+#include "Telemetry.h"
+#include "SelfTest.h"
+#ifdef LATENCY_TRACE
+#include "LatencyTrace.h"
+#endif
 
 #define DEBOUNCE_COUNT 10
+#define DISPLAY_I2C_HZ 400000
 
 enum BUTTONS {
     BUTTON_LEFT,
@@ -35,16 +46,6 @@ UserInterface::UserInterface() {
 ssd1306_t   disp;
 
 void UserInterface::init() {
-    // Setup the I2C interface to the display
-    i2c_init(SSD1306_I2C, 400000);
-    gpio_set_function(SSD1306_SDA, GPIO_FUNC_I2C);
-    gpio_set_function(SSD1306_SCL, GPIO_FUNC_I2C);
-    gpio_pull_up(SSD1306_SDA);
-    gpio_pull_up(SSD1306_SCL);
-
-    // Initialise the display library
-    ssd1306_init(&disp, SSD1306_WIDTH, SSD1306_HEIGHT, SSD1306_ADDR, SSD1306_I2C);
-
     // Setup GPIO for buttons
     btn_gpio[0] = GPIO_BUTTON_LEFT;
     btn_gpio[1] = GPIO_BUTTON_MIDDLE;
@@ -65,8 +66,55 @@ void UserInterface::init() {
         mouse_speed = MOUSE_MAX;
         settings.get_settings().mouse_speed = mouse_speed;
     }
+    if (settings.get_settings().engine > ENGINE_HLE) {
+        settings.get_settings().engine = ENGINE_LLE;
+    }
+    engine = settings.get_settings().engine;
+    if (settings.get_settings().turbo > TURBO_MAX) {
+        settings.get_settings().turbo = 0;
+    }
+    turbo = settings.get_settings().turbo;
+    if (settings.get_settings().key_layout > KEY_LAYOUT_MAX) {
+        settings.get_settings().key_layout = KEY_LAYOUT_ISO;
+    }
 
     serial_tm = get_absolute_time();
+    perf_tm = serial_tm;
+}
+
+void UserInterface::init_display() {
+    // Setup the I2C interface to the display
+    i2c_init(SSD1306_I2C, DISPLAY_I2C_HZ);
+    gpio_set_function(SSD1306_SDA, GPIO_FUNC_I2C);
+    gpio_set_function(SSD1306_SCL, GPIO_FUNC_I2C);
+    gpio_pull_up(SSD1306_SDA);
+    gpio_pull_up(SSD1306_SCL);
+
+    // Initialise the display library
+    ssd1306_init(&disp, SSD1306_WIDTH, SSD1306_HEIGHT, SSD1306_ADDR, SSD1306_I2C);
+    display_up = true;
+    if (blank) {
+        ssd1306_poweroff(&disp);
+    }
+    Telemetry::instance().boot(TELEMETRY_BOOT_DISPLAY);
+}
+
+void UserInterface::clock_changed() {
+    // The I2C divider is worked out from clk_sys
+    if (display_up) {
+        i2c_set_baudrate(SSD1306_I2C, DISPLAY_I2C_HZ);
+    }
+}
+
+void UserInterface::turbo_fallback() {
+    turbo = 0;
+    settings.get_settings().turbo = 0;
+    settings.write();
+    dirty = true;
+}
+
+bool UserInterface::display_idle() const {
+    return !display_up || !ssd1306_busy(&disp);
 }
 
 void UserInterface::usb_connect_state(int kb, int mouse, int joy) {
@@ -98,20 +146,57 @@ void UserInterface::set_mouse_enabled(uint8_t en) {
 
 
 void UserInterface::update_serial() {
+    static const char hex[] = "0123456789ABCDEF";
+    SerialTraceEntry entries[SERIAL_LINES];
+    char buf[3] = {};
     uint8_t y = 0;
+    int n = SerialTrace::instance().latest(entries, SERIAL_LINES);
     ssd1306_clear(&disp);
-    for (auto it : serial_lines) {
-        ssd1306_draw_string(&disp, 0, y, 1, (char*)it.c_str());
+    for (int i = 0; i < n; ++i) {
+        // Bytes sent to the ST go in the last two of the 16 columns
+        buf[0] = hex[entries[i].data >> 4];
+        buf[1] = hex[entries[i].data & 0xf];
+        ssd1306_draw_string(&disp, entries[i].send ? 14 * 8 : 0, y, 1, buf);
         y += 9;
     }
     ssd1306_draw_string(&disp, 24, 27, 1, (char*)"ST <-> Kbd");
 }
 
+void UserInterface::update_protocol() {
+    char buf[32];
+    IkbdAnalyser& analyser = IkbdAnalyser::instance();
+    const IkbdAnalyserStats& stats = analyser.get();
+    const uint32_t* p = stats.packets;
+    ssd1306_clear(&disp);
+    ssd1306_draw_string_page(&disp, 0, 0, "IKBD protocol");
+    sprintf(buf, "ST> %4lu/s %4luB", (unsigned long)(p[IKBD_PACKET_COMMAND] + p[IKBD_PACKET_IGNORED]),
+        (unsigned long)stats.rx_bytes);
+    ssd1306_draw_string(&disp, 0, 9, 1, buf);
+    sprintf(buf, ">ST %4lu/s %4luB", (unsigned long)(p[IKBD_PACKET_KEY_MAKE] + p[IKBD_PACKET_KEY_BREAK] +
+        p[IKBD_PACKET_MOUSE_RELATIVE] + p[IKBD_PACKET_MOUSE_ABSOLUTE] + p[IKBD_PACKET_JOYSTICK] +
+        p[IKBD_PACKET_STATUS] + p[IKBD_PACKET_CLOCK]), (unsigned long)stats.tx_bytes);
+    ssd1306_draw_string(&disp, 0, 18, 1, buf);
+    sprintf(buf, "Key %lu Mse %lu", (unsigned long)(p[IKBD_PACKET_KEY_MAKE] + p[IKBD_PACKET_KEY_BREAK]),
+        (unsigned long)(p[IKBD_PACKET_MOUSE_RELATIVE] + p[IKBD_PACKET_MOUSE_ABSOLUTE]));
+    ssd1306_draw_string(&disp, 0, 27, 1, buf);
+    sprintf(buf, "Joy %lu Sts %lu", (unsigned long)p[IKBD_PACKET_JOYSTICK],
+        (unsigned long)(p[IKBD_PACKET_STATUS] + p[IKBD_PACKET_CLOCK]));
+    ssd1306_draw_string(&disp, 0, 36, 1, buf);
+    sprintf(buf, "%02X > %02X %s", analyser.last_rx(), analyser.last_tx(),
+        IkbdAnalyser::name(analyser.last_tx_packet()));
+    ssd1306_draw_string(&disp, 0, 45, 1, buf);
+    // Deepest the queues were and the bytes lost to the trace and the
+    // receive queue since boot
+    sprintf(buf, "Q %lu/%lu Lost %lu", (unsigned long)stats.rx_depth_max, (unsigned long)stats.tx_depth_max,
+        (unsigned long)(analyser.lost() + CoreLink::instance().rx_dropped()));
+    ssd1306_draw_string(&disp, 0, 54, 1, buf);
+}
+
 void UserInterface::update_status() {
     char buf[32];
     ssd1306_clear(&disp);
     sprintf(buf, "USB Keyboard  %d", num_kb);
-    ssd1306_draw_string(&disp, 0, 0, 1,  buf);
+    ssd1306_draw_string_page(&disp, 0, 0, buf);
     sprintf(buf, "USB Mouse     %d", num_mouse);
     ssd1306_draw_string(&disp, 0, 9, 1,  buf);
     sprintf(buf, "USB Joystick  %d", num_joy);
@@ -134,6 +219,98 @@ void UserInterface::update_joy(int index) {
     ssd1306_draw_string(&disp, 0, 54, 1, buf);
 }
 
+void UserInterface::update_clock() {
+    char buf[32];
+    int shift = settings.get_settings().turbo;
+    ssd1306_draw_string(&disp, 0, 45, 1, (shift == turbo) ? "6301 clock" : "At power on");
+    sprintf(buf, "%dMHz %lu baud", 1 << shift, 7812ul << shift);
+    ssd1306_draw_string(&disp, 0, 54, 1, buf);
+}
+
+void UserInterface::update_layout() {
+    ssd1306_draw_string(&disp, 0, 45, 1, "Keyboard layout");
+    ssd1306_draw_string(&disp, 0, 54, 1,
+        (settings.get_settings().key_layout == KEY_LAYOUT_ANSI) ? "ANSI: US" : "ISO: GB DE FR");
+}
+
+void UserInterface::update_perf() {
+    char buf[32];
+    EmulatorLoadStats stats;
+    ssd1306_clear(&disp);
+    ssd1306_draw_string_page(&disp, 0, 0, (engine == ENGINE_HLE) ? "HLE core load" : "6301 core load");
+    if (settings.get_settings().engine != engine) {
+        ssd1306_draw_string(&disp, 0, 9, 1,
+            (settings.get_settings().engine == ENGINE_HLE) ? (char*)"HLE at power on" : (char*)"6301 at power on");
+    }
+    if (!EmulatorLoad::instance().get(stats)) {
+        ssd1306_draw_string(&disp, 0, 18, 1, (char*)"Waiting...");
+        return;
+    }
+    sprintf(buf, "Load %3d%% %3luMHz", EmulatorLoad::utilisation(stats),
+        (unsigned long)(clock_get_hz(clk_sys) / 1000000));
+    ssd1306_draw_string(&disp, 0, 18, 1, buf);
+    sprintf(buf, "Busy avg  %4luus", (unsigned long)(stats.busy_total_us / stats.slices));
+    ssd1306_draw_string(&disp, 0, 27, 1, buf);
+    sprintf(buf, "Busy max  %4luus", (unsigned long)stats.busy_max_us);
+    ssd1306_draw_string(&disp, 0, 36, 1, buf);
+    sprintf(buf, "Slack min %4ldus", (long)stats.slack_min_us);
+    ssd1306_draw_string(&disp, 0, 45, 1, buf);
+    sprintf(buf, "Missed %lu/%luus", (unsigned long)stats.missed_total, (unsigned long)stats.overrun_worst_us);
+    ssd1306_draw_string(&disp, 0, 54, 1, buf);
+}
+
+void UserInterface::update_latency() {
+#ifdef LATENCY_TRACE
+    char buf[32];
+    ssd1306_clear(&disp);
+    ssd1306_draw_string_page(&disp, 0, 0, "USB to ST (ms)");
+    ssd1306_draw_string(&disp, 0, 18, 1, (char*)"     min avg p99");
+    for (int in = 0; in < LATENCY_INPUTS; ++in) {
+        LatencyHistogram h;
+        LatencyTrace::instance().get((LatencyInput)in, LATENCY_TO_SENT, h);
+        if (h.count) {
+            sprintf(buf, "%-5s%3lu %3lu %3lu", LatencyTrace::name((LatencyInput)in),
+                (unsigned long)(h.min_us / 1000),
+                (unsigned long)(h.total_us / h.count / 1000),
+                (unsigned long)(LatencyTrace::percentile(h, 99) / 1000));
+        }
+        else {
+            sprintf(buf, "%-5s  -   -   -", LatencyTrace::name((LatencyInput)in));
+        }
+        ssd1306_draw_string(&disp, 0, 27 + in * 9, 1, buf);
+    }
+#endif
+}
+
+void UserInterface::update_selftest() {
+    char buf[32];
+    SelfTestResult r;
+    SelfTest& test = SelfTest::instance();
+    ssd1306_clear(&disp);
+    ssd1306_draw_string_page(&disp, 0, 0, "Loopback test");
+    if (test.running()) {
+        sprintf(buf, "Running %lu/%lu", (unsigned long)test.progress(), (unsigned long)SelfTest::total());
+        ssd1306_draw_string(&disp, 0, 18, 1, buf);
+        return;
+    }
+    if (!test.get(r) || !r.commands) {
+        ssd1306_draw_string(&disp, 0, 18, 1, (char*)"No answer");
+        return;
+    }
+    sprintf(buf, "Answered %lu/%lu", (unsigned long)r.commands, (unsigned long)(r.commands + r.lost));
+    ssd1306_draw_string(&disp, 0, 9, 1, buf);
+    sprintf(buf, "Min  %5luus", (unsigned long)r.min_us);
+    ssd1306_draw_string(&disp, 0, 18, 1, buf);
+    sprintf(buf, "Avg  %5luus", (unsigned long)(r.total_us / r.commands));
+    ssd1306_draw_string(&disp, 0, 27, 1, buf);
+    sprintf(buf, "Max  %5luus", (unsigned long)r.max_us);
+    ssd1306_draw_string(&disp, 0, 36, 1, buf);
+    sprintf(buf, "%lu cmd/s", (unsigned long)((uint64_t)r.commands * 1000000 / r.elapsed_us));
+    ssd1306_draw_string(&disp, 0, 45, 1, buf);
+    sprintf(buf, "%lu bytes/s", (unsigned long)((uint64_t)r.bytes * 1000000 / r.elapsed_us));
+    ssd1306_draw_string(&disp, 0, 54, 1, buf);
+}
+
 void UserInterface::handle_buttons() {
     for (int i = 0; i < 3; ++i) {
         bool state = gpio_get(btn_gpio[i]);
@@ -149,13 +326,27 @@ void UserInterface::handle_buttons() {
             btn_count[i] = 0;
         }
     }
+    // Left and right together on the serial page, or while the display is
+    // off because there is no ST, run the loopback test
+    bool both = (btn_count[BUTTON_LEFT] >= DEBOUNCE_COUNT) && (btn_count[BUTTON_RIGHT] >= DEBOUNCE_COUNT);
+    if (both && !combo && (blank || (page == PAGE_SERIAL))) {
+        page = PAGE_SERIAL;
+        selftest_shown = true;
+        dirty = true;
+        SelfTest::instance().start();
+    }
+    combo = both;
 }
 
 void UserInterface::on_button_down(int i) {
+    if (blank) {
+        return;
+    }
     // Middle button changes page
     if (i == BUTTON_MIDDLE) {
+        selftest_shown = false;
         int pg = (int)page;
-        pg = ((pg + 1) % (PAGE_SERIAL + 1));
+        pg = ((pg + 1) % PAGE_COUNT);
         page = (PAGE)pg;
         dirty = true;
     }
@@ -172,6 +363,24 @@ void UserInterface::on_button_down(int i) {
             settings.write();
             dirty = true;
         }
+        else if (page == PAGE_CLOCK) {
+            if (settings.get_settings().turbo > 0) {
+                --settings.get_settings().turbo;
+                settings.write();
+                dirty = true;
+            }
+        }
+        else if (page == PAGE_LAYOUT) {
+            settings.get_settings().key_layout =
+                (settings.get_settings().key_layout + 1) % (KEY_LAYOUT_MAX + 1);
+            settings.write();
+            dirty = true;
+        }
+        else if (page == PAGE_PERF) {
+            settings.get_settings().engine ^= ENGINE_HLE;
+            settings.write();
+            dirty = true;
+        }
     }
     else if (i == BUTTON_RIGHT) {
         if (page == PAGE_MOUSE) {
@@ -186,14 +395,74 @@ void UserInterface::on_button_down(int i) {
             settings.write();
             dirty = true;
         }
+        else if (page == PAGE_CLOCK) {
+            if (settings.get_settings().turbo < TURBO_MAX) {
+                ++settings.get_settings().turbo;
+                settings.write();
+                dirty = true;
+            }
+        }
+        else if (page == PAGE_LAYOUT) {
+            settings.get_settings().key_layout =
+                (settings.get_settings().key_layout + 1) % (KEY_LAYOUT_MAX + 1);
+            settings.write();
+            dirty = true;
+        }
+        else if (page == PAGE_PERF) {
+            settings.get_settings().engine ^= ENGINE_HLE;
+            settings.write();
+            dirty = true;
+        }
     }
 }
 
+void UserInterface::show() {
+    ssd1306_show_async(&disp);
+    Telemetry::instance().ui_redraw((uint32_t)absolute_time_diff_us(draw_tm, get_absolute_time()));
+}
+
+void UserInterface::set_blank(bool en) {
+    if (!display_up) {
+        // Applied when the display is initialised
+        blank = en;
+        return;
+    }
+    while (ssd1306_busy(&disp)) {
+        tight_loop_contents();
+    }
+    if (en) {
+        ssd1306_poweroff(&disp);
+    }
+    else {
+        ssd1306_poweron(&disp);
+        dirty = true;
+    }
+    blank = en;
+}
+
 void UserInterface::update() {
+    if (!display_up) {
+        init_display();
+    }
+    if (blank) {
+        // Only the loopback test can be started
+        handle_buttons();
+        settings.update();
+        return;
+    }
     handle_buttons();
+    settings.update();
 
-    if (dirty) {
+    // The serial page is redrawn when the trace has new bytes
+    if ((page == PAGE_SERIAL) && (SerialTrace::instance().count() != serial_count)) {
+        dirty = true;
+    }
+
+    // The display is flushed by DMA, wait for the last flush to finish
+    // before drawing the next one
+    if (dirty && !ssd1306_busy(&disp)) {
         dirty = false;
+        draw_tm = get_absolute_time();
 
         if (page == PAGE_MOUSE) {
             update_status();
@@ -207,10 +476,28 @@ void UserInterface::update() {
             update_status();
             update_joy(1);
         }
+        else if (page == PAGE_CLOCK) {
+            update_status();
+            update_clock();
+        }
+        else if (page == PAGE_LAYOUT) {
+            update_status();
+            update_layout();
+        }
+        else if ((page == PAGE_SERIAL) && selftest_shown) {
+            absolute_time_t tm = get_absolute_time();
+            if (absolute_time_diff_us(perf_tm, tm) >= (500 * 1000)) {
+                perf_tm = tm;
+                update_selftest();
+                show();
+            }
+            dirty = true;
+        }
         else if (page == PAGE_SERIAL) {
             absolute_time_t tm = get_absolute_time();
             if (absolute_time_diff_us(serial_tm, tm) >= (500 * 1000)) {
                 serial_tm = tm;
+                serial_count = SerialTrace::instance().count();
                 update_serial();
             }
             else {
@@ -218,21 +505,38 @@ void UserInterface::update() {
                 dirty = true;
             }
         }
+        else if (page == PAGE_PROTOCOL) {
+            absolute_time_t tm = get_absolute_time();
+            if (absolute_time_diff_us(perf_tm, tm) >= (500 * 1000)) {
+                perf_tm = tm;
+                update_protocol();
+                show();
+            }
+            dirty = true;
+        }
+        else if (page == PAGE_PERF) {
+            absolute_time_t tm = get_absolute_time();
+            if (absolute_time_diff_us(perf_tm, tm) >= (500 * 1000)) {
+                perf_tm = tm;
+                update_perf();
+                show();
+            }
+            // Keep refreshing while the page is shown
+            dirty = true;
+        }
+#ifdef LATENCY_TRACE
+        else if (page == PAGE_LATENCY) {
+            absolute_time_t tm = get_absolute_time();
+            if (absolute_time_diff_us(perf_tm, tm) >= (500 * 1000)) {
+                perf_tm = tm;
+                update_latency();
+                show();
+            }
+            dirty = true;
+        }
+#endif
         if (!dirty) {
-            ssd1306_show(&disp);
+            show();
         }
     }
 }
-
-void UserInterface::serial(bool send, uint8_t data) {
-    char buf[32];
-    sprintf(buf, "%s%02X", send ? "              " : "", data);
-
-    serial_lines.push_back(std::string(buf));
-    while (serial_lines.size() > 7) {
-        serial_lines.pop_front();
-    }
-    if (page == PAGE_SERIAL) {
-        dirty = true;
-    }
-}
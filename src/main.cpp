@@ -31,24 +31,129 @@
 #include "SerialPort.h"
 #include "AtariSTMouse.h"
 #include "UserInterface.h"
+#include "EmulatorLoad.h"
+#include "CoreLink.h"
+#include "Scheduler.h"
+#include "ReadySnapshot.h"
+#include "CoreAlarm.h"
+#include "IkbdHle.h"
+#include "NVSettings.h"
+#include "Telemetry.h"
+#include "PowerMonitor.h"
+#include "SelfTest.h"
+#include "ClockGovernor.h"
+#include "IkbdAnalyser.h"
+#include "Core1Watchdog.h"
+#include "config.h"
+#ifdef LATENCY_TRACE
+#include "LatencyTrace.h"
+#endif
 
 #define ROMBASE     256
-#define CYCLES_PER_LOOP 1000
+
+// Core1 emulation slices in microseconds (and 6301 cycles). The long slice
+// matches LINK_INPUT_DELAY_CYCLES so input lands in the next slice.
+#define SLICE_LONG_US       1000
+#define SLICE_SHORT_US      250
+// Emulated time more than this far behind is given up rather than caught up
+#define SLICE_MAX_DEBT_US   20000
+// Core1 polls the high level engine this often
+#define HLE_PERIOD_US       250
+
+// Core0 task periods in microseconds
+#define JOYSTICK_PERIOD_US  1000
+#define UI_PERIOD_US        10000
+#define LOAD_PERIOD_US      10000000
+#define SNAPSHOT_PERIOD_US  100000
+#define TELEMETRY_PERIOD_US 1000000
+#define POWER_PERIOD_US     1000
+#define SELFTEST_PERIOD_US  1000
+#define GOVERNOR_PERIOD_US  1000
+#define ANALYSER_PERIOD_US  2000
+#define WATCHDOG_PERIOD_US  1000
+#define TURBO_PERIOD_US     100000
 
 extern unsigned char rom_HD6301V1ST_img[];
 extern unsigned int rom_HD6301V1ST_img_len;
 
+// ENGINE_LLE or ENGINE_HLE, from the settings at power on
+static uint8_t engine = ENGINE_LLE;
+// The 6301 runs 1 << turbo cycles per microsecond, from the settings
+static uint8_t turbo = 0;
+// Set by core0 when core1 can't keep up with turbo, core1 drops back to
+// 1MHz at the start of the next slice and clears it
+static volatile bool turbo_drop = false;
+
+#if defined(HD6301_SESSION) && HD6301_SESSION
+// Set by core0 when 'r' is typed on the console, core1 prints the session
+// recording at the end of the slice and carries on recording
+static volatile bool session_dump = false;
+#endif
+
+#ifdef LOW_POWER_SLEEP
+static CoreAlarm core1_alarm;
+#endif
+
+static void core1_sleep_until(absolute_time_t t) {
+#ifdef LOW_POWER_SLEEP
+    core1_alarm.sleep_until(t);
+#else
+    sleep_until(t);
+#endif
+}
+
 /**
- * Read a byte from the physical serial port and pass
- * it to the HD6301
+ * Core1 waits here while the ST is off and returns once it is back on
  */
-static void handle_rx_from_st() {
-    if (!hd6301_sci_busy()) {
-        unsigned char data;
-        if (SerialPort::instance().recv(data)) {
-            //printf("ST -> 6301 %X\n", data);
-            hd6301_receive_byte(data);
+static bool core1_park() {
+#ifdef ST_POWER_DETECT
+    if (!PowerMonitor::instance().dormant()) {
+        return false;
+    }
+    while (PowerMonitor::instance().dormant()) {
+        Core1Watchdog::instance().beat();
+        core1_sleep_until(delayed_by_us(get_absolute_time(), POWER_PERIOD_US));
+    }
+    CoreLink::instance().discard_rx();
+    return true;
+#else
+    return false;
+#endif
+}
+
+/**
+ * Core0: drop the 6301 back to 1MHz if core1 has had to give up emulated
+ * time in TURBO_FALLBACK_WINDOWS load windows in a row. The 6301 would
+ * otherwise run slower than the serial line and bytes from the ST would
+ * back up and be lost.
+ */
+static void turbo_check(UserInterface& ui) {
+    static uint32_t window_seen = 0;
+    static uint64_t dropped_seen = 0;
+    static int behind = 0;
+    static int from = 0;
+
+    if (from) {
+        // Core1 is at 1MHz, the UART follows
+        if (!turbo_drop) {
+            SerialPort::instance().set_turbo(0);
+            ui.turbo_fallback();
+            printf("core1: can't keep up at %dMHz, back to 1MHz\n", 1 << from);
+            from = 0;
         }
+        return;
+    }
+    EmulatorLoad& load = EmulatorLoad::instance();
+    EmulatorLoadStats stats;
+    if (!turbo || (load.windows() == window_seen) || !load.get(stats)) {
+        return;
+    }
+    window_seen = load.windows();
+    behind = (stats.dropped_total_us != dropped_seen) ? behind + 1 : 0;
+    dropped_seen = stats.dropped_total_us;
+    if (behind >= TURBO_FALLBACK_WINDOWS) {
+        from = turbo;
+        turbo_drop = true;
     }
 }
 
@@ -64,65 +169,282 @@ void setup_hd6301() {
     memcpy(pram + ROMBASE, rom_HD6301V1ST_img, rom_HD6301V1ST_img_len);
 }
 
+/**
+ * Core1 loop for the high level engine. There is no emulation to keep in
+ * step, each pass hands over what core0 has queued and sends what is due.
+ */
+void core1_hle() {
+    static IkbdHle hle;
+    CoreLink& link = CoreLink::instance();
+    SerialPort& serial = SerialPort::instance();
+    link.set_hle(&hle);
+
+    absolute_time_t deadline = get_absolute_time();
+    hle.reset((int64_t)to_us_since_boot(deadline));
+    while (true) {
+        if (core1_park()) {
+            deadline = get_absolute_time();
+            hle.reset((int64_t)to_us_since_boot(deadline));
+        }
+        absolute_time_t start = get_absolute_time();
+        int64_t now = (int64_t)to_us_since_boot(start);
+        if (absolute_time_diff_us(deadline, start) > SLICE_MAX_DEBT_US) {
+            deadline = start;
+        }
+        deadline = delayed_by_us(deadline, HLE_PERIOD_US);
+
+        link.sync_clock((uint32_t)now, now);
+        link.poll(now);
+        hle.update(now);
+        uint8_t data;
+        while (!serial.send_buf_full() && hle.get_tx(data, now)) {
+            serial.send(data);
+            Telemetry::instance().boot(TELEMETRY_BOOT_READY);
+        }
+        absolute_time_t end = get_absolute_time();
+
+        EmulatorLoad::instance().record(absolute_time_diff_us(start, end),
+            absolute_time_diff_us(end, deadline), HLE_PERIOD_US);
+        Core1Watchdog::instance().beat();
+        core1_sleep_until(deadline);
+    }
+}
+
 void core1_entry() {
-    // Initialise the HD6301
-    setup_hd6301();
-    hd6301_reset(1);
+    Telemetry::instance().boot(TELEMETRY_BOOT_CORE1);
+#if !PICO_COPY_TO_RAM
+    // Let core0 pause this core while it writes the settings to flash
+    multicore_lockout_victim_init();
+#endif
+#ifdef LOW_POWER_SLEEP
+    // Claimed here so the alarm interrupt is taken on core1
+    core1_alarm.init();
+#endif
+    if (engine == ENGINE_HLE) {
+        core1_hle();
+    }
+
+    if (Core1Watchdog::instance().restarted()) {
+        // Launched again after a stall, the ROM is copied in again in case
+        // it was overwritten and the 6301 carries on from a snapshot. Bytes
+        // the old core1 was part way through are dropped.
+        hd6301_destroy();
+        setup_hd6301();
+        ReadySnapshot::instance().failover(Core1Watchdog::instance().good_first());
+        CoreLink::instance().discard_rx();
+    }
+    else {
+        // Initialise the HD6301, from the ready snapshot if there is one
+        setup_hd6301();
+        ReadySnapshot::instance().boot();
+    }
+#if defined(HD6301_SESSION) && HD6301_SESSION
+    hd6301_session_start();
+#endif
 
-    unsigned long count = 0;
-    absolute_time_t tm = get_absolute_time();
+    // Emulated time is tied to the time since boot, one cycle per
+    // microsecond (or 1 << turbo): cycle = (us << turbo) + offset. A slice
+    // that overruns leaves a debt that the following slices catch up on, so
+    // over the long term the 6301 runs at exactly 1MHz (or 2, 4 or 8MHz).
+    // The SCI and timer count 6301 cycles, so they scale with the UART.
+    CoreLink::instance().set_turbo(turbo);
+    absolute_time_t deadline = get_absolute_time();
+    COUNTER_VAR offset = cpu.ncycles - ((COUNTER_VAR)to_us_since_boot(deadline) << turbo);
     while (true) {
-        count += CYCLES_PER_LOOP;
-        // Update the tx serial port status based on our serial port handler
-        hd6301_tx_empty(1);
+        if (core1_park()) {
+            // The ST has been switched back on, the keyboard starts again as
+            // if it had been powered up with it
+            ReadySnapshot::instance().boot();
+            deadline = get_absolute_time();
+            offset = cpu.ncycles - ((COUNTER_VAR)to_us_since_boot(deadline) << turbo);
+        }
+        if (turbo_drop) {
+            // Core1 couldn't keep up, carry on at 1MHz from here
+            turbo = 0;
+            CoreLink::instance().set_turbo(0);
+            deadline = get_absolute_time();
+            offset = cpu.ncycles - (COUNTER_VAR)to_us_since_boot(deadline);
+            turbo_drop = false;
+        }
+        // TDRE follows the serial byte timing, held off if our TX queue is full
+        hd6301_tx_empty(!SerialPort::instance().send_buf_full());
 
-        hd6301_run_clocks(CYCLES_PER_LOOP);
+        absolute_time_t start = get_absolute_time();
+        if (absolute_time_diff_us(deadline, start) > SLICE_MAX_DEBT_US) {
+            deadline = start;
+        }
+        // Short slices while bytes are moving on the serial line so the next
+        // one from the ST is picked up sooner, long ones otherwise
+        uint32_t slice = (CoreLink::instance().rx_pending() || hd6301_sci_busy() || hd6301_tx_busy()) ?
+            SLICE_SHORT_US : SLICE_LONG_US;
+        deadline = delayed_by_us(deadline, slice);
+        COUNTER_VAR slice_end = ((COUNTER_VAR)to_us_since_boot(deadline) << turbo) + offset;
+        COUNTER_VAR debt = slice_end - cpu.ncycles - ((COUNTER_VAR)slice << turbo);
+        if (debt > ((COUNTER_VAR)SLICE_MAX_DEBT_US << turbo)) {
+            // Too far behind to catch up (or the 6301 was reset), give that
+            // time up
+            offset -= debt;
+            slice_end -= debt;
+            EmulatorLoad::instance().dropped((uint32_t)(debt >> turbo));
+        }
 
-        if ((count % 1000000) == 0) {
-            //printf("Cycles = %lu\n", count);
-            //printf("CPU cycles = %llu\n", cpu.ncycles);
+        // The slice is split where the next byte from the ST is due so it
+        // reaches the SCI at the serial byte rate
+        CoreLink::instance().sync_clock((uint32_t)((cpu.ncycles - offset) >> turbo), cpu.ncycles);
+        do {
+            COUNTER_VAR run = slice_end - cpu.ncycles;
+            COUNTER_VAR next = CoreLink::instance().poll(cpu.ncycles);
+            hd6301_run_clocks((next && next < run) ? next : run);
+        } while (!crashed && (cpu.ncycles < slice_end));
+        // Picks up the ready point after a cold reset and recovers a crash
+        ReadySnapshot::instance().slice_end();
+        if (hd6301_sci_count(1)) {
+            Telemetry::instance().boot(TELEMETRY_BOOT_READY);
+        }
+#if defined(HD6301_SESSION) && HD6301_SESSION
+        if (session_dump) {
+            // The 6301 stands still while this is printed, the slice debt
+            // is given up afterwards
+            Core1Watchdog::instance().hold(true);
+            hd6301_session_stop();
+            hd6301_session_dump(stdout);
+            hd6301_session_start();
+            session_dump = false;
+            Core1Watchdog::instance().hold(false);
         }
+#endif
+        absolute_time_t end = get_absolute_time();
 
-        tm = delayed_by_us(tm, CYCLES_PER_LOOP);
-        sleep_until(tm);
+        EmulatorLoad::instance().record(absolute_time_diff_us(start, end),
+            absolute_time_diff_us(end, deadline), slice);
+        Core1Watchdog::instance().beat();
+        core1_sleep_until(deadline);
     }
 }
 
 int main() {
-    //stdio_init_all();
+    // The ST may send its reset command as soon as it is powered up, so the
+    // UART and core1 come first. Only the console and the settings are
+    // needed before that, the settings are read when ui is constructed. The
+    // display is initialised by the first UI update and USB devices
+    // enumerate while core1 runs.
     board_init();
-    tusb_init();
-
-    UserInterface ui;
+    static UserInterface ui;
     ui.init();
-    ui.update();
+
+    // Create the queues between the cores and the mouse, whose alarms run
+    // on core0, before the UART or core1 can use them
+    CoreLink::instance();
+    AtariSTMouse::instance();
 
     // Setup the UART and HID instance.
-    SerialPort::instance().open();
-    SerialPort::instance().set_ui(ui);
-    HidInput::instance().reset();
+    turbo = ui.get_turbo();
+    SerialPort::instance().open(turbo);
     HidInput::instance().set_ui(ui);
+    PowerMonitor::instance().set_ui(ui);
+    ClockGovernor::instance().set_ui(ui);
+    Telemetry::instance().boot(TELEMETRY_BOOT_SERIAL);
 
-    // The second CPU core is dedicated to the HD6301 emulation.
-    multicore_launch_core1(core1_entry);
-
-    absolute_time_t ten_ms = get_absolute_time();
-    while (true) {
-        absolute_time_t tm = get_absolute_time();
+    engine = ui.get_engine();
+    if (engine == ENGINE_LLE) {
+        ReadySnapshot::instance().load();
+    }
 
-        AtariSTMouse::instance().update();
+    // The second CPU core is dedicated to the HD6301 emulation. Its stack
+    // is the SDK's, the top 2KB of SCRATCH_X, beside the 6301 state placed
+    // there with HD6301_FAST_DATA so core1 keeps that bank to itself.
+#ifdef CORE1_WATCHDOG
+    Core1Watchdog::instance().start(core1_entry);
+#else
+    multicore_launch_core1(core1_entry);
+#endif
 
-        // 10ms handler
-        if (absolute_time_diff_us(ten_ms, tm) >= 10000) {
-            ten_ms = tm;
+    tusb_init();
+    HidInput::instance().reset();
+    Telemetry::instance().boot(TELEMETRY_BOOT_USB);
 
+    // USB is serviced on every pass and a mouse or keyboard report is
+    // handled as soon as it arrives. The joystick ports are polled and the
+    // UI and load report run at their own slower rates.
+    Scheduler scheduler;
+#ifdef LOW_POWER_SLEEP
+    scheduler.set_sleep(true);
+#endif
+    // USB and the joysticks are left alone while the ST is off
+    scheduler.add([]() {
+        if (!PowerMonitor::instance().dormant()) {
             tuh_task();
-            HidInput::instance().handle_keyboard();
-            handle_rx_from_st();
-            HidInput::instance().handle_mouse(cpu.ncycles);
+            HidInput::instance().poll(cpu.ncycles);
+        }
+    }, 0);
+    scheduler.add([]() {
+        if (!PowerMonitor::instance().dormant()) {
             HidInput::instance().handle_joystick();
-            ui.update();
         }
-    }
+    }, JOYSTICK_PERIOD_US);
+    scheduler.add([]() { ui.update(); }, UI_PERIOD_US);
+    scheduler.add([]() { ReadySnapshot::instance().update(); }, SNAPSHOT_PERIOD_US);
+    scheduler.add([]() { IkbdAnalyser::instance().update(); }, ANALYSER_PERIOD_US);
+    scheduler.add([]() { SelfTest::instance().update(); }, SELFTEST_PERIOD_US);
+#ifdef ST_POWER_DETECT
+    scheduler.add([]() { PowerMonitor::instance().update(); }, POWER_PERIOD_US);
+#endif
+#ifdef CORE1_WATCHDOG
+    scheduler.add([]() { Core1Watchdog::instance().update(); }, WATCHDOG_PERIOD_US);
+#endif
+#ifdef CLOCK_GOVERNOR
+    scheduler.add([]() { ClockGovernor::instance().update(); }, GOVERNOR_PERIOD_US);
+#endif
+    scheduler.add([]() { turbo_check(ui); }, TURBO_PERIOD_US);
+    // Console commands: t prints the counters now, r the session recording
+    scheduler.add([]() {
+        int c = getchar_timeout_us(0);
+        if (c == 't') {
+            Telemetry::instance().dump_boot();
+            Telemetry::header();
+            Telemetry::instance().dump();
+        }
+#if defined(HD6301_SESSION) && HD6301_SESSION
+        else if (c == 'r') {
+            session_dump = true;
+        }
+#endif
+    }, UI_PERIOD_US);
+#ifdef TELEMETRY_STREAM
+    scheduler.add([]() {
+        static bool started = false;
+        if (!started) {
+            started = true;
+            Telemetry::header();
+        }
+        Telemetry::instance().dump();
+    }, TELEMETRY_PERIOD_US);
+#endif
+    // The boot times are printed once everything is up
+    scheduler.add([]() {
+        static bool printed = false;
+        if (!printed && Telemetry::instance().booted()) {
+            printed = true;
+            Telemetry::instance().dump_boot();
+        }
+    }, UI_PERIOD_US);
+    scheduler.add([]() {
+        EmulatorLoad::instance().dump();
+#ifdef CLOCK_GOVERNOR
+        ClockGovernor::instance().dump();
+#endif
+        if (ReadySnapshot::instance().recoveries()) {
+            printf("core1: recovered from %lu crashes\n", (unsigned long)ReadySnapshot::instance().recoveries());
+        }
+#ifdef LATENCY_TRACE
+        LatencyTrace::instance().dump();
+#endif
+#if defined(HD6301_PROFILE) && HD6301_PROFILE
+        // Look the addresses up in rom/HD6301V1ST.sym
+        hd6301_profile_dump(10);
+        hd6301_profile_clear();
+#endif
+    }, LOAD_PERIOD_US);
+    scheduler.run();
     return 0;
 }
@@ -18,5 +18,12 @@
 */
 #pragma once
 
+#include <stdint.h>
+
 extern char st_key_lookup_gb[];
-extern char st_key_lookup_hid_gb[];
+
+/**
+ * ST scancode for each USB HID usage from 0 to 127, indexed by
+ * Settings::key_layout
+ */
+extern const uint8_t* const st_key_lookup_hid[];
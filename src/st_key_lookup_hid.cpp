@@ -16,7 +16,48 @@
  * along with this program; if not, write to the Free Software
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 */
-char st_key_lookup_hid_gb[] = {
+#include "st_key_lookup.h"
+#include "NVSettings.h"
+#include <stddef.h>
+
+/**
+ * ST scancode for each USB HID keyboard usage, 0 if the key has no ST key
+ */
+struct StKeyMap {
+    uint8_t code[128];
+};
+
+/**
+ * A usage that another layout maps differently
+ */
+struct StKeyChange {
+    uint8_t usage;
+    uint8_t code;
+};
+
+template <size_t N>
+static constexpr StKeyMap with_changes(StKeyMap map, const StKeyChange (&changes)[N]) {
+    for (size_t i = 0; i < N; ++i) {
+        map.code[changes[i].usage] = changes[i].code;
+    }
+    return map;
+}
+
+static constexpr bool valid_codes(const StKeyMap& map) {
+    for (int i = 0; i < 128; ++i) {
+        if (map.code[i] >= 128) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// USB usages are the position of a key rather than its legend and so are ST
+// scancodes, the characters come from the country of TOS. So one table does
+// for every ISO keyboard, GB, DE, FR and the rest, with the TOS of the same
+// country. Only a few keys are laid out differently on ANSI
+// keyboards, the ones beside Return and Backspace.
+static constexpr StKeyMap hid_iso = {{
     0, // 0x00  No key pressed
     0, // 0x01  Keyboard Error Roll Over - used for all slots if too many keys are pressed ("Phantom key")
     0, // 0x02  Not used
@@ -145,4 +186,20 @@ char st_key_lookup_hid_gb[] = {
     0, // 0x7d
     0, // 0x7e
     0, // 0x7f
-};
\ No newline at end of file
+}};
+
+// A US keyboard with US TOS, where the key beside Backspace is ` and ~ and
+// the one beside Return is \ and |
+static constexpr StKeyChange ansi_changes[] = {
+    { 0x31, 43 },   // Keyboard \ and |
+    { 0x32, 43 },   // Keyboard Non-US # and ~, the same key on ANSI keyboards
+    { 0x35, 41 },   // Keyboard ` and ~
+};
+static constexpr StKeyMap hid_ansi = with_changes(hid_iso, ansi_changes);
+
+static_assert(valid_codes(hid_iso) && valid_codes(hid_ansi), "ST scancodes are 0-127");
+
+const uint8_t* const st_key_lookup_hid[KEY_LAYOUT_MAX + 1] = {
+    hid_iso.code,
+    hid_ansi.code,
+};
@@ -25,6 +25,8 @@ SOFTWARE.
 
 #include <pico/stdlib.h>
 #include <hardware/i2c.h>
+#include <hardware/dma.h>
+#include <hardware/irq.h>
 #include <pico/binary_info.h>
 #include <stdlib.h>
 #include <string.h>
@@ -33,7 +35,14 @@ SOFTWARE.
 #include "ssd1306.h"
 #include "font.h"
 
+/* display with a dma flush in progress, there is only one */
+static ssd1306_t *dma_display;
+
 inline static void fancy_write(i2c_inst_t *i2c, uint8_t addr, const uint8_t *src, size_t len, char *name) {
+    // blocking writes share the controller with a dma flush
+    if(dma_display)
+        while(ssd1306_busy(dma_display))
+            tight_loop_contents();
     switch(i2c_write_blocking(i2c, addr, src, len, false)) {
     case PICO_ERROR_GENERIC:
         printf("[%s] addr not acknowledged!\n", name);
@@ -52,7 +61,17 @@ inline static void ssd1306_write(ssd1306_t *p, uint8_t val) {
     fancy_write(p->i2c_i, p->address, d, 2, "ssd1306_write");
 }
 
+// the buffers are static so the display never uses the heap
+#define SSD1306_MAX_PAGES   (SSD1306_MAX_HEIGHT/8)
+#define SSD1306_MAX_BUFSIZE (SSD1306_MAX_PAGES*SSD1306_MAX_WIDTH)
+static uint8_t display_buffer[SSD1306_MAX_BUFSIZE+1];
+static uint8_t display_shown[SSD1306_MAX_BUFSIZE];
+static uint16_t display_cmds[SSD1306_MAX_PAGES*(7+1+SSD1306_MAX_WIDTH)];
+
 bool ssd1306_init(ssd1306_t *p, uint16_t width, uint16_t height, uint8_t address, i2c_inst_t *i2c_instance) {
+    if(width>SSD1306_MAX_WIDTH || height>SSD1306_MAX_HEIGHT)
+        return false;
+
     p->width=width;
     p->height=height;
     p->pages=height/8;
@@ -62,12 +81,18 @@ bool ssd1306_init(ssd1306_t *p, uint16_t width, uint16_t height, uint8_t address
 
 
     p->bufsize=(p->pages)*(p->width);
-    if((p->buffer=malloc(p->bufsize+1))==NULL) {
-        p->bufsize=0;
-        return false;
-    }
-
-    ++(p->buffer);
+    p->buffer=display_buffer+1;
+
+    // worst case every page is sent on its own: 7 addressing words, the
+    // 0x40 control byte and one row of columns
+    p->ncmds=(p->pages)*(7+1+p->width);
+    p->cmds=display_cmds;
+    p->shown=display_shown;
+    p->refresh=true;
+    p->dma_chan=dma_claim_unused_channel(true);
+    p->dma_busy=false;
+    p->done=NULL;
+    p->done_ctx=NULL;
 
 	// from https://github.com/makerportal/rpi-pico-ssd1306
     int8_t cmds[]= {
@@ -110,7 +135,9 @@ bool ssd1306_init(ssd1306_t *p, uint16_t width, uint16_t height, uint8_t address
 }
 
 inline void ssd1306_deinit(ssd1306_t *p) {
-    free(p->buffer-1);
+    while(ssd1306_busy(p))
+        tight_loop_contents();
+    dma_channel_unclaim(p->dma_chan);
 }
 
 inline void ssd1306_poweroff(ssd1306_t *p) {
@@ -172,10 +199,42 @@ void ssd13606_draw_empty_square(ssd1306_t *p, uint32_t x, uint32_t y, uint32_t w
 	ssd1306_draw_line(p, x+width, y, x+width, y+height);
 }
 
+/*
+ * Unscaled glyphs up to 8 pixels high. The fonts are column major with bit 0
+ * at the top, the same as a framebuffer page, so each glyph column is ORed
+ * into the page it starts in and, shifted, into the one below.
+ */
+static void ssd1306_blit_char(ssd1306_t *p, uint32_t x, uint32_t y, const uint8_t *font, char c) {
+    const uint8_t *col=&font[(c-0x20)*font[1]+2];
+    uint8_t mask=(font[0]<8) ? (1<<font[0])-1 : 0xff;
+    uint32_t shift=y&7;
+    uint32_t w=font[1];
+    uint8_t *top, *bottom;
+
+    if(x>=p->width || y>=p->height)
+        return;
+    if(w>p->width-x)
+        w=p->width-x;
+    top=p->buffer+x+p->width*(y>>3);
+    bottom=(shift && (y>>3)+1<p->pages) ? top+p->width : NULL;
+
+    for(uint32_t i=0; i<w; ++i) {
+        uint8_t line=col[i]&mask;
+        top[i]|=line<<shift;
+        if(bottom)
+            bottom[i]|=line>>(8-shift);
+    }
+}
+
 void ssd1306_draw_char_with_font(ssd1306_t *p, uint32_t x, uint32_t y, uint32_t scale, const uint8_t *font, char c) {
-    if(c > '~')
+    if(c < ' ' || c > '~')
         return;
 
+    if(scale==1 && font[0]<=8) {
+        ssd1306_blit_char(p, x, y, font, c);
+        return;
+    }
+
     for(uint8_t i=0; i<font[1]; ++i) {
         uint8_t line=(uint8_t)(font[(c-0x20)*font[1]+i+2]);
 
@@ -187,7 +246,7 @@ void ssd1306_draw_char_with_font(ssd1306_t *p, uint32_t x, uint32_t y, uint32_t
 }
 
 void ssd1306_draw_string_with_font(ssd1306_t *p, uint32_t x, uint32_t y, uint32_t scale, const uint8_t *font, const char *s) {
-    for(int32_t x_n=x; *s; x_n+=font[0]*scale) {
+    for(uint32_t x_n=x; *s && x_n<p->width; x_n+=font[0]*scale) {
         ssd1306_draw_char_with_font(p, x_n, y, scale, font, *(s++));
     }
 }
@@ -200,6 +259,20 @@ void ssd1306_draw_string(ssd1306_t *p, uint32_t x, uint32_t y, uint32_t scale, c
     ssd1306_draw_string_with_font(p, x, y, scale, font_8x5, s);
 }
 
+void ssd1306_draw_string_page(ssd1306_t *p, uint32_t x, uint32_t page, const char *s) {
+    const uint8_t *font=font_8x5;
+
+    if(page>=p->pages)
+        return;
+    for(uint8_t *dst=p->buffer+p->width*page; *s && x<p->width; x+=font[0], ++s) {
+        if(*s < ' ' || *s > '~')
+            continue;
+        const uint8_t *col=&font[(*s-0x20)*font[1]+2];
+        for(uint32_t i=0; i<font[1] && x+i<p->width; ++i)
+            dst[x+i]|=col[i];
+    }
+}
+
 void ssd1306_show(ssd1306_t *p) {
     uint8_t payload[]= {SET_COL_ADDR, 0, p->width-1, SET_PAGE_ADDR, 0, p->pages-1};
     if(p->width==64) {
@@ -213,4 +286,95 @@ void ssd1306_show(ssd1306_t *p) {
     *(p->buffer-1)=0x40;
 
     fancy_write(p->i2c_i, p->address, p->buffer-1, p->bufsize+1, "ssd1306_show");
+    if(p->ncmds) {
+        memcpy(p->shown, p->buffer, p->bufsize);
+        p->refresh=false;
+    }
+}
+
+static void ssd1306_dma_irq(void) {
+    ssd1306_t *p=dma_display;
+    if(p && dma_channel_get_irq0_status(p->dma_chan)) {
+        dma_channel_acknowledge_irq0(p->dma_chan);
+        p->dma_busy=false;
+        if(p->done)
+            p->done(p->done_ctx);
+    }
+}
+
+void ssd1306_set_done_callback(ssd1306_t *p, void (*done)(void *), void *ctx) {
+    p->done=done;
+    p->done_ctx=ctx;
+}
+
+bool ssd1306_busy(ssd1306_t *p) {
+    i2c_hw_t *hw=i2c_get_hw(p->i2c_i);
+    // the last few words are still in the fifo when the dma finishes
+    return p->dma_busy || !(hw->status&I2C_IC_STATUS_TFE_BITS) || (hw->status&I2C_IC_STATUS_ACTIVITY_BITS);
+}
+
+bool ssd1306_show_async(ssd1306_t *p) {
+    static bool irq_ready=false;
+    i2c_hw_t *hw=i2c_get_hw(p->i2c_i);
+    uint8_t offset=(p->width==64) ? 32 : 0;
+    uint16_t *cmd=p->cmds;
+
+    if(!p->ncmds || ssd1306_busy(p))
+        return false;
+
+    // each page with changes is sent as two transactions, each ending with
+    // a stop: the addressing commands after a 0x00 control byte and the
+    // changed columns after 0x40
+    for(uint8_t page=0; page<p->pages; ++page) {
+        uint8_t *row=p->buffer+page*p->width;
+        uint8_t *old=p->shown+page*p->width;
+        int first=0, last=p->width-1;
+        if(!p->refresh) {
+            while(first<p->width && row[first]==old[first])
+                ++first;
+            if(first==p->width)
+                continue;
+            while(row[last]==old[last])
+                --last;
+        }
+        memcpy(old+first, row+first, last-first+1);
+
+        *cmd++=0x00;
+        *cmd++=SET_COL_ADDR;
+        *cmd++=first+offset;
+        *cmd++=last+offset;
+        *cmd++=SET_PAGE_ADDR;
+        *cmd++=page;
+        *cmd++=page|I2C_IC_DATA_CMD_STOP_BITS;
+        *cmd++=0x40;
+        for(int i=first; i<=last; ++i)
+            *cmd++=row[i];
+        cmd[-1]|=I2C_IC_DATA_CMD_STOP_BITS;
+    }
+    p->refresh=false;
+    if(cmd==p->cmds)
+        return true; // nothing has changed
+
+    if(!irq_ready) {
+        irq_add_shared_handler(DMA_IRQ_0, ssd1306_dma_irq, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+        irq_set_enabled(DMA_IRQ_0, true);
+        irq_ready=true;
+    }
+    dma_display=p;
+    dma_channel_set_irq0_enabled(p->dma_chan, true);
+
+    // same target setup as i2c_write_blocking, and clear any earlier abort
+    hw->enable=0;
+    hw->tar=p->address;
+    hw->enable=1;
+    (void)hw->clr_tx_abrt;
+
+    dma_channel_config c=dma_channel_get_default_config(p->dma_chan);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_16);
+    channel_config_set_read_increment(&c, true);
+    channel_config_set_write_increment(&c, false);
+    channel_config_set_dreq(&c, i2c_hw_index(p->i2c_i)==0 ? DREQ_I2C0_TX : DREQ_I2C1_TX);
+    p->dma_busy=true;
+    dma_channel_configure(p->dma_chan, &c, &hw->data_cmd, p->cmds, cmd-p->cmds, true);
+    return true;
 }
@@ -37,6 +37,10 @@ SOFTWARE.
 extern "C" {
 #endif
 
+// Largest display the static buffers are sized for, there is room for one
+#define SSD1306_MAX_WIDTH   128
+#define SSD1306_MAX_HEIGHT  64
+
 /**
 *	@brief defines commands used in ssd1306
 */
@@ -72,6 +76,14 @@ typedef struct {
     bool external_vcc; 	/**< whether display uses external vcc */ 
     uint8_t *buffer;	/**< display buffer */
     size_t bufsize;		/**< buffer size */
+    uint8_t *shown;		/**< copy of what the display is showing */
+    bool refresh;		/**< display contents unknown, send everything */
+    int dma_chan;		/**< dma channel used by ssd1306_show_async */
+    uint16_t *cmds;		/**< i2c data_cmd words sent by dma */
+    size_t ncmds;		/**< number of words in cmds */
+    volatile bool dma_busy;	/**< dma transfer in progress */
+    void (*done)(void *);	/**< called from the dma interrupt when a flush has been queued */
+    void *done_ctx;		/**< argument for done */
 } ssd1306_t;
 
 /**
@@ -85,7 +97,7 @@ typedef struct {
 *	
 * 	@return bool.
 *	@retval true for Success
-*	@retval false if initialization failed
+*	@retval false if the display is larger than SSD1306_MAX_WIDTH x SSD1306_MAX_HEIGHT
 */
 bool ssd1306_init(ssd1306_t *p, uint16_t width, uint16_t height, uint8_t address, i2c_inst_t *i2c_instance);
 
@@ -131,6 +143,34 @@ void ssd1306_invert(ssd1306_t *p, uint8_t inv);
 */
 void ssd1306_show(ssd1306_t *p);
 
+/**
+	@brief start sending the buffer to the display with dma and return at once
+
+	The buffer is copied before the transfer starts so drawing can carry on
+	straight away. Only the columns of each page that differ from what was
+	last sent are transmitted. Returns false, doing nothing, if the previous
+	flush is still in progress.
+
+	@param[in] p : instance of display
+*/
+bool ssd1306_show_async(ssd1306_t *p);
+
+/**
+	@brief check if a flush started with ssd1306_show_async is still being sent
+
+	@param[in] p : instance of display
+*/
+bool ssd1306_busy(ssd1306_t *p);
+
+/**
+	@brief set a function called from the dma interrupt once a flush has been handed to the i2c controller
+
+	@param[in] p : instance of display
+	@param[in] done : callback, can be NULL
+	@param[in] ctx : argument passed to done
+*/
+void ssd1306_set_done_callback(ssd1306_t *p, void (*done)(void *), void *ctx);
+
 /**
 	@brief clear display buffer
 
@@ -227,6 +267,16 @@ void ssd1306_draw_string_with_font(ssd1306_t *p, uint32_t x, uint32_t y, uint32_
 */
 void ssd1306_draw_string(ssd1306_t *p, uint32_t x, uint32_t y, uint32_t scale, const char *s);
 
+/**
+	@brief draw string with builtin font on a display page, without shifting
+
+	@param[in] p : instance of display
+	@param[in] x : x starting position of text
+	@param[in] page : page (8 pixel row) of text
+	@param[in] s : text to draw
+*/
+void ssd1306_draw_string_page(ssd1306_t *p, uint32_t x, uint32_t page, const char *s);
+
 #ifdef __cplusplus
 }
 #endif